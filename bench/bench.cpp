@@ -0,0 +1,385 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <ctime>
+#include <stdexcept>
+#include <exception>
+#include <unistd.h>
+#include "commands.h"
+#include "object_store.h"
+#include "delta.h"
+#include "repack.h"
+#include "pkt_line.h"
+#include "http_server.h"
+#include "upload_pack.h"
+#include "index_pack.h"
+
+struct BenchOptions {
+    int files = 2000;              // files in the synthetic tree
+    int commits = 5;               // history of the repository served to clone
+    double min_time = 0.5;         // seconds spent on each benchmark
+    std::string filter;            // only run benchmarks whose name contains it
+    std::string fixtures = BENCH_FIXTURES_DIR; // a captured info-refs / upload-pack pair, checked in
+    std::string output;            // write the JSON here instead of stdout
+};
+
+struct BenchResult {
+    std::string name;
+    uint64_t iterations = 0;
+    double total_ns = 0;
+    uint64_t bytes_per_op = 0;
+    uint64_t items_per_op = 0;
+};
+
+class BenchRunner {
+public:
+    explicit BenchRunner (const BenchOptions& options) : options(options) {}
+
+    // call setup untimed and body timed until min_time is spent, at least once
+    void run (const std::string& name, uint64_t bytes_per_op, uint64_t items_per_op,
+              const std::function<void()>& setup, const std::function<void()>& body) {
+        if (!options.filter.empty() && name.find(options.filter) == std::string::npos) {
+            return;
+        }
+
+        BenchResult result;
+        result.name = name;
+        result.bytes_per_op = bytes_per_op;
+        result.items_per_op = items_per_op;
+        while (result.iterations == 0 || result.total_ns < options.min_time * 1e9) {
+            if (setup) setup();
+            auto start = std::chrono::steady_clock::now();
+            body();
+            auto end = std::chrono::steady_clock::now();
+            result.total_ns += std::chrono::duration<double, std::nano>(end - start).count();
+            result.iterations++;
+        }
+        std::cerr << name << ": " << uint64_t(result.total_ns / result.iterations) << " ns/op\n";
+        results.push_back(result);
+    }
+
+    std::string json (const std::string& build_type) const {
+        std::ostringstream out;
+        char date[32];
+        std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+        out << "{\n  \"context\": {\n"
+            << "    \"date\": \"" << date << "\",\n"
+            << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+            << "    \"build_type\": \"" << build_type << "\",\n"
+            << "    \"files\": " << options.files << ",\n"
+            << "    \"commits\": " << options.commits << "\n"
+            << "  },\n  \"benchmarks\": [";
+        for (size_t i = 0; i < results.size(); i++) {
+            const BenchResult& result = results[i];
+            double ns_per_op = result.total_ns / result.iterations;
+            out << (i ? "," : "") << "\n    {\"name\": \"" << result.name << "\""
+                << ", \"iterations\": " << result.iterations
+                << ", \"real_time_ns\": " << uint64_t(ns_per_op);
+            if (result.bytes_per_op) {
+                out << ", \"bytes_per_second\": " << uint64_t(result.bytes_per_op * 1e9 / ns_per_op);
+            }
+            if (result.items_per_op) {
+                out << ", \"items_per_second\": " << uint64_t(result.items_per_op * 1e9 / ns_per_op);
+            }
+            out << "}";
+        }
+        out << "\n  ]\n}\n";
+
+        return out.str();
+    }
+
+private:
+    const BenchOptions& options;
+    std::vector<BenchResult> results;
+};
+
+// deterministic text so runs stay comparable
+static std::string random_text (std::mt19937& random, size_t length) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz      \n";
+    std::string text(length, ' ');
+    for (auto& c : text) {
+        c = alphabet[random() % (sizeof(alphabet) - 1)];
+    }
+
+    return text;
+}
+
+// files spread over two directory levels, 1 to 8 KiB each; returns the bytes written
+static uint64_t generate_tree (const std::string& root, int files, std::mt19937& random) {
+    uint64_t bytes = 0;
+    for (int i = 0; i < files; i++) {
+        std::string dir = root + "/d" + std::to_string(i / 500) + "/s" + std::to_string(i / 50 % 10);
+        std::filesystem::create_directories(dir);
+        std::ofstream file(dir + "/f" + std::to_string(i) + ".txt", std::ios::binary);
+        std::string text = random_text(random, 1024 + random() % 7168);
+        file << text;
+        bytes += text.length();
+    }
+
+    return bytes;
+}
+
+// rewrite a few files of the tree so the next commit shares most of its objects
+static void mutate_tree (const std::string& root, int files, std::mt19937& random) {
+    for (int change = 0; change < std::max(1, files / 100); change++) {
+        int i = random() % files;
+        std::string path = root + "/d" + std::to_string(i / 500) + "/s" + std::to_string(i / 50 % 10) + "/f" + std::to_string(i) + ".txt";
+        std::ofstream file(path, std::ios::binary | std::ios::app);
+        file << random_text(random, 64);
+    }
+}
+
+static void bench_objects (BenchRunner& runner, const std::string& work_dir) {
+    std::mt19937 random(1);
+    std::string megabyte = random_text(random, 1 << 20);
+    runner.run("compute_sha1/1MiB", megabyte.length(), 0, nullptr, [&]() {
+        compute_sha1(megabyte);
+    });
+
+    std::string store_dir = work_dir + "/store";
+    std::filesystem::create_directories(store_dir + "/.git/objects");
+    std::vector<std::pair<std::string, std::string>> blobs;
+    const int batch = 256;
+    runner.run("compress_and_store/4KiB", 4096 * batch, batch, [&]() {
+        // fresh contents every time, stored objects are skipped
+        blobs.clear();
+        for (int i = 0; i < batch; i++) {
+            std::string content = "blob 4096";
+            content += '\0';
+            content += random_text(random, 4096);
+            blobs.emplace_back(compute_sha1(content), std::move(content));
+        }
+    }, [&]() {
+        for (const auto& [hash, content] : blobs) {
+            compress_and_store(hash, content, store_dir);
+        }
+    });
+
+    // a base with edits spread over it, as between two versions of a file
+    std::string target = megabyte;
+    for (size_t pos = 0; pos < target.length(); pos += 16384) {
+        target.replace(pos, 32, random_text(random, 48));
+    }
+    std::string delta = create_delta(megabyte, target);
+    runner.run("create_delta/1MiB", megabyte.length(), 0, nullptr, [&]() {
+        create_delta(megabyte, target);
+    });
+    runner.run("apply_delta/1MiB", target.length(), 0, nullptr, [&]() {
+        apply_delta(delta, megabyte);
+    });
+}
+
+static void bench_trees (BenchRunner& runner, const BenchOptions& options, const std::string& work_dir) {
+    std::string repo = work_dir + "/tree";
+    std::filesystem::create_directories(repo);
+    git_init(repo);
+    std::mt19937 random(2);
+    uint64_t bytes = generate_tree(repo, options.files, random);
+
+    // write_tree stores below the current directory
+    std::filesystem::path previous = std::filesystem::current_path();
+    std::filesystem::current_path(repo);
+    std::string tree_hash;
+    runner.run("write_tree/cold", bytes, options.files, [&]() {
+        std::filesystem::remove_all(".git/objects");
+        std::filesystem::create_directory(".git/objects");
+    }, [&]() {
+        tree_hash = write_tree(".");
+    });
+    runner.run("write_tree/warm", bytes, options.files, nullptr, [&]() {
+        write_tree(".");
+    });
+    std::filesystem::current_path(previous);
+
+    std::string checkout = work_dir + "/checkout";
+    runner.run("restore_tree", bytes, options.files, [&]() {
+        std::filesystem::remove_all(checkout);
+        std::filesystem::create_directories(checkout);
+    }, [&]() {
+        restore_tree(tree_hash, checkout, repo);
+    });
+}
+
+// a repository with history, packed with deltas the way a server would store it
+static std::string build_served_repo (const BenchOptions& options, const std::string& work_dir) {
+    std::string repo = work_dir + "/served";
+    std::filesystem::create_directories(repo);
+    git_init(repo);
+    std::mt19937 random(3);
+    generate_tree(repo, options.files, random);
+
+    std::filesystem::path previous = std::filesystem::current_path();
+    std::filesystem::current_path(repo);
+    std::string commit;
+    for (int i = 0; i < options.commits; i++) {
+        if (i > 0) mutate_tree(".", options.files, random);
+        std::string tree = write_tree(".");
+        if (!commit.empty()) {
+            commit = commit_tree(tree, commit, "commit " + std::to_string(i));
+            continue;
+        }
+        // commit_tree always names a parent, write the root commit here
+        std::string body = "tree " + tree + "\nauthor Bench <bench@example.com> 0 +0000\n"
+                           "committer Bench <bench@example.com> 0 +0000\n\nroot\n";
+        std::string object = "commit " + std::to_string(body.length()) + '\0' + body;
+        commit = compute_sha1(object);
+        compress_and_store(commit, object);
+    }
+    std::filesystem::current_path(previous);
+
+    std::filesystem::create_directories(repo + "/.git/refs/heads");
+    std::ofstream(repo + "/.git/refs/heads/master") << commit << '\n';
+    repack(RepackOptions(), {}, repo);
+
+    return repo;
+}
+
+static std::string read_file (const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+static void bench_clone (BenchRunner& runner, const BenchOptions& options, const std::string& work_dir) {
+    // replay the captured exchange; a fixtures directory without one records it from a synthetic
+    // repository first, and keeps it for the next run
+    const std::string& fixtures = options.fixtures;
+    std::string advertisement = read_file(fixtures + "/info-refs");
+    std::string pack_response = read_file(fixtures + "/upload-pack");
+    if (advertisement.empty() || pack_response.empty()) {
+        std::string repo = build_served_repo(options, work_dir);
+        advertisement = advertise_refs(repo);
+        std::string head = resolve_revision("HEAD", repo);
+        pack_response.clear();
+        upload_pack(pkt_line("want " + head + "\n") + PKT_FLUSH + pkt_line("done\n"), [&](const char* data, size_t length) {
+            pack_response.append(data, length);
+            return true;
+        }, repo);
+
+        std::filesystem::create_directories(fixtures);
+        std::ofstream(fixtures + "/info-refs", std::ios::binary) << advertisement;
+        std::ofstream(fixtures + "/upload-pack", std::ios::binary) << pack_response;
+    }
+
+    // the pack of the recorded response, indexed into a fresh repository every time
+    std::string index_repo = work_dir + "/index";
+    std::filesystem::create_directories(index_repo);
+    git_init(index_repo);
+    std::string pack_dir = index_repo + "/.git/objects/pack";
+    IndexPackResult indexed;
+    runner.run("index_pack", pack_response.length(), 0, [&]() {
+        std::filesystem::remove_all(pack_dir);
+        std::filesystem::create_directories(pack_dir);
+        PackReceiver receiver;
+        if (!receiver.open(pack_dir + "/tmp_pack_bench") || !receiver.receive(pack_response.data(), pack_response.length()) ||
+            !receiver.finish()) {
+            throw std::runtime_error("the recorded upload-pack response holds no pack: " + receiver.error);
+        }
+    }, [&]() {
+        if (!index_pack(pack_dir + "/tmp_pack_bench", indexed, index_repo)) {
+            throw std::runtime_error("index_pack failed on the recorded pack");
+        }
+    });
+
+    // a local stand-in for the remote, answering with the recorded bytes
+    std::atomic<bool> stop(false);
+    std::atomic<uint16_t> port(0);
+    std::thread server([&]() {
+        serve_http(0, 2, [&](const HttpRequest& request, HttpResponse& response) {
+            if (request.method == "GET") {
+                response.start(200, "application/x-git-upload-pack-advertisement");
+                response.write(advertisement);
+            } else {
+                response.start(200, "application/x-git-upload-pack-result");
+                response.write(pack_response);
+            }
+        }, &stop, [&](uint16_t bound) { port = bound; });
+    });
+    while (port == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::string url = "http://127.0.0.1:" + std::to_string(port) + "/repo";
+    std::string target = work_dir + "/clone";
+    std::exception_ptr error;
+    try {
+        runner.run("clone/http", pack_response.length(), 0, [&]() {
+            std::filesystem::remove_all(target);
+        }, [&]() {
+            if (clone(url, target) != EXIT_SUCCESS) {
+                throw std::runtime_error("clone of " + url + " failed");
+            }
+        });
+    }
+    catch (...) {
+        error = std::current_exception(); // the server thread is stopped first
+    }
+
+    stop = true;
+    server.join();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+int main (int argc, char* argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--files=", 0) == 0) options.files = std::stoi(arg.substr(8));
+        else if (arg.rfind("--commits=", 0) == 0) options.commits = std::stoi(arg.substr(10));
+        else if (arg.rfind("--min-time=", 0) == 0) options.min_time = std::stod(arg.substr(11));
+        else if (arg.rfind("--filter=", 0) == 0) options.filter = arg.substr(9);
+        else if (arg.rfind("--fixtures=", 0) == 0 && arg.length() > 11) options.fixtures = arg.substr(11);
+        else if (arg.rfind("--output=", 0) == 0) options.output = arg.substr(9);
+        else {
+            std::cerr << "Usage: bench [--files=N] [--commits=N] [--min-time=SECONDS] [--filter=NAME]"
+                         " [--fixtures=DIR] [--output=FILE]\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::string work_dir = (std::filesystem::temp_directory_path() / ("git-cpp-bench-" + std::to_string(getpid()))).string();
+    std::filesystem::create_directories(work_dir);
+
+    // the commands being measured report progress on stdout, keep it for the JSON
+    std::ostringstream discarded;
+    std::streambuf* stdout_buffer = std::cout.rdbuf(discarded.rdbuf());
+
+    // a scenario that fails would otherwise be recorded as a fast one
+    BenchRunner runner(options);
+    bool failed = false;
+    try {
+        bench_objects(runner, work_dir);
+        bench_trees(runner, options, work_dir);
+        bench_clone(runner, options, work_dir);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "bench: " << e.what() << '\n';
+        failed = true;
+    }
+
+    std::cout.rdbuf(stdout_buffer);
+    std::filesystem::remove_all(work_dir);
+    if (failed) {
+        return EXIT_FAILURE;
+    }
+
+    std::string json = runner.json(BENCH_BUILD_TYPE);
+    if (options.output.empty()) {
+        std::cout << json;
+    } else {
+        std::ofstream(options.output) << json;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,612 +1,94 @@
 #include <iostream>
 #include <filesystem>
 #include <fstream>
+#include <sstream>
 #include <string>
-#include <cstring>
-#include <zlib.h> 
 #include <vector>
-#include <sstream>
-#include <iomanip>
-#include <openssl/sha.h>
 #include <algorithm>
-#include <numeric>
-#include <set>
-#include <ctime>
-#include <curl/curl.h>
-#include "zlib_implement.h"
-
-/* Functions */
-bool git_init (const std::string& dir) {
-    std::cout << "git init \n";
-    try {
-        std::filesystem::create_directory(dir + "/.git");
-        std::filesystem::create_directory(dir + "/.git/objects");
-        std::filesystem::create_directory(dir + "/.git/refs");
-
-        std::ofstream headFile(dir + "/.git/HEAD");
-        if (headFile.is_open()) { // create .git/HEAD file
-            headFile << "ref: refs/heads/master\n"; // write to the headFile
-            headFile.close();
-        } else {
-            std::cerr << "Failed to create .git/HEAD file.\n";
-            return false;
-        }
-       
-        std::cout << "Initialized git directory in " << dir << "\n";
-        return true;
-    } catch (const std::filesystem::filesystem_error& e) {
-        std::cerr << e.what() << '\n';
+#include <thread>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include "commands.h"
+#include "object_store.h"
+#include "commit_graph.h"
+#include "revision.h"
+#include "repack.h"
+#include "upload_pack.h"
+#include "diff_tree.h"
+#include "status.h"
+#include "fsck.h"
+#include "fast_import.h"
+#include "archive.h"
+#include "grep.h"
+#include "mirror.h"
+#include "refs.h"
+#include "trace.h"
+
+// parse the number of an option like "--threads=<n>"; false unless it is all digits and
+// within [min, max]
+static bool parse_count (const std::string& text, unsigned min, unsigned max, unsigned& value) {
+    if (text.empty() || !isdigit((unsigned char) text[0])) {
         return false;
     }
-}
-
-int cat_file(const char* filepath) {
-        FILE* dataFile = fopen(filepath, "rb");
-        if (!dataFile) {
-            std::cerr << "Invalid object hash.\n";
-            return EXIT_FAILURE;
-        }
-
-        // create output file for standard output
-        FILE* outputFile = fdopen(1, "wb");
-        if (!outputFile) {
-            std::cerr << "Failed to create output file.\n";
-            return EXIT_FAILURE;
-        }
-
-        // decompress data file
-        if (decompress(dataFile, outputFile) != EXIT_SUCCESS) {
-            std::cerr << "Failed to decompress data file.\n";
-            return EXIT_FAILURE;
-        }
-
-        return EXIT_SUCCESS;
-}
-
-std::string compute_sha1 (const std::string& data, bool print_out = false) {
-    unsigned char hash[20]; // 160 bits long for SHA1
-    SHA1(reinterpret_cast<const unsigned char*>(data.c_str()), data.size(), hash);
-    std::stringstream ss;
-    ss << std::hex << std::setfill('0');
-    for (const auto& byte : hash) {
-        ss << std::setw(2) << static_cast<int>(byte);
-    }
-
-    if (print_out)  {
-        std::cout << ss.str() << std::endl;
-    }
-
-    return ss.str();
-}
-
-void compress_and_store (const std::string& hash, const std::string& content, std::string dir = ".") {
-    FILE* input = fmemopen((void*) content.c_str(), content.length(), "rb");
-    std::string hash_folder = hash.substr(0, 2);
-    std::string object_path = dir + "/.git/objects/" + hash_folder + '/';
-    if (!std::filesystem::exists(object_path)) {
-        std::filesystem::create_directories(object_path);
-    }
-    
-    std::string object_file_path = object_path + hash.substr(2);
-    if (!std::filesystem::exists(object_file_path)) {
-        FILE* output = fopen(object_file_path.c_str(), "wb");
-        if (compress(input, output) != EXIT_SUCCESS) {
-            std::cerr << "Failed to compress data.\n";
-            return;
-        }
-        fclose(output);
+    char* end;
+    errno = 0;
+    unsigned long number = strtoul(text.c_str(), &end, 10);
+    if (*end != '\0' || errno == ERANGE || number < min || number > max) {
+        return false;
     }
-
-    fclose(input);
+    value = unsigned(number);
+    return true;
 }
 
-std::string hash_object (std::string filepath, std::string type = "blob", bool print_out = false) {
-        // open the file
-        std::ifstream inputFile(filepath, std::ios::binary);
-        if(inputFile.fail()) {
-            std::cerr << "Failed to open file.\n";
-            return {};
+// parse "<rev>", "^<rev>", "<rev>..<rev>" and "-n <count>" arguments of rev-list and log, and
+// for rev-list "--count", "--objects" and "--use-bitmap-index"
+bool parse_revision_args (int argc, char* argv[], int start, RevListOptions& options, RevListOutput* output) {
+    for (int i = start; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--count" && output) {
+            output->count_only = true;
         }
-
-        // read the file
-        std::string content(
-            (std::istreambuf_iterator<char>(inputFile)), std::istreambuf_iterator<char>()
-        );
-
-        // create the content
-        std::string header = type + " " + std::to_string(content.size());
-        std::string file_content = header + '\0' + content;
-
-        std::string hash = compute_sha1(file_content, false);
-
-        compress_and_store(hash, file_content);
-        inputFile.close();
-
-        if (print_out) {
-            std::cout << hash << std::endl;
+        else if (arg == "--objects" && output) {
+            output->objects = true;
         }
-
-        return hash;
-}
-
-std::set<std::string> parse_tree_object (FILE* tree_object) {
-    rewind(tree_object); // set the file position indicator to the beginning of the file
-    
-    std::vector<std::string> unsorted_directories;
-    char mode[7];
-    char filename[256];
-    unsigned char hash[20];
-    while (fscanf(tree_object, "%6s", mode) != EOF) {
-        // read the filename (up to the null byte)
-        int i = 0;
-        int c;
-        while ((c = fgetc(tree_object)) != 0 && c != EOF) {
-            // if the character is a blank space, continue
-            if (c == ' ') {
-                continue;
-            }
-            filename[i++] = c;
+        else if (arg == "--use-bitmap-index" && output) {
+            output->use_bitmap = true;
         }
-        filename[i] = '\0'; // null-terminate the filename
-
-        // read the hash
-        fread(hash, 1, 20, tree_object);
-
-        unsorted_directories.push_back(filename);
-    }
-
-    std::sort(unsorted_directories.begin(), unsorted_directories.end()); // sort the directories lexicographically
-    std::set<std::string> sorted_directories(unsorted_directories.begin(), unsorted_directories.end()); // remove duplicates
-
-    return sorted_directories;
-}
-
-int ls_tree (const char* object_hash) {
-    // retrieve the object path
-    char object_path[64];
-    snprintf(object_path, sizeof(object_path), ".git/objects/%.2s/%s", object_hash, object_hash + 2);
-
-    // set the input and output file descriptors
-    FILE* object_file = fopen(object_path, "rb");
-    if(object_file == NULL) {
-        std::cerr << "Invalid object hash.\n";
-        return EXIT_FAILURE;
-    }
-    FILE* output_file = tmpfile();
-    if(output_file == NULL) {
-        std::cerr << "Failed to create output file.\n";
-        return EXIT_FAILURE;
-    }
-
-    if(decompress(object_file, output_file) != EXIT_SUCCESS) {
-        std::cerr << "Failed to decompress object file.\n";
-        return EXIT_FAILURE;
-    }
-
-    std::set<std::string> directories = parse_tree_object(output_file);
-
-    // print the directories
-    for (const std::string& directory : directories) {
-        std::cout << directory << '\n';
-    }
-
-    return EXIT_SUCCESS;
-}
-
-std::string hash_digest (const std::string& input) {
-    std::string condensed;
-
-    for (size_t i = 0; i < input.length(); i += 2) {
-        std::string byte_string = input.substr(i, 2);
-        char byte = static_cast<char>(std::stoi(byte_string, nullptr, 16));
-
-        condensed.push_back(byte);
-    }
-
-    return condensed;
-}
-
-std::string write_tree (const std::string& directory) {
-    std::vector<std::string> tree_entries;
-    std::vector<std::string> skip = {
-        ".git", "server", "CMakeCache.txt", 
-        "CMakeFiles", "Makefile", "cmake_install.cmake"
-    };
-
-    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
-        std::string path = entry.path().string();
-        
-        if (std::any_of(skip.begin(), skip.end(), [&path](const std::string& s) {
-            return path.find(s) != std::string::npos;
-        })) {
-            continue;
-        }
-
-        std::error_code ec;
-        std::string entry_type = std::filesystem::is_directory(path, ec) ? "40000 " : "100644 ";
-        std::string relative_path = path.substr(path.find(directory) + directory.length() + 1);
-        std::string hash = std::filesystem::is_directory(path, ec) ?
-                           hash_digest(write_tree(path.c_str())):
-                           hash_digest(hash_object(path.c_str(), "blob", false));
-        
-        tree_entries.emplace_back(path + '\0' + entry_type + relative_path + '\0' + hash);
-    }
-
-    // sort the entries based on the absolute path
-    std::sort(tree_entries.begin(), tree_entries.end());
-
-    // delete the path from the beginning of each entry
-    int bytes = 0;
-    for (auto& entry : tree_entries) {
-        entry = entry.substr(entry.find('\0') + 1);
-        bytes += entry.length();
-    }
-
-    // concatenate the entries
-    std::string tree_content = "tree " + std::to_string(bytes) + '\0';
-    for (const auto& entry : tree_entries) {
-        tree_content += entry;
-    }
-
-    // storing the tree object
-    std::string tree_hash = compute_sha1(tree_content, false);
-    compress_and_store(tree_hash.c_str(), tree_content);
-
-    return tree_hash;
-}
-
-std::string commit_tree (std::string tree_sha, std::string parent_sha, std::string message) {
-    std::string author = "John Doe <john.doe@gmail.com>";
-    std::string committer = "John Doe <john.doe@gmail.com>";
-    std::string timestamp = std::to_string(std::time(nullptr));
-
-    std::string commit_content = "tree " + tree_sha + "\n" +
-                                 "parent " + parent_sha + "\n" +
-                                 "author " + author + " " + timestamp + " -0800\n" +
-                                 "committer " + committer + " " + timestamp + " -0800\n" +
-                                 "\n" + message + "\n";
-    
-
-    std::string header = "commit " + std::to_string(commit_content.length()) + '\0';
-    commit_content = header + commit_content;
-
-
-    std::string commit_hash = compute_sha1(commit_content, false);
-    compress_and_store(commit_hash.c_str(), commit_content);
-
-    return commit_hash;
-}
-
-// curl helper function
-size_t write_callback (void* received_data, size_t element_size, size_t num_element, void* userdata) {
-    size_t total_size = element_size * num_element;
-    std::string received_text((char*) received_data, num_element);
-
-    std::string* master_hash = (std::string*) userdata;
-    if (received_text.find("servie=git-upload-pack") == std::string::npos) {
-        size_t hash_pos = received_text.find("refs/heads/master\n");
-        if (hash_pos != std::string::npos) {
-            *master_hash = received_text.substr(hash_pos - 41, 40);
-        }
-    }
-
-    return total_size;
-}
-
-// curl helper function
-size_t pack_data_callback (void* received_data, size_t element_size, size_t num_element, void* userdata) {
-    std::string* accumulated_data = (std::string*) userdata;
-    *accumulated_data += std::string((char*) received_data, num_element);
-
-    return element_size * num_element;
-}
-
-std::pair<std::string, std::string> curl_request (const std::string& url) {
-    CURL* handle = curl_easy_init();
-    if (handle) {
-        // fetch info/refs
-        curl_easy_setopt(handle, CURLOPT_URL, (url + "/info/refs?service=git-upload-pack").c_str());
-        
-        std::string packhash;
-        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(handle, CURLOPT_WRITEDATA, (void*) &packhash);
-        curl_easy_perform(handle);
-        curl_easy_reset(handle);
-
-        // fetch git-upload-pack
-        curl_easy_setopt(handle, CURLOPT_URL, (url + "/git-upload-pack").c_str());
-        std::string postdata = "0032want " + packhash + "\n" +
-                               "00000009done\n";
-        curl_easy_setopt(handle, CURLOPT_POSTFIELDS, postdata.c_str());
-
-        std::string pack;
-        curl_easy_setopt(handle, CURLOPT_WRITEDATA, (void*) &pack);
-        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, pack_data_callback);
-
-        struct curl_slist* headers = NULL;
-        headers = curl_slist_append(headers, "Content-Type: application/x-git-upload-pack-request");
-        curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
-        curl_easy_perform(handle);
-
-        // clean up
-        curl_easy_cleanup(handle);
-        curl_slist_free_all(headers);
-
-        return {pack, packhash};
-    }
-    else {
-        std::cerr << "Failed to initialize curl.\n";
-        return {};
-    }
-}
-
-// convert git hash digest to hash
-std::string digest_to_hash (const std::string& digest) {
-    std::stringstream ss;
-    for (unsigned char c : digest) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(c);
-    }
-
-    return ss.str();
-}
-
-int read_length (const std::string& pack, int* pos) {
-    int length = 0;
-
-    // extract the lower 4 bits of the first byte
-    length |= pack[*pos] & 0x0F;
-
-    // if the MSB is set, read the next byte
-    if (pack[*pos] & 0x80) {
-        (*pos)++;
-
-        while (pack[*pos] & 0x80) {
-            length <<= 7;
-            length |= pack[*pos] & 0x7F;
-            (*pos)++;
-        }
-
-        // read the last byte
-        length <<= 7;
-        length |= pack[*pos];
-    }
-
-    (*pos)++; // move to the next position
-
-    return length;
-}
-
-std::string apply_delta (const std::string& delta_contents, const std::string& base_contents) {
-    std::string reconstructed_object;
-    int current_position_in_delta = 0;
-
-    // read and skip the length of the base object
-    read_length(delta_contents, &current_position_in_delta);
-    read_length(delta_contents, &current_position_in_delta);
-
-    // iterate through the delta contents
-    while (current_position_in_delta < delta_contents.length()) {
-        unsigned char current_instruction = delta_contents[current_position_in_delta++];
-
-        // check if the highest bit of the instruction byte is set
-        if (current_instruction & 0x80) {
-            int copy_offset = 0;
-            int copy_size = 0;
-            int bytes_processed_for_offset = 0;
-
-            // calculate copy offset from the delta contents
-            for (int i = 3; i >= 0; i--) {
-                copy_offset <<= 8;
-                if (current_instruction & (1 << i)) {
-                    copy_offset += static_cast<unsigned char>(delta_contents[current_position_in_delta + i]);
-                    bytes_processed_for_offset++;
-                }
-            }
-
-            int bytes_processed_for_size = 0;
-            // calculate copy size from the delta contents
-            for (int i = 6; i >= 4; i--) {
-                copy_size <<= 8;
-                if (current_instruction & (1 << i)) {
-                    copy_size += static_cast<unsigned char>(delta_contents[current_position_in_delta + i - (4 - bytes_processed_for_offset)]);
-                    bytes_processed_for_size++;
-                }
-            }
-
-            // default size to 0x100000 if no size was specified
-            if (copy_size == 0) {
-                copy_size = 0x100000;
+        else if ((arg == "-n" && i + 1 < argc) || arg.rfind("--max-count=", 0) == 0) {
+            unsigned count;
+            if (!parse_count(arg == "-n" ? argv[++i] : arg.substr(12), 0, UINT_MAX, count)) {
+                std::cerr << "Usage: " << (output ? "rev-list [--count] [--objects] [--use-bitmap-index]" : "log")
+                          << " [-n <count>] [<rev>|^<rev>|<rev>..<rev>]...\n";
+                return false;
             }
-
-            // append the copied data from base contents to the reconstructed object
-            reconstructed_object += base_contents.substr(copy_offset, copy_size);
-            current_position_in_delta += bytes_processed_for_size + bytes_processed_for_offset;
+            options.max_count = count;
         }
-        else {
-            // direct add insturction, the highest bit is not set
-            int add_size = current_instruction & 0x7F;
-            reconstructed_object += delta_contents.substr(current_position_in_delta, add_size);
-            current_position_in_delta += add_size;
+        else if (arg.rfind("^", 0) == 0) {
+            options.exclude.push_back(arg.substr(1));
         }
-    }
-
-    return reconstructed_object;
-}
-
-int cat_file_for_clone(const char* file_path, const std::string& dir, FILE* dest, bool print_out = false) {
-    try {
-        std::string blob_sha = file_path;
-        std::string blob_path = dir + "/.git/objects/" + blob_sha.insert(2, "/");
-        if (print_out) std::cout << "blob path: " << blob_path << std::endl;
-
-        FILE* blob_file = fopen(blob_path.c_str(), "rb");
-        if (blob_file == NULL) {
-            std::cerr << "Invalid object hash.\n";
-            return EXIT_FAILURE;
+        else if (arg.find("..") != std::string::npos) {
+            size_t dots = arg.find("..");
+            options.exclude.push_back(dots == 0 ? "HEAD" : arg.substr(0, dots));
+            options.include.push_back(dots + 2 == arg.length() ? "HEAD" : arg.substr(dots + 2));
         }
-
-        decompress(blob_file, dest);
-        fclose(blob_file);
-    }
-    catch (const std::filesystem::filesystem_error& e) {
-        std::cerr << e.what() << '\n';
-        return EXIT_FAILURE;
-    }
-
-    return EXIT_SUCCESS;
-}
-
-void restore_tree (const std::string& tree_hash, const std::string& dir, const std::string& proj_dir) {
-    // construct the path to the tree object
-    std::string object_path = proj_dir + "/.git/objects/" + tree_hash.substr(0, 2) + '/' + tree_hash.substr(2);
-    std::ifstream master_tree(object_path);
-
-    // read the contents of the tree object into a buffer
-    std::ostringstream buffer;
-    buffer << master_tree.rdbuf();
-
-    // decompress the tree object
-    std::string tree_contents = decompress_string(buffer.str());
-
-    // skip the metadata part of the tree object
-    tree_contents = tree_contents.substr(tree_contents.find('\0') + 1);
-
-    // iterate over each entry in the tree object
-    int pos = 0;
-    while (pos < tree_contents.length()) {
-        if (tree_contents.find("40000", pos) == pos) {
-            pos += 6; // skip the mode 40000
-
-            // extract the directory path
-            std::string path = tree_contents.substr(pos, tree_contents.find('\0', pos) - pos);
-            pos += path.length() + 1; // skip the path and the null byte
-
-            // extract the hash of the nested tree object
-            std::string next_hash = digest_to_hash(tree_contents.substr(pos, 20));
-
-            // create directories and recursively restore the nested tree
-            std::filesystem::create_directory(dir + '/' + path);
-            restore_tree(next_hash, dir + '/' + path, proj_dir);
-            pos += 20; // skip the hash
+        else if (arg.rfind("-", 0) == 0) {
+            std::cerr << "Unknown option " << arg << '\n';
+            return false;
         }
         else {
-            pos += 7; // skip the mode 100644
-
-            // extract the file path
-            std::string path = tree_contents.substr(pos, tree_contents.find('\0', pos) - pos);
-            pos += path.length() + 1; // skip the path and the null byte
-
-            // extract the hash of the blob object
-            std::string blob_hash = digest_to_hash(tree_contents.substr(pos, 20));
-
-            // create the file and write its contents
-            FILE* new_file = fopen((dir + '/' + path).c_str(), "wb");
-            cat_file_for_clone(blob_hash.c_str(), proj_dir, new_file);
-            fclose(new_file);
-            pos += 20; // skip the hash
+            options.include.push_back(arg);
         }
     }
-}
-
-int clone (std::string url, std::string dir) {
-    // create the repository directory and initialize it
-    std::filesystem::create_directory(dir);
-    if (git_init(dir) != true) {
-        std::cerr << "Failed to initialize git repository.\n";
-        return EXIT_FAILURE;
-    }
 
-    // fetch the repository
-    auto [pack, packhash] = curl_request(url);
-
-    // parse the pack file
-    int num_objects = 0;
-    for (int i=16; i<20; i++) {
-        num_objects = num_objects << 8;
-        num_objects = num_objects | (unsigned char) pack[i];
-    }
-    pack = pack.substr(20, pack.length() - 40); // removing the headers of HTTP
-
-    // proecessing object files in a git pack file
-    int object_type;
-    int current_position = 0;
-    std::string master_commit_contents;
-    for (int object_index = 0; object_index < num_objects; object_index++) {
-        // extract object type from the first byte
-        object_type = (pack[current_position] & 112) >> 4; // 112 is 11100000
-
-        // read the object's length
-        int object_length = read_length(pack, &current_position);
-
-        // process based on object type
-        if (object_type == 6) { // offset deltas: ignore it
-            throw std::invalid_argument("Offset deltas not implemented.\n");
-        }
-        else if (object_type == 7) { // reference deltas
-            // process reference deltas
-            std::string digest = pack.substr(current_position, 20);
-            std::string hash = digest_to_hash(digest);
-            current_position += 20;
-
-            // read the base object's contents
-            std::ifstream file(dir + "/.git/objects/" + hash.insert(2, "/"));
-            std::stringstream buffer;
-            buffer << file.rdbuf();
-            std::string file_contents = buffer.str();
-
-            std::string base_object_contents = decompress_string(file_contents);
-            
-            // extract and remove the object type
-            std::string object_type_extracted = base_object_contents.substr(0, base_object_contents.find(" "));
-            base_object_contents = base_object_contents.substr(base_object_contents.find('\0') + 1);
-
-            // apply delta to base object
-            std::string delta_contents = decompress_string(pack.substr(current_position));
-            std::string reconstructed_contents = apply_delta(delta_contents, base_object_contents);
-
-            // reconstruct the object with its type and length
-            reconstructed_contents = object_type_extracted + ' ' + std::to_string(reconstructed_contents.length()) + '\0' + reconstructed_contents;
-
-            // compute the object hash and store it
-            std::string object_hash = compute_sha1(reconstructed_contents);
-            compress_and_store(object_hash.c_str(), reconstructed_contents, dir);
-
-            // advance position past the delta data
-            std::string compressed_delta = compress_string(delta_contents);
-            current_position += compressed_delta.length();
-
-            // update master commits if hash matches
-            if (hash.compare(packhash) == 0) {
-                master_commit_contents = reconstructed_contents.substr(reconstructed_contents.find('\0'));
-            }
-        }
-        else { // other object types (1: commit, 2: tree, other: blob)
-            // process standard objects
-            std::string object_contents = decompress_string(pack.substr(current_position));
-            current_position += compress_string(object_contents).length();
-
-            // prepare object header
-            std::string object_type_str = (object_type == 1) ? "commit " : (object_type == 2) ? "tree " : "blob ";
-            object_contents = object_type_str + std::to_string(object_contents.length()) + '\0' + object_contents;
-
-            // store the object and update master commits if hash matches
-            std::string object_hash = compute_sha1(object_contents, false);
-            std::string compressed_object = compress_string(object_contents);
-            compress_and_store(object_hash.c_str(), object_contents, dir);
-            if (object_hash.compare(packhash) == 0) {
-                master_commit_contents = object_contents.substr(object_contents.find('\0'));
-            }
-        }
-    }
-
-    // restore the tree
-    std::string tree_hash = master_commit_contents.substr(master_commit_contents.find("tree") + 5, 40);
-    restore_tree(tree_hash, dir, dir);
-
-    return EXIT_SUCCESS;
+    return true;
 }
 
 int main(int argc, char* argv[]) {
+    trace_start(argc, argv);
     if (argc < 2) {
         std::cerr << "No command provided.\n";
         return EXIT_FAILURE;
@@ -615,7 +97,22 @@ int main(int argc, char* argv[]) {
     std::string command = argv[1];
 
     if (command == "init") {
-        if (git_init(".") != true) {
+        std::string initial_branch = "master";
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-b" && i + 1 < argc) {
+                initial_branch = argv[++i];
+            }
+            else if (arg.rfind("--initial-branch=", 0) == 0) {
+                initial_branch = arg.substr(17);
+            }
+        }
+        if (!check_ref_format("refs/heads/" + initial_branch)) {
+            std::cerr << "Invalid branch name " << initial_branch << ".\n";
+            return EXIT_FAILURE;
+        }
+
+        if (git_init(".", true, initial_branch) != true) {
             std::cerr << "Failed to initialize git repository.\n";
             return EXIT_FAILURE;
         }
@@ -627,10 +124,8 @@ int main(int argc, char* argv[]) {
             return EXIT_FAILURE;
         }
 
-        // retrieve file path and check if object hash is valid
-        char dataPath[64];
-        snprintf(dataPath, sizeof(dataPath), ".git/objects/%.2s/%s", argv[3], argv[3] + 2);
-        if (cat_file(dataPath) != EXIT_SUCCESS) {
+        // check if object hash is valid
+        if (cat_file(argv[3]) != EXIT_SUCCESS) {
             std::cerr << "Failed to retrieve object.\n";
             return EXIT_FAILURE;
         }
@@ -691,19 +186,400 @@ int main(int argc, char* argv[]) {
         std::cout << commit_hash << std::endl;
     }
     else if (command == "clone") {
-        if (argc < 3) {
+        // clone [--sparse] <url> <directory> [<sparse directory>...]
+        int arg = 2;
+        bool sparse = argc > arg && std::string(argv[arg]) == "--sparse";
+        if (sparse) arg++;
+        if (argc < arg + 2) {
             std::cerr << "No repository provided.\n";
             return EXIT_FAILURE;
         }
 
-        std::string url = argv[2];
-        std::string directory = argv[3];
+        std::string url = argv[arg];
+        std::string directory = argv[arg + 1];
+        std::vector<std::string> sparse_dirs(argv + arg + 2, argv + argc);
 
-        if (clone(url, directory) != EXIT_SUCCESS) {
+        if (clone(url, directory, true, sparse ? &sparse_dirs : nullptr) != EXIT_SUCCESS) {
             std::cerr << "Failed to clone repository.\n";
             return EXIT_FAILURE;
         }
     }
+    else if (command == "mirror") {
+        // mirror [--transfers=<n>] [--threads=<n>] [<list>], one "<url> [<directory>]" per line
+        MirrorOptions options;
+        std::string list = "-";
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg.rfind("--transfers=", 0) == 0) {
+                if (!parse_count(arg.substr(12), 1, 1024, options.transfers)) {
+                    std::cerr << "Usage: mirror [--transfers=<n>] [--threads=<n>] [<list>]\n";
+                    return EXIT_FAILURE;
+                }
+            }
+            else if (arg.rfind("--threads=", 0) == 0) {
+                if (!parse_count(arg.substr(10), 0, 1024, options.threads)) {
+                    std::cerr << "Usage: mirror [--transfers=<n>] [--threads=<n>] [<list>]\n";
+                    return EXIT_FAILURE;
+                }
+            }
+            else {
+                list = arg;
+            }
+        }
+
+        std::ifstream list_file;
+        if (list != "-") {
+            list_file.open(list);
+            if (!list_file.is_open()) {
+                std::cerr << "Cannot read " << list << ".\n";
+                return EXIT_FAILURE;
+            }
+        }
+        std::istream& input = list == "-" ? std::cin : list_file;
+
+        // without a directory the last part of the url names it, less any ".git"
+        std::vector<std::pair<std::string, std::string>> repositories;
+        std::string line;
+        while (std::getline(input, line)) {
+            std::istringstream fields(line);
+            std::string url, directory;
+            if (!(fields >> url) || url[0] == '#') {
+                continue;
+            }
+            if (!(fields >> directory)) {
+                while (url.length() > 1 && url.back() == '/') {
+                    url.pop_back();
+                }
+                directory = url.substr(url.find_last_of('/') + 1);
+                if (directory.length() > 4 && directory.compare(directory.length() - 4, 4, ".git") == 0) {
+                    directory.resize(directory.length() - 4);
+                }
+            }
+            repositories.emplace_back(url, directory);
+        }
+
+        return mirror(repositories, options);
+    }
+    else if (command == "commit-graph") {
+        if (argc < 3 || std::string(argv[2]) != "write") {
+            std::cerr << "Usage: commit-graph write [<rev>...]\n";
+            return EXIT_FAILURE;
+        }
+
+        // default to every ref and HEAD as tips
+        std::vector<std::string> tips(argv + 3, argv + argc);
+        if (tips.empty()) {
+            tips = reference_tips();
+        }
+
+        if (write_commit_graph(tips) != EXIT_SUCCESS) {
+            std::cerr << "Failed to write commit-graph.\n";
+            return EXIT_FAILURE;
+        }
+    }
+    else if (command == "rev-list" || command == "log") {
+        RevListOptions options;
+        RevListOutput output;
+        if (!parse_revision_args(argc, argv, 2, options, command == "rev-list" ? &output : nullptr)) {
+            return EXIT_FAILURE;
+        }
+        if (options.include.empty()) {
+            if (command == "rev-list") {
+                std::cerr << "No revision provided.\n";
+                return EXIT_FAILURE;
+            }
+            options.include.push_back("HEAD");
+        }
+
+        int status = command == "rev-list" ? rev_list(options, output) : log_commits(options);
+        if (status != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+    else if (command == "repack" || command == "gc") {
+        RepackOptions options;
+        std::vector<std::string> revisions;
+        std::string usage = "Usage: " + command + " [-d] [-b] [--window=<n>] [--depth=<n>] [--threads=<n>] [<rev>...]\n";
+        unsigned value;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-d") {
+                options.delete_redundant = true;
+            }
+            else if (arg == "-b" || arg == "--write-bitmap-index") {
+                options.write_bitmap = true;
+            }
+            else if (arg.rfind("--window=", 0) == 0) {
+                if (!parse_count(arg.substr(9), 0, INT_MAX, value)) {
+                    std::cerr << usage;
+                    return EXIT_FAILURE;
+                }
+                options.window = int(value);
+            }
+            else if (arg.rfind("--depth=", 0) == 0) {
+                if (!parse_count(arg.substr(8), 0, INT_MAX, value)) {
+                    std::cerr << usage;
+                    return EXIT_FAILURE;
+                }
+                options.depth = int(value);
+            }
+            else if (arg.rfind("--threads=", 0) == 0) {
+                if (!parse_count(arg.substr(10), 0, 1024, options.threads)) {
+                    std::cerr << usage;
+                    return EXIT_FAILURE;
+                }
+            }
+            else {
+                revisions.push_back(arg);
+            }
+        }
+
+        // with -d (always for gc) packs the new one covers are dropped; without revisions that is
+        // every old pack, so packed objects not reachable from the refs go with them
+        int status = command == "gc" ? gc() : repack(options, revisions);
+        if (status != EXIT_SUCCESS) {
+            std::cerr << "Failed to repack repository.\n";
+            return EXIT_FAILURE;
+        }
+    }
+    else if (command == "serve") {
+        uint16_t port = 8080;
+        unsigned workers = std::max(4u, std::thread::hardware_concurrency());
+        std::string base_dir = ".";
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            unsigned value;
+            if (arg.rfind("--port=", 0) == 0) {
+                if (!parse_count(arg.substr(7), 0, UINT16_MAX, value)) {
+                    std::cerr << "Usage: serve [--port=<n>] [--workers=<n>] [<directory>]\n";
+                    return EXIT_FAILURE;
+                }
+                port = uint16_t(value);
+            }
+            else if (arg.rfind("--workers=", 0) == 0) {
+                if (!parse_count(arg.substr(10), 1, 1024, workers)) {
+                    std::cerr << "Usage: serve [--port=<n>] [--workers=<n>] [<directory>]\n";
+                    return EXIT_FAILURE;
+                }
+            }
+            else {
+                base_dir = arg;
+            }
+        }
+
+        if (serve(port, workers, base_dir) != EXIT_SUCCESS) {
+            std::cerr << "Failed to start server.\n";
+            return EXIT_FAILURE;
+        }
+    }
+    else if (command == "diff-tree") {
+        bool recursive = false;
+        std::vector<std::string> revisions;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-r") {
+                recursive = true;
+            }
+            else {
+                revisions.push_back(arg);
+            }
+        }
+        if (revisions.size() != 2) {
+            std::cerr << "Usage: diff-tree [-r] <tree-ish> <tree-ish>\n";
+            return EXIT_FAILURE;
+        }
+
+        return diff_tree(revisions[0], revisions[1], recursive);
+    }
+    else if (command == "status") {
+        unsigned threads = 0;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg.rfind("--threads=", 0) == 0 && !parse_count(arg.substr(10), 0, 1024, threads)) {
+                std::cerr << "Usage: status [--threads=<n>]\n";
+                return EXIT_FAILURE;
+            }
+        }
+
+        return status(threads);
+    }
+    else if (command == "update-ref") {
+        bool packed = false;
+        std::vector<std::string> args;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--packed") {
+                packed = true;
+            }
+            else {
+                args.push_back(arg);
+            }
+        }
+
+        return update_ref(args, packed);
+    }
+    else if (command == "pack-refs") {
+        return pack_refs() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    else if (command == "fsck") {
+        FsckOptions options;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg.rfind("--threads=", 0) == 0) {
+                if (!parse_count(arg.substr(10), 0, 1024, options.threads)) {
+                    std::cerr << "Usage: fsck [--threads=<n>] [--no-dangling] [--no-connectivity]\n";
+                    return EXIT_FAILURE;
+                }
+            }
+            else if (arg == "--no-dangling") {
+                options.dangling = false;
+            }
+            else if (arg == "--no-connectivity") {
+                options.connectivity = false;
+            }
+        }
+
+        return fsck(options);
+    }
+    else if (command == "fast-import") {
+        FastImportOptions options;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--force") {
+                options.force = true;
+            }
+            else if (arg.rfind("--export-marks=", 0) == 0) {
+                options.export_marks = arg.substr(15);
+            }
+        }
+
+        std::ios::sync_with_stdio(false);
+        return fast_import(std::cin, options);
+    }
+    else if (command == "archive") {
+        ArchiveOptions options;
+        std::string format, output, revision;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg.rfind("--format=", 0) == 0) {
+                format = arg.substr(9);
+            }
+            else if (arg.rfind("--prefix=", 0) == 0) {
+                options.prefix = arg.substr(9);
+            }
+            else if (arg == "-o" && i + 1 < argc) {
+                output = argv[++i];
+            }
+            else if (arg.rfind("--output=", 0) == 0) {
+                output = arg.substr(9);
+            }
+            else if (arg.rfind("--threads=", 0) == 0) {
+                if (!parse_count(arg.substr(10), 0, 1024, options.threads)) {
+                    std::cerr << "Usage: archive [--format=tar|tar.gz] [--prefix=<dir>/] [-o <file>] [--threads=<n>] [-<level>] <tree-ish>\n";
+                    return EXIT_FAILURE;
+                }
+            }
+            else if (arg.length() == 2 && arg[0] == '-' && isdigit(arg[1])) {
+                options.level = arg[1] - '0';
+            }
+            else {
+                revision = arg;
+            }
+        }
+
+        // without --format the name of the output file decides
+        auto ends_with = [](const std::string& name, const std::string& suffix) {
+            return name.length() >= suffix.length() && name.compare(name.length() - suffix.length(), suffix.length(), suffix) == 0;
+        };
+        if (format.empty()) {
+            format = ends_with(output, ".tar.gz") || ends_with(output, ".tgz") ? "tar.gz" : "tar";
+        }
+        if (format != "tar" && format != "tar.gz" && format != "tgz") {
+            std::cerr << "Unknown archive format '" << format << "'\n";
+            return EXIT_FAILURE;
+        }
+        options.gzip = format != "tar";
+        if (revision.empty()) {
+            std::cerr << "Usage: archive [--format=tar|tar.gz] [--prefix=<dir>/] [-o <file>] [--threads=<n>] [-<level>] <tree-ish>\n";
+            return EXIT_FAILURE;
+        }
+
+        int fd = STDOUT_FILENO;
+        if (!output.empty() && (fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+            std::cerr << "Cannot create " << output << ".\n";
+            return EXIT_FAILURE;
+        }
+        int status = archive(revision, options, fd);
+        if (fd != STDOUT_FILENO) {
+            close(fd);
+        }
+        return status;
+    }
+    else if (command == "grep") {
+        // grep [-e <pattern>]... [-F|-E] [-i] [-n] [-l] [-c] [--threads=N] [<pattern>] <tree-ish> [-- <path>...]
+        GrepOptions options;
+        std::vector<std::string> args;
+        const char* usage = "Usage: grep [-e <pattern>]... [-F|-E] [-i] [-n] [-l] [-c] [--threads=<n>] [<pattern>] <tree-ish> [-- <path>...]\n";
+        int i = 2;
+        for (; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--") {
+                i++;
+                break;
+            }
+            if (arg == "-e" && i + 1 < argc) options.patterns.push_back(argv[++i]);
+            else if (arg == "-F" || arg == "--fixed-strings") options.fixed = true;
+            else if (arg == "-E" || arg == "--extended-regexp") options.extended = true;
+            else if (arg == "-i" || arg == "--ignore-case") options.ignore_case = true;
+            else if (arg == "-n" || arg == "--line-number") options.line_numbers = true;
+            else if (arg == "-l" || arg == "--files-with-matches") options.names_only = true;
+            else if (arg == "-c" || arg == "--count") options.count = true;
+            else if (arg.rfind("--threads=", 0) == 0) {
+                if (!parse_count(arg.substr(10), 0, 1024, options.threads)) {
+                    std::cerr << usage;
+                    return EXIT_FAILURE;
+                }
+            }
+            else args.push_back(arg);
+        }
+        options.paths.assign(argv + i, argv + argc);
+
+        // without -e the first argument is the pattern
+        if (options.patterns.empty() && !args.empty()) {
+            options.patterns.push_back(args.front());
+            args.erase(args.begin());
+        }
+        if (options.patterns.empty() || args.size() != 1) {
+            std::cerr << usage;
+            return EXIT_FAILURE;
+        }
+
+        return grep(args[0], options);
+    }
+    else if (command == "merge-base") {
+        bool all = false;
+        bool is_ancestor_check = false;
+        std::vector<std::string> revisions;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--all") {
+                all = true;
+            }
+            else if (arg == "--is-ancestor") {
+                is_ancestor_check = true;
+            }
+            else {
+                revisions.push_back(arg);
+            }
+        }
+
+        if (revisions.size() < 2 || (is_ancestor_check && revisions.size() != 2)) {
+            std::cerr << "Two commits are required.\n";
+            return EXIT_FAILURE;
+        }
+
+        return merge_base(revisions, all, is_ancestor_check);
+    }
     else {
         std::cerr << "Unknown command " << command << '\n';
         return EXIT_FAILURE;
@@ -0,0 +1,252 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <functional>
+#include <stdexcept>
+#include <unistd.h>
+#include "archive.h"
+#include "batch_io.h"
+#include "commands.h"
+#include "object_store.h"
+#include "zlib_implement.h"
+#include "trace.h"
+
+#define TAR_BLOCK 512
+#define TAR_RECORD 10240 // git pads the archive to whole records of 20 blocks
+
+namespace {
+
+// buffered writes to a file descriptor
+class FdOutput {
+public:
+    explicit FdOutput (int fd) : fd(fd) { buffer.reserve(capacity); }
+
+    bool write (const char* data, size_t length) {
+        if (buffer.length() + length > capacity && !flush()) {
+            return false;
+        }
+        if (length >= capacity) {
+            return write_all(data, length);
+        }
+        buffer.append(data, length);
+        return true;
+    }
+
+    bool flush () {
+        bool written = write_all(buffer.data(), buffer.length());
+        buffer.clear();
+        return written;
+    }
+
+private:
+    bool write_all (const char* data, size_t length) {
+        while (length > 0) {
+            ssize_t written = ::write(fd, data, length);
+            if (written <= 0) {
+                return false;
+            }
+            data += written;
+            length -= written;
+        }
+        return true;
+    }
+
+    static constexpr size_t capacity = 1 << 20;
+    int fd;
+    std::string buffer;
+};
+
+// ustar entries, with pax extended headers for what the fixed fields cannot hold
+class TarWriter : public CheckoutSink {
+public:
+    TarWriter (const std::function<bool(const char*, size_t)>& sink, time_t mtime) : sink(sink), mtime(mtime) {}
+
+    void mkdir (const std::string& path) override {
+        entry(path + '/', "", 0, '5', 040775);
+    }
+
+    void write (const std::string& path, std::string data, mode_t mode) override {
+        entry(path, "", data.length(), '0', (mode & 0111) ? 0100775 : 0100664);
+        emit(data.data(), data.length());
+        pad(data.length());
+    }
+
+    void symlink (const std::string& target, const std::string& path) override {
+        entry(path, target, 0, '2', 0120777);
+    }
+
+    // a pax global header naming the commit, the first entry of the archive
+    void comment (const std::string& commit) {
+        std::string records = pax_record("comment", commit);
+        header("pax_global_header", "", records.length(), 'g', 0100666);
+        emit(records.data(), records.length());
+        pad(records.length());
+    }
+
+    // two zero blocks end the archive, then padding up to a whole record
+    void finish () {
+        size_t end = written + 2 * TAR_BLOCK;
+        end += (TAR_RECORD - end % TAR_RECORD) % TAR_RECORD;
+        std::string zeros(end - written, '\0');
+        emit(zeros.data(), zeros.length());
+    }
+
+private:
+    // "<length> <key>=<value>\n", the length counting itself
+    static std::string pax_record (const std::string& key, const std::string& value) {
+        size_t length = key.length() + value.length() + 3;
+        size_t digits = std::to_string(length).length();
+        while (std::to_string(length + digits).length() != digits) {
+            digits++;
+        }
+        return std::to_string(length + digits) + ' ' + key + '=' + value + '\n';
+    }
+
+    void entry (const std::string& path, const std::string& link, uint64_t size, char type, uint32_t mode) {
+        // a long path splits at the last '/' that fits the prefix field, as git does, or goes
+        // into a pax header
+        std::string name = path;
+        std::string prefix;
+        std::string records;
+        if (name.length() > 100) {
+            size_t slash = std::min<size_t>(path.length() - (path.back() == '/'), 155);
+            while (--slash > 0 && path[slash] != '/') {}
+            if (slash > 0 && path.length() - slash - 1 <= 100) {
+                prefix = path.substr(0, slash);
+                name = path.substr(slash + 1);
+            } else {
+                records += pax_record("path", path);
+                name = path.substr(0, 100);
+            }
+        }
+        if (link.length() > 100) {
+            records += pax_record("linkpath", link);
+        }
+        if (size > 077777777777ull) {
+            records += pax_record("size", std::to_string(size));
+        }
+
+        if (!records.empty()) {
+            header(name, "", records.length(), 'x', 0100666);
+            emit(records.data(), records.length());
+            pad(records.length());
+        }
+        header(name, link.substr(0, 100), size > 077777777777ull ? 0 : size, type, mode, prefix);
+    }
+
+    void header (const std::string& name, const std::string& link, uint64_t size, char type, uint32_t mode,
+                 const std::string& prefix = "") {
+        char block[TAR_BLOCK];
+        memset(block, 0, sizeof(block));
+        memcpy(block, name.data(), std::min<size_t>(name.length(), 100));
+        snprintf(block + 100, 8, "%07o", mode & 07777);
+        snprintf(block + 108, 8, "%07o", 0);
+        snprintf(block + 116, 8, "%07o", 0);
+        // the field holds 11 octal digits, larger sizes go in a pax record
+        snprintf(block + 124, 12, "%011llo", static_cast<unsigned long long>(std::min<uint64_t>(size, 077777777777ull)));
+        snprintf(block + 136, 12, "%011llo", static_cast<unsigned long long>(mtime));
+        memset(block + 148, ' ', 8);
+        block[156] = type;
+        memcpy(block + 157, link.data(), link.length());
+        memcpy(block + 257, "ustar", 6);
+        memcpy(block + 263, "00", 2);
+        memcpy(block + 265, "root", 4);
+        memcpy(block + 297, "root", 4);
+        snprintf(block + 329, 8, "%07o", 0);
+        snprintf(block + 337, 8, "%07o", 0);
+        memcpy(block + 345, prefix.data(), std::min<size_t>(prefix.length(), 155));
+
+        unsigned checksum = 0;
+        for (unsigned char byte : block) {
+            checksum += byte;
+        }
+        snprintf(block + 148, 8, "%07o", checksum);
+        emit(block, sizeof(block));
+    }
+
+    void pad (uint64_t length) {
+        static const char zeros[TAR_BLOCK] = {};
+        size_t padding = (TAR_BLOCK - length % TAR_BLOCK) % TAR_BLOCK;
+        emit(zeros, padding);
+    }
+
+    // the walk has no error path of its own, a failed write ends it by throwing
+    void emit (const char* data, size_t length) {
+        if (length > 0 && !sink(data, length)) {
+            throw std::runtime_error("write error");
+        }
+        written += length;
+    }
+
+    std::function<bool(const char*, size_t)> sink;
+    time_t mtime;
+    uint64_t written = 0;
+};
+
+} // namespace
+
+int archive (const std::string& revision, const ArchiveOptions& options, int fd, const std::string& dir) {
+    // peel tags down to a tree, remembering the commit on the way for its id and date
+    std::string hash = resolve_revision(revision, dir);
+    std::string type, contents, commit;
+    time_t mtime = time(nullptr);
+    while (!hash.empty() && read_object(hash, type, contents, dir) && type != "tree") {
+        CommitObject parsed;
+        if (type == "commit" && parse_commit(contents, parsed)) {
+            commit = hash;
+            mtime = parsed.commit_time;
+            hash = parsed.tree;
+        }
+        else if (type == "tag" && contents.rfind("object ", 0) == 0) {
+            hash = contents.substr(7, 40);
+        }
+        else {
+            hash.clear();
+        }
+    }
+    if (hash.empty() || type != "tree") {
+        std::cerr << "Not a tree-ish: " << revision << '\n';
+        return EXIT_FAILURE;
+    }
+
+    TraceRegion region("archive", "write");
+    FdOutput output(fd);
+    std::function<bool(const char*, size_t)> sink = [&output](const char* data, size_t length) {
+        return output.write(data, length);
+    };
+    std::unique_ptr<ParallelGzip> gzip;
+    if (options.gzip) {
+        gzip = std::make_unique<ParallelGzip>(sink, options.threads, options.level);
+        sink = [&gzip](const char* data, size_t length) { return gzip->write(data, length); };
+    }
+
+    std::string prefix = options.prefix;
+    while (!prefix.empty() && prefix.back() == '/') {
+        prefix.pop_back();
+    }
+
+    TarWriter tar(sink, mtime);
+    try {
+        if (!commit.empty()) {
+            tar.comment(commit);
+        }
+        if (!prefix.empty()) {
+            tar.mkdir(prefix);
+        }
+        checkout_tree(tar, hash, prefix, dir);
+        tar.finish();
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << "archive: " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    if ((gzip && !gzip->finish()) || !output.flush()) {
+        std::cerr << "archive: write error\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,20 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <string>
+#include <unistd.h>
+#include <zlib.h>
+
+struct ArchiveOptions {
+    bool gzip = false;
+    int level = Z_DEFAULT_COMPRESSION;
+    unsigned threads = 0;  // gzip threads, 0 uses one per core
+    std::string prefix;    // put in front of every path, "project-1.0/"
+};
+
+// write a tree-ish as a tar to fd. The tree is walked by checkout_tree and each blob goes
+// from the object store into the stream, so nothing touches a worktree or a temporary file.
+// A commit dates the entries and is named in a pax comment header, as git archive does.
+int archive (const std::string& revision, const ArchiveOptions& options, int fd = STDOUT_FILENO, const std::string& dir = ".");
+
+#endif // ARCHIVE_H
@@ -0,0 +1,372 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "batch_io.h"
+
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#define RING_ENTRIES 256
+#define MAX_WRITE_SQE (1u << 30) // bytes one write SQE is asked for
+
+#ifdef HAVE_IO_URING
+
+// the submission and completion rings of one io_uring instance, mapped from the kernel
+struct IoUring {
+    int fd = -1;
+    unsigned entries = 0;
+    void* sq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    void* cq_ring = MAP_FAILED;
+    size_t cq_ring_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size = 0;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    bool has_mkdirat = false;
+
+    ~IoUring () {
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+        if (fd >= 0) close(fd);
+    }
+};
+
+static bool setup_ring (IoUring& ring) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring.fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (ring.fd < 0) {
+        return false;
+    }
+
+    ring.entries = params.sq_entries;
+    ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        ring.sq_ring_size = ring.cq_ring_size = std::max(ring.sq_ring_size, ring.cq_ring_size);
+    }
+
+    ring.sq_ring = mmap(nullptr, ring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ring == MAP_FAILED) return false;
+    ring.cq_ring = single_mmap ? ring.sq_ring :
+                   mmap(nullptr, ring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+    if (ring.cq_ring == MAP_FAILED) return false;
+    ring.sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring.sqes = static_cast<io_uring_sqe*>(mmap(nullptr, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES));
+    if (ring.sqes == MAP_FAILED) return false;
+
+    char* sq = static_cast<char*>(ring.sq_ring);
+    char* cq = static_cast<char*>(ring.cq_ring);
+    ring.sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    ring.sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    ring.sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    ring.cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    ring.cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    ring.cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    ring.cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // openat, write and close are required, mkdirat (5.15) is used when present
+    size_t probe_size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    std::vector<char> probe_buffer(probe_size, 0);
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(probe_buffer.data());
+    if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        return false;
+    }
+    auto supported = [&](int op) { return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED); };
+    ring.has_mkdirat = supported(IORING_OP_MKDIRAT);
+
+    return supported(IORING_OP_OPENAT) && supported(IORING_OP_WRITE) && supported(IORING_OP_CLOSE);
+}
+
+// submit count prepared entries and wait for all of them; results[user_data] receives each result
+static bool submit_and_wait (IoUring& ring, unsigned count, std::vector<int>& results) {
+    unsigned submitted = 0;
+    while (submitted < count) {
+        int ret = syscall(__NR_io_uring_enter, ring.fd, count - submitted, 0, 0, nullptr, 0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        submitted += ret;
+    }
+
+    unsigned completed = 0;
+    while (completed < count) {
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            int ret = syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (ret < 0 && errno != EINTR) return false;
+            continue;
+        }
+        for (; head != tail; head++, completed++) {
+            const io_uring_cqe& cqe = ring.cqes[head & *ring.cq_mask];
+            results[cqe.user_data] = cqe.res;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return true;
+}
+
+static io_uring_sqe* next_sqe (IoUring& ring, unsigned queued) {
+    unsigned index = (*ring.sq_tail + queued) & *ring.sq_mask;
+    ring.sq_array[index] = index;
+    io_uring_sqe* sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void publish (IoUring& ring, unsigned queued) {
+    __atomic_store_n(ring.sq_tail, *ring.sq_tail + queued, __ATOMIC_RELEASE);
+}
+
+#else
+
+struct IoUring {};
+
+#endif // HAVE_IO_URING
+
+FileBatch::FileBatch (size_t max_bytes, size_t max_files) : max_bytes(max_bytes), max_files(max_files) {}
+
+FileBatch::~FileBatch () {
+    flush();
+}
+
+void FileBatch::mkdir (const std::string& path) {
+    if (created_directories.insert(path).second) {
+        directories.push_back(path);
+    }
+}
+
+void FileBatch::write (const std::string& path, std::string data, mode_t mode) {
+    if ((pending_bytes + data.length() > max_bytes || files.size() >= max_files) && !flush()) {
+        failed = true; // reported again by the next flush
+    }
+
+    pending_bytes += data.length();
+    files.push_back({path, std::move(data), mode});
+}
+
+void FileBatch::symlink (const std::string& target, const std::string& path) {
+    symlinks.emplace_back(target, path);
+}
+
+bool FileBatch::io_uring_available () {
+#ifdef HAVE_IO_URING
+    static const bool available = []() {
+        const char* setting = getenv("GIT_CPP_IO_URING");
+        if (setting && strcmp(setting, "0") == 0) {
+            return false;
+        }
+        IoUring ring;
+        return setup_ring(ring);
+    }();
+    return available;
+#else
+    return false;
+#endif
+}
+
+bool FileBatch::flush () {
+    if (directories.empty() && files.empty() && symlinks.empty()) {
+        bool ok = !failed;
+        failed = false;
+        return ok;
+    }
+
+    // shallower directories first, so parents always precede their children
+    auto depth = [](const std::string& path) { return std::count(path.begin(), path.end(), '/'); };
+    std::stable_sort(directories.begin(), directories.end(), [&](const std::string& a, const std::string& b) {
+        return depth(a) < depth(b);
+    });
+
+    bool ok = io_uring_available() ? flush_io_uring() : flush_blocking();
+    for (const auto& [target, path] : symlinks) {
+        if (::symlink(target.c_str(), path.c_str()) != 0) {
+            std::cerr << "Failed to create " << path << ": " << strerror(errno) << '\n';
+            ok = false;
+        }
+    }
+
+    directories.clear();
+    files.clear();
+    symlinks.clear();
+    pending_bytes = 0;
+    ok = ok && !failed;
+    failed = false;
+
+    return ok;
+}
+
+static bool write_fully (int fd, const char* data, size_t length, size_t offset) {
+    while (offset < length) {
+        ssize_t written = pwrite(fd, data + offset, length - offset, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        offset += written;
+    }
+
+    return true;
+}
+
+bool FileBatch::flush_blocking () {
+    bool ok = true;
+    for (const auto& path : directories) {
+        if (::mkdir(path.c_str(), 0777) != 0 && errno != EEXIST) {
+            std::cerr << "Failed to create " << path << ": " << strerror(errno) << '\n';
+            ok = false;
+        }
+    }
+
+    for (const auto& file : files) {
+        int fd = open(file.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, file.mode);
+        if (fd < 0 || !write_fully(fd, file.data.data(), file.data.length(), 0)) {
+            std::cerr << "Failed to write " << file.path << ": " << strerror(errno) << '\n';
+            ok = false;
+        }
+        if (fd >= 0) close(fd);
+    }
+
+    return ok;
+}
+
+bool FileBatch::flush_io_uring () {
+#ifdef HAVE_IO_URING
+    if (!ring) {
+        ring.reset(new IoUring());
+        if (!setup_ring(*ring)) {
+            ring.reset();
+            return flush_blocking();
+        }
+    }
+    bool ok = true;
+
+    // directories level by level, a parent finishes before its children are submitted
+    if (ring->has_mkdirat) {
+        std::vector<int> results(directories.size());
+        size_t first = 0;
+        while (first < directories.size()) {
+            size_t depth = std::count(directories[first].begin(), directories[first].end(), '/');
+            unsigned queued = 0;
+            size_t last = first;
+            while (last < directories.size() && queued < ring->entries &&
+                   size_t(std::count(directories[last].begin(), directories[last].end(), '/')) == depth) {
+                io_uring_sqe* sqe = next_sqe(*ring, queued++);
+                sqe->opcode = IORING_OP_MKDIRAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = reinterpret_cast<uintptr_t>(directories[last].c_str());
+                sqe->len = 0777;
+                sqe->user_data = last++;
+            }
+            publish(*ring, queued);
+            if (!submit_and_wait(*ring, queued, results)) return false;
+            first = last;
+        }
+        for (size_t i = 0; i < directories.size(); i++) {
+            if (results[i] < 0 && results[i] != -EEXIST) {
+                std::cerr << "Failed to create " << directories[i] << ": " << strerror(-results[i]) << '\n';
+                ok = false;
+            }
+        }
+    }
+    else {
+        for (const auto& path : directories) {
+            if (::mkdir(path.c_str(), 0777) != 0 && errno != EEXIST) {
+                std::cerr << "Failed to create " << path << ": " << strerror(errno) << '\n';
+                ok = false;
+            }
+        }
+    }
+
+    for (size_t first = 0; first < files.size(); first += ring->entries / 2) {
+        size_t count = std::min<size_t>(ring->entries / 2, files.size() - first);
+
+        // open every file of the chunk
+        std::vector<int> fds(count);
+        for (size_t i = 0; i < count; i++) {
+            io_uring_sqe* sqe = next_sqe(*ring, i);
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = reinterpret_cast<uintptr_t>(files[first + i].path.c_str());
+            sqe->len = files[first + i].mode;
+            sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+            sqe->user_data = i;
+        }
+        publish(*ring, count);
+        if (!submit_and_wait(*ring, count, fds)) return false;
+
+        // then write and close each one, the close linked behind its write. A file longer than one
+        // write SQE gets no close queued, the rest of it is written below.
+        std::vector<int> results(2 * count, 0);
+        unsigned queued = 0;
+        for (size_t i = 0; i < count; i++) {
+            const PendingFile& file = files[first + i];
+            if (fds[i] < 0) {
+                std::cerr << "Failed to create " << file.path << ": " << strerror(-fds[i]) << '\n';
+                ok = false;
+                continue;
+            }
+            io_uring_sqe* sqe = next_sqe(*ring, queued++);
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = fds[i];
+            sqe->addr = reinterpret_cast<uintptr_t>(file.data.data());
+            sqe->len = std::min<size_t>(file.data.length(), MAX_WRITE_SQE);
+            sqe->off = 0;
+            sqe->flags = file.data.length() <= MAX_WRITE_SQE ? IOSQE_IO_LINK : 0;
+            sqe->user_data = 2 * i;
+            if (file.data.length() > MAX_WRITE_SQE) {
+                results[2 * i + 1] = -ECANCELED;
+                continue;
+            }
+
+            sqe = next_sqe(*ring, queued++);
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = fds[i];
+            sqe->user_data = 2 * i + 1;
+        }
+        publish(*ring, queued);
+        if (!submit_and_wait(*ring, queued, results)) return false;
+
+        for (size_t i = 0; i < count; i++) {
+            if (fds[i] < 0) continue;
+            const PendingFile& file = files[first + i];
+            // a short write breaks the link and cancels the close, finish both here
+            if (results[2 * i + 1] == -ECANCELED) {
+                if (results[2 * i] < 0 || !write_fully(fds[i], file.data.data(), file.data.length(), results[2 * i])) {
+                    std::cerr << "Failed to write " << file.path << ": " << strerror(results[2 * i] < 0 ? -results[2 * i] : errno) << '\n';
+                    ok = false;
+                }
+                close(fds[i]);
+            }
+            else if (results[2 * i] != int(file.data.length()) || results[2 * i + 1] < 0) {
+                std::cerr << "Failed to write " << file.path << ".\n";
+                ok = false;
+            }
+        }
+    }
+
+    return ok;
+#else
+    return flush_blocking();
+#endif
+}
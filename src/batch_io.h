@@ -0,0 +1,66 @@
+#ifndef BATCH_IO_H
+#define BATCH_IO_H
+
+#include <cstddef>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+struct IoUring;
+
+// receives what checking out a tree creates, in tree order: FileBatch puts it on disk,
+// archive into a tar stream
+class CheckoutSink {
+public:
+    virtual ~CheckoutSink () = default;
+    virtual void mkdir (const std::string& path) = 0;
+    virtual void write (const std::string& path, std::string data, mode_t mode = 0666) = 0;
+    virtual void symlink (const std::string& target, const std::string& path) = 0;
+};
+
+// Creates directories, files and symlinks in batches. With io_uring (Linux, built with
+// HAVE_IO_URING, not disabled by GIT_CPP_IO_URING=0) each flush submits the mkdirs, then
+// every openat, then linked write+close pairs, waiting once per stage instead of once per
+// call; otherwise the same operations run one blocking syscall at a time.
+// Directories are created before the files of the same flush, parents before children.
+class FileBatch : public CheckoutSink {
+public:
+    explicit FileBatch (size_t max_bytes = 8 << 20, size_t max_files = 256);
+    ~FileBatch () override;
+    FileBatch (const FileBatch&) = delete;
+    FileBatch& operator= (const FileBatch&) = delete;
+
+    void mkdir (const std::string& path) override;
+    void write (const std::string& path, std::string data, mode_t mode = 0666) override;
+    void symlink (const std::string& target, const std::string& path) override;
+
+    // run everything queued; false if any operation failed, the error was printed
+    bool flush ();
+
+    // whether this process can use io_uring for the batches
+    static bool io_uring_available ();
+
+private:
+    struct PendingFile {
+        std::string path;
+        std::string data;
+        mode_t mode;
+    };
+
+    bool flush_blocking ();
+    bool flush_io_uring ();
+
+    size_t max_bytes;
+    size_t max_files;
+    size_t pending_bytes = 0;
+    std::vector<std::string> directories;
+    std::set<std::string> created_directories; // never queued twice
+    std::vector<PendingFile> files;
+    std::vector<std::pair<std::string, std::string>> symlinks; // target, path
+    std::unique_ptr<IoUring> ring;
+    bool failed = false;
+};
+
+#endif // BATCH_IO_H
@@ -0,0 +1,467 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <zlib.h> 
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <openssl/sha.h>
+#include <algorithm>
+#include <set>
+#include <ctime>
+#include <mutex>
+#include <curl/curl.h>
+#include <unistd.h>
+#include "commands.h"
+#include "zlib_implement.h"
+#include "object_store.h"
+#include "delta.h"
+#include "pack.h"
+#include "index_pack.h"
+#include "local_clone.h"
+#include "index.h"
+#include "batch_io.h"
+#include "sparse_checkout.h"
+#include "pkt_line.h"
+#include "remote_refs.h"
+#include "trace.h"
+
+bool git_init (const std::string& dir, bool print_out, const std::string& initial_branch) {
+    if (print_out) std::cout << "git init \n";
+    try {
+        std::filesystem::create_directory(dir + "/.git");
+        std::filesystem::create_directory(dir + "/.git/objects");
+        std::filesystem::create_directory(dir + "/.git/refs");
+
+        std::ofstream headFile(dir + "/.git/HEAD");
+        if (headFile.is_open()) { // create .git/HEAD file
+            headFile << "ref: refs/heads/" << initial_branch << "\n"; // write to the headFile
+            headFile.close();
+        } else {
+            std::cerr << "Failed to create .git/HEAD file.\n";
+            return false;
+        }
+       
+        if (print_out) std::cout << "Initialized git directory in " << dir << "\n";
+        return true;
+    } catch (const std::filesystem::filesystem_error& e) {
+        std::cerr << e.what() << '\n';
+        return false;
+    }
+}
+
+int cat_file(const char* object_hash) {
+        // inflated a piece at a time straight to standard output
+        std::string type;
+        bool found = stream_object(object_hash, type, [](const char* data, size_t length) {
+            return fwrite(data, 1, length, stdout) == length;
+        });
+        if (!found) {
+            std::cerr << "Invalid object hash.\n";
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+std::string hash_object (std::string filepath, std::string type, bool print_out, const std::string& dir) {
+        // open the file
+        std::ifstream inputFile(filepath, std::ios::binary);
+        if(inputFile.fail()) {
+            std::cerr << "Failed to open file.\n";
+            return {};
+        }
+
+        // read the file
+        std::string content(
+            (std::istreambuf_iterator<char>(inputFile)), std::istreambuf_iterator<char>()
+        );
+
+        // create the content
+        std::string header = type + " " + std::to_string(content.size());
+        std::string file_content = header + '\0' + content;
+
+        std::string hash = compute_sha1(file_content, false);
+
+        compress_and_store(hash, file_content, dir);
+        inputFile.close();
+
+        if (print_out) {
+            std::cout << hash << std::endl;
+        }
+
+        return hash;
+}
+
+std::set<std::string> parse_tree_object (const std::string& tree_contents) {
+    std::vector<TreeEntry> entries;
+    parse_tree(tree_contents, entries);
+
+    std::set<std::string> sorted_directories; // sorted lexicographically, without duplicates
+    for (const TreeEntry& entry : entries) {
+        sorted_directories.insert(entry.name);
+    }
+
+    return sorted_directories;
+}
+
+int ls_tree (const char* object_hash) {
+    std::string type, contents;
+    if (!read_object(object_hash, type, contents) || type != "tree") {
+        std::cerr << "Invalid object hash.\n";
+        return EXIT_FAILURE;
+    }
+
+    std::set<std::string> directories = parse_tree_object(contents);
+
+    // print the directories
+    for (const std::string& directory : directories) {
+        std::cout << directory << '\n';
+    }
+
+    return EXIT_SUCCESS;
+}
+
+std::string write_tree (const std::string& directory, const std::string& dir) {
+    std::vector<std::string> tree_entries;
+    std::vector<std::string> skip = {
+        ".git", "server", "CMakeCache.txt", 
+        "CMakeFiles", "Makefile", "cmake_install.cmake"
+    };
+
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        std::string path = entry.path().string();
+        
+        if (std::any_of(skip.begin(), skip.end(), [&path](const std::string& s) {
+            return path.find(s) != std::string::npos;
+        })) {
+            continue;
+        }
+
+        std::error_code ec;
+        std::string entry_type = std::filesystem::is_directory(path, ec) ? "40000 " : "100644 ";
+        std::string relative_path = path.substr(path.find(directory) + directory.length() + 1);
+        std::string hash = std::filesystem::is_directory(path, ec) ?
+                           hash_digest(write_tree(path.c_str(), dir)):
+                           hash_digest(hash_object(path.c_str(), "blob", false, dir));
+        
+        tree_entries.emplace_back(path + '\0' + entry_type + relative_path + '\0' + hash);
+    }
+
+    // sort the entries based on the absolute path
+    std::sort(tree_entries.begin(), tree_entries.end());
+
+    // delete the path from the beginning of each entry
+    int bytes = 0;
+    for (auto& entry : tree_entries) {
+        entry = entry.substr(entry.find('\0') + 1);
+        bytes += entry.length();
+    }
+
+    // concatenate the entries
+    std::string tree_content = "tree " + std::to_string(bytes) + '\0';
+    for (const auto& entry : tree_entries) {
+        tree_content += entry;
+    }
+
+    // storing the tree object
+    std::string tree_hash = compute_sha1(tree_content, false);
+    compress_and_store(tree_hash.c_str(), tree_content, dir);
+
+    return tree_hash;
+}
+
+std::string commit_tree (std::string tree_sha, std::string parent_sha, std::string message, const std::string& dir) {
+    std::string author = "John Doe <john.doe@gmail.com>";
+    std::string committer = "John Doe <john.doe@gmail.com>";
+    std::string timestamp = std::to_string(std::time(nullptr));
+
+    std::string commit_content = "tree " + tree_sha + "\n" +
+                                 "parent " + parent_sha + "\n" +
+                                 "author " + author + " " + timestamp + " -0800\n" +
+                                 "committer " + committer + " " + timestamp + " -0800\n" +
+                                 "\n" + message + "\n";
+    
+
+    std::string header = "commit " + std::to_string(commit_content.length()) + '\0';
+    commit_content = header + commit_content;
+
+
+    std::string commit_hash = compute_sha1(commit_content, false);
+    compress_and_store(commit_hash.c_str(), commit_content, dir);
+
+    return commit_hash;
+}
+
+// curl helper function: stream the ref advertisement through the parser as it arrives
+static size_t refs_callback (void* received_data, size_t element_size, size_t num_element, void* userdata) {
+    size_t total_size = element_size * num_element;
+    RefAdvertisementParser* parser = (RefAdvertisementParser*) userdata;
+
+    return parser->feed((const char*) received_data, total_size) ? total_size : 0; // a short count aborts the transfer
+}
+
+static CURL* curl_handle () {
+    static std::once_flag curl_initialized; // curl_global_init is not thread-safe, run it once per process
+    std::call_once(curl_initialized, []() { curl_global_init(CURL_GLOBAL_DEFAULT); });
+    CURL* handle = curl_easy_init();
+    if (!handle) {
+        std::cerr << "Failed to initialize curl.\n";
+    }
+
+    return handle;
+}
+
+bool fetch_refs (const std::string& url, RefTable& refs) {
+    TraceRegion region("http", "fetch_refs");
+    CURL* handle = curl_handle();
+    if (!handle) {
+        return false;
+    }
+
+    RefAdvertisementParser parser(refs);
+    curl_easy_setopt(handle, CURLOPT_URL, (url + "/info/refs?service=git-upload-pack").c_str());
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, refs_callback);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, (void*) &parser);
+    curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
+    CURLcode result = curl_easy_perform(handle);
+    curl_easy_cleanup(handle);
+    if (result != CURLE_OK || !parser.finish()) {
+        std::cerr << "Failed to read the refs of " << url << (result != CURLE_OK ? ": " + std::string(curl_easy_strerror(result)) : "") << ".\n";
+        return false;
+    }
+    trace_data("http", "refs", refs.size());
+
+    return true;
+}
+
+static size_t pack_file_callback (void* received_data, size_t element_size, size_t num_element, void* userdata) {
+    size_t total_size = element_size * num_element;
+    PackReceiver* receiver = (PackReceiver*) userdata;
+
+    return receiver->receive((const char*) received_data, total_size) ? total_size : 0; // a short count aborts the transfer
+}
+
+bool fetch_pack_file (const std::string& url, const std::vector<std::string>& wants, PackReceiver& receiver) {
+    TraceRegion region("http", "fetch_pack");
+    CURL* handle = curl_handle();
+    if (!handle) {
+        return false;
+    }
+
+    curl_easy_setopt(handle, CURLOPT_URL, (url + "/git-upload-pack").c_str());
+    std::string postdata;
+    for (const auto& want : wants) {
+        postdata += pkt_line("want " + want + (postdata.empty() ? " ofs-delta\n" : "\n"));
+    }
+    postdata += PKT_FLUSH + pkt_line("done\n");
+    curl_easy_setopt(handle, CURLOPT_POSTFIELDS, postdata.c_str());
+    curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE, (long) postdata.length());
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, (void*) &receiver);
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, pack_file_callback);
+    curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
+
+    struct curl_slist* headers = curl_slist_append(nullptr, "Content-Type: application/x-git-upload-pack-request");
+    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+    CURLcode result = curl_easy_perform(handle);
+    curl_easy_cleanup(handle);
+    curl_slist_free_all(headers);
+
+    if (result != CURLE_OK && receiver.error.empty()) {
+        receiver.error = curl_easy_strerror(result);
+    }
+    bool received = receiver.finish();
+    trace_data("http", "pack_bytes", receiver.bytes);
+    if (!received) {
+        std::cerr << "Failed to fetch a pack from " << url << ": " << receiver.error << ".\n";
+    }
+    return received;
+}
+
+// queue the files of a tree on the batch, directories first. With a sparse cone, path is the
+// tree's place in the checkout and excluded subtrees are skipped before they are read.
+void checkout_tree (CheckoutSink& sink, const std::string& tree_hash, const std::string& dir, const std::string& proj_dir,
+                    const SparseCone* cone, const std::string& path) {
+    static TraceCounter checkout_files("checkout", "files");
+    static TraceCounter checkout_bytes("checkout", "bytes");
+    static TraceCounter checkout_pruned("checkout", "sparse_pruned_trees");
+
+    // read the tree object, loose or from a mapped pack
+    std::string type, tree_contents;
+    std::vector<TreeEntry> entries;
+    if (!read_object(tree_hash, type, tree_contents, proj_dir) || type != "tree" || !parse_tree(tree_contents, entries)) {
+        throw std::runtime_error("Invalid tree object " + tree_hash + ".");
+    }
+
+    // iterate over each entry in the tree object
+    for (const auto& entry : entries) {
+        std::string full_path = dir.empty() ? entry.name : dir + '/' + entry.name;
+        if (entry.mode == "40000") {
+            std::string entry_path = path.empty() ? entry.name : path + '/' + entry.name;
+            SparseMatch match = cone ? sparse_match(*cone, entry_path) : SparseMatch::Recursive;
+            if (match == SparseMatch::Excluded) {
+                checkout_pruned.add(1);
+                continue;
+            }
+
+            // create directories and recursively restore the nested tree
+            sink.mkdir(full_path);
+            checkout_tree(sink, entry.hash, full_path, proj_dir, match == SparseMatch::Parent ? cone : nullptr, entry_path);
+        }
+        else if (entry.mode == "160000") {
+            sink.mkdir(full_path); // submodules are left empty
+        }
+        else {
+            std::string blob_contents;
+            if (!read_object(entry.hash, type, blob_contents, proj_dir)) {
+                throw std::runtime_error("Missing blob " + entry.hash + ".");
+            }
+
+            if (entry.mode == "120000") {
+                sink.symlink(blob_contents, full_path);
+                continue;
+            }
+
+            // the file is created with its executable bits, subject to the umask
+            checkout_files.add(1);
+            checkout_bytes.add(blob_contents.length());
+            sink.write(full_path, std::move(blob_contents), entry.mode == "100755" ? 0777 : 0666);
+        }
+    }
+}
+
+void restore_tree (const std::string& tree_hash, const std::string& dir, const std::string& proj_dir) {
+    SparseCone cone;
+    bool sparse = read_sparse_checkout(cone, proj_dir);
+    FileBatch batch;
+    checkout_tree(batch, tree_hash, dir, proj_dir, sparse ? &cone : nullptr);
+    if (!batch.flush()) {
+        throw std::runtime_error("Failed to check out " + tree_hash + ".");
+    }
+}
+
+// clone a repository on this machine by sharing its object files instead of fetching a pack
+int clone_local (const std::string& url, const std::string& dir, bool print_out, const std::vector<std::string>* sparse_dirs) {
+    std::string source = local_repository_path(url);
+    if (!std::filesystem::is_directory(source + "/.git/objects")) {
+        std::cerr << source << " is not a git repository.\n";
+        return EXIT_FAILURE;
+    }
+
+    std::filesystem::create_directory(dir);
+    if (git_init(dir, print_out) != true) {
+        std::cerr << "Failed to initialize git repository.\n";
+        return EXIT_FAILURE;
+    }
+    if (sparse_dirs && !write_sparse_checkout(sparse_cone(*sparse_dirs), dir)) {
+        return EXIT_FAILURE;
+    }
+
+    {
+        TraceRegion region("clone", "link_objects");
+        if (link_objects(source, dir) < 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::string head;
+    if (!clone_refs(source, dir, head)) {
+        return EXIT_FAILURE;
+    }
+    if (head.empty()) {
+        std::cerr << "warning: You appear to have cloned an empty repository.\n";
+        return EXIT_SUCCESS;
+    }
+
+    // check out straight from the linked, mmapped packs
+    std::string type, contents;
+    CommitObject commit;
+    if (!read_object(head, type, contents, dir) || !parse_commit(contents, commit)) {
+        std::cerr << "Invalid HEAD commit " << head << ".\n";
+        return EXIT_FAILURE;
+    }
+    TraceRegion region("checkout", "restore_tree");
+    restore_tree(commit.tree, dir, dir);
+    write_index_for_tree(commit.tree, dir);
+
+    return EXIT_SUCCESS;
+}
+
+int clone (std::string url, std::string dir, bool print_out, const std::vector<std::string>* sparse_dirs) {
+    if (is_local_repository(url)) {
+        return clone_local(url, dir, print_out, sparse_dirs);
+    }
+
+    // create the repository directory and initialize it
+    std::filesystem::create_directory(dir);
+    if (git_init(dir, print_out) != true) {
+        std::cerr << "Failed to initialize git repository.\n";
+        return EXIT_FAILURE;
+    }
+    if (sparse_dirs && !write_sparse_checkout(sparse_cone(*sparse_dirs), dir)) {
+        return EXIT_FAILURE;
+    }
+
+    // fetch every branch and tag, checking out the remote default branch
+    RefTable refs;
+    if (!fetch_refs(url, refs)) {
+        return EXIT_FAILURE;
+    }
+    std::string branch, packhash;
+    if (!refs.default_branch(branch, packhash)) {
+        std::cerr << "warning: You appear to have cloned an empty repository.\n";
+        return EXIT_SUCCESS;
+    }
+    std::vector<std::string> wants = {packhash};
+    std::vector<std::pair<std::string, std::string>> remote_refs;
+    for (size_t i = 0; i < refs.size(); i++) {
+        std::string name = refs.name(i);
+        if ((name.rfind("refs/heads/", 0) == 0 || name.rfind("refs/tags/", 0) == 0) &&
+            name.compare(name.length() - std::min<size_t>(3, name.length()), 3, "^{}") != 0) {
+            wants.push_back(refs.hash(i));
+            remote_refs.emplace_back(name, refs.hash(i));
+        }
+    }
+    std::sort(wants.begin() + 1, wants.end());
+    wants.erase(std::unique(wants.begin() + 1, wants.end()), wants.end());
+    wants.erase(std::remove(wants.begin() + 1, wants.end(), packhash), wants.end());
+
+    // the pack goes to a file as it arrives and is indexed there, nothing holds all of it in memory
+    PackReceiver receiver;
+    IndexPackResult result;
+    std::string pack_dir = dir + "/.git/objects/pack/";
+    std::filesystem::create_directories(pack_dir);
+    if (!receiver.open(pack_dir + "tmp_pack_clone_" + std::to_string(getpid()))) {
+        std::cerr << "Failed to fetch a pack from " << url << ": " << receiver.error << ".\n";
+        return EXIT_FAILURE;
+    }
+    if (!fetch_pack_file(url, wants, receiver)) {
+        return EXIT_FAILURE;
+    }
+    if (!index_pack(receiver.path, result, dir)) {
+        std::filesystem::remove(receiver.path);
+        return EXIT_FAILURE;
+    }
+    trace_data("clone", "objects", result.objects);
+    trace_data("clone", "deltas", result.deltas);
+
+    if (!write_clone_refs(remote_refs, branch, packhash, dir)) {
+        return EXIT_FAILURE;
+    }
+
+    // check out straight from the installed pack
+    std::string type, contents;
+    CommitObject commit;
+    if (!read_object(packhash, type, contents, dir) || !parse_commit(contents, commit)) {
+        std::cerr << "Invalid HEAD commit " << packhash << ".\n";
+        return EXIT_FAILURE;
+    }
+    TraceRegion region("checkout", "restore_tree");
+    restore_tree(commit.tree, dir, dir);
+    write_index_for_tree(commit.tree, dir);
+
+    return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,43 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <cstdio>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// the plumbing commands behind the CLI, operating on the repository in dir (or the current directory)
+bool git_init (const std::string& dir, bool print_out = true, const std::string& initial_branch = "master");
+int cat_file (const char* object_hash);
+std::string hash_object (std::string filepath, std::string type = "blob", bool print_out = false, const std::string& dir = ".");
+std::set<std::string> parse_tree_object (const std::string& tree_contents);
+int ls_tree (const char* object_hash);
+std::string write_tree (const std::string& directory, const std::string& dir = ".");
+std::string commit_tree (std::string tree_sha, std::string parent_sha, std::string message, const std::string& dir = ".");
+
+class RefTable;
+class PackReceiver;
+
+// read the ref advertisement of a smart HTTP remote, false if it cannot be fetched or parsed
+bool fetch_refs (const std::string& url, RefTable& refs);
+// fetch a pack with the wanted objects and everything they reach into the receiver's file,
+// false with the reason on stderr if none arrived whole
+bool fetch_pack_file (const std::string& url, const std::vector<std::string>& wants, PackReceiver& receiver);
+
+class CheckoutSink;
+struct SparseCone;
+
+// hand the directories, files and symlinks of a tree to sink with their paths below dir (the
+// tree root when empty), reading each blob from the repository in proj_dir as it is reached;
+// directories outside cone are skipped. Throws if an object is missing.
+void checkout_tree (CheckoutSink& sink, const std::string& tree_hash, const std::string& dir, const std::string& proj_dir,
+                    const SparseCone* cone = nullptr, const std::string& path = "");
+// check out a tree of the repository in proj_dir into dir, only its sparse-checkout cone if it has one
+void restore_tree (const std::string& tree_hash, const std::string& dir, const std::string& proj_dir);
+// with sparse_dirs the checkout is limited to the cone of those directories, none keeps the root files only
+int clone_local (const std::string& url, const std::string& dir, bool print_out = true,
+                 const std::vector<std::string>* sparse_dirs = nullptr);
+int clone (std::string url, std::string dir, bool print_out = true, const std::vector<std::string>* sparse_dirs = nullptr);
+
+#endif // COMMANDS_H
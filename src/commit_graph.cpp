@@ -0,0 +1,434 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/sha.h>
+#include "commit_graph.h"
+#include "object_store.h"
+#include "revision.h"
+
+#define GRAPH_SIGNATURE "CGPH"
+#define GRAPH_HEADER_SIZE 8
+#define GRAPH_CHUNK_OIDF 0x4f494446
+#define GRAPH_CHUNK_OIDL 0x4f49444c
+#define GRAPH_CHUNK_CDAT 0x43444154
+#define GRAPH_CHUNK_EDGE 0x45444745
+#define GRAPH_EXTRA_EDGES_NEEDED 0x80000000
+#define GRAPH_LAST_EDGE 0x80000000
+#define GRAPH_DATA_WIDTH 36 // tree oid, two parent positions, generation and commit time
+#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+
+static uint32_t get_be32 (const unsigned char* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+static uint64_t get_be64 (const unsigned char* p) {
+    return (uint64_t(get_be32(p)) << 32) | get_be32(p + 4);
+}
+
+static void put_be32 (std::string& out, uint32_t value) {
+    out.push_back(char(value >> 24));
+    out.push_back(char(value >> 16));
+    out.push_back(char(value >> 8));
+    out.push_back(char(value));
+}
+
+static void put_be64 (std::string& out, uint64_t value) {
+    put_be32(out, uint32_t(value >> 32));
+    put_be32(out, uint32_t(value));
+}
+
+static std::string graph_path (const std::string& dir) {
+    return dir + "/.git/objects/info/commit-graph";
+}
+
+bool load_commit_graph (CommitGraph& graph, const std::string& dir) {
+    int fd = open(graph_path(dir).c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < GRAPH_HEADER_SIZE + 20) {
+        close(fd);
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file alive
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    const unsigned char* data = static_cast<const unsigned char*>(mapped);
+    size_t size = st.st_size;
+
+    // header: signature, version 1, hash version 1 (SHA-1), chunk count, base graph count
+    if (memcmp(data, GRAPH_SIGNATURE, 4) != 0 || data[4] != 1 || data[5] != 1) {
+        std::cerr << "Ignoring commit-graph with unsupported format.\n";
+        munmap(mapped, size);
+        return false;
+    }
+
+    // the chunk lookup table has one extra terminating entry
+    uint8_t num_chunks = data[6];
+    if (GRAPH_HEADER_SIZE + (num_chunks + 1) * 12u > size) {
+        munmap(mapped, size);
+        return false;
+    }
+
+    // the trailing SHA-1 covers the rest of the file
+    unsigned char checksum[SHA_DIGEST_LENGTH];
+    SHA1(data, size - 20, checksum);
+    if (memcmp(checksum, data + size - 20, 20) != 0) {
+        std::cerr << "Ignoring corrupt commit-graph.\n";
+        munmap(mapped, size);
+        return false;
+    }
+
+    // a chunk ends where the next table entry, or the terminating one, starts
+    CommitGraph loaded;
+    loaded.data = data;
+    loaded.size = size;
+    size_t fanout_size = 0, oid_lookup_size = 0, commit_data_size = 0, extra_edges_size = 0;
+    const unsigned char* chunk = data + GRAPH_HEADER_SIZE;
+    bool valid = true;
+    for (int i = 0; i < num_chunks; i++, chunk += 12) {
+        uint32_t chunk_id = get_be32(chunk);
+        uint64_t offset = get_be64(chunk + 4);
+        uint64_t end = get_be64(chunk + 16);
+        if (offset > end || end > size - 20) {
+            valid = false;
+            break;
+        }
+
+        switch (chunk_id) {
+            case GRAPH_CHUNK_OIDF: loaded.fanout = data + offset; fanout_size = end - offset; break;
+            case GRAPH_CHUNK_OIDL: loaded.oid_lookup = data + offset; oid_lookup_size = end - offset; break;
+            case GRAPH_CHUNK_CDAT: loaded.commit_data = data + offset; commit_data_size = end - offset; break;
+            case GRAPH_CHUNK_EDGE: loaded.extra_edges = data + offset; extra_edges_size = end - offset; break;
+            default: break; // unknown optional chunks are skipped
+        }
+    }
+
+    if (valid && (!loaded.fanout || !loaded.oid_lookup || !loaded.commit_data)) {
+        std::cerr << "Ignoring commit-graph with missing chunks.\n";
+        munmap(mapped, size);
+        return false;
+    }
+
+    // every later read indexes these chunks by positions taken from the file, check them all once
+    if (valid && fanout_size == 256 * 4) {
+        for (int i = 1; i < 256 && valid; i++) {
+            valid = get_be32(loaded.fanout + (i - 1) * 4) <= get_be32(loaded.fanout + i * 4);
+        }
+        loaded.num_commits = get_be32(loaded.fanout + 255 * 4);
+        loaded.num_extra_edges = extra_edges_size / 4;
+        valid = valid && oid_lookup_size == size_t(loaded.num_commits) * 20 &&
+                commit_data_size == size_t(loaded.num_commits) * GRAPH_DATA_WIDTH;
+    }
+    else {
+        valid = false;
+    }
+    for (uint32_t i = 0; i < loaded.num_commits && valid; i++) {
+        const unsigned char* entry = loaded.commit_data + size_t(i) * GRAPH_DATA_WIDTH;
+        uint32_t first = get_be32(entry + 20);
+        uint32_t second = get_be32(entry + 24);
+        valid = first == GRAPH_PARENT_NONE || first < loaded.num_commits;
+        if (!valid || second == GRAPH_PARENT_NONE) {
+            continue;
+        }
+        if (!(second & GRAPH_EXTRA_EDGES_NEEDED)) {
+            valid = second < loaded.num_commits;
+            continue;
+        }
+        // an octopus list has to end on a marked entry inside the EDGE chunk
+        uint32_t edge = second & ~GRAPH_EXTRA_EDGES_NEEDED;
+        for (valid = false; edge < loaded.num_extra_edges; edge++) {
+            uint32_t value = get_be32(loaded.extra_edges + size_t(edge) * 4);
+            if ((value & ~GRAPH_LAST_EDGE) >= loaded.num_commits) {
+                break;
+            }
+            if (value & GRAPH_LAST_EDGE) {
+                valid = true;
+                break;
+            }
+        }
+    }
+
+    if (!valid) {
+        std::cerr << "Ignoring corrupt commit-graph.\n";
+        munmap(mapped, size);
+        return false;
+    }
+
+    graph = loaded;
+    return true;
+}
+
+void close_commit_graph (CommitGraph& graph) {
+    if (graph.data) {
+        munmap(const_cast<unsigned char*>(graph.data), graph.size);
+    }
+    graph = CommitGraph();
+}
+
+bool commit_graph_find (const CommitGraph& graph, const unsigned char* oid, uint32_t* position) {
+    if (graph.num_commits == 0) {
+        return false;
+    }
+
+    // the fanout table narrows the search to ids sharing the first byte
+    uint32_t low = oid[0] == 0 ? 0 : get_be32(graph.fanout + (oid[0] - 1) * 4);
+    uint32_t high = get_be32(graph.fanout + oid[0] * 4);
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        int cmp = memcmp(oid, graph.oid_lookup + size_t(mid) * 20, 20);
+        if (cmp == 0) {
+            *position = mid;
+            return true;
+        }
+        if (cmp < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    return false;
+}
+
+const unsigned char* commit_graph_oid (const CommitGraph& graph, uint32_t position) {
+    return graph.oid_lookup + size_t(position) * 20;
+}
+
+const unsigned char* commit_graph_tree (const CommitGraph& graph, uint32_t position) {
+    return graph.commit_data + size_t(position) * GRAPH_DATA_WIDTH;
+}
+
+void commit_graph_parents (const CommitGraph& graph, uint32_t position, std::vector<uint32_t>& parents) {
+    parents.clear();
+    const unsigned char* entry = graph.commit_data + size_t(position) * GRAPH_DATA_WIDTH;
+
+    uint32_t first = get_be32(entry + 20);
+    if (first == GRAPH_PARENT_NONE) {
+        return;
+    }
+    parents.push_back(first);
+
+    uint32_t second = get_be32(entry + 24);
+    if (second == GRAPH_PARENT_NONE) {
+        return;
+    }
+    if (!(second & GRAPH_EXTRA_EDGES_NEEDED)) {
+        parents.push_back(second);
+        return;
+    }
+
+    // octopus merges keep the remaining parents in the EDGE chunk
+    if (!graph.extra_edges) {
+        return;
+    }
+    const unsigned char* edge = graph.extra_edges + size_t(second & ~GRAPH_EXTRA_EDGES_NEEDED) * 4;
+    while (true) {
+        uint32_t value = get_be32(edge);
+        parents.push_back(value & ~GRAPH_LAST_EDGE);
+        if (value & GRAPH_LAST_EDGE) {
+            break;
+        }
+        edge += 4;
+    }
+}
+
+uint64_t commit_graph_time (const CommitGraph& graph, uint32_t position) {
+    const unsigned char* entry = graph.commit_data + size_t(position) * GRAPH_DATA_WIDTH;
+    return (uint64_t(get_be32(entry + 28) & 0x3) << 32) | get_be32(entry + 32);
+}
+
+uint32_t commit_graph_generation (const CommitGraph& graph, uint32_t position) {
+    const unsigned char* entry = graph.commit_data + size_t(position) * GRAPH_DATA_WIDTH;
+    return get_be32(entry + 28) >> 2;
+}
+
+namespace {
+
+struct GraphCommit {
+    std::string oid; // raw 20 bytes
+    std::string tree;
+    std::vector<std::string> parents;
+    uint64_t time = 0;
+    uint32_t generation = 0;
+};
+
+} // namespace
+
+int write_commit_graph (const std::vector<std::string>& tips, const std::string& dir) {
+    // collect every commit reachable from the tips
+    std::unordered_map<std::string, size_t> seen;
+    std::vector<GraphCommit> commits;
+    std::vector<std::string> pending;
+    for (const auto& tip : tips) {
+        std::string hash = resolve_revision(tip, dir);
+        if (hash.empty()) {
+            std::cerr << "Unknown revision " << tip << ".\n";
+            return EXIT_FAILURE;
+        }
+        // tags are peeled; a ref to a tree or blob has no history to add
+        hash = peel_to_commit(hash, dir);
+        if (!hash.empty()) {
+            pending.push_back(hash);
+        }
+    }
+
+    while (!pending.empty()) {
+        std::string hash = pending.back();
+        pending.pop_back();
+        if (seen.count(hash)) {
+            continue;
+        }
+
+        std::string type, contents;
+        CommitObject commit;
+        if (!read_object(hash, type, contents, dir) || type != "commit" || !parse_commit(contents, commit)) {
+            std::cerr << "Failed to read commit " << hash << ".\n";
+            return EXIT_FAILURE;
+        }
+
+        seen[hash] = commits.size();
+        GraphCommit entry;
+        entry.oid = hash_digest(hash);
+        entry.tree = hash_digest(commit.tree);
+        entry.parents = commit.parents;
+        entry.time = commit.commit_time;
+        commits.push_back(std::move(entry));
+
+        for (const auto& parent : commit.parents) {
+            pending.push_back(parent);
+        }
+    }
+
+    // the commit-graph lists commits sorted by object id
+    std::sort(commits.begin(), commits.end(), [](const GraphCommit& a, const GraphCommit& b) {
+        return a.oid < b.oid;
+    });
+
+    std::unordered_map<std::string, uint32_t> positions;
+    for (uint32_t i = 0; i < commits.size(); i++) {
+        positions[digest_to_hash(commits[i].oid)] = i;
+    }
+
+    std::vector<std::vector<uint32_t>> parent_positions(commits.size());
+    for (size_t i = 0; i < commits.size(); i++) {
+        for (const auto& parent : commits[i].parents) {
+            parent_positions[i].push_back(positions[parent]);
+        }
+    }
+
+    // topological levels, computed with an explicit stack to survive deep histories
+    for (uint32_t start = 0; start < commits.size(); start++) {
+        if (commits[start].generation != 0) {
+            continue;
+        }
+
+        std::vector<uint32_t> stack = {start};
+        while (!stack.empty()) {
+            uint32_t current = stack.back();
+            uint32_t max_parent_generation = 0;
+            bool parents_done = true;
+            for (uint32_t parent : parent_positions[current]) {
+                if (commits[parent].generation == 0) {
+                    stack.push_back(parent);
+                    parents_done = false;
+                } else {
+                    max_parent_generation = std::max(max_parent_generation, commits[parent].generation);
+                }
+            }
+
+            if (parents_done) {
+                commits[current].generation = std::min<uint32_t>(max_parent_generation + 1, GENERATION_NUMBER_MAX);
+                stack.pop_back();
+            }
+        }
+    }
+
+    // build the chunks
+    std::string fanout, oid_lookup, commit_data, extra_edges;
+    uint32_t count = 0;
+    for (int byte = 0; byte < 256; byte++) {
+        while (count < commits.size() && static_cast<unsigned char>(commits[count].oid[0]) == byte) {
+            count++;
+        }
+        put_be32(fanout, count);
+    }
+
+    for (size_t i = 0; i < commits.size(); i++) {
+        const GraphCommit& commit = commits[i];
+        const std::vector<uint32_t>& parents = parent_positions[i];
+        oid_lookup += commit.oid;
+
+        commit_data += commit.tree;
+        put_be32(commit_data, parents.size() > 0 ? parents[0] : GRAPH_PARENT_NONE);
+        if (parents.size() <= 2) {
+            put_be32(commit_data, parents.size() == 2 ? parents[1] : GRAPH_PARENT_NONE);
+        } else {
+            put_be32(commit_data, GRAPH_EXTRA_EDGES_NEEDED | uint32_t(extra_edges.length() / 4));
+            for (size_t p = 1; p < parents.size(); p++) {
+                put_be32(extra_edges, parents[p] | (p + 1 == parents.size() ? GRAPH_LAST_EDGE : 0));
+            }
+        }
+        put_be32(commit_data, (commit.generation << 2) | uint32_t((commit.time >> 32) & 0x3));
+        put_be32(commit_data, uint32_t(commit.time));
+    }
+
+    std::vector<std::pair<uint32_t, const std::string*>> chunks = {
+        {GRAPH_CHUNK_OIDF, &fanout}, {GRAPH_CHUNK_OIDL, &oid_lookup}, {GRAPH_CHUNK_CDAT, &commit_data}
+    };
+    if (!extra_edges.empty()) {
+        chunks.push_back({GRAPH_CHUNK_EDGE, &extra_edges});
+    }
+
+    std::string graph = GRAPH_SIGNATURE;
+    graph.push_back(1); // version
+    graph.push_back(1); // hash version (SHA-1)
+    graph.push_back(char(chunks.size()));
+    graph.push_back(0); // base graphs
+
+    uint64_t offset = GRAPH_HEADER_SIZE + (chunks.size() + 1) * 12;
+    for (const auto& [chunk_id, chunk] : chunks) {
+        put_be32(graph, chunk_id);
+        put_be64(graph, offset);
+        offset += chunk->length();
+    }
+    put_be32(graph, 0);
+    put_be64(graph, offset);
+
+    for (const auto& chunk : chunks) {
+        graph += *chunk.second;
+    }
+
+    unsigned char checksum[20];
+    SHA1(reinterpret_cast<const unsigned char*>(graph.data()), graph.length(), checksum);
+    graph.append(reinterpret_cast<const char*>(checksum), 20);
+
+    // write to a temporary file and rename so readers never see a partial graph
+    std::string path = graph_path(dir);
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+    std::string temp_path = path + ".lock";
+    std::ofstream output(temp_path, std::ios::binary | std::ios::trunc);
+    if (!output.is_open() || !output.write(graph.data(), graph.length())) {
+        std::cerr << "Failed to write commit-graph.\n";
+        return EXIT_FAILURE;
+    }
+    output.close();
+    std::filesystem::rename(temp_path, path);
+
+    return EXIT_SUCCESS;
+}
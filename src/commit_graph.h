@@ -0,0 +1,39 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#define GRAPH_PARENT_NONE 0x70000000
+#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF
+
+// a read-only view of .git/objects/info/commit-graph, mapped into memory
+struct CommitGraph {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    uint32_t num_commits = 0;
+    const unsigned char* fanout = nullptr;      // OIDF chunk
+    const unsigned char* oid_lookup = nullptr;  // OIDL chunk
+    const unsigned char* commit_data = nullptr; // CDAT chunk
+    const unsigned char* extra_edges = nullptr; // EDGE chunk, only present for octopus merges
+    uint32_t num_extra_edges = 0;
+};
+
+bool load_commit_graph (CommitGraph& graph, const std::string& dir = ".");
+void close_commit_graph (CommitGraph& graph);
+
+// binary search for a raw 20-byte object id, stores its graph position
+bool commit_graph_find (const CommitGraph& graph, const unsigned char* oid, uint32_t* position);
+
+const unsigned char* commit_graph_oid (const CommitGraph& graph, uint32_t position);
+const unsigned char* commit_graph_tree (const CommitGraph& graph, uint32_t position);
+void commit_graph_parents (const CommitGraph& graph, uint32_t position, std::vector<uint32_t>& parents);
+uint64_t commit_graph_time (const CommitGraph& graph, uint32_t position);
+uint32_t commit_graph_generation (const CommitGraph& graph, uint32_t position);
+
+// write a commit-graph covering every commit reachable from the given tips
+int write_commit_graph (const std::vector<std::string>& tips, const std::string& dir = ".");
+
+#endif // COMMIT_GRAPH_H
@@ -0,0 +1,254 @@
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <bit>
+#include <vector>
+#include <stdexcept>
+#include "delta.h"
+#include "trace.h"
+
+#define DELTA_BLOCK_SIZE 16
+#define DELTA_MAX_COPY 0x10000
+#define DELTA_MAX_INSERT 0x7F
+#define DELTA_BUCKET_LIMIT 64 // offsets kept per hash bucket, bounds work on repetitive input
+#define ROLLING_BASE 0x01000193u
+
+// the size headers of a delta are little-endian base-128 numbers
+static size_t read_delta_size (const std::string& delta, size_t* pos) {
+    size_t size = 0;
+    int shift = 0;
+    unsigned char byte;
+    do {
+        if (*pos >= delta.length()) {
+            throw std::runtime_error("Truncated delta header.");
+        }
+        byte = delta[(*pos)++];
+        size |= size_t(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    return size;
+}
+
+static void write_delta_size (std::string& delta, size_t size) {
+    while (size >= 0x80) {
+        delta.push_back(char((size & 0x7F) | 0x80));
+        size >>= 7;
+    }
+    delta.push_back(char(size));
+}
+
+std::string apply_delta (const std::string& delta_contents, const std::string& base_contents) {
+    static TraceTimer timer("delta", "apply_delta");
+    static TraceCounter bytes("delta", "apply_delta_bytes");
+    TraceTimerScope scope(timer);
+    size_t current_position_in_delta = 0;
+
+    // read the length of the base object and of the result
+    size_t base_length = read_delta_size(delta_contents, &current_position_in_delta);
+    size_t result_length = read_delta_size(delta_contents, &current_position_in_delta);
+    if (base_length != base_contents.length()) {
+        throw std::runtime_error("Delta base size mismatch.");
+    }
+
+    std::string reconstructed_object;
+    reconstructed_object.reserve(result_length);
+
+    // iterate through the delta contents
+    while (current_position_in_delta < delta_contents.length()) {
+        unsigned char current_instruction = delta_contents[current_position_in_delta++];
+
+        // check if the highest bit of the instruction byte is set
+        if (current_instruction & 0x80) {
+            size_t copy_offset = 0;
+            size_t copy_size = 0;
+
+            // bits 0-3 select which little-endian offset bytes follow, bits 4-6 the size bytes
+            if (size_t(std::popcount(unsigned(current_instruction & 0x7F))) > delta_contents.length() - current_position_in_delta) {
+                throw std::runtime_error("Truncated delta copy.");
+            }
+            for (int i = 0; i < 4; i++) {
+                if (current_instruction & (1 << i)) {
+                    copy_offset |= size_t(static_cast<unsigned char>(delta_contents[current_position_in_delta++])) << (i * 8);
+                }
+            }
+            for (int i = 0; i < 3; i++) {
+                if (current_instruction & (1 << (i + 4))) {
+                    copy_size |= size_t(static_cast<unsigned char>(delta_contents[current_position_in_delta++])) << (i * 8);
+                }
+            }
+
+            // default size to 0x10000 if no size was specified
+            if (copy_size == 0) {
+                copy_size = DELTA_MAX_COPY;
+            }
+            if (copy_offset + copy_size > base_contents.length()) {
+                throw std::runtime_error("Delta copy out of range.");
+            }
+
+            // append the copied data from base contents to the reconstructed object
+            reconstructed_object.append(base_contents, copy_offset, copy_size);
+        }
+        else if (current_instruction != 0) {
+            // direct add instruction, the highest bit is not set
+            size_t add_size = current_instruction & 0x7F;
+            if (current_position_in_delta + add_size > delta_contents.length()) {
+                throw std::runtime_error("Delta insert out of range.");
+            }
+            reconstructed_object.append(delta_contents, current_position_in_delta, add_size);
+            current_position_in_delta += add_size;
+        }
+        else {
+            throw std::runtime_error("Unexpected delta opcode 0.");
+        }
+    }
+
+    if (reconstructed_object.length() != result_length) {
+        throw std::runtime_error("Delta result size mismatch.");
+    }
+    bytes.add(result_length);
+
+    return reconstructed_object;
+}
+
+// polynomial hash of one block, rolled a byte at a time over the target
+static uint32_t block_hash (const unsigned char* data) {
+    uint32_t hash = 0;
+    for (int i = 0; i < DELTA_BLOCK_SIZE; i++) {
+        hash = hash * ROLLING_BASE + data[i];
+    }
+
+    return hash;
+}
+
+static void flush_insert (std::string& delta, const std::string& target, size_t start, size_t end) {
+    while (start < end) {
+        size_t length = std::min<size_t>(end - start, DELTA_MAX_INSERT);
+        delta.push_back(char(length));
+        delta.append(target, start, length);
+        start += length;
+    }
+}
+
+static void emit_copy (std::string& delta, size_t offset, size_t size) {
+    while (size > 0) {
+        size_t length = std::min<size_t>(size, DELTA_MAX_COPY);
+        std::string operands;
+        unsigned char instruction = 0x80;
+        for (int i = 0; i < 4; i++) {
+            unsigned char byte = (offset >> (i * 8)) & 0xFF;
+            if (byte) {
+                instruction |= 1 << i;
+                operands.push_back(char(byte));
+            }
+        }
+
+        // a size of exactly 0x10000 is encoded by leaving out the size bytes
+        if (length != DELTA_MAX_COPY) {
+            for (int i = 0; i < 3; i++) {
+                unsigned char byte = (length >> (i * 8)) & 0xFF;
+                if (byte) {
+                    instruction |= 1 << (i + 4);
+                    operands.push_back(char(byte));
+                }
+            }
+        }
+
+        delta.push_back(char(instruction));
+        delta += operands;
+        offset += length;
+        size -= length;
+    }
+}
+
+std::string create_delta (const std::string& base_contents, const std::string& target_contents, size_t max_size) {
+    std::string delta;
+    write_delta_size(delta, base_contents.length());
+    write_delta_size(delta, target_contents.length());
+
+    const unsigned char* base = reinterpret_cast<const unsigned char*>(base_contents.data());
+    const unsigned char* target = reinterpret_cast<const unsigned char*>(target_contents.data());
+    size_t base_length = base_contents.length();
+    size_t target_length = target_contents.length();
+
+    // index the base in non-overlapping blocks
+    size_t num_blocks = base_length / DELTA_BLOCK_SIZE;
+    size_t bucket_count = 1;
+    while (bucket_count < num_blocks) {
+        bucket_count <<= 1;
+    }
+    std::vector<uint32_t> heads(bucket_count, UINT32_MAX);
+    std::vector<uint32_t> next(num_blocks, UINT32_MAX);
+    std::vector<uint16_t> bucket_sizes(bucket_count, 0);
+    // later blocks are inserted first so that earlier offsets are tried first
+    for (size_t block = num_blocks; block-- > 0;) {
+        uint32_t bucket = block_hash(base + block * DELTA_BLOCK_SIZE) & (bucket_count - 1);
+        if (bucket_sizes[bucket] >= DELTA_BUCKET_LIMIT) {
+            continue;
+        }
+        bucket_sizes[bucket]++;
+        next[block] = heads[bucket];
+        heads[bucket] = block;
+    }
+
+    // the weight of the byte leaving the rolling window
+    uint32_t outgoing_weight = 1;
+    for (int i = 1; i < DELTA_BLOCK_SIZE; i++) {
+        outgoing_weight *= ROLLING_BASE;
+    }
+
+    size_t insert_start = 0;
+    size_t pos = 0;
+    uint32_t hash = target_length >= DELTA_BLOCK_SIZE && num_blocks > 0 ? block_hash(target) : 0;
+    while (num_blocks > 0 && pos + DELTA_BLOCK_SIZE <= target_length) {
+        size_t best_offset = 0;
+        size_t best_length = 0;
+        for (uint32_t block = heads[hash & (bucket_count - 1)]; block != UINT32_MAX; block = next[block]) {
+            size_t offset = size_t(block) * DELTA_BLOCK_SIZE;
+            size_t length = 0;
+            while (offset + length < base_length && pos + length < target_length &&
+                   base[offset + length] == target[pos + length]) {
+                length++;
+            }
+            if (length > best_length) {
+                best_offset = offset;
+                best_length = length;
+            }
+        }
+
+        if (best_length < DELTA_BLOCK_SIZE) {
+            // no match here, roll the window one byte forward
+            if (pos + DELTA_BLOCK_SIZE < target_length) {
+                hash = (hash - target[pos] * outgoing_weight) * ROLLING_BASE + target[pos + DELTA_BLOCK_SIZE];
+            }
+            pos++;
+            continue;
+        }
+
+        // grow the match backwards over bytes that would otherwise be inserted
+        while (best_offset > 0 && pos > insert_start && base[best_offset - 1] == target[pos - 1]) {
+            best_offset--;
+            pos--;
+            best_length++;
+        }
+
+        flush_insert(delta, target_contents, insert_start, pos);
+        emit_copy(delta, best_offset, best_length);
+        pos += best_length;
+        insert_start = pos;
+        if (max_size && delta.length() > max_size) {
+            return {};
+        }
+
+        if (pos + DELTA_BLOCK_SIZE <= target_length) {
+            hash = block_hash(target + pos);
+        }
+    }
+
+    flush_insert(delta, target_contents, insert_start, target_length);
+    if (max_size && delta.length() > max_size) {
+        return {};
+    }
+
+    return delta;
+}
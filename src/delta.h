@@ -0,0 +1,12 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <cstddef>
+#include <string>
+
+std::string apply_delta (const std::string& delta_contents, const std::string& base_contents);
+
+// build a git delta turning base_contents into target_contents, empty if it would exceed max_size
+std::string create_delta (const std::string& base_contents, const std::string& target_contents, size_t max_size = 0);
+
+#endif // DELTA_H
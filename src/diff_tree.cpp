@@ -0,0 +1,140 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <vector>
+#include "diff_tree.h"
+#include "object_store.h"
+
+#define NULL_OID "0000000000000000000000000000000000000000"
+
+std::string resolve_tree (const std::string& revision, const std::string& dir) {
+    std::string hash = resolve_revision(revision, dir);
+    std::string type, contents;
+    while (!hash.empty() && read_object(hash, type, contents, dir)) {
+        if (type == "tree") {
+            return hash;
+        }
+        // commits and annotated tags both start with the object they point at
+        if ((type == "commit" && contents.rfind("tree ", 0) == 0) ||
+            (type == "tag" && contents.rfind("object ", 0) == 0)) {
+            hash = contents.substr(contents.find(' ') + 1, 40);
+            continue;
+        }
+        break;
+    }
+
+    return {};
+}
+
+static bool is_tree (const TreeEntry& entry) {
+    return entry.mode == "40000";
+}
+
+// git's tree order: a tree sorts as if its name ended in '/'
+static int compare_entries (const TreeEntry& a, const TreeEntry& b) {
+    size_t length = std::min(a.name.length(), b.name.length());
+    int cmp = memcmp(a.name.data(), b.name.data(), length);
+    if (cmp != 0) {
+        return cmp;
+    }
+
+    unsigned char c1 = length < a.name.length() ? a.name[length] : (is_tree(a) ? '/' : '\0');
+    unsigned char c2 = length < b.name.length() ? b.name[length] : (is_tree(b) ? '/' : '\0');
+    return c1 < c2 ? -1 : (c1 > c2 ? 1 : 0);
+}
+
+static bool read_tree_entries (const std::string& hash, std::vector<TreeEntry>& entries, const std::string& dir) {
+    if (hash.empty()) {
+        return true; // the empty tree
+    }
+
+    std::string type, contents;
+    if (!read_object(hash, type, contents, dir) || type != "tree" || !parse_tree(contents, entries)) {
+        std::cerr << "Invalid tree object " << hash << ".\n";
+        return false;
+    }
+
+    return true;
+}
+
+static bool diff_tree_entries (const std::string& old_tree, const std::string& new_tree, const std::string& base,
+                               bool recursive, const std::function<void(const TreeChange&)>& show, const std::string& dir) {
+    std::vector<TreeEntry> old_entries, new_entries;
+    if (!read_tree_entries(old_tree, old_entries, dir) || !read_tree_entries(new_tree, new_entries, dir)) {
+        return false;
+    }
+
+    size_t i = 0, j = 0;
+    while (i < old_entries.size() || j < new_entries.size()) {
+        int cmp;
+        if (i == old_entries.size()) cmp = 1;
+        else if (j == new_entries.size()) cmp = -1;
+        else cmp = compare_entries(old_entries[i], new_entries[j]);
+
+        const TreeEntry* old_entry = cmp <= 0 ? &old_entries[i++] : nullptr;
+        const TreeEntry* new_entry = cmp >= 0 ? &new_entries[j++] : nullptr;
+        if (old_entry && new_entry && old_entry->hash == new_entry->hash && old_entry->mode == new_entry->mode) {
+            continue; // identical, the whole subtree is skipped unread
+        }
+
+        std::string path = base + (old_entry ? old_entry->name : new_entry->name);
+        bool old_is_tree = old_entry && is_tree(*old_entry);
+        bool new_is_tree = new_entry && is_tree(*new_entry);
+        if (recursive && (old_is_tree || new_is_tree)) {
+            if (!diff_tree_entries(old_entry ? old_entry->hash : "", new_entry ? new_entry->hash : "",
+                                   path + '/', recursive, show, dir)) {
+                return false;
+            }
+            continue;
+        }
+
+        TreeChange change;
+        change.status = !old_entry ? 'A' : (!new_entry ? 'D' : 'M');
+        change.path = path;
+        if (old_entry) {
+            change.old_mode = old_entry->mode;
+            change.old_hash = old_entry->hash;
+        }
+        if (new_entry) {
+            change.new_mode = new_entry->mode;
+            change.new_hash = new_entry->hash;
+        }
+        show(change);
+    }
+
+    return true;
+}
+
+bool diff_trees (const std::string& old_tree, const std::string& new_tree, bool recursive,
+                 const std::function<void(const TreeChange&)>& show, const std::string& dir) {
+    if (old_tree == new_tree) {
+        return true;
+    }
+
+    return diff_tree_entries(old_tree, new_tree, "", recursive, show, dir);
+}
+
+static std::string full_mode (const std::string& mode) {
+    return mode.empty() ? "000000" : std::string(6 - std::min<size_t>(mode.length(), 6), '0') + mode;
+}
+
+int diff_tree (const std::string& old_revision, const std::string& new_revision, bool recursive, const std::string& dir) {
+    std::string old_tree = resolve_tree(old_revision, dir);
+    std::string new_tree = resolve_tree(new_revision, dir);
+    if (old_tree.empty() || new_tree.empty()) {
+        std::cerr << "Not a tree-ish: " << (old_tree.empty() ? old_revision : new_revision) << '\n';
+        return EXIT_FAILURE;
+    }
+
+    // ":<old mode> <new mode> <old hash> <new hash> <status>\t<path>", as git diff-tree prints it
+    std::string output;
+    bool diffed = diff_trees(old_tree, new_tree, recursive, [&](const TreeChange& change) {
+        output += ':' + full_mode(change.old_mode) + ' ' + full_mode(change.new_mode) + ' ' +
+                  (change.old_hash.empty() ? NULL_OID : change.old_hash) + ' ' +
+                  (change.new_hash.empty() ? NULL_OID : change.new_hash) + ' ' +
+                  change.status + '\t' + change.path + '\n';
+    }, dir);
+    std::cout << output;
+
+    return diffed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
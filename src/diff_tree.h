@@ -0,0 +1,29 @@
+#ifndef DIFF_TREE_H
+#define DIFF_TREE_H
+
+#include <functional>
+#include <string>
+#include "object_store.h"
+
+// one changed path; modes and hashes of a missing side are empty
+struct TreeChange {
+    char status;          // 'A', 'D' or 'M'
+    std::string old_mode;
+    std::string new_mode;
+    std::string old_hash;
+    std::string new_hash;
+    std::string path;
+};
+
+// the tree behind a tree-ish: a tree, a commit or an annotated tag, by hash or ref name
+std::string resolve_tree (const std::string& revision, const std::string& dir = ".");
+
+// merge-walk two trees (an empty hash stands for the empty tree) and report every changed
+// entry in path order; with recursive, descend into changed subtrees and report only their files.
+// Entries with equal ids are skipped without reading them, so the cost follows the size of the change.
+bool diff_trees (const std::string& old_tree, const std::string& new_tree, bool recursive,
+                 const std::function<void(const TreeChange&)>& show, const std::string& dir = ".");
+
+int diff_tree (const std::string& old_revision, const std::string& new_revision, bool recursive, const std::string& dir = ".");
+
+#endif // DIFF_TREE_H
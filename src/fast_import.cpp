@@ -0,0 +1,870 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include "fast_import.h"
+#include "pack.h"
+#include "repack.h"
+#include "refs.h"
+#include "revision.h"
+#include "object_store.h"
+#include "delta.h"
+#include "zlib_implement.h"
+#include "trace.h"
+
+#define ZERO_OID "0000000000000000000000000000000000000000"
+#define EMPTY_TREE "4b825dc642cb6eb9a060e54bf8d69288fbee4904"
+#define MAX_DELTA_DEPTH 50
+
+namespace {
+
+// a file or directory of a branch tree; directories read their entries on first change
+struct ImportNode {
+    std::string mode;    // "40000" for directories
+    std::string oid;     // raw, empty while a directory has unsaved changes
+    bool loaded = false; // entries read into children
+    std::map<std::string, std::unique_ptr<ImportNode>> children;
+
+    // the version of this directory stored last, the delta base of the next one
+    std::string base_hash;
+    std::string base_contents;
+};
+
+} // namespace
+
+static std::unique_ptr<ImportNode> empty_directory () {
+    auto node = std::make_unique<ImportNode>();
+    node->mode = "40000";
+    node->loaded = true;
+    return node;
+}
+
+namespace {
+
+struct ImportBranch {
+    std::string commit; // hex, empty until the first commit or after a reset
+    std::unique_ptr<ImportNode> root = empty_directory();
+};
+
+// an object written by this import and where its data sits in the pack
+struct ImportedObject {
+    int type;
+    uint64_t offset;
+    uint32_t crc;
+    uint64_t data_offset;
+    uint64_t data_length;
+    std::string base; // hex id of the delta base, empty for a whole object
+    int depth = 0;
+};
+
+class FastImporter {
+public:
+    FastImporter (std::istream& input, const FastImportOptions& options, const std::string& dir);
+    ~FastImporter ();
+    FastImporter (const FastImporter&) = delete;
+    FastImporter& operator= (const FastImporter&) = delete;
+
+    int run ();
+
+private:
+    bool next_line ();
+    bool read_data (std::string& data);
+    bool read_mark (uint64_t& mark);
+    bool parse_blob ();
+    bool parse_commit (const std::string& ref);
+    bool parse_reset (const std::string& ref);
+    bool parse_file_change (ImportBranch& branch);
+    bool start_from (ImportBranch& branch, const std::string& commit);
+
+    std::string resolve (const std::string& commitish);
+    std::string store (int type, const std::string& contents, const std::string& base_hash = {}, const std::string& base_contents = {});
+    bool read (const std::string& hash, std::string& type, std::string& contents);
+    bool load (ImportNode& node);
+    bool modify (ImportNode& directory, const std::string& path, size_t start, std::unique_ptr<ImportNode>& leaf);
+    bool write_tree (ImportNode& node);
+
+    bool emit (const char* data, size_t length);
+    bool flush ();
+    bool finish_pack ();
+    bool update_refs ();
+    bool export_marks ();
+
+    std::istream& input;
+    const FastImportOptions& options;
+    std::string dir;
+
+    std::string line;
+    bool unread = false; // line belongs to the next command
+
+    std::map<uint64_t, std::string> marks;
+    std::map<std::string, ImportBranch> branches;
+
+    std::string pack_dir;
+    std::string temp_pack;
+    int fd = -1;
+    std::string buffered; // pack bytes not yet written to fd
+    PackWriter writer; // encodes entries only, the header count and checksum are fixed up at the end
+    std::unordered_map<std::string, ImportedObject> objects;
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> sha;
+    Deflater deflater;
+    std::string deflated;
+    uint64_t counts[OBJ_TAG + 1] = {};
+    uint64_t duplicates = 0;
+};
+
+} // namespace
+
+FastImporter::FastImporter (std::istream& input, const FastImportOptions& options, const std::string& dir)
+    : input(input), options(options), dir(dir),
+      writer([this](const char* data, size_t length) { return emit(data, length); }),
+      sha(EVP_MD_CTX_new(), EVP_MD_CTX_free) {}
+
+FastImporter::~FastImporter () {
+    if (fd >= 0) {
+        close(fd);
+        std::filesystem::remove(temp_pack);
+    }
+}
+
+// entries are a few hundred bytes each, gather them into large writes
+bool FastImporter::emit (const char* data, size_t length) {
+    buffered.append(data, length);
+    return buffered.length() < (1 << 20) || flush();
+}
+
+bool FastImporter::flush () {
+    const char* data = buffered.data();
+    size_t length = buffered.length();
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written <= 0) {
+            std::cerr << "fast-import: failed to write " << temp_pack << ".\n";
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    buffered.clear();
+
+    return true;
+}
+
+// the next line that is not a comment, or the one a command gave back
+bool FastImporter::next_line () {
+    if (unread) {
+        unread = false;
+        return true;
+    }
+    while (std::getline(input, line)) {
+        if (line.empty() || line[0] != '#') {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// "data <count>" followed by exactly that many bytes, or "data <<<delimiter>" followed by lines
+bool FastImporter::read_data (std::string& data) {
+    if (!next_line() || line.rfind("data ", 0) != 0) {
+        std::cerr << "fast-import: expected data command, got '" << line << "'.\n";
+        return false;
+    }
+
+    data.clear();
+    if (line.compare(5, 2, "<<") == 0) {
+        std::string delimiter = line.substr(7);
+        std::string text;
+        while (std::getline(input, text) && text != delimiter) {
+            data += text;
+            data += '\n';
+        }
+        if (text != delimiter) {
+            std::cerr << "fast-import: EOF in data (terminator '" << delimiter << "' not found).\n";
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t length;
+    try {
+        length = std::stoull(line.substr(5));
+    }
+    catch (const std::exception&) {
+        std::cerr << "fast-import: invalid data length '" << line.substr(5) << "'.\n";
+        return false;
+    }
+    data.resize(length);
+    if (!input.read(&data[0], length)) {
+        std::cerr << "fast-import: EOF in data (" << length << " bytes remaining).\n";
+        return false;
+    }
+    if (input.peek() == '\n') {
+        input.get(); // the optional newline after the data
+    }
+
+    return true;
+}
+
+// an optional "mark :<n>", zero when the command has none
+bool FastImporter::read_mark (uint64_t& mark) {
+    mark = 0;
+    if (!next_line()) {
+        return true;
+    }
+    if (line.rfind("mark :", 0) != 0) {
+        unread = true;
+        return true;
+    }
+
+    try {
+        mark = std::stoull(line.substr(6));
+    }
+    catch (const std::exception&) {}
+    if (mark == 0) {
+        std::cerr << "fast-import: invalid mark '" << line << "'.\n";
+        return false;
+    }
+
+    return true;
+}
+
+std::string FastImporter::resolve (const std::string& commitish) {
+    std::string name = commitish;
+    if (name.length() > 2 && name.compare(name.length() - 2, 2, "^0") == 0) {
+        name.resize(name.length() - 2);
+    }
+
+    if (name.rfind(':', 0) == 0) {
+        uint64_t mark = 0;
+        try {
+            mark = std::stoull(name.substr(1));
+        }
+        catch (const std::exception&) {}
+        auto found = marks.find(mark);
+        return found != marks.end() ? found->second : std::string();
+    }
+    if (name.length() == 40 && name.find_first_not_of("0123456789abcdef") == std::string::npos) {
+        return name;
+    }
+    auto branch = branches.find(name);
+    if (branch != branches.end() && !branch->second.commit.empty()) {
+        return branch->second.commit;
+    }
+
+    return resolve_revision(name, dir);
+}
+
+// append an object to the pack unless this import or the repository already has it. Given the
+// previous version of the object, it is stored as a delta against that when this pack has it:
+// a commit usually changes one entry of each tree on its path, and deflating a delta of a few
+// bytes is far cheaper than deflating the whole tree again.
+std::string FastImporter::store (int type, const std::string& contents, const std::string& base_hash, const std::string& base_contents) {
+    std::string header = std::string(object_type_name(type)) + ' ' + std::to_string(contents.length());
+    header.push_back('\0');
+
+    unsigned char digest[20];
+    EVP_DigestInit_ex(sha.get(), EVP_sha1(), nullptr);
+    EVP_DigestUpdate(sha.get(), header.data(), header.length());
+    EVP_DigestUpdate(sha.get(), contents.data(), contents.length());
+    EVP_DigestFinal_ex(sha.get(), digest, nullptr);
+    std::string hash = digest_to_hash(std::string(reinterpret_cast<char*>(digest), 20));
+
+    if (objects.count(hash) || has_object(hash, dir)) {
+        duplicates++;
+        return hash;
+    }
+
+    ImportedObject object;
+    object.type = type;
+    auto base = base_hash.empty() ? objects.end() : objects.find(base_hash);
+    std::string delta;
+    if (base != objects.end() && base->second.depth < MAX_DELTA_DEPTH) {
+        delta = create_delta(base_contents, contents, contents.length() / 2);
+    }
+
+    bool written;
+    if (!delta.empty()) {
+        deflater.compress(delta.data(), delta.length(), deflated);
+        written = writer.add_ofs_delta(base->second.offset, delta.length(), deflated.data(), deflated.length(), &object.offset, &object.crc);
+        object.base = base_hash;
+        object.depth = base->second.depth + 1;
+    }
+    else {
+        deflater.compress(contents.data(), contents.length(), deflated);
+        written = writer.add_object(type, contents.length(), deflated.data(), deflated.length(), &object.offset, &object.crc);
+    }
+    if (!written) {
+        return {};
+    }
+    object.data_offset = writer.position - deflated.length();
+    object.data_length = deflated.length();
+    objects.emplace(hash, std::move(object));
+    counts[type]++;
+
+    return hash;
+}
+
+// objects of this import are read back out of the unfinished pack
+bool FastImporter::read (const std::string& hash, std::string& type, std::string& contents) {
+    auto found = objects.find(hash);
+    if (found == objects.end()) {
+        return read_object(hash, type, contents, dir);
+    }
+
+    const ImportedObject& object = found->second;
+    std::string data(object.data_length, '\0');
+    if (!flush() || pread(fd, &data[0], object.data_length, object.data_offset) != ssize_t(object.data_length)) {
+        return false;
+    }
+    try {
+        contents = decompress_string(data);
+        if (!object.base.empty()) {
+            std::string base;
+            if (!read(object.base, type, base)) {
+                return false;
+            }
+            contents = apply_delta(contents, base);
+        }
+    }
+    catch (const std::runtime_error&) {
+        return false;
+    }
+    type = object_type_name(object.type);
+
+    return true;
+}
+
+bool FastImporter::load (ImportNode& node) {
+    if (node.loaded) {
+        return true;
+    }
+
+    std::string type, contents;
+    std::vector<TreeEntry> entries;
+    if (!read(digest_to_hash(node.oid), type, contents) || type != "tree" || !parse_tree(contents, entries)) {
+        std::cerr << "fast-import: cannot read tree " << digest_to_hash(node.oid) << ".\n";
+        return false;
+    }
+    for (const auto& entry : entries) {
+        auto child = std::make_unique<ImportNode>();
+        child->mode = entry.mode;
+        child->oid = hash_digest(entry.hash);
+        child->loaded = entry.mode != "40000";
+        node.children.emplace(entry.name, std::move(child));
+    }
+    node.loaded = true;
+
+    return true;
+}
+
+// put leaf at path below directory, or delete what is there when leaf is null; directories
+// left empty are dropped, as git has no way to store them
+bool FastImporter::modify (ImportNode& directory, const std::string& path, size_t start, std::unique_ptr<ImportNode>& leaf) {
+    if (!load(directory)) {
+        return false;
+    }
+
+    size_t slash = path.find('/', start);
+    std::string name = path.substr(start, slash == std::string::npos ? std::string::npos : slash - start);
+    auto found = directory.children.find(name);
+    if (slash == std::string::npos) {
+        if (leaf) {
+            directory.children[name] = std::move(leaf);
+        }
+        else if (found != directory.children.end()) {
+            directory.children.erase(found);
+        }
+        else {
+            return true;
+        }
+        directory.oid.clear();
+        return true;
+    }
+
+    if (found == directory.children.end() || found->second->mode != "40000") {
+        if (!leaf) {
+            return true;
+        }
+        found = directory.children.insert_or_assign(name, empty_directory()).first;
+    }
+    if (!modify(*found->second, path, slash + 1, leaf)) {
+        return false;
+    }
+    if (found->second->loaded && found->second->children.empty()) {
+        directory.children.erase(found);
+    }
+    directory.oid.clear();
+
+    return true;
+}
+
+// store the directories changed since the last commit, bottom up
+bool FastImporter::write_tree (ImportNode& node) {
+    if (!node.oid.empty()) {
+        return true;
+    }
+
+    // git orders directories as if their names ended in '/'
+    std::vector<std::pair<std::string, ImportNode*>> sorted;
+    for (auto& [name, child] : node.children) {
+        sorted.emplace_back(child->mode == "40000" ? name + '/' : name, child.get());
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::string contents;
+    for (auto& [key, child] : sorted) {
+        bool is_directory = child->mode == "40000";
+        if (is_directory && !write_tree(*child)) {
+            return false;
+        }
+        contents += child->mode;
+        contents += ' ';
+        contents.append(key, 0, key.length() - is_directory);
+        contents += '\0';
+        contents += child->oid;
+    }
+    std::string hash = store(OBJ_TREE, contents, node.base_hash, node.base_contents);
+    if (hash.empty()) {
+        return false;
+    }
+    node.oid = hash_digest(hash);
+    node.base_hash = hash;
+    node.base_contents = std::move(contents);
+
+    return true;
+}
+
+// restart a branch from a commit, its tree read lazily as paths change
+bool FastImporter::start_from (ImportBranch& branch, const std::string& commit) {
+    if (commit == branch.commit) {
+        return true;
+    }
+
+    branch.root = empty_directory();
+    branch.commit = commit == ZERO_OID ? std::string() : commit;
+    if (branch.commit.empty()) {
+        return true;
+    }
+
+    std::string type, contents;
+    CommitObject parsed;
+    if (!read(commit, type, contents) || type != "commit" || !::parse_commit(contents, parsed)) {
+        std::cerr << "fast-import: not a commit: " << commit << ".\n";
+        return false;
+    }
+    branch.root->oid = hash_digest(parsed.tree);
+    branch.root->loaded = false;
+
+    return true;
+}
+
+static std::string unquote_path (const std::string& path) {
+    if (path.empty() || path[0] != '"') {
+        return path;
+    }
+
+    std::string result;
+    for (size_t i = 1; i < path.length() && path[i] != '"'; i++) {
+        if (path[i] != '\\' || i + 1 == path.length()) {
+            result.push_back(path[i]);
+            continue;
+        }
+        char escaped = path[++i];
+        if (escaped >= '0' && escaped <= '7' && i + 2 < path.length()) {
+            result.push_back(char(std::stoi(path.substr(i, 3), nullptr, 8)));
+            i += 2;
+        }
+        else {
+            result.push_back(escaped == 'n' ? '\n' : escaped == 't' ? '\t' : escaped);
+        }
+    }
+
+    return result;
+}
+
+static bool valid_path (const std::string& path) {
+    return !path.empty() && path.front() != '/' && path.back() != '/' && path.find("//") == std::string::npos;
+}
+
+// "M <mode> <dataref> <path>", "D <path>" or "deleteall"
+bool FastImporter::parse_file_change (ImportBranch& branch) {
+    if (line == "deleteall") {
+        branch.root = empty_directory();
+        return true;
+    }
+
+    if (line.rfind("D ", 0) == 0) {
+        std::string path = unquote_path(line.substr(2));
+        std::unique_ptr<ImportNode> none;
+        return valid_path(path) ? modify(*branch.root, path, 0, none) : true;
+    }
+
+    size_t mode_end = line.find(' ', 2);
+    size_t ref_end = mode_end == std::string::npos ? mode_end : line.find(' ', mode_end + 1);
+    if (ref_end == std::string::npos) {
+        std::cerr << "fast-import: invalid file change '" << line << "'.\n";
+        return false;
+    }
+    std::string mode = line.substr(2, mode_end - 2);
+    std::string dataref = line.substr(mode_end + 1, ref_end - mode_end - 1);
+    std::string path = unquote_path(line.substr(ref_end + 1));
+
+    if (mode == "644") mode = "100644";
+    else if (mode == "755") mode = "100755";
+    else if (mode == "040000") mode = "40000";
+    if (mode != "100644" && mode != "100755" && mode != "120000" && mode != "160000" && mode != "40000") {
+        std::cerr << "fast-import: invalid mode " << mode << " for " << path << ".\n";
+        return false;
+    }
+    if (!valid_path(path)) {
+        std::cerr << "fast-import: invalid path '" << path << "'.\n";
+        return false;
+    }
+
+    std::string hash;
+    if (dataref == "inline") {
+        std::string data;
+        if (!read_data(data) || (hash = store(OBJ_BLOB, data)).empty()) {
+            return false;
+        }
+    }
+    else if (dataref.rfind(':', 0) == 0 || mode == "160000") {
+        hash = resolve(dataref);
+    }
+    else if (dataref.length() == 40 && dataref.find_first_not_of("0123456789abcdef") == std::string::npos) {
+        hash = dataref;
+    }
+    if (hash.empty()) {
+        std::cerr << "fast-import: unknown data reference " << dataref << ".\n";
+        return false;
+    }
+
+    // an empty directory removes the path, like it does in git
+    std::unique_ptr<ImportNode> leaf;
+    if (mode != "40000" || hash != EMPTY_TREE) {
+        leaf = std::make_unique<ImportNode>();
+        leaf->mode = mode;
+        leaf->oid = hash_digest(hash);
+        leaf->loaded = mode != "40000";
+    }
+
+    return modify(*branch.root, path, 0, leaf);
+}
+
+bool FastImporter::parse_blob () {
+    uint64_t mark;
+    std::string data;
+    if (!read_mark(mark)) {
+        return false;
+    }
+    if (next_line() && line.rfind("original-oid ", 0) != 0) {
+        unread = true;
+    }
+    if (!read_data(data)) {
+        return false;
+    }
+
+    std::string hash = store(OBJ_BLOB, data);
+    if (hash.empty()) {
+        return false;
+    }
+    if (mark) {
+        marks[mark] = hash;
+    }
+
+    return true;
+}
+
+bool FastImporter::parse_commit (const std::string& ref) {
+    ImportBranch& branch = branches[ref];
+
+    uint64_t mark;
+    std::string author, committer, encoding, message;
+    if (!read_mark(mark)) {
+        return false;
+    }
+    while (next_line()) {
+        if (line.rfind("original-oid ", 0) == 0) continue;
+        else if (line.rfind("author ", 0) == 0) author = line.substr(7);
+        else if (line.rfind("committer ", 0) == 0) committer = line.substr(10);
+        else if (line.rfind("encoding ", 0) == 0) encoding = line.substr(9);
+        else {
+            unread = true;
+            break;
+        }
+    }
+    if (committer.empty()) {
+        std::cerr << "fast-import: missing committer in commit " << ref << ".\n";
+        return false;
+    }
+    if (!read_data(message)) {
+        return false;
+    }
+
+    // without "from" a commit continues its branch
+    std::vector<std::string> parents;
+    if (next_line()) {
+        if (line.rfind("from ", 0) != 0) {
+            unread = true;
+        }
+        else if (std::string from = resolve(line.substr(5)); from.empty() || !start_from(branch, from)) {
+            std::cerr << "fast-import: cannot find " << line.substr(5) << ".\n";
+            return false;
+        }
+    }
+    if (!branch.commit.empty()) {
+        parents.push_back(branch.commit);
+    }
+    while (next_line()) {
+        if (line.rfind("merge ", 0) != 0) {
+            unread = true;
+            break;
+        }
+        std::string merge = resolve(line.substr(6));
+        if (merge.empty()) {
+            std::cerr << "fast-import: cannot find " << line.substr(6) << ".\n";
+            return false;
+        }
+        parents.push_back(merge);
+    }
+
+    // file changes run up to a blank line or the next command
+    while (next_line()) {
+        if (line.empty()) {
+            break;
+        }
+        if (line.rfind("M ", 0) != 0 && line.rfind("D ", 0) != 0 && line != "deleteall") {
+            unread = true;
+            break;
+        }
+        if (!parse_file_change(branch)) {
+            return false;
+        }
+    }
+
+    if (!write_tree(*branch.root)) {
+        return false;
+    }
+    std::string contents = "tree " + digest_to_hash(branch.root->oid) + '\n';
+    for (const auto& parent : parents) {
+        contents += "parent " + parent + '\n';
+    }
+    contents += "author " + (author.empty() ? committer : author) + '\n';
+    contents += "committer " + committer + '\n';
+    if (!encoding.empty()) {
+        contents += "encoding " + encoding + '\n';
+    }
+    contents += '\n' + message;
+
+    branch.commit = store(OBJ_COMMIT, contents);
+    if (branch.commit.empty()) {
+        return false;
+    }
+    if (mark) {
+        marks[mark] = branch.commit;
+    }
+
+    return true;
+}
+
+// "reset <ref>" with an optional "from": the branch starts over, empty or at that commit
+bool FastImporter::parse_reset (const std::string& ref) {
+    ImportBranch& branch = branches[ref];
+    branch.commit.clear();
+    branch.root = empty_directory();
+
+    if (!next_line()) {
+        return true;
+    }
+    if (line.rfind("from ", 0) != 0) {
+        unread = !line.empty();
+        return true;
+    }
+    std::string from = resolve(line.substr(5));
+    if (from.empty() || !start_from(branch, from)) {
+        std::cerr << "fast-import: cannot find " << line.substr(5) << ".\n";
+        return false;
+    }
+
+    return true;
+}
+
+// fix up the object count, checksum the pack, then index and install it
+bool FastImporter::finish_pack () {
+    unsigned char count[4] = {
+        static_cast<unsigned char>(objects.size() >> 24), static_cast<unsigned char>(objects.size() >> 16),
+        static_cast<unsigned char>(objects.size() >> 8), static_cast<unsigned char>(objects.size())
+    };
+    if (!flush() || pwrite(fd, count, 4, 8) != 4) {
+        return false;
+    }
+
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> context(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    EVP_DigestInit_ex(context.get(), EVP_sha1(), nullptr);
+    std::vector<char> buffer(1 << 20);
+    for (uint64_t offset = 0; offset < writer.position;) {
+        ssize_t length = pread(fd, buffer.data(), std::min<uint64_t>(buffer.size(), writer.position - offset), offset);
+        if (length <= 0) {
+            return false;
+        }
+        EVP_DigestUpdate(context.get(), buffer.data(), length);
+        offset += length;
+    }
+    unsigned char digest[20];
+    EVP_DigestFinal_ex(context.get(), digest, nullptr);
+    std::string checksum(reinterpret_cast<char*>(digest), 20);
+    buffered = checksum;
+    if (!flush() || fsync(fd) != 0) {
+        return false;
+    }
+
+    std::vector<PackInput> entries(objects.size());
+    std::vector<uint64_t> offsets;
+    std::vector<uint32_t> crcs;
+    size_t i = 0;
+    for (const auto& [hash, object] : objects) {
+        entries[i++].hash = hash;
+        offsets.push_back(object.offset);
+        crcs.push_back(object.crc);
+    }
+
+    std::string temp_index = pack_dir + "tmp_idx_" + std::to_string(getpid());
+    if (!write_pack_index(temp_index, entries, offsets, crcs, checksum)) {
+        std::filesystem::remove(temp_index);
+        return false;
+    }
+
+    // the index is renamed last, a pack only becomes visible once it has one
+    std::string name = "pack-" + digest_to_hash(checksum);
+    close(fd);
+    fd = -1;
+    std::filesystem::rename(temp_pack, pack_dir + name + ".pack");
+    std::filesystem::rename(temp_index, pack_dir + name + ".idx");
+    reload_packs(dir);
+
+    return true;
+}
+
+// move every branch the stream touched, refusing to lose commits unless forced
+bool FastImporter::update_refs () {
+    std::unique_ptr<CommitIndex> history;
+    RefTransaction transaction(dir);
+    bool refused = false;
+
+    for (const auto& [ref, branch] : branches) {
+        if (branch.commit.empty()) {
+            continue;
+        }
+        std::string old = resolve_revision(ref, dir);
+        if (old == branch.commit) {
+            continue;
+        }
+        if (!old.empty() && !options.force) {
+            if (!history) {
+                history = std::make_unique<CommitIndex>(dir);
+            }
+            uint32_t old_id, new_id;
+            if (!history->lookup(old, &old_id) || !history->lookup(branch.commit, &new_id) ||
+                !is_ancestor(*history, old_id, new_id)) {
+                std::cerr << "warning: Not updating " << ref << " (new tip " << branch.commit
+                          << " does not contain " << old << ")\n";
+                refused = true;
+                continue;
+            }
+        }
+        transaction.update(ref, branch.commit, old.empty() ? ZERO_OID : old);
+    }
+
+    return transaction.commit() && !refused;
+}
+
+bool FastImporter::export_marks () {
+    std::ofstream output(options.export_marks, std::ios::trunc);
+    for (const auto& [mark, hash] : marks) {
+        output << ':' << mark << ' ' << hash << '\n';
+    }
+
+    return output.good();
+}
+
+int FastImporter::run () {
+    pack_dir = dir + "/.git/objects/pack/";
+    std::filesystem::create_directories(pack_dir);
+    temp_pack = pack_dir + "tmp_pack_" + std::to_string(getpid());
+    fd = open(temp_pack.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0444);
+    if (fd < 0) {
+        std::cerr << "fast-import: failed to create " << temp_pack << ".\n";
+        return EXIT_FAILURE;
+    }
+    if (!writer.begin(0)) {
+        return EXIT_FAILURE;
+    }
+
+    TraceRegion region("fast-import", "parse");
+    while (next_line()) {
+        bool parsed = true;
+        if (line.empty() || line == "checkpoint" || line.rfind("feature ", 0) == 0 || line.rfind("option ", 0) == 0) {
+            continue; // everything is installed at the end anyway
+        }
+        else if (line == "done") {
+            break;
+        }
+        else if (line == "blob") {
+            parsed = parse_blob();
+        }
+        else if (line.rfind("commit ", 0) == 0 || line.rfind("reset ", 0) == 0) {
+            bool commit = line[0] == 'c';
+            std::string ref = line.substr(commit ? 7 : 6);
+            if (!check_ref_format(ref)) {
+                std::cerr << "fast-import: invalid ref name " << ref << ".\n";
+                return EXIT_FAILURE;
+            }
+            parsed = commit ? parse_commit(ref) : parse_reset(ref);
+        }
+        else if (line.rfind("progress ", 0) == 0) {
+            std::cout << line << std::endl;
+        }
+        else {
+            std::cerr << "fast-import: unsupported command: " << line << '\n';
+            return EXIT_FAILURE;
+        }
+        if (!parsed) {
+            return EXIT_FAILURE;
+        }
+    }
+    region.leave();
+
+    TraceRegion install("fast-import", "install");
+    if (!objects.empty() && !finish_pack()) {
+        std::cerr << "fast-import: failed to write pack.\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cerr << "fast-import: " << objects.size() << " objects written (" << counts[OBJ_BLOB] << " blobs, "
+              << counts[OBJ_TREE] << " trees, " << counts[OBJ_COMMIT] << " commits), " << duplicates << " duplicates\n";
+    trace_data("fast-import", "objects", objects.size());
+    trace_data("fast-import", "duplicates", duplicates);
+
+    int status = update_refs() ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (!options.export_marks.empty() && !export_marks()) {
+        std::cerr << "fast-import: failed to write " << options.export_marks << ".\n";
+        status = EXIT_FAILURE;
+    }
+
+    return status;
+}
+
+int fast_import (std::istream& input, const FastImportOptions& options, const std::string& dir) {
+    FastImporter importer(input, options, dir);
+    return importer.run();
+}
@@ -0,0 +1,19 @@
+#ifndef FAST_IMPORT_H
+#define FAST_IMPORT_H
+
+#include <istream>
+#include <string>
+
+struct FastImportOptions {
+    bool force = false;        // let a branch move to a commit that does not contain its old tip
+    std::string export_marks;  // write ":<mark> <id>" lines here when done
+};
+
+// read a git fast-import stream of blob, commit, reset, progress and done commands. Branch
+// trees are kept in memory and only the changed subtrees are rehashed per commit; every new
+// object goes straight into one pack, trees as deltas against their previous version, and
+// objects the repository or the stream already has are skipped. The pack is indexed and
+// installed at the end, before the refs are updated.
+int fast_import (std::istream& input, const FastImportOptions& options, const std::string& dir = ".");
+
+#endif // FAST_IMPORT_H
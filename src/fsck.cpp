@@ -0,0 +1,552 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <openssl/sha.h>
+#include <openssl/evp.h>
+#include "fsck.h"
+#include "pack.h"
+#include "delta.h"
+#include "index.h"
+#include "object_store.h"
+#include "zlib_implement.h"
+#include "trace.h"
+
+namespace {
+
+// a verified object and the objects it names, ids raw
+struct CheckedObject {
+    std::string oid;
+    int type = 0;
+    std::vector<std::pair<int, std::string>> links; // expected type, id
+};
+
+// the delta trees of one pack: every entry hangs below the entry it is a delta against
+struct PackPlan {
+    std::shared_ptr<PackFile> pack;
+    std::vector<std::vector<uint32_t>> children; // by index position
+    std::vector<char> resolved;                  // each written only by the thread owning its tree
+};
+
+// one unit of work: a loose object, a delta tree of a pack, or the checksums of a pack
+struct FsckJob {
+    enum Kind { LOOSE, PACK_ROOT, PACK_CHECKSUM } kind;
+    std::string path;        // loose file
+    std::string hash;        // its name
+    PackPlan* plan = nullptr;
+    uint32_t position = 0;   // index position of the root
+};
+
+// what one worker found, merged once every worker is done
+struct FsckResult {
+    std::vector<CheckedObject> objects;
+    std::vector<std::string> problems;
+};
+
+} // namespace
+
+static bool is_hex (const std::string& value) {
+    return value.length() == 40 && value.find_first_not_of("0123456789abcdef") == std::string::npos;
+}
+
+static std::string type_name (int type) {
+    const char* name = object_type_name(type);
+    return name ? name : "object";
+}
+
+// "Name <email> 1700000000 +0000"
+static bool valid_ident (const std::string& ident) {
+    size_t lt = ident.find('<');
+    size_t gt = lt == std::string::npos ? std::string::npos : ident.find('>', lt);
+    if (gt == std::string::npos || gt + 2 >= ident.length() || ident[gt + 1] != ' ') {
+        return false;
+    }
+
+    size_t space = ident.find(' ', gt + 2);
+    std::string timestamp = ident.substr(gt + 2, space == std::string::npos ? std::string::npos : space - gt - 2);
+    std::string zone = space == std::string::npos ? "" : ident.substr(space + 1);
+    return !timestamp.empty() && timestamp.find_first_not_of("0123456789") == std::string::npos &&
+           zone.length() == 5 && (zone[0] == '+' || zone[0] == '-') &&
+           zone.find_first_not_of("0123456789", 1) == std::string::npos;
+}
+
+// read "<key> <value>\n" at pos
+static bool header_line (const std::string& contents, size_t& pos, const char* key, std::string& value) {
+    size_t key_length = strlen(key);
+    if (contents.compare(pos, key_length, key) != 0 || pos + key_length >= contents.length() ||
+        contents[pos + key_length] != ' ') {
+        return false;
+    }
+    size_t end = contents.find('\n', pos);
+    if (end == std::string::npos) {
+        return false;
+    }
+
+    value = contents.substr(pos + key_length + 1, end - pos - key_length - 1);
+    pos = end + 1;
+    return true;
+}
+
+static std::string check_commit (const std::string& contents, CheckedObject& object) {
+    size_t pos = 0;
+    std::string value;
+    if (!header_line(contents, pos, "tree", value) || !is_hex(value)) {
+        return "missingTree: invalid format - expected 'tree' line";
+    }
+    object.links.emplace_back(OBJ_TREE, hash_digest(value));
+    while (contents.compare(pos, 7, "parent ") == 0) {
+        if (!header_line(contents, pos, "parent", value) || !is_hex(value)) {
+            return "badParentSha1: invalid 'parent' line format - bad sha1";
+        }
+        object.links.emplace_back(OBJ_COMMIT, hash_digest(value));
+    }
+    if (!header_line(contents, pos, "author", value) || !valid_ident(value)) {
+        return "missingAuthor: invalid format - expected 'author' line";
+    }
+    if (!header_line(contents, pos, "committer", value) || !valid_ident(value)) {
+        return "missingCommitter: invalid format - expected 'committer' line";
+    }
+
+    return "";
+}
+
+static std::string check_tag (const std::string& contents, CheckedObject& object) {
+    size_t pos = 0;
+    std::string target, type, name;
+    if (!header_line(contents, pos, "object", target) || !is_hex(target)) {
+        return "missingObject: invalid format - expected 'object' line";
+    }
+    if (!header_line(contents, pos, "type", type) || object_type_code(type) == 0) {
+        return "missingTypeEntry: invalid format - unexpected type line";
+    }
+    if (!header_line(contents, pos, "tag", name) || name.empty()) {
+        return "missingTagEntry: invalid format - expected 'tag' line";
+    }
+    object.links.emplace_back(object_type_code(type), hash_digest(target));
+
+    return "";
+}
+
+// git's tree order: a directory sorts as if its name ended in '/'
+static bool tree_order_less (const TreeEntry& a, const TreeEntry& b) {
+    size_t length = std::min(a.name.length(), b.name.length());
+    int cmp = memcmp(a.name.data(), b.name.data(), length);
+    if (cmp != 0) {
+        return cmp < 0;
+    }
+
+    unsigned char c1 = length < a.name.length() ? a.name[length] : (a.mode == "40000" ? '/' : '\0');
+    unsigned char c2 = length < b.name.length() ? b.name[length] : (b.mode == "40000" ? '/' : '\0');
+    return c1 < c2;
+}
+
+static std::string check_tree (const std::string& contents, CheckedObject& object) {
+    std::vector<TreeEntry> entries;
+    if (!parse_tree(contents, entries)) {
+        return "badTree: cannot be parsed as a tree";
+    }
+
+    std::string problem;
+    for (size_t i = 0; i < entries.size(); i++) {
+        const TreeEntry& entry = entries[i];
+        if (problem.empty()) {
+            if (entry.name.empty()) problem = "emptyName: contains empty pathname";
+            else if (entry.name.find('/') != std::string::npos) problem = "fullPathname: contains full pathnames";
+            else if (entry.name == ".") problem = "hasDot: contains '.'";
+            else if (entry.name == "..") problem = "hasDotdot: contains '..'";
+            else if (entry.name == ".git") problem = "hasDotgit: contains '.git'";
+            else if (entry.mode != "100644" && entry.mode != "100755" && entry.mode != "120000" &&
+                     entry.mode != "40000" && entry.mode != "160000") problem = "badFilemode: contains bad file modes";
+            else if (i > 0 && entries[i - 1].name == entry.name) problem = "duplicateEntries: contains duplicate file entries";
+            else if (i > 0 && !tree_order_less(entries[i - 1], entry)) problem = "treeNotSorted: not properly sorted";
+        }
+
+        // submodule commits live in another repository
+        if (entry.mode == "40000") object.links.emplace_back(OBJ_TREE, hash_digest(entry.hash));
+        else if (entry.mode != "160000") object.links.emplace_back(OBJ_BLOB, hash_digest(entry.hash));
+    }
+
+    return problem;
+}
+
+static bool hash_matches (const std::string& oid, const std::string& type, const std::string& contents) {
+    std::string header = type + ' ' + std::to_string(contents.length()) + '\0';
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> context(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    EVP_DigestInit_ex(context.get(), EVP_sha1(), nullptr);
+    EVP_DigestUpdate(context.get(), header.data(), header.length());
+    EVP_DigestUpdate(context.get(), contents.data(), contents.length());
+    EVP_DigestFinal_ex(context.get(), digest, &length);
+
+    return length == 20 && memcmp(digest, oid.data(), 20) == 0;
+}
+
+// the syntax of an object whose hash is already verified, recording its links
+static void check_object (const std::string& oid, const std::string& type, const std::string& contents, FsckResult& result) {
+    CheckedObject object;
+    object.oid = oid;
+    object.type = object_type_code(type);
+
+    std::string problem;
+    if (type == "commit") problem = check_commit(contents, object);
+    else if (type == "tree") problem = check_tree(contents, object);
+    else if (type == "tag") problem = check_tag(contents, object);
+    else if (type != "blob") problem = "badType: unknown object type";
+    if (!problem.empty()) {
+        result.problems.push_back("error in " + type + ' ' + digest_to_hash(oid) + ": " + problem);
+    }
+
+    result.objects.push_back(std::move(object));
+}
+
+static void check_loose (const FsckJob& job, FsckResult& result) {
+    std::ifstream file(job.path, std::ios::binary);
+    std::string compressed((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::string object;
+    try {
+        object = decompress_string(compressed);
+    }
+    catch (const std::runtime_error& e) {
+        result.problems.push_back("error: " + job.path + ": object corrupt or missing: " + e.what());
+        return;
+    }
+
+    // "<type> <size>\0<contents>"
+    size_t space = object.find(' ');
+    size_t null_pos = object.find('\0');
+    if (space == std::string::npos || null_pos == std::string::npos || space > null_pos) {
+        result.problems.push_back("error: " + job.path + ": object has a bad header");
+        return;
+    }
+    std::string type = object.substr(0, space);
+    std::string size = object.substr(space + 1, null_pos - space - 1);
+    std::string contents = object.substr(null_pos + 1);
+    if (size != std::to_string(contents.length())) {
+        result.problems.push_back("error: " + job.hash + ": object length does not match its header");
+        return;
+    }
+
+    std::string oid = hash_digest(job.hash);
+    if (!hash_matches(oid, type, contents)) {
+        result.problems.push_back("error: hash mismatch for " + job.path + " (expected " + job.hash + ")");
+        return;
+    }
+    check_object(oid, type, contents, result);
+}
+
+static void check_packed (const PackPlan& plan, uint32_t position, const std::string& type, const std::string& contents, FsckResult& result) {
+    std::string oid(reinterpret_cast<const char*>(pack_index_oid(*plan.pack, position)), 20);
+    if (!hash_matches(oid, type, contents)) {
+        result.problems.push_back("error: sha1 mismatch for packed object " + digest_to_hash(oid) + " in " + plan.pack->pack_path);
+        return;
+    }
+    check_object(oid, type, contents, result);
+}
+
+// apply every delta against the object at position, depth first, so each entry is inflated once
+static void check_delta_children (PackPlan& plan, uint32_t position, const std::string& type, const std::string& base, FsckResult& result) {
+    const PackFile& pack = *plan.pack;
+    PackEntry entry;
+    std::string delta, contents;
+    for (uint32_t child : plan.children[position]) {
+        plan.resolved[child] = 1;
+        std::string hash = digest_to_hash(std::string(reinterpret_cast<const char*>(pack_index_oid(pack, child)), 20));
+        if (!read_pack_entry(pack, pack_index_offset(pack, child), entry) ||
+            !inflate_pack_data(pack, entry.data_offset, entry.size, delta)) {
+            result.problems.push_back("error: cannot inflate delta of " + hash + " in " + pack.pack_path);
+            continue;
+        }
+        try {
+            contents = apply_delta(delta, base);
+        }
+        catch (const std::runtime_error& e) {
+            result.problems.push_back("error: cannot apply delta of " + hash + " in " + pack.pack_path + ": " + e.what());
+            continue;
+        }
+
+        check_packed(plan, child, type, contents, result);
+        check_delta_children(plan, child, type, contents, result);
+    }
+}
+
+static void check_pack_root (const FsckJob& job, FsckResult& result, const std::string& dir) {
+    PackPlan& plan = *job.plan;
+    plan.resolved[job.position] = 1;
+
+    // a whole object, or a delta against an object outside this pack
+    std::string type, contents;
+    if (!read_pack_object(*plan.pack, pack_index_offset(*plan.pack, job.position), type, contents, dir)) {
+        std::string hash = digest_to_hash(std::string(reinterpret_cast<const char*>(pack_index_oid(*plan.pack, job.position)), 20));
+        result.problems.push_back("error: cannot read packed object " + hash + " in " + plan.pack->pack_path);
+        return;
+    }
+
+    check_packed(plan, job.position, type, contents, result);
+    check_delta_children(plan, job.position, type, contents, result);
+}
+
+static void check_pack_checksums (const FsckJob& job, FsckResult& result) {
+    const PackFile& pack = *job.plan->pack;
+    unsigned char digest[20];
+    SHA1(pack.pack_data, pack.pack_size - 20, digest);
+    if (memcmp(digest, pack.pack_data + pack.pack_size - 20, 20) != 0) {
+        result.problems.push_back("error: " + pack.pack_path + ": pack checksum mismatch");
+    }
+
+    SHA1(pack.index_data, pack.index_size - 20, digest);
+    if (memcmp(digest, pack.index_data + pack.index_size - 20, 20) != 0) {
+        result.problems.push_back("error: " + pack.pack_path + ": index checksum mismatch");
+    }
+    if (memcmp(pack.index_data + pack.index_size - 40, pack.pack_data + pack.pack_size - 20, 20) != 0) {
+        result.problems.push_back("error: " + pack.pack_path + ": index does not belong to the pack");
+    }
+}
+
+// hang every delta below its base, queueing the entries that can be read on their own
+static void plan_pack (PackPlan& plan, std::vector<FsckJob>& jobs, std::vector<std::string>& problems) {
+    const PackFile& pack = *plan.pack;
+    std::vector<std::pair<uint64_t, uint32_t>> by_offset;
+    by_offset.reserve(pack.num_objects);
+    for (uint32_t i = 0; i < pack.num_objects; i++) {
+        by_offset.emplace_back(pack_index_offset(pack, i), i);
+    }
+    std::sort(by_offset.begin(), by_offset.end());
+    auto position_at = [&](uint64_t offset, uint32_t* position) {
+        auto found = std::lower_bound(by_offset.begin(), by_offset.end(), std::make_pair(offset, uint32_t(0)));
+        if (found == by_offset.end() || found->first != offset) return false;
+        *position = found->second;
+        return true;
+    };
+
+    plan.children.assign(pack.num_objects, {});
+    plan.resolved.assign(pack.num_objects, 0);
+    jobs.push_back({FsckJob::PACK_CHECKSUM, "", "", &plan, 0});
+    for (uint32_t i = 0; i < pack.num_objects; i++) {
+        uint64_t offset = pack_index_offset(pack, i);
+        PackEntry entry;
+        if (!read_pack_entry(pack, offset, entry)) {
+            problems.push_back("error: bad pack entry at offset " + std::to_string(offset) + " in " + pack.pack_path);
+            plan.resolved[i] = 1;
+            continue;
+        }
+
+        uint32_t base;
+        uint64_t base_offset;
+        if (entry.type == OBJ_OFS_DELTA && entry.base_offset > 0 && entry.base_offset <= offset &&
+            position_at(offset - entry.base_offset, &base)) {
+            plan.children[base].push_back(i);
+        }
+        else if (entry.type == OBJ_REF_DELTA &&
+                 pack_find(pack, reinterpret_cast<const unsigned char*>(entry.base_oid.data()), &base_offset) &&
+                 position_at(base_offset, &base)) {
+            plan.children[base].push_back(i);
+        }
+        else if (entry.type == OBJ_OFS_DELTA) {
+            problems.push_back("error: delta at offset " + std::to_string(offset) + " in " + pack.pack_path + " has no base");
+            plan.resolved[i] = 1;
+        }
+        else {
+            jobs.push_back({FsckJob::PACK_ROOT, "", "", &plan, i});
+        }
+    }
+}
+
+static void list_loose_objects (const std::string& dir, std::vector<FsckJob>& jobs) {
+    std::string objects_dir = dir + "/.git/objects";
+    if (!std::filesystem::is_directory(objects_dir)) {
+        return;
+    }
+
+    for (const auto& fanout : std::filesystem::directory_iterator(objects_dir)) {
+        std::string prefix = fanout.path().filename().string();
+        if (prefix.length() != 2 || !fanout.is_directory() ||
+            prefix.find_first_not_of("0123456789abcdef") != std::string::npos) {
+            continue;
+        }
+        for (const auto& file : std::filesystem::directory_iterator(fanout.path())) {
+            std::string name = prefix + file.path().filename().string();
+            if (is_hex(name)) {
+                jobs.push_back({FsckJob::LOOSE, file.path().string(), name, nullptr, 0});
+            }
+        }
+    }
+}
+
+namespace {
+
+struct FsckNode {
+    int type;
+    bool reachable = false;
+    bool referenced = false;
+    std::vector<std::pair<int, std::string>> links;
+};
+
+} // namespace
+
+// walk the links from the refs, HEAD and the index, returns false if anything is missing
+static bool check_connectivity (std::unordered_map<std::string, FsckNode>& nodes, const FsckOptions& options,
+                                std::vector<std::string>& messages, const std::string& dir) {
+    std::vector<std::pair<std::string, std::string>> roots = list_refs(dir);
+    std::string head = resolve_revision("HEAD", dir);
+    if (!head.empty()) {
+        roots.emplace_back("HEAD", head);
+    }
+    Index index;
+    if (read_index(index, dir)) {
+        for (const auto& entry : index.entries) {
+            if (entry.mode != 0160000) roots.emplace_back("index", entry.hash);
+        }
+    }
+
+    bool ok = true;
+    std::vector<std::string> stack;
+    for (const auto& [name, hash] : roots) {
+        auto found = nodes.find(hash_digest(hash));
+        if (found == nodes.end()) {
+            messages.push_back("error: " + name + ": invalid sha1 pointer " + hash);
+            ok = false;
+        }
+        else if (!found->second.reachable) {
+            found->second.reachable = true;
+            stack.push_back(found->first);
+        }
+    }
+
+    std::unordered_set<std::string> missing;
+    while (!stack.empty()) {
+        std::string oid = std::move(stack.back());
+        stack.pop_back();
+        const FsckNode& node = nodes.at(oid);
+        for (const auto& [type, link] : node.links) {
+            auto found = nodes.find(link);
+            if (found == nodes.end()) {
+                messages.push_back("broken link from " + std::string(7 - std::min<size_t>(7, type_name(node.type).length()), ' ') +
+                                   type_name(node.type) + ' ' + digest_to_hash(oid) + "\n              to " +
+                                   std::string(7 - std::min<size_t>(7, type_name(type).length()), ' ') +
+                                   type_name(type) + ' ' + digest_to_hash(link));
+                if (missing.insert(link).second) {
+                    messages.push_back("missing " + type_name(type) + ' ' + digest_to_hash(link));
+                }
+                ok = false;
+                continue;
+            }
+            if (found->second.type != type) {
+                messages.push_back("error: object " + digest_to_hash(link) + " is a " + type_name(found->second.type) +
+                                   ", not a " + type_name(type));
+                ok = false;
+            }
+            if (!found->second.reachable) {
+                found->second.reachable = true;
+                stack.push_back(link);
+            }
+        }
+    }
+
+    if (options.dangling) {
+        for (auto& [oid, node] : nodes) {
+            for (const auto& link : node.links) {
+                auto found = nodes.find(link.second);
+                if (found != nodes.end()) found->second.referenced = true;
+            }
+        }
+        for (const auto& [oid, node] : nodes) {
+            if (!node.reachable && !node.referenced) {
+                messages.push_back("dangling " + type_name(node.type) + ' ' + digest_to_hash(oid));
+            }
+        }
+    }
+
+    return ok;
+}
+
+int fsck (const FsckOptions& options, const std::string& dir) {
+    if (!std::filesystem::is_directory(dir + "/.git/objects")) {
+        std::cerr << "Not a git repository.\n";
+        return EXIT_FAILURE;
+    }
+
+    // checksums first so the long sequential hashes overlap everything else
+    std::vector<FsckJob> jobs;
+    std::vector<std::string> problems;
+    std::vector<std::shared_ptr<PackFile>> packs = repository_packs(dir);
+    std::vector<PackPlan> plans(packs.size());
+    for (size_t i = 0; i < packs.size(); i++) {
+        plans[i].pack = packs[i];
+        plan_pack(plans[i], jobs, problems);
+    }
+    std::stable_partition(jobs.begin(), jobs.end(), [](const FsckJob& job) { return job.kind == FsckJob::PACK_CHECKSUM; });
+    list_loose_objects(dir, jobs);
+
+    unsigned threads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<size_t>(threads, std::max<size_t>(jobs.size(), 1));
+    std::vector<FsckResult> results(threads);
+    {
+        TraceRegion region("fsck", "verify");
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                for (size_t i = next++; i < jobs.size(); i = next++) {
+                    const FsckJob& job = jobs[i];
+                    if (job.kind == FsckJob::LOOSE) check_loose(job, results[t]);
+                    else if (job.kind == FsckJob::PACK_ROOT) check_pack_root(job, results[t], dir);
+                    else check_pack_checksums(job, results[t]);
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // deltas never reached from a readable base: cycles or chains through a broken entry
+    for (const auto& plan : plans) {
+        for (uint32_t i = 0; i < plan.pack->num_objects; i++) {
+            if (!plan.resolved[i]) {
+                std::string hash = digest_to_hash(std::string(reinterpret_cast<const char*>(pack_index_oid(*plan.pack, i)), 20));
+                problems.push_back("error: cannot resolve delta of " + hash + " in " + plan.pack->pack_path);
+            }
+        }
+    }
+
+    std::unordered_map<std::string, FsckNode> nodes;
+    size_t checked = 0;
+    for (auto& result : results) {
+        checked += result.objects.size();
+        for (auto& object : result.objects) {
+            FsckNode node;
+            node.type = object.type;
+            node.links = std::move(object.links);
+            nodes.emplace(std::move(object.oid), std::move(node)); // the same object loose and packed counts once
+        }
+        problems.insert(problems.end(), result.problems.begin(), result.problems.end());
+    }
+    std::sort(problems.begin(), problems.end());
+    trace_data("fsck", "objects", checked);
+    trace_data("fsck", "problems", problems.size());
+
+    std::vector<std::string> messages;
+    bool connected = true;
+    if (options.connectivity) {
+        TraceRegion region("fsck", "connectivity");
+        connected = check_connectivity(nodes, options, messages, dir);
+        std::sort(messages.begin(), messages.end());
+    }
+
+    std::string output;
+    for (const auto& line : problems) output += line + '\n';
+    for (const auto& line : messages) output += line + '\n';
+    std::cout << output;
+    std::cerr << "Checked " << checked << " objects in " << packs.size() << " packs with " << threads << " threads.\n";
+
+    return problems.empty() && connected ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,18 @@
+#ifndef FSCK_H
+#define FSCK_H
+
+#include <string>
+
+struct FsckOptions {
+    unsigned threads = 0;      // 0 uses one thread per core
+    bool connectivity = true;  // walk the links from the refs, HEAD and the index
+    bool dangling = true;      // report unreachable objects nothing else points at
+};
+
+// verify the repository: every loose object and every pack entry is inflated and re-hashed
+// against its name on a pool of threads, packs are resolved one delta tree at a time so each
+// entry is inflated once, and commits, trees and tags are checked for syntax. Problems are
+// printed in git's wording, EXIT_FAILURE if any object is corrupt or missing.
+int fsck (const FsckOptions& options, const std::string& dir = ".");
+
+#endif // FSCK_H
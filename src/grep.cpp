@@ -0,0 +1,392 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <condition_variable>
+#include <fnmatch.h>
+#include <regex.h>
+#include <strings.h>
+#include "grep.h"
+#include "diff_tree.h"
+#include "object_store.h"
+#include "trace.h"
+
+#define BINARY_CHECK_BYTES 8000 // git looks for a NUL this far into a file
+
+// the longest run of characters every match of a regular expression contains, empty if
+// there is none that can be told without a real parser (alternations, for one)
+static std::string required_literal (const std::string& pattern, bool extended) {
+    if ((extended && pattern.find('|') != std::string::npos) || (!extended && pattern.find("\\|") != std::string::npos)) {
+        return {};
+    }
+
+    std::string best, run;
+    auto end_run = [&]() {
+        if (run.length() > best.length()) best = run;
+        run.clear();
+    };
+    // a group is skipped whole, it may be optional or repeated
+    auto skip_group = [&](size_t i) {
+        int depth = 0;
+        for (; i < pattern.length(); i++) {
+            bool open = extended ? pattern[i] == '(' : pattern.compare(i, 2, "\\(") == 0;
+            bool close = extended ? pattern[i] == ')' : pattern.compare(i, 2, "\\)") == 0;
+            if (open) depth++;
+            if (close && --depth == 0) return i + (extended ? 0 : 1);
+            if (pattern[i] == '\\') i++;
+        }
+        return pattern.length();
+    };
+
+    for (size_t i = 0; i < pattern.length(); i++) {
+        char c = pattern[i];
+        char next = i + 1 < pattern.length() ? pattern[i + 1] : '\0';
+        if (c == '[') {
+            // a bracket expression: "]" right after "[" or "[^" is a member, not the end
+            size_t close = i + 1;
+            if (close < pattern.length() && pattern[close] == '^') close++;
+            if (close < pattern.length() && pattern[close] == ']') close++;
+            close = pattern.find(']', close);
+            i = close == std::string::npos ? pattern.length() : close;
+            end_run();
+        }
+        else if ((extended && c == '(') || (!extended && c == '\\' && next == '(')) {
+            i = skip_group(i);
+            end_run();
+        }
+        else if (c == '*' || (extended && (c == '?' || c == '{')) || (!extended && c == '\\' && (next == '?' || next == '{'))) {
+            // the character before may not be there at all
+            if (!run.empty()) run.pop_back();
+            end_run();
+            if (c == '\\') i++;
+            if (c == '{' || next == '{') {
+                size_t close = pattern.find('}', i);
+                i = close == std::string::npos ? pattern.length() : close;
+            }
+        }
+        else if (c == '\\') {
+            // an escaped punctuation character stands for itself; \w, \b, \+ and the like do not
+            if (next != '\0' && !isalnum(static_cast<unsigned char>(next)) && (extended || strchr("+<>", next) == nullptr)) {
+                run.push_back(next);
+            } else {
+                end_run();
+            }
+            i++;
+        }
+        else if (c == '.' || c == '^' || c == '$' || (extended && c == '+')) {
+            end_run();
+        }
+        else {
+            run.push_back(c);
+        }
+    }
+    end_run();
+
+    return best;
+}
+
+// the first occurrence of a literal, memmem or two memchr scans for either case of its first byte
+static const char* find_literal (const char* begin, const char* end, const std::string& literal, bool ignore_case) {
+    if (!ignore_case) {
+        return static_cast<const char*>(memmem(begin, end - begin, literal.data(), literal.length()));
+    }
+
+    unsigned char first = literal[0];
+    int lower = tolower(first), upper = toupper(first);
+    const char* next_lower = nullptr;
+    const char* next_upper = nullptr;
+    for (const char* pos = begin; end - pos >= ssize_t(literal.length());) {
+        if (!next_lower || next_lower < pos) next_lower = static_cast<const char*>(memchr(pos, lower, end - pos));
+        if (!next_upper || next_upper < pos) next_upper = lower == upper ? next_lower : static_cast<const char*>(memchr(pos, upper, end - pos));
+        const char* candidate = !next_lower ? next_upper : !next_upper ? next_lower : std::min(next_lower, next_upper);
+        if (!candidate || end - candidate < ssize_t(literal.length())) {
+            return nullptr;
+        }
+        if (strncasecmp(candidate, literal.data(), literal.length()) == 0) {
+            return candidate;
+        }
+        pos = candidate + 1;
+    }
+
+    return nullptr;
+}
+
+namespace {
+
+class LineMatcher {
+public:
+    ~LineMatcher () {
+        for (auto& regex : regexes) {
+            regfree(&regex);
+        }
+    }
+
+    bool compile (const GrepOptions& options) {
+        this->options = &options;
+        if (options.fixed) {
+            if (options.patterns.size() == 1) literal = options.patterns[0];
+            return true;
+        }
+
+        int flags = REG_NEWLINE | (options.extended ? REG_EXTENDED : 0) | (options.ignore_case ? REG_ICASE : 0);
+        regexes.resize(options.patterns.size());
+        for (size_t i = 0; i < options.patterns.size(); i++) {
+            int status = regcomp(&regexes[i], options.patterns[i].c_str(), flags);
+            if (status != 0) {
+                char message[256];
+                regerror(status, &regexes[i], message, sizeof(message));
+                std::cerr << "Invalid pattern " << options.patterns[i] << ": " << message << '\n';
+                regexes.resize(i);
+                return false;
+            }
+        }
+        if (options.patterns.size() == 1) {
+            literal = required_literal(options.patterns[0], options.extended);
+        }
+        return true;
+    }
+
+    // a literal to jump to before matching, empty to match every line
+    const std::string& prefilter () const { return literal; }
+
+    // whether the lines next_match or the prefilter land on match without a further check:
+    // a single fixed string, or a single regular expression searched for directly
+    bool confirms () const {
+        return options->patterns.size() == 1 && (options->fixed || literal.empty());
+    }
+
+    // whether a line (without its newline) matches
+    bool match (const char* begin, const char* end) const {
+        if (options->fixed) {
+            for (const auto& pattern : options->patterns) {
+                if (pattern.empty() || find_literal(begin, end, pattern, options->ignore_case)) return true;
+            }
+            return false;
+        }
+
+        regmatch_t range;
+        for (const auto& regex : regexes) {
+            range.rm_so = 0;
+            range.rm_eo = end - begin;
+            if (regexec(&regex, begin, 1, &range, REG_STARTEND) == 0) return true;
+        }
+        return false;
+    }
+
+    // without a prefilter one regex can find the next matching line itself
+    const char* next_match (const char* begin, const char* end) const {
+        if (options->fixed || regexes.size() != 1) {
+            return begin;
+        }
+        regmatch_t range;
+        range.rm_so = 0;
+        range.rm_eo = end - begin;
+        return regexec(&regexes[0], begin, 1, &range, REG_STARTEND) == 0 ? begin + range.rm_so : nullptr;
+    }
+
+private:
+    const GrepOptions* options = nullptr;
+    std::vector<regex_t> regexes;
+    std::string literal;
+};
+
+struct GrepJob {
+    std::string path;
+    std::string hash;
+    std::string output;
+    bool matched = false;
+    bool failed = false;
+    bool done = false;
+};
+
+} // namespace
+
+static bool has_wildcard (const std::string& spec) {
+    return spec.find_first_of("*?[") != std::string::npos;
+}
+
+// whether a file is named by the pathspecs, or a directory may hold files that are
+static bool path_selected (const std::vector<std::string>& specs, const std::string& path, bool directory) {
+    if (specs.empty()) {
+        return true;
+    }
+    for (const auto& spec : specs) {
+        if (spec.empty() || spec == "." || path == spec || (path.rfind(spec, 0) == 0 && (spec.back() == '/' || path[spec.length()] == '/'))) {
+            return true;
+        }
+        if (directory && (has_wildcard(spec) || spec.rfind(path + '/', 0) == 0)) {
+            return true;
+        }
+        if (!directory && has_wildcard(spec) && fnmatch(spec.c_str(), path.c_str(), 0) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// the blobs below a tree in path order, symlinks included and submodules left out
+static bool collect_blobs (const std::string& tree_hash, const std::string& base, const GrepOptions& options,
+                           std::vector<std::unique_ptr<GrepJob>>& jobs, const std::string& dir) {
+    std::string type, contents;
+    std::vector<TreeEntry> entries;
+    if (!read_object(tree_hash, type, contents, dir) || type != "tree" || !parse_tree(contents, entries)) {
+        std::cerr << "Invalid tree object " << tree_hash << ".\n";
+        return false;
+    }
+
+    for (const auto& entry : entries) {
+        std::string path = base + entry.name;
+        bool directory = entry.mode == "40000";
+        if (entry.mode == "160000" || !path_selected(options.paths, path, directory)) {
+            continue;
+        }
+        if (directory) {
+            if (!collect_blobs(entry.hash, path + '/', options, jobs, dir)) {
+                return false;
+            }
+            continue;
+        }
+        auto job = std::make_unique<GrepJob>();
+        job->path = path;
+        job->hash = entry.hash;
+        jobs.push_back(std::move(job));
+    }
+
+    return true;
+}
+
+static void grep_blob (GrepJob& job, const LineMatcher& matcher, const GrepOptions& options, const std::string& prefix,
+                       const std::string& dir) {
+    static TraceCounter grep_bytes("grep", "bytes");
+    static TraceCounter grep_skipped("grep", "prefilter_skipped_blobs");
+
+    std::string type, contents;
+    if (!read_object(job.hash, type, contents, dir)) {
+        std::cerr << "Failed to read blob " << job.hash << ".\n";
+        job.failed = true;
+        return;
+    }
+    grep_bytes.add(contents.length());
+
+    const char* begin = contents.data();
+    const char* end = begin + contents.length();
+    const std::string& literal = matcher.prefilter();
+    bool binary = memchr(begin, '\0', std::min<size_t>(contents.length(), BINARY_CHECK_BYTES)) != nullptr;
+    std::string name = prefix + job.path;
+
+    uint64_t line_number = 1;
+    const char* counted = begin; // line_number is the number of the line starting here
+    uint64_t count = 0;
+    for (const char* pos = begin; pos < end;) {
+        const char* candidate = literal.empty() ? matcher.next_match(pos, end) : find_literal(pos, end, literal, options.ignore_case);
+        if (!candidate) {
+            if (pos == begin && !literal.empty()) grep_skipped.add(1);
+            break;
+        }
+
+        const char* line_start = static_cast<const char*>(memrchr(pos, '\n', candidate - pos));
+        line_start = line_start ? line_start + 1 : pos;
+        const char* line_end = static_cast<const char*>(memchr(candidate, '\n', end - candidate));
+        if (!line_end) line_end = end;
+        pos = line_end + 1;
+
+        if (!matcher.confirms() && !matcher.match(line_start, line_end)) {
+            continue;
+        }
+        job.matched = true;
+        count++;
+        if (options.names_only || binary) {
+            break;
+        }
+        if (options.count) {
+            continue;
+        }
+
+        job.output += name;
+        job.output += ':';
+        if (options.line_numbers) {
+            line_number += std::count(counted, line_start, '\n');
+            counted = line_start;
+            job.output += std::to_string(line_number);
+            job.output += ':';
+        }
+        job.output.append(line_start, line_end);
+        job.output += '\n';
+    }
+
+    if (!job.matched) {
+        return;
+    }
+    if (options.names_only) {
+        job.output = name + '\n';
+    }
+    else if (options.count) {
+        job.output = name + ':' + std::to_string(count) + '\n';
+    }
+    else if (binary) {
+        job.output = "Binary file " + name + " matches\n";
+    }
+}
+
+int grep (const std::string& revision, const GrepOptions& options, const std::string& dir) {
+    std::string tree = resolve_tree(revision, dir);
+    if (tree.empty()) {
+        std::cerr << "Not a tree-ish: " << revision << '\n';
+        return EXIT_FAILURE;
+    }
+
+    LineMatcher matcher;
+    if (!matcher.compile(options)) {
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::unique_ptr<GrepJob>> jobs;
+    if (!collect_blobs(tree, "", options, jobs, dir)) {
+        return EXIT_FAILURE;
+    }
+
+    // workers take blobs in path order; the results are printed as soon as all before them are in
+    TraceRegion region("grep", "scan");
+    std::string prefix = revision + ':';
+    std::atomic<size_t> next(0);
+    std::mutex mutex;
+    std::condition_variable job_done;
+    unsigned threads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<size_t>(threads, std::max<size_t>(jobs.size(), 1));
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&]() {
+            for (size_t i = next++; i < jobs.size(); i = next++) {
+                grep_blob(*jobs[i], matcher, options, prefix, dir);
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs[i]->done = true;
+                job_done.notify_one();
+            }
+        });
+    }
+
+    bool matched = false;
+    bool failed = false;
+    for (auto& job : jobs) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_done.wait(lock, [&job]() { return job->done; });
+        }
+        std::cout << job->output;
+        matched = matched || job->matched;
+        failed = failed || job->failed;
+        job.reset();
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    std::cout.flush();
+
+    return matched && !failed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,25 @@
+#ifndef GREP_H
+#define GREP_H
+
+#include <string>
+#include <vector>
+
+struct GrepOptions {
+    std::vector<std::string> patterns; // a line matches if any of them does
+    bool fixed = false;          // -F: the patterns are plain strings
+    bool extended = false;       // -E: POSIX extended instead of basic regular expressions
+    bool ignore_case = false;    // -i
+    bool line_numbers = false;   // -n
+    bool names_only = false;     // -l
+    bool count = false;          // -c
+    unsigned threads = 0;        // 0 uses one thread per core
+    std::vector<std::string> paths; // only these files and directories, wildcards allowed
+};
+
+// search the blobs of a tree-ish without checking it out. Blobs are inflated and scanned on a
+// pool of threads: a literal every match must contain is looked for with memmem/memchr first,
+// and only the lines holding it go through the regular expression. Matches print in path order
+// as "<rev>:<path>:<line>"; EXIT_FAILURE if nothing matched.
+int grep (const std::string& revision, const GrepOptions& options, const std::string& dir = ".");
+
+#endif // GREP_H
@@ -0,0 +1,645 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cctype>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "http_server.h"
+
+#define MAX_HEADER_SIZE 65536
+#define MAX_BODY_SIZE (256 << 20)
+#define MAX_QUEUED_OUTPUT (4 << 20) // a worker waits once this much output is pending
+#define MAX_CHUNK_LINE 1024
+#define HEADER_TIMEOUT std::chrono::seconds(10) // from the first byte of a request to the end of its headers
+#define IDLE_TIMEOUT std::chrono::seconds(60)   // without a byte either way, unless a worker is busy
+#define READ_CHUNK 65536
+#define MAX_EVENTS 256
+
+namespace {
+
+struct HttpServer {
+    int epoll_fd = -1;
+    int listen_fd = -1;
+    int wake_fd = -1;
+    const HttpHandler* handler = nullptr;
+    std::unordered_map<int, std::shared_ptr<HttpConnection>> connections;
+
+    // connections with new output, handed from workers to the event loop
+    std::mutex dirty_mutex;
+    std::vector<std::shared_ptr<HttpConnection>> dirty;
+
+    // worker pool
+    std::mutex task_mutex;
+    std::condition_variable task_ready;
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+
+    void notify (const std::shared_ptr<HttpConnection>& connection) {
+        {
+            std::lock_guard<std::mutex> lock(dirty_mutex);
+            dirty.push_back(connection);
+        }
+        uint64_t one = 1;
+        (void) ::write(wake_fd, &one, sizeof(one));
+    }
+};
+
+} // namespace
+
+struct HttpConnection {
+    int fd = -1;
+    HttpServer* server = nullptr;
+
+    // owned by the event loop thread
+    std::string input;
+    size_t header_scanned = 0; // input already searched for the end of the headers
+    bool have_headers = false; // request holds a parsed head whose body is still arriving
+    HttpRequest request;
+    bool chunked_body = false;
+    unsigned long long body_length = 0;
+    std::chrono::steady_clock::time_point head_started; // the current request began arriving
+    std::chrono::steady_clock::time_point last_active;  // a byte was last read or written
+    bool busy = false;
+    bool want_write = false;
+    uint32_t events = EPOLLIN | EPOLLRDHUP; // registered with epoll
+
+    // shared between the event loop and the worker answering the current request
+    std::mutex mutex;
+    std::condition_variable drained;
+    std::string output;
+    size_t output_sent = 0;
+    bool keep_alive = true;
+    bool chunked = true;
+    bool response_done = false;
+    bool closed = false;
+};
+
+static const char* status_text (int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 413: return "Payload Too Large";
+        case 415: return "Unsupported Media Type";
+        case 431: return "Request Header Fields Too Large";
+        default: return "Internal Server Error";
+    }
+}
+
+// append to the output queue, waiting for the loop to drain it when it is full
+static bool queue_output (const std::shared_ptr<HttpConnection>& connection, const char* data, size_t length) {
+    {
+        std::unique_lock<std::mutex> lock(connection->mutex);
+        connection->drained.wait(lock, [&]() {
+            return connection->closed || connection->output.length() - connection->output_sent < MAX_QUEUED_OUTPUT;
+        });
+        if (connection->closed) {
+            return false;
+        }
+        if (connection->output_sent > 0) {
+            connection->output.erase(0, connection->output_sent);
+            connection->output_sent = 0;
+        }
+        connection->output.append(data, length);
+    }
+
+    connection->server->notify(connection);
+    return true;
+}
+
+bool HttpResponse::start (int status, const std::string& content_type, const std::vector<std::string>& extra_headers) {
+    bool chunked;
+    bool keep_alive;
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        chunked = connection->chunked;
+        keep_alive = connection->keep_alive;
+    }
+
+    std::string head = "HTTP/1.1 " + std::to_string(status) + ' ' + status_text(status) + "\r\n";
+    head += "Content-Type: " + content_type + "\r\n";
+    head += chunked ? "Transfer-Encoding: chunked\r\n" : "";
+    head += keep_alive ? "" : "Connection: close\r\n";
+    for (const auto& header : extra_headers) {
+        head += header + "\r\n";
+    }
+    head += "\r\n";
+
+    started = true;
+    return queue_output(connection, head.data(), head.length());
+}
+
+bool HttpResponse::write (const char* data, size_t length) {
+    if (length == 0) {
+        return true;
+    }
+
+    bool chunked;
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        chunked = connection->chunked;
+    }
+    if (!chunked) {
+        return queue_output(connection, data, length);
+    }
+
+    char size_line[32];
+    int size_length = snprintf(size_line, sizeof(size_line), "%zx\r\n", length);
+    std::string chunk;
+    chunk.reserve(size_length + length + 2);
+    chunk.append(size_line, size_length);
+    chunk.append(data, length);
+    chunk += "\r\n";
+
+    return queue_output(connection, chunk.data(), chunk.length());
+}
+
+static void close_connection (HttpServer& server, const std::shared_ptr<HttpConnection>& connection) {
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        if (connection->closed) {
+            return;
+        }
+        connection->closed = true;
+    }
+    connection->drained.notify_all();
+
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_DEL, connection->fd, nullptr);
+    close(connection->fd);
+    server.connections.erase(connection->fd);
+}
+
+// read only between requests, so what a client sends while one runs waits in the socket
+// rather than in the input buffer; write while output is pending
+static void update_interest (HttpServer& server, HttpConnection& connection) {
+    uint32_t events = (connection.busy ? 0u : uint32_t(EPOLLIN | EPOLLRDHUP)) |
+                      (connection.want_write ? uint32_t(EPOLLOUT) : 0u);
+    if (connection.events == events) {
+        return;
+    }
+
+    epoll_event event = {};
+    event.events = events;
+    event.data.fd = connection.fd;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+    connection.events = events;
+}
+
+// move the complete chunks at the front of input into body, returns 1 once the last chunk and
+// its trailers are in, 0 when more input is needed and -1 on errors
+static int decode_chunked (std::string& input, std::string& body) {
+    size_t pos = 0;
+    int status = 0;
+    while (true) {
+        size_t line_end = input.find("\r\n", pos);
+        if (line_end == std::string::npos) {
+            status = input.length() - pos > MAX_CHUNK_LINE ? -1 : 0;
+            break;
+        }
+
+        char* end;
+        unsigned long long size = strtoull(input.c_str() + pos, &end, 16);
+        if (end == input.c_str() + pos || size > MAX_BODY_SIZE - body.length()) {
+            return -1;
+        }
+
+        if (size == 0) {
+            // skip trailers up to the final empty line
+            size_t trailer = line_end + 2;
+            size_t trailer_end = input.find("\r\n", trailer);
+            while (trailer_end != std::string::npos && trailer_end != trailer) {
+                trailer = trailer_end + 2;
+                trailer_end = input.find("\r\n", trailer);
+            }
+            if (trailer_end == std::string::npos) {
+                status = input.length() - pos > MAX_HEADER_SIZE ? -1 : 0;
+                break;
+            }
+            pos = trailer_end + 2;
+            status = 1;
+            break;
+        }
+
+        size_t data = line_end + 2;
+        if (input.length() < data + size + 2) {
+            break;
+        }
+        if (input.compare(data + size, 2, "\r\n") != 0) {
+            return -1;
+        }
+        body.append(input, data, size);
+        pos = data + size + 2;
+    }
+
+    input.erase(0, pos);
+    return status;
+}
+
+static void respond_and_close (HttpServer& server, const std::shared_ptr<HttpConnection>& connection, int status) {
+    std::string response = "HTTP/1.1 " + std::to_string(status) + ' ' + status_text(status) +
+                           "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    (void) send(connection->fd, response.data(), response.length(), MSG_NOSIGNAL);
+    close_connection(server, connection);
+}
+
+static void run_request (HttpServer& server, const std::shared_ptr<HttpConnection>& connection, const HttpRequest& request) {
+    HttpResponse response;
+    response.connection = connection;
+    try {
+        (*server.handler)(request, response);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Request failed: " << e.what() << '\n';
+    }
+
+    if (!response.started) {
+        response.start(500, "text/plain");
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        if (connection->chunked && !connection->closed) {
+            connection->output += "0\r\n\r\n";
+        }
+        connection->response_done = true;
+    }
+    server.notify(connection);
+}
+
+// parse the head of the next request once it is in, then take its body as it arrives and
+// hand the complete request to a worker
+static void dispatch_request (HttpServer& server, const std::shared_ptr<HttpConnection>& connection) {
+    if (connection->busy) {
+        return;
+    }
+
+    std::string& input = connection->input;
+    HttpRequest& request = connection->request;
+    if (!connection->have_headers) {
+        size_t header_end = input.find("\r\n\r\n", connection->header_scanned);
+        if (header_end == std::string::npos) {
+            if (input.length() > MAX_HEADER_SIZE) {
+                respond_and_close(server, connection, 431);
+                return;
+            }
+            connection->header_scanned = input.length() < 3 ? 0 : input.length() - 3;
+            return;
+        }
+
+        request = HttpRequest();
+        size_t line_end = input.find("\r\n");
+        std::string request_line = input.substr(0, line_end);
+        size_t first_space = request_line.find(' ');
+        size_t second_space = request_line.rfind(' ');
+        if (first_space == std::string::npos || second_space == first_space) {
+            respond_and_close(server, connection, 400);
+            return;
+        }
+        request.method = request_line.substr(0, first_space);
+        std::string target = request_line.substr(first_space + 1, second_space - first_space - 1);
+        request.version = request_line.substr(second_space + 1);
+        size_t question = target.find('?');
+        request.path = target.substr(0, question);
+        request.query = question == std::string::npos ? "" : target.substr(question + 1);
+
+        size_t pos = line_end + 2;
+        while (pos < header_end) {
+            size_t next = input.find("\r\n", pos);
+            std::string line = input.substr(pos, next - pos);
+            size_t colon = line.find(':');
+            if (colon != std::string::npos) {
+                std::string name = line.substr(0, colon);
+                std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+                size_t value_start = line.find_first_not_of(' ', colon + 1);
+                request.headers[name] = value_start == std::string::npos ? "" : line.substr(value_start);
+            }
+            pos = next + 2;
+        }
+
+        auto encoding = request.headers.find("transfer-encoding");
+        connection->chunked_body = encoding != request.headers.end() && encoding->second.find("chunked") != std::string::npos;
+        connection->body_length = 0;
+        if (!connection->chunked_body) {
+            // digits only: strtoull alone would take a sign, spaces or an empty value
+            auto length_header = request.headers.find("content-length");
+            if (length_header != request.headers.end()) {
+                const std::string& value = length_header->second;
+                char* end = nullptr;
+                errno = 0;
+                connection->body_length = strtoull(value.c_str(), &end, 10);
+                if (value.empty() || !isdigit(static_cast<unsigned char>(value[0])) || *end != '\0' || errno == ERANGE) {
+                    respond_and_close(server, connection, 400);
+                    return;
+                }
+            }
+            if (connection->body_length > MAX_BODY_SIZE) {
+                respond_and_close(server, connection, 413);
+                return;
+            }
+        }
+
+        input.erase(0, header_end + 4);
+        connection->header_scanned = 0;
+        connection->have_headers = true;
+    }
+
+    if (connection->chunked_body) {
+        int status = decode_chunked(input, request.body);
+        if (status < 0) {
+            respond_and_close(server, connection, 400);
+            return;
+        }
+        if (status == 0) {
+            return;
+        }
+    }
+    else {
+        if (input.length() < connection->body_length) {
+            return;
+        }
+        request.body.assign(input, 0, connection->body_length);
+        input.erase(0, connection->body_length);
+    }
+    connection->have_headers = false;
+    connection->head_started = std::chrono::steady_clock::now(); // anything left is the next request
+
+    auto connection_header = request.headers.find("connection");
+    bool close_requested = connection_header != request.headers.end() && connection_header->second == "close";
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        connection->keep_alive = request.version == "HTTP/1.1" && !close_requested;
+        connection->chunked = request.version == "HTTP/1.1";
+        connection->response_done = false;
+    }
+    connection->busy = true;
+
+    {
+        std::lock_guard<std::mutex> lock(server.task_mutex);
+        server.tasks.push_back([&server, connection, request = std::move(request)]() {
+            run_request(server, connection, request);
+        });
+    }
+    server.task_ready.notify_one();
+}
+
+// write as much queued output as the socket takes
+static void flush_connection (HttpServer& server, const std::shared_ptr<HttpConnection>& connection) {
+    std::unique_lock<std::mutex> lock(connection->mutex);
+    if (connection->closed) {
+        return;
+    }
+
+    while (connection->output_sent < connection->output.length()) {
+        ssize_t sent = send(connection->fd, connection->output.data() + connection->output_sent,
+                            connection->output.length() - connection->output_sent, MSG_NOSIGNAL);
+        if (sent > 0) {
+            connection->output_sent += sent;
+            connection->last_active = std::chrono::steady_clock::now();
+        }
+        else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        else if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        else {
+            lock.unlock();
+            close_connection(server, connection);
+            return;
+        }
+    }
+
+    bool pending = connection->output_sent < connection->output.length();
+    if (!pending) {
+        connection->output.clear();
+        connection->output_sent = 0;
+    }
+    bool finished = connection->response_done && !pending;
+    bool keep_alive = connection->keep_alive;
+    if (finished) {
+        connection->response_done = false;
+    }
+    lock.unlock();
+    connection->drained.notify_all();
+
+    connection->want_write = pending;
+    if (finished) {
+        connection->busy = false;
+        if (!keep_alive) {
+            close_connection(server, connection);
+            return;
+        }
+        dispatch_request(server, connection); // a pipelined request may be waiting
+        if (connection->closed) {
+            return;
+        }
+    }
+    update_interest(server, *connection);
+}
+
+// read until the socket is drained or a request is complete; parsing after every read keeps the
+// buffered input within one request head or body
+static void read_connection (HttpServer& server, const std::shared_ptr<HttpConnection>& connection) {
+    char buffer[READ_CHUNK];
+    while (!connection->busy) {
+        ssize_t received = recv(connection->fd, buffer, sizeof(buffer), 0);
+        if (received > 0) {
+            auto now = std::chrono::steady_clock::now();
+            if (connection->input.empty() && !connection->have_headers) {
+                connection->head_started = now;
+            }
+            connection->last_active = now;
+            connection->input.append(buffer, received);
+            dispatch_request(server, connection);
+            if (connection->closed) {
+                return;
+            }
+            continue;
+        }
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+
+        // the peer closed the connection or the socket failed
+        close_connection(server, connection);
+        return;
+    }
+
+    update_interest(server, *connection);
+}
+
+// close connections that stalled: a request head that takes too long, or no traffic at all
+// while nothing is being worked on or output is stuck waiting for the client
+static void expire_connections (HttpServer& server) {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::shared_ptr<HttpConnection>> connections;
+    for (const auto& [fd, connection] : server.connections) {
+        connections.push_back(connection);
+    }
+
+    for (const auto& connection : connections) {
+        if (!connection->busy && !connection->have_headers && !connection->input.empty() &&
+            now - connection->head_started > HEADER_TIMEOUT) {
+            respond_and_close(server, connection, 408);
+        }
+        else if ((!connection->busy || connection->want_write) && now - connection->last_active > IDLE_TIMEOUT) {
+            close_connection(server, connection);
+        }
+    }
+}
+
+int serve_http (uint16_t port, unsigned workers, const HttpHandler& handler,
+                const std::atomic<bool>* stop, const std::function<void(uint16_t)>& on_listen) {
+    HttpServer server;
+    server.handler = &handler;
+
+    server.listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    setsockopt(server.listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (server.listen_fd < 0 || bind(server.listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(server.listen_fd, SOMAXCONN) != 0) {
+        std::cerr << "Failed to listen on port " << port << ": " << strerror(errno) << '\n';
+        if (server.listen_fd >= 0) close(server.listen_fd);
+        return EXIT_FAILURE;
+    }
+
+    socklen_t address_length = sizeof(address);
+    getsockname(server.listen_fd, reinterpret_cast<sockaddr*>(&address), &address_length);
+    if (on_listen) {
+        on_listen(ntohs(address.sin_port));
+    }
+
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = server.listen_fd;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &event);
+    event.data.fd = server.wake_fd;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.wake_fd, &event);
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < std::max(workers, 1u); i++) {
+        pool.emplace_back([&server]() {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(server.task_mutex);
+                    server.task_ready.wait(lock, [&]() { return server.stopping || !server.tasks.empty(); });
+                    if (server.stopping) return;
+                    task = std::move(server.tasks.front());
+                    server.tasks.pop_front();
+                }
+                task();
+            }
+        });
+    }
+
+    epoll_event events[MAX_EVENTS];
+    auto last_expiry = std::chrono::steady_clock::now();
+    while (!stop || !stop->load()) {
+        int ready = epoll_wait(server.epoll_fd, events, MAX_EVENTS, 100);
+        if (ready < 0 && errno != EINTR) {
+            std::cerr << "epoll_wait failed: " << strerror(errno) << '\n';
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == server.listen_fd) {
+                int client;
+                while ((client = accept4(server.listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    auto connection = std::make_shared<HttpConnection>();
+                    connection->fd = client;
+                    connection->server = &server;
+                    connection->last_active = std::chrono::steady_clock::now();
+                    server.connections[client] = connection;
+                    epoll_event client_event = {};
+                    client_event.events = EPOLLIN | EPOLLRDHUP;
+                    client_event.data.fd = client;
+                    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, client, &client_event);
+                }
+                continue;
+            }
+
+            if (fd == server.wake_fd) {
+                uint64_t count;
+                (void) ::read(server.wake_fd, &count, sizeof(count));
+                std::vector<std::shared_ptr<HttpConnection>> dirty;
+                {
+                    std::lock_guard<std::mutex> lock(server.dirty_mutex);
+                    dirty.swap(server.dirty);
+                }
+                for (const auto& connection : dirty) {
+                    flush_connection(server, connection);
+                }
+                continue;
+            }
+
+            auto found = server.connections.find(fd);
+            if (found == server.connections.end()) {
+                continue;
+            }
+            std::shared_ptr<HttpConnection> connection = found->second;
+            if ((events[i].events & (EPOLLHUP | EPOLLERR)) && connection->busy) {
+                // nobody left to answer; closing also stops the worker writing to it
+                close_connection(server, connection);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                read_connection(server, connection);
+            }
+            if ((events[i].events & EPOLLOUT) && server.connections.count(fd)) {
+                flush_connection(server, connection);
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_expiry >= std::chrono::seconds(1)) {
+            expire_connections(server);
+            last_expiry = now;
+        }
+    }
+
+    // shut down: wake workers blocked on output, then stop the pool
+    while (!server.connections.empty()) {
+        close_connection(server, server.connections.begin()->second);
+    }
+    {
+        std::lock_guard<std::mutex> lock(server.task_mutex);
+        server.stopping = true;
+    }
+    server.task_ready.notify_all();
+    for (auto& worker : pool) {
+        worker.join();
+    }
+    close(server.listen_fd);
+    close(server.wake_fd);
+    close(server.epoll_fd);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,40 @@
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct HttpRequest {
+    std::string method;
+    std::string path;
+    std::string query;
+    std::string version;
+    std::map<std::string, std::string> headers; // names in lower case
+    std::string body;
+};
+
+struct HttpConnection;
+
+// streams one response to the event loop; write() blocks while too much output is queued
+struct HttpResponse {
+    std::shared_ptr<HttpConnection> connection;
+    bool started = false;
+
+    bool start (int status, const std::string& content_type, const std::vector<std::string>& extra_headers = {});
+    bool write (const char* data, size_t length);
+    bool write (const std::string& data) { return write(data.data(), data.length()); }
+};
+
+using HttpHandler = std::function<void(const HttpRequest&, HttpResponse&)>;
+
+// run an epoll event loop on the port (0 picks a free one) handing complete requests to a
+// pool of workers, until stop becomes true; on_listen receives the bound port
+int serve_http (uint16_t port, unsigned workers, const HttpHandler& handler,
+                const std::atomic<bool>* stop = nullptr, const std::function<void(uint16_t)>& on_listen = nullptr);
+
+#endif // HTTP_SERVER_H
@@ -0,0 +1,290 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <openssl/sha.h>
+#include "index.h"
+#include "object_store.h"
+#include "sparse_checkout.h"
+
+#define INDEX_SIGNATURE "DIRC"
+#define CACHE_TREE_SIGNATURE "TREE"
+#define ENTRY_FIXED_SIZE 62     // stat data, hash and flags before the path
+#define FLAG_EXTENDED 0x4000
+#define NAME_MASK 0x0FFF
+
+static uint32_t get_be32 (const unsigned char* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+static void put_be32 (std::string& out, uint32_t value) {
+    out.push_back(char(value >> 24));
+    out.push_back(char(value >> 16));
+    out.push_back(char(value >> 8));
+    out.push_back(char(value));
+}
+
+// "<path>\0<entry count> <subtree count>\n<hash>", children following their parent
+static bool parse_cache_tree (const unsigned char* data, size_t length, std::vector<CacheTreeNode>& nodes) {
+    struct Pending { std::string path; int children; };
+    std::vector<Pending> stack;
+    size_t pos = 0;
+    while (pos < length) {
+        const char* start = reinterpret_cast<const char*>(data + pos);
+        const char* name_end = static_cast<const char*>(memchr(start, '\0', length - pos));
+        const char* line_end = name_end ? static_cast<const char*>(memchr(name_end, '\n', length - (name_end - start) - pos)) : nullptr;
+        if (!line_end) {
+            return false;
+        }
+
+        CacheTreeNode node;
+        std::string name(start, name_end);
+        if (sscanf(name_end + 1, "%d %d", &node.entry_count, &node.subtree_count) != 2) {
+            return false;
+        }
+        pos += line_end - start + 1;
+        if (node.entry_count >= 0) {
+            if (pos + 20 > length) return false;
+            node.hash = digest_to_hash(std::string(reinterpret_cast<const char*>(data + pos), 20));
+            pos += 20;
+        }
+
+        while (!stack.empty() && stack.back().children == 0) {
+            stack.pop_back();
+        }
+        if (!stack.empty()) {
+            stack.back().children--;
+            node.path = stack.back().path.empty() ? name : stack.back().path + '/' + name;
+        }
+        stack.push_back({node.path, node.subtree_count});
+        nodes.push_back(std::move(node));
+    }
+
+    return true;
+}
+
+bool read_index (Index& index, const std::string& dir) {
+    std::string path = dir + "/.git/index";
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    index.mtime_sec = st.st_mtim.tv_sec;
+    index.mtime_nsec = st.st_mtim.tv_nsec;
+
+    std::ifstream file(path, std::ios::binary);
+    std::string buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(buffer.data());
+    if (buffer.length() < 32 || memcmp(data, INDEX_SIGNATURE, 4) != 0) {
+        return false;
+    }
+
+    uint32_t version = get_be32(data + 4);
+    if (version != 2 && version != 3) {
+        return false; // version 4 compresses paths, treat it as having no cache
+    }
+
+    unsigned char digest[20];
+    size_t content_end = buffer.length() - 20;
+    SHA1(data, content_end, digest);
+    if (memcmp(digest, data + content_end, 20) != 0) {
+        std::cerr << "Index checksum mismatch.\n";
+        return false;
+    }
+
+    uint32_t count = get_be32(data + 8);
+    size_t pos = 12;
+    index.entries.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        if (pos + ENTRY_FIXED_SIZE > content_end) return false;
+        const unsigned char* p = data + pos;
+        IndexEntry& entry = index.entries[i];
+        uint32_t* fields[] = { &entry.ctime_sec, &entry.ctime_nsec, &entry.mtime_sec, &entry.mtime_nsec, &entry.dev,
+                               &entry.ino, &entry.mode, &entry.uid, &entry.gid, &entry.size };
+        for (int f = 0; f < 10; f++) {
+            *fields[f] = get_be32(p + 4 * f);
+        }
+        entry.hash = digest_to_hash(std::string(reinterpret_cast<const char*>(p + 40), 20));
+        entry.flags = (p[60] << 8) | p[61];
+
+        if (entry.flags & FLAG_EXTENDED) {
+            entry.extended_flags = (p[62] << 8) | p[63];
+        }
+        size_t name_start = pos + ENTRY_FIXED_SIZE + ((entry.flags & FLAG_EXTENDED) ? 2 : 0);
+        const void* name_end = memchr(data + name_start, '\0', content_end - name_start);
+        if (!name_end) return false;
+        entry.path.assign(reinterpret_cast<const char*>(data + name_start),
+                          static_cast<const unsigned char*>(name_end) - (data + name_start));
+
+        // entries are padded with 1 to 8 NUL bytes to a multiple of 8
+        size_t entry_length = name_start - pos + entry.path.length();
+        pos += (entry_length + 8) & ~size_t(7);
+    }
+
+    while (pos + 8 <= content_end) {
+        uint32_t length = get_be32(data + pos + 4);
+        if (pos + 8 + length > content_end) return false;
+        if (memcmp(data + pos, CACHE_TREE_SIGNATURE, 4) == 0 &&
+            !parse_cache_tree(data + pos + 8, length, index.cache_tree)) {
+            index.cache_tree.clear();
+        }
+        pos += 8 + length;
+    }
+
+    return true;
+}
+
+bool write_index (const Index& index, const std::string& dir) {
+    // the extended flags need version 3
+    bool extended = std::any_of(index.entries.begin(), index.entries.end(),
+                                [](const IndexEntry& entry) { return entry.extended_flags != 0; });
+    std::string buffer = INDEX_SIGNATURE;
+    put_be32(buffer, extended ? 3 : 2);
+    put_be32(buffer, index.entries.size());
+    for (const auto& entry : index.entries) {
+        size_t start = buffer.length();
+        for (uint32_t field : { entry.ctime_sec, entry.ctime_nsec, entry.mtime_sec, entry.mtime_nsec, entry.dev,
+                                entry.ino, entry.mode, entry.uid, entry.gid, entry.size }) {
+            put_be32(buffer, field);
+        }
+        buffer += hash_digest(entry.hash);
+        uint16_t flags = (entry.flags & ~(NAME_MASK | FLAG_EXTENDED)) | std::min<size_t>(entry.path.length(), NAME_MASK);
+        if (entry.extended_flags) {
+            flags |= FLAG_EXTENDED;
+        }
+        buffer.push_back(char(flags >> 8));
+        buffer.push_back(char(flags));
+        if (entry.extended_flags) {
+            buffer.push_back(char(entry.extended_flags >> 8));
+            buffer.push_back(char(entry.extended_flags));
+        }
+        buffer += entry.path;
+        buffer.append(8 - (buffer.length() - start) % 8, '\0');
+    }
+
+    if (!index.cache_tree.empty()) {
+        std::string extension;
+        for (const auto& node : index.cache_tree) {
+            extension += node.path.substr(node.path.rfind('/') == std::string::npos ? 0 : node.path.rfind('/') + 1);
+            extension += '\0' + std::to_string(node.entry_count) + ' ' + std::to_string(node.subtree_count) + '\n';
+            if (node.entry_count >= 0) {
+                extension += hash_digest(node.hash);
+            }
+        }
+        buffer += CACHE_TREE_SIGNATURE;
+        put_be32(buffer, extension.length());
+        buffer += extension;
+    }
+
+    unsigned char digest[20];
+    SHA1(reinterpret_cast<const unsigned char*>(buffer.data()), buffer.length(), digest);
+    buffer.append(reinterpret_cast<const char*>(digest), 20);
+
+    std::string lock_path = dir + "/.git/index.lock";
+    std::ofstream output(lock_path, std::ios::binary | std::ios::trunc);
+    if (!output.is_open() || !output.write(buffer.data(), buffer.length()).good()) {
+        std::cerr << "Failed to write " << lock_path << ".\n";
+        return false;
+    }
+    output.close();
+    std::filesystem::rename(lock_path, dir + "/.git/index");
+
+    return true;
+}
+
+const IndexEntry* index_find (const Index& index, const std::string& path) {
+    auto it = std::lower_bound(index.entries.begin(), index.entries.end(), path,
+                               [](const IndexEntry& entry, const std::string& key) { return entry.path < key; });
+    return it != index.entries.end() && it->path == path ? &*it : nullptr;
+}
+
+uint32_t worktree_mode (const struct stat& st) {
+    if (S_ISLNK(st.st_mode)) return 0120000;
+    return (st.st_mode & S_IXUSR) ? 0100755 : 0100644;
+}
+
+bool index_entry_clean (const Index& index, const IndexEntry& entry, const struct stat& st) {
+    if (entry.mode != worktree_mode(st) || entry.size != uint32_t(st.st_size) ||
+        entry.mtime_sec != uint32_t(st.st_mtim.tv_sec) || entry.mtime_nsec != uint32_t(st.st_mtim.tv_nsec) ||
+        entry.ino != uint32_t(st.st_ino)) {
+        return false;
+    }
+
+    // racily clean: written in the same tick as the index, a later change could keep the same stat data
+    return entry.mtime_sec < index.mtime_sec ||
+           (entry.mtime_sec == index.mtime_sec && entry.mtime_nsec < index.mtime_nsec);
+}
+
+IndexEntry index_entry_from_stat (const std::string& path, const std::string& hash, const struct stat& st) {
+    IndexEntry entry;
+    entry.ctime_sec = st.st_ctim.tv_sec;
+    entry.ctime_nsec = st.st_ctim.tv_nsec;
+    entry.mtime_sec = st.st_mtim.tv_sec;
+    entry.mtime_nsec = st.st_mtim.tv_nsec;
+    entry.dev = st.st_dev;
+    entry.ino = st.st_ino;
+    entry.mode = worktree_mode(st);
+    entry.uid = st.st_uid;
+    entry.gid = st.st_gid;
+    entry.size = st.st_size;
+    entry.hash = hash;
+    entry.path = path;
+
+    return entry;
+}
+
+bool write_index_for_tree (const std::string& tree_hash, const std::string& dir) {
+    Index index;
+    SparseCone cone;
+    bool sparse = read_sparse_checkout(cone, dir);
+    std::function<int(const std::string&, const std::string&, bool)> add_tree = [&](const std::string& hash, const std::string& path, bool skipped) {
+        std::string type, contents;
+        std::vector<TreeEntry> entries;
+        if (!read_object(hash, type, contents, dir) || !parse_tree(contents, entries)) {
+            std::cerr << "Invalid tree object " << hash << ".\n";
+            return -1;
+        }
+
+        size_t node = index.cache_tree.size();
+        index.cache_tree.push_back({path, 0, 0, hash});
+        int files = 0;
+        for (const auto& entry : entries) {
+            std::string entry_path = path.empty() ? entry.name : path + '/' + entry.name;
+            if (entry.mode == "40000") {
+                bool skip = skipped || (sparse && sparse_match(cone, entry_path) == SparseMatch::Excluded);
+                int nested = add_tree(entry.hash, entry_path, skip);
+                if (nested < 0) return -1;
+                files += nested;
+                index.cache_tree[node].subtree_count++;
+                continue;
+            }
+
+            struct stat st;
+            if (skipped || lstat((dir + '/' + entry_path).c_str(), &st) != 0) {
+                memset(&st, 0, sizeof(st)); // not checked out, the entry will never look clean
+            }
+            IndexEntry index_entry = index_entry_from_stat(entry_path, entry.hash, st);
+            index_entry.mode = std::stoul(entry.mode, nullptr, 8);
+            if (skipped) {
+                index_entry.extended_flags = INDEX_SKIP_WORKTREE;
+            }
+            index.entries.push_back(std::move(index_entry));
+            files++;
+        }
+        index.cache_tree[node].entry_count = files;
+
+        return files;
+    };
+
+    if (add_tree(tree_hash, "", false) < 0) {
+        return false;
+    }
+    std::sort(index.entries.begin(), index.entries.end(),
+              [](const IndexEntry& a, const IndexEntry& b) { return a.path < b.path; });
+
+    return write_index(index, dir);
+}
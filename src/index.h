@@ -0,0 +1,58 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#define INDEX_SKIP_WORKTREE 0x4000 // outside the sparse checkout, the worktree file is not expected
+
+// one path of .git/index with the stat data it was recorded with
+struct IndexEntry {
+    uint32_t ctime_sec = 0, ctime_nsec = 0;
+    uint32_t mtime_sec = 0, mtime_nsec = 0;
+    uint32_t dev = 0, ino = 0, mode = 0, uid = 0, gid = 0, size = 0;
+    std::string hash; // hex
+    uint16_t flags = 0;
+    uint16_t extended_flags = 0; // version 3, INDEX_SKIP_WORKTREE
+    std::string path;
+};
+
+// a directory of the cached tree extension, in the pre-order of the file
+struct CacheTreeNode {
+    std::string path;     // "" for the root, "a/b" below it
+    int entry_count = -1; // files below this directory, -1 once invalidated
+    int subtree_count = 0;
+    std::string hash;     // hex, only meaningful when entry_count >= 0
+};
+
+struct Index {
+    std::vector<IndexEntry> entries; // sorted by path
+    std::vector<CacheTreeNode> cache_tree;
+    uint32_t mtime_sec = 0, mtime_nsec = 0; // of the index file itself, for racy entries
+};
+
+// read a version 2 or 3 .git/index, false if it is missing, corrupt or of another version
+bool read_index (Index& index, const std::string& dir = ".");
+
+// write .git/index through index.lock
+bool write_index (const Index& index, const std::string& dir = ".");
+
+// the entry for a path, or nullptr
+const IndexEntry* index_find (const Index& index, const std::string& path);
+
+// git's mode for a file of the worktree: 100644, 100755 or 120000
+uint32_t worktree_mode (const struct stat& st);
+
+// whether the file still matches the stat data of its entry; files modified in the same
+// instant the index was written are never trusted
+bool index_entry_clean (const Index& index, const IndexEntry& entry, const struct stat& st);
+
+IndexEntry index_entry_from_stat (const std::string& path, const std::string& hash, const struct stat& st);
+
+// record a freshly checked out tree as the index of dir, with a complete cached tree. Paths
+// outside the sparse-checkout cone are marked skip-worktree.
+bool write_index_for_tree (const std::string& tree_hash, const std::string& dir = ".");
+
+#endif // INDEX_H
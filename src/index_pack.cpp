@@ -0,0 +1,393 @@
+#include <iostream>
+#include <filesystem>
+#include <string>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <zlib.h>
+#include "index_pack.h"
+#include "pack.h"
+#include "delta.h"
+#include "object_store.h"
+#include "repack.h"
+#include "zlib_implement.h"
+#include "trace.h"
+
+// bytes of the mapped pack kept in memory while indexing, pages behind it are dropped
+#define PACK_WINDOW (64ull << 20)
+
+PackReceiver::~PackReceiver () {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool PackReceiver::open (const std::string& pack_path) {
+    path = pack_path;
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0444);
+    if (fd < 0) {
+        error = "cannot create " + path;
+        return false;
+    }
+    return true;
+}
+
+bool PackReceiver::spill (const char* data, size_t length) {
+    bytes += length;
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written <= 0) {
+            error = "cannot write " + path;
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+static int hex_digit (char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool PackReceiver::receive (const char* data, size_t length) {
+    if (in_pack) {
+        return spill(data, length);
+    }
+
+    preamble.append(data, length);
+    size_t position = 0;
+    while (preamble.length() - position >= 4) {
+        if (preamble.compare(position, 4, "PACK") == 0) {
+            in_pack = true;
+            bool written = spill(preamble.data() + position, preamble.length() - position);
+            preamble.clear();
+            return written;
+        }
+
+        size_t line_length = 0;
+        for (int i = 0; i < 4; i++) {
+            int digit = hex_digit(preamble[position + i]);
+            if (digit < 0) {
+                error = "malformed upload-pack response";
+                return false;
+            }
+            line_length = (line_length << 4) | digit;
+        }
+        if (line_length == 0) {
+            position += 4;
+            continue;
+        }
+        if (line_length < 4) {
+            error = "malformed upload-pack response";
+            return false;
+        }
+        if (preamble.length() - position < line_length) {
+            break;
+        }
+        if (preamble.compare(position + 4, 4, "ERR ") == 0) {
+            error = "remote error: " + preamble.substr(position + 8, line_length - 8);
+            return false;
+        }
+        position += line_length;
+    }
+    preamble.erase(0, position);
+
+    return true;
+}
+
+bool PackReceiver::finish () {
+    if (fd >= 0 && close(fd) != 0 && error.empty()) {
+        error = "cannot write " + path;
+    }
+    fd = -1;
+    if (error.empty() && !in_pack) {
+        error = "the server sent no pack";
+    }
+    if (!error.empty()) {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+struct IndexEntry {
+    PackEntry header;
+    uint64_t offset = 0;
+    uint32_t crc = 0;
+    int type = 0;      // of the object, for a delta once it is resolved
+    std::string oid;   // raw, empty until known
+};
+
+// the two passes over a pack that has no index yet
+class PackIndexer {
+public:
+    explicit PackIndexer (const PackFile& pack) : pack(pack), context(EVP_MD_CTX_new(), EVP_MD_CTX_free) {}
+
+    // walk the entries in pack order: extent, CRC, and the id of every whole object
+    bool scan ();
+    // give every delta its type and id by applying it under its base
+    bool resolve ();
+
+    std::vector<IndexEntry> entries;
+    uint32_t deltas = 0;
+
+private:
+    bool resolve_children (uint32_t position, const std::string& base);
+    bool inflate_entry (uint32_t position, std::string& out);
+    bool fail (const std::string& message, uint64_t offset);
+    void hash_header (int type, uint64_t size);
+    std::string hash_final ();
+
+    const PackFile& pack;
+    Inflater inflater;
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> context;
+    std::vector<std::vector<uint32_t>> children;                     // ofs-deltas by base position
+    std::unordered_map<std::string, std::vector<uint32_t>> ref_children; // ref-deltas by base id
+    uint64_t touched = 0; // bytes of the pack read since its pages were last dropped
+};
+
+} // namespace
+
+bool PackIndexer::fail (const std::string& message, uint64_t offset) {
+    std::cerr << "error: " << message << " at offset " << offset << " in " << pack.pack_path << ".\n";
+    return false;
+}
+
+void PackIndexer::hash_header (int type, uint64_t size) {
+    std::string header = std::string(object_type_name(type)) + ' ' + std::to_string(size) + '\0';
+    EVP_DigestInit_ex(context.get(), EVP_sha1(), nullptr);
+    EVP_DigestUpdate(context.get(), header.data(), header.length());
+}
+
+std::string PackIndexer::hash_final () {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_DigestFinal_ex(context.get(), digest, &length);
+    return std::string(reinterpret_cast<const char*>(digest), 20);
+}
+
+bool PackIndexer::scan () {
+    uint64_t offset = 12;
+    uint64_t end = pack.pack_size - 20;
+    uint64_t released = 0;
+    entries.resize(pack.num_objects);
+    for (IndexEntry& entry : entries) {
+        if (offset - released > PACK_WINDOW) {
+            release_pack_pages(pack, released, offset);
+            released = offset;
+        }
+        entry.offset = offset;
+        if (!read_pack_entry(pack, offset, entry.header)) {
+            return fail("bad pack entry", offset);
+        }
+
+        // whole objects are hashed as they inflate, deltas only measured
+        bool whole = entry.header.type >= OBJ_COMMIT && entry.header.type <= OBJ_TAG;
+        if (!whole && entry.header.type != OBJ_OFS_DELTA && entry.header.type != OBJ_REF_DELTA) {
+            return fail("unknown object type " + std::to_string(entry.header.type), offset);
+        }
+        if (whole) {
+            hash_header(entry.header.type, entry.header.size);
+        }
+        uint64_t inflated = 0;
+        size_t consumed = 0;
+        const char* data = reinterpret_cast<const char*>(pack.pack_data) + entry.header.data_offset;
+        bool ok = inflater.decompress(data, end - entry.header.data_offset, [&](const char* chunk, size_t length) {
+            inflated += length;
+            if (whole) {
+                EVP_DigestUpdate(context.get(), chunk, length);
+            }
+            return inflated <= entry.header.size;
+        }, &consumed);
+        if (!ok || inflated != entry.header.size) {
+            return fail("cannot inflate entry", offset);
+        }
+
+        if (whole) {
+            entry.type = entry.header.type;
+            entry.oid = hash_final();
+        } else {
+            deltas++;
+        }
+        offset = entry.header.data_offset + consumed;
+        entry.crc = crc32_z(0, pack.pack_data + entry.offset, offset - entry.offset);
+    }
+
+    if (offset != end) {
+        return fail("garbage after the last entry", offset);
+    }
+    return true;
+}
+
+// resolving jumps around the pack, once a window's worth of it has been read all of it is dropped
+bool PackIndexer::inflate_entry (uint32_t position, std::string& out) {
+    const IndexEntry& entry = entries[position];
+    uint64_t end = position + 1 < entries.size() ? entries[position + 1].offset : pack.pack_size - 20;
+    touched += end - entry.offset + 4096;
+    if (touched > PACK_WINDOW) {
+        release_pack_pages(pack, 0, pack.pack_size);
+        touched = end - entry.offset;
+    }
+    if (!inflate_pack_data(pack, entry.header.data_offset, entry.header.size, out)) {
+        return fail("cannot inflate entry", entry.offset);
+    }
+    return true;
+}
+
+bool PackIndexer::resolve () {
+    // entries are in offset order, an ofs-delta finds its base by binary search
+    children.assign(entries.size(), {});
+    for (uint32_t i = 0; i < entries.size(); i++) {
+        const PackEntry& header = entries[i].header;
+        if (header.type == OBJ_OFS_DELTA) {
+            uint64_t base_offset = entries[i].offset - header.base_offset;
+            auto base = std::lower_bound(entries.begin(), entries.begin() + i, base_offset,
+                                         [](const IndexEntry& entry, uint64_t offset) { return entry.offset < offset; });
+            if (header.base_offset == 0 || base == entries.begin() + i || base->offset != base_offset) {
+                return fail("delta with no base", entries[i].offset);
+            }
+            children[base - entries.begin()].push_back(i);
+        }
+        else if (header.type == OBJ_REF_DELTA) {
+            ref_children[header.base_oid].push_back(i);
+        }
+    }
+
+    std::string contents;
+    for (uint32_t i = 0; i < entries.size(); i++) {
+        const IndexEntry& entry = entries[i];
+        if (entry.oid.empty() || (children[i].empty() && !ref_children.count(entry.oid))) {
+            continue;
+        }
+        if (!inflate_entry(i, contents) || !resolve_children(i, contents)) {
+            return false;
+        }
+    }
+
+    // whatever is left depends on an object the pack does not have: a thin pack
+    for (const IndexEntry& entry : entries) {
+        if (entry.oid.empty()) {
+            return fail("delta base " + digest_to_hash(entry.header.base_oid) + " is not in the pack", entry.offset);
+        }
+    }
+    return true;
+}
+
+bool PackIndexer::resolve_children (uint32_t position, const std::string& base) {
+    std::vector<uint32_t> list = std::move(children[position]);
+    auto by_id = ref_children.find(entries[position].oid);
+    if (by_id != ref_children.end()) {
+        list.insert(list.end(), by_id->second.begin(), by_id->second.end());
+        ref_children.erase(by_id);
+    }
+
+    std::string delta, contents;
+    for (uint32_t child : list) {
+        IndexEntry& entry = entries[child];
+        if (!inflate_entry(child, delta)) {
+            return false;
+        }
+        try {
+            contents = apply_delta(delta, base);
+        }
+        catch (const std::runtime_error& e) {
+            return fail(std::string("cannot apply delta: ") + e.what(), entry.offset);
+        }
+
+        entry.type = entries[position].type;
+        hash_header(entry.type, contents.length());
+        EVP_DigestUpdate(context.get(), contents.data(), contents.length());
+        entry.oid = hash_final();
+        if (!resolve_children(child, contents)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool index_pack (const std::string& pack_path, IndexPackResult& result, const std::string& dir) {
+    TraceRegion region("index_pack", "index");
+    PackFile pack;
+    if (!open_pack_data(pack_path, pack)) {
+        return false;
+    }
+    const unsigned char* version = pack.pack_data + 4;
+    if (version[0] != 0 || version[1] != 0 || version[2] != 0 || (version[3] != 2 && version[3] != 3)) {
+        std::cerr << "error: unsupported pack version in " << pack_path << ".\n";
+        return false;
+    }
+
+    // the trailing checksum covers everything before it
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> checksum_context(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    EVP_DigestInit_ex(checksum_context.get(), EVP_sha1(), nullptr);
+    for (uint64_t offset = 0; offset < pack.pack_size - 20; offset += PACK_WINDOW) {
+        uint64_t length = std::min<uint64_t>(PACK_WINDOW, pack.pack_size - 20 - offset);
+        EVP_DigestUpdate(checksum_context.get(), pack.pack_data + offset, length);
+        release_pack_pages(pack, offset, offset + length);
+    }
+    EVP_DigestFinal_ex(checksum_context.get(), digest, nullptr);
+    if (memcmp(digest, pack.pack_data + pack.pack_size - 20, 20) != 0) {
+        std::cerr << "error: " << pack_path << ": pack checksum mismatch.\n";
+        return false;
+    }
+
+    PackIndexer indexer(pack);
+    if (!indexer.scan() || !indexer.resolve()) {
+        return false;
+    }
+    trace_data("index_pack", "objects", pack.num_objects);
+    trace_data("index_pack", "deltas", indexer.deltas);
+
+    std::vector<PackInput> objects(indexer.entries.size());
+    std::vector<uint64_t> offsets(indexer.entries.size());
+    std::vector<uint32_t> crcs(indexer.entries.size());
+    for (size_t i = 0; i < indexer.entries.size(); i++) {
+        objects[i].hash = digest_to_hash(indexer.entries[i].oid);
+        offsets[i] = indexer.entries[i].offset;
+        crcs[i] = indexer.entries[i].crc;
+    }
+    std::vector<IndexEntry>().swap(indexer.entries); // per-object state is what grows with the pack, let it go first
+
+    std::string checksum(reinterpret_cast<const char*>(pack.pack_data) + pack.pack_size - 20, 20);
+    std::string pack_dir = dir + "/.git/objects/pack/";
+    std::string temp_index = pack_path + "_idx";
+    if (!write_pack_index(temp_index, objects, offsets, crcs, checksum)) {
+        std::cerr << "Failed to write " << temp_index << ".\n";
+        std::filesystem::remove(temp_index);
+        return false;
+    }
+
+    // the index is renamed last, a pack only becomes visible once it has one
+    result.name = "pack-" + digest_to_hash(checksum);
+    result.objects = pack.num_objects;
+    result.deltas = indexer.deltas;
+    std::error_code ec;
+    std::filesystem::rename(pack_path, pack_dir + result.name + ".pack", ec);
+    if (!ec) {
+        std::filesystem::rename(temp_index, pack_dir + result.name + ".idx", ec);
+    }
+    if (ec) {
+        std::cerr << "Failed to install " << result.name << ": " << ec.message() << ".\n";
+        std::filesystem::remove(temp_index);
+        return false;
+    }
+    reload_packs(dir);
+
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef INDEX_PACK_H
+#define INDEX_PACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct IndexPackResult {
+    std::string name;      // "pack-<checksum>"
+    uint32_t objects = 0;
+    uint32_t deltas = 0;
+};
+
+// the body of an upload-pack response without side-band: the negotiation pkt-lines, then the
+// raw pack, which goes straight to a file as it arrives so it never has to fit in memory
+class PackReceiver {
+public:
+    PackReceiver () = default;
+    ~PackReceiver ();
+    PackReceiver (const PackReceiver&) = delete;
+    PackReceiver& operator= (const PackReceiver&) = delete;
+
+    // create the file the pack is spilled to, replacing a stale one
+    bool open (const std::string& pack_path);
+    // feed the response as it arrives, false (with error set) aborts the transfer
+    bool receive (const char* data, size_t length);
+    // close the file, false if no pack arrived; the file is removed on failure
+    bool finish ();
+
+    std::string path;
+    uint64_t bytes = 0;   // of pack spilled so far
+    std::string error;    // why the transfer failed, empty while it has not
+
+private:
+    bool spill (const char* data, size_t length);
+
+    std::string preamble; // pkt-lines in front of the pack, until one is complete
+    bool in_pack = false;
+    int fd = -1;
+};
+
+// index a pack received from a remote and install it under .git/objects/pack. One pass over the
+// entries finds their extents and CRCs and hashes the whole objects as they inflate; each delta
+// is then resolved under its base, depth first, so no entry is inflated more than twice. Every
+// delta base must be in the pack. False, with the reason on stderr, if the pack is corrupt.
+// The pack is mapped but only a window of PACK_WINDOW bytes of it is kept in memory at a time,
+// so packs far larger than memory index with flat usage.
+bool index_pack (const std::string& pack_path, IndexPackResult& result, const std::string& dir = ".");
+
+#endif // INDEX_PACK_H
@@ -0,0 +1,129 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include "local_clone.h"
+#include "refs.h"
+#include "object_store.h"
+
+bool is_local_repository (const std::string& url) {
+    return url.rfind("file://", 0) == 0 || url.find("://") == std::string::npos;
+}
+
+std::string local_repository_path (const std::string& url) {
+    if (url.rfind("file://", 0) == 0) {
+        return url.substr(7);
+    }
+
+    return url;
+}
+
+// share the data blocks of source with a new file at target (btrfs, xfs), false if unsupported
+static bool reflink_file (const std::filesystem::path& source, const std::filesystem::path& target) {
+    int source_fd = open(source.c_str(), O_RDONLY);
+    if (source_fd < 0) {
+        return false;
+    }
+    int target_fd = open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0444);
+    if (target_fd < 0) {
+        close(source_fd);
+        return false;
+    }
+
+    bool cloned = ioctl(target_fd, FICLONE, source_fd) == 0;
+    close(source_fd);
+    close(target_fd);
+    if (!cloned) {
+        unlink(target.c_str());
+    }
+
+    return cloned;
+}
+
+long link_objects (const std::string& source, const std::string& dir) {
+    std::filesystem::path source_objects = source + "/.git/objects";
+    std::filesystem::path target_objects = dir + "/.git/objects";
+    long linked = 0;
+
+    std::error_code ec;
+    for (auto it = std::filesystem::recursive_directory_iterator(source_objects, ec);
+         !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        std::filesystem::path relative = it->path().lexically_relative(source_objects);
+        std::filesystem::path target = target_objects / relative;
+        if (it->is_directory()) {
+            std::filesystem::create_directories(target);
+            continue;
+        }
+        // temporary files of a writer running in the source repository
+        std::string name = relative.filename().string();
+        if (name.rfind("tmp_", 0) == 0 || (name.length() > 5 && name.compare(name.length() - 5, 5, ".lock") == 0)) {
+            continue;
+        }
+
+        // objects are immutable, so the clone can share the very same files
+        std::error_code link_error;
+        std::filesystem::create_hard_link(it->path(), target, link_error);
+        if (link_error && !reflink_file(it->path(), target) &&
+            !std::filesystem::copy_file(it->path(), target, std::filesystem::copy_options::overwrite_existing, link_error)) {
+            std::cerr << "Failed to copy " << it->path() << ": " << link_error.message() << '\n';
+            return -1;
+        }
+        linked++;
+    }
+    if (ec) {
+        std::cerr << "Failed to read " << source_objects << ": " << ec.message() << '\n';
+        return -1;
+    }
+
+    return linked;
+}
+
+bool write_clone_refs (const std::vector<std::pair<std::string, std::string>>& refs, const std::string& head_branch,
+                       const std::string& head, const std::string& dir) {
+    // everything goes into packed-refs with one rename, however many refs the remote has
+    RefTransaction transaction(dir);
+    transaction.set_packed(true);
+    for (const auto& [name, hash] : refs) {
+        if (name.rfind("refs/heads/", 0) == 0) {
+            transaction.update("refs/remotes/origin/" + name.substr(11), hash);
+        }
+        else if (name.rfind("refs/tags/", 0) == 0) {
+            transaction.update(name, hash);
+        }
+    }
+    if (!head_branch.empty() && !head.empty()) {
+        transaction.update("refs/heads/" + head_branch, head);
+    }
+    if (!transaction.commit()) {
+        return false;
+    }
+
+    if (head_branch.empty()) {
+        std::ofstream target_head(dir + "/.git/HEAD", std::ios::trunc);
+        target_head << head << '\n'; // detached
+        return target_head.good();
+    }
+
+    return write_symref("HEAD", "refs/heads/" + head_branch, dir);
+}
+
+bool clone_refs (const std::string& source, const std::string& dir, std::string& head) {
+    std::string head_branch;
+    std::ifstream head_file(source + "/.git/HEAD");
+    std::string line;
+    if (std::getline(head_file, line) && line.rfind("ref: refs/heads/", 0) == 0) {
+        head_branch = line.substr(16);
+    }
+
+    head = resolve_revision("HEAD", source);
+    if (!write_clone_refs(list_refs(source), head_branch, head, dir)) {
+        std::cerr << "Failed to write the refs of " << source << ".\n";
+        return false;
+    }
+
+    return true;
+}
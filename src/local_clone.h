@@ -0,0 +1,28 @@
+#ifndef LOCAL_CLONE_H
+#define LOCAL_CLONE_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// whether a clone source names a repository on this machine: a path or a file:// URL
+bool is_local_repository (const std::string& url);
+
+// the repository directory behind a local path or file:// URL
+std::string local_repository_path (const std::string& url);
+
+// hardlink (or reflink, or as a last resort copy) every file under the source object
+// directory into dir, which must already be initialized; returns the number of files
+long link_objects (const std::string& source, const std::string& dir);
+
+// record the refs of a remote in a fresh clone: its branches under refs/remotes/origin, its tags,
+// and a local branch head_branch at head, or a detached HEAD when head_branch is empty
+bool write_clone_refs (const std::vector<std::pair<std::string, std::string>>& refs, const std::string& head_branch,
+                       const std::string& head, const std::string& dir);
+
+// point dir at the same history as source: its branches under refs/remotes/origin, a local
+// branch for the source HEAD, and its tags. head is the HEAD commit, empty when the source has
+// none; false, with the reason on stderr, if the refs could not be written
+bool clone_refs (const std::string& source, const std::string& dir, std::string& head);
+
+#endif // LOCAL_CLONE_H
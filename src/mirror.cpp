@@ -0,0 +1,414 @@
+#include <iostream>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <algorithm>
+#include <condition_variable>
+#include <curl/curl.h>
+#include <unistd.h>
+#include "mirror.h"
+#include "commands.h"
+#include "object_store.h"
+#include "index_pack.h"
+#include "remote_refs.h"
+#include "pkt_line.h"
+#include "refs.h"
+#include "trace.h"
+
+#define MAX_HAVES 256
+
+namespace {
+
+// a fixed set of threads taking jobs in the order they were submitted
+class WorkerPool {
+public:
+    explicit WorkerPool (unsigned threads) {
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    // runs whatever is still queued first
+    ~WorkerPool () {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    void submit (std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        ready.notify_one();
+    }
+
+private:
+    void work () {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (jobs.empty()) {
+                    return;
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::function<void()>> jobs;
+    bool stopping = false;
+};
+
+struct MirrorRepository {
+    std::string url;
+    std::string dir;
+    RefTable refs;
+    std::unique_ptr<RefAdvertisementParser> parser;
+    std::vector<std::pair<std::string, std::string>> remote_refs;
+
+    std::string request;   // the upload-pack request body, alive while it is sent
+    PackReceiver receiver; // spills the pack to a file as it arrives
+
+    std::string error;     // why the mirror failed, empty while it has not
+    std::string summary;
+};
+
+struct Transfer {
+    MirrorRepository* repository;
+    bool pack;  // the upload-pack POST, else the ref advertisement
+    CURL* handle = nullptr;
+    struct curl_slist* headers = nullptr;
+};
+
+} // namespace
+
+static size_t refs_received (void* data, size_t element_size, size_t num_elements, void* userdata) {
+    size_t total_size = element_size * num_elements;
+    MirrorRepository* repository = static_cast<MirrorRepository*>(userdata);
+
+    return repository->parser->feed(static_cast<const char*>(data), total_size) ? total_size : 0; // a short count aborts the transfer
+}
+
+static size_t pack_received (void* data, size_t element_size, size_t num_elements, void* userdata) {
+    size_t total_size = element_size * num_elements;
+    MirrorRepository* repository = static_cast<MirrorRepository*>(userdata);
+
+    return repository->receiver.receive(static_cast<const char*>(data), total_size) ? total_size : 0;
+}
+
+namespace {
+
+class Mirror {
+public:
+    Mirror (std::vector<MirrorRepository>& repositories, const MirrorOptions& options);
+    ~Mirror ();
+
+    void run ();
+
+private:
+    void start (Transfer* transfer);
+    void finish (Transfer* transfer, CURLcode result);
+    void plan_fetch (MirrorRepository& repository);
+    void install (MirrorRepository& repository);
+    void update_refs (MirrorRepository& repository);
+
+    std::vector<MirrorRepository>& repositories;
+    unsigned max_transfers;
+    CURLM* multi;
+    std::deque<Transfer*> waiting;
+    unsigned active = 0;
+    WorkerPool pool;
+};
+
+} // namespace
+
+static unsigned thread_count (unsigned requested) {
+    unsigned cores = std::thread::hardware_concurrency();
+    return requested > 0 ? requested : std::max(cores, 1u);
+}
+
+Mirror::Mirror (std::vector<MirrorRepository>& repositories, const MirrorOptions& options)
+    : repositories(repositories), max_transfers(std::max(options.transfers, 1u)), pool(thread_count(options.threads)) {
+    multi = curl_multi_init();
+    // share connections: multiplex over HTTP/2, and keep enough idle ones for every transfer slot
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, static_cast<long>(max_transfers));
+    curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, static_cast<long>(max_transfers));
+}
+
+Mirror::~Mirror () {
+    curl_multi_cleanup(multi);
+}
+
+void Mirror::start (Transfer* transfer) {
+    MirrorRepository& repository = *transfer->repository;
+    CURL* handle = curl_easy_init();
+    transfer->handle = handle;
+    curl_easy_setopt(handle, CURLOPT_PRIVATE, transfer);
+    curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, "");
+    // HTTP/2 where TLS negotiates it, waiting for a connection that can multiplex rather than opening another
+    curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, static_cast<long>(CURL_HTTP_VERSION_2TLS));
+    curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, static_cast<void*>(&repository));
+
+    if (!transfer->pack) {
+        repository.parser = std::make_unique<RefAdvertisementParser>(repository.refs);
+        curl_easy_setopt(handle, CURLOPT_URL, (repository.url + "/info/refs?service=git-upload-pack").c_str());
+        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, refs_received);
+    }
+    else {
+        curl_easy_setopt(handle, CURLOPT_URL, (repository.url + "/git-upload-pack").c_str());
+        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, pack_received);
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDS, repository.request.data());
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(repository.request.length()));
+        transfer->headers = curl_slist_append(transfer->headers, "Content-Type: application/x-git-upload-pack-request");
+        transfer->headers = curl_slist_append(transfer->headers, "Accept: application/x-git-upload-pack-result");
+        curl_easy_setopt(handle, CURLOPT_HTTPHEADER, transfer->headers);
+    }
+
+    curl_multi_add_handle(multi, handle);
+    active++;
+}
+
+void Mirror::run () {
+    TraceRegion region("mirror", "transfers");
+    for (MirrorRepository& repository : repositories) {
+        waiting.push_back(new Transfer{&repository, false});
+    }
+
+    int running = 0;
+    do {
+        while (active < max_transfers && !waiting.empty()) {
+            start(waiting.front());
+            waiting.pop_front();
+        }
+
+        curl_multi_perform(multi, &running);
+        int queued;
+        while (CURLMsg* message = curl_multi_info_read(multi, &queued)) {
+            if (message->msg == CURLMSG_DONE) {
+                Transfer* transfer = nullptr;
+                curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &transfer);
+                finish(transfer, message->data.result);
+            }
+        }
+
+        if (running > 0) {
+            curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+        }
+    } while (active > 0 || !waiting.empty());
+}
+
+void Mirror::finish (Transfer* transfer, CURLcode result) {
+    static TraceCounter connections("mirror", "new_connections");
+    static TraceCounter http2("mirror", "http2_transfers");
+    MirrorRepository& repository = *transfer->repository;
+
+    long new_connections = 0;
+    long version = 0;
+    curl_easy_getinfo(transfer->handle, CURLINFO_NUM_CONNECTS, &new_connections);
+    curl_easy_getinfo(transfer->handle, CURLINFO_HTTP_VERSION, &version);
+    connections.add(new_connections);
+    http2.add(version == CURL_HTTP_VERSION_2_0);
+
+    curl_multi_remove_handle(multi, transfer->handle);
+    curl_easy_cleanup(transfer->handle);
+    curl_slist_free_all(transfer->headers);
+    bool pack = transfer->pack;
+    delete transfer;
+    active--;
+
+    if (pack && !repository.receiver.error.empty()) {
+        repository.error = repository.receiver.error; // it aborted the transfer
+    }
+    if (result != CURLE_OK && repository.error.empty()) {
+        repository.error = curl_easy_strerror(result);
+    }
+
+    if (!pack) {
+        if (repository.error.empty()) {
+            plan_fetch(repository);
+        }
+        return;
+    }
+
+    bool received = repository.receiver.finish();
+    if (!received || !repository.error.empty()) {
+        if (repository.error.empty()) {
+            repository.error = repository.receiver.error;
+        }
+        std::filesystem::remove(repository.receiver.path);
+        return;
+    }
+    pool.submit([this, &repository]() { install(repository); });
+}
+
+// ask for every advertised object the mirror does not have yet
+void Mirror::plan_fetch (MirrorRepository& repository) {
+    if (!repository.parser->finish()) {
+        repository.error = "malformed ref advertisement";
+        return;
+    }
+    trace_data("mirror", "refs", repository.refs.size());
+
+    std::error_code ec;
+    if (!std::filesystem::exists(repository.dir + "/.git")) {
+        std::filesystem::create_directories(repository.dir, ec);
+        if (!git_init(repository.dir, false)) {
+            repository.error = "cannot create " + repository.dir;
+            return;
+        }
+    }
+
+    std::set<std::string> wants;
+    for (size_t i = 0; i < repository.refs.size(); i++) {
+        std::string name = repository.refs.name(i);
+        if (name.rfind("refs/", 0) != 0 || (name.length() > 3 && name.compare(name.length() - 3, 3, "^{}") == 0)) {
+            continue;
+        }
+        std::string hash = repository.refs.hash(i);
+        repository.remote_refs.emplace_back(name, hash);
+        if (!has_object(hash, repository.dir)) {
+            wants.insert(hash);
+        }
+    }
+    if (wants.empty()) {
+        pool.submit([this, &repository]() { update_refs(repository); });
+        return;
+    }
+
+    std::string request;
+    for (const std::string& want : wants) {
+        request += pkt_line("want " + want + (request.empty() ? " ofs-delta\n" : "\n"));
+    }
+    request += PKT_FLUSH;
+    // the current tips tell the server what it can leave out
+    size_t haves = 0;
+    for (const auto& [name, hash] : read_all_refs(repository.dir)) {
+        if (haves++ < MAX_HAVES && has_object(hash, repository.dir)) {
+            request += pkt_line("have " + hash + "\n");
+        }
+    }
+    request += pkt_line("done\n");
+    repository.request = std::move(request);
+
+    std::string pack_dir = repository.dir + "/.git/objects/pack/";
+    std::filesystem::create_directories(pack_dir, ec);
+    if (!repository.receiver.open(pack_dir + "tmp_pack_mirror_" + std::to_string(getpid()))) {
+        repository.error = repository.receiver.error;
+        return;
+    }
+
+    // a started repository goes ahead of those still waiting for their refs
+    waiting.push_front(new Transfer{&repository, true});
+}
+
+void Mirror::install (MirrorRepository& repository) {
+    IndexPackResult result;
+    if (!index_pack(repository.receiver.path, result, repository.dir)) {
+        repository.error = "cannot index the pack from " + repository.url;
+        std::filesystem::remove(repository.receiver.path);
+        return;
+    }
+    repository.summary = std::to_string(result.objects) + " objects (" + std::to_string(repository.receiver.bytes) + " bytes), ";
+    update_refs(repository);
+}
+
+// make the local refs exactly the remote ones, deleting what the remote no longer has
+void Mirror::update_refs (MirrorRepository& repository) {
+    std::map<std::string, std::string> local;
+    for (const auto& [name, hash] : read_all_refs(repository.dir)) {
+        local[name] = hash;
+    }
+
+    RefTransaction transaction(repository.dir);
+    transaction.set_packed(true);
+    size_t changed = 0;
+    for (const auto& [name, hash] : repository.remote_refs) {
+        if (!has_object(hash, repository.dir)) {
+            repository.error = "the pack does not contain " + hash + " for " + name;
+            return;
+        }
+        auto found = local.find(name);
+        if (found == local.end() || found->second != hash) {
+            transaction.update(name, hash);
+            changed++;
+        }
+        if (found != local.end()) {
+            local.erase(found);
+        }
+    }
+    for (const auto& [name, hash] : local) {
+        transaction.remove(name);
+        changed++;
+    }
+    if (changed > 0 && !transaction.commit()) {
+        repository.error = "cannot update the refs of " + repository.dir;
+        return;
+    }
+
+    std::string head = repository.refs.symref_target("HEAD");
+    if (!head.empty() && read_ref("HEAD", repository.dir) != "ref: " + head && !write_symref("HEAD", head, repository.dir)) {
+        repository.error = "cannot point HEAD at " + head;
+        return;
+    }
+    if (repository.summary.empty() && changed == 0) {
+        repository.summary = "up to date";
+        return;
+    }
+    repository.summary += std::to_string(changed) + " refs updated";
+}
+
+int mirror (const std::vector<std::pair<std::string, std::string>>& repositories, const MirrorOptions& options) {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    std::vector<MirrorRepository> states(repositories.size());
+    for (size_t i = 0; i < repositories.size(); i++) {
+        states[i].url = repositories[i].first;
+        states[i].dir = repositories[i].second;
+        while (!states[i].url.empty() && states[i].url.back() == '/') {
+            states[i].url.pop_back();
+        }
+    }
+
+    {
+        // the pool is joined when the mirror goes out of scope, after the last install
+        Mirror mirror(states, options);
+        mirror.run();
+    }
+
+    int status = EXIT_SUCCESS;
+    for (const MirrorRepository& repository : states) {
+        if (!repository.error.empty()) {
+            std::cerr << "error: " << repository.url << ": " << repository.error << '\n';
+            status = EXIT_FAILURE;
+        }
+        else {
+            std::cout << repository.url << " -> " << repository.dir << ": " << repository.summary << '\n';
+        }
+    }
+
+    return status;
+}
@@ -0,0 +1,21 @@
+#ifndef MIRROR_H
+#define MIRROR_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+struct MirrorOptions {
+    unsigned transfers = 16; // HTTP requests in flight at once
+    unsigned threads = 0;    // pack indexing workers, 0 uses one per core
+};
+
+// mirror every remote into its directory: all of its refs/ and HEAD, objects kept as the packs
+// the server sent. A directory that is already a mirror only fetches what it lacks, its local
+// refs telling the server what it has, and refs gone from the remote are deleted.
+// All transfers run on one curl multi handle, so connections are reused across repositories
+// and multiplexed over HTTP/2 when the server offers it; at most options.transfers are in
+// flight. Finished packs are indexed on a shared pool of threads while others download.
+int mirror (const std::vector<std::pair<std::string, std::string>>& repositories, const MirrorOptions& options);
+
+#endif // MIRROR_H
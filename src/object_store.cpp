@@ -0,0 +1,347 @@
+#include <iostream>
+#include <filesystem>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <openssl/sha.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "object_store.h"
+#include "zlib_implement.h"
+#include "pack.h"
+#include "trace.h"
+#include "refs.h"
+#include "batch_io.h"
+
+std::string compute_sha1 (const std::string& data, bool print_out) {
+    unsigned char hash[20]; // 160 bits long for SHA1
+    SHA1(reinterpret_cast<const unsigned char*>(data.c_str()), data.size(), hash);
+    std::stringstream ss;
+    ss << std::hex << std::setfill('0');
+    for (const auto& byte : hash) {
+        ss << std::setw(2) << static_cast<int>(byte);
+    }
+
+    if (print_out)  {
+        std::cout << ss.str() << std::endl;
+    }
+
+    return ss.str();
+}
+
+static bool write_all (int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+// the whole file in one read, sized from fstat
+static bool read_file (const std::string& path, std::string& out) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    if (ok) {
+        out.resize(st.st_size);
+        size_t done = 0;
+        while (ok && done < out.length()) {
+            ssize_t got = read(fd, &out[done], out.length() - done);
+            ok = got > 0;
+            done += ok ? got : 0;
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+// shared by both compress_and_store overloads, so each event is reported once
+static TraceTimer store_timer("object_store", "compress_and_store");
+static TraceCounter store_written("object_store", "loose_written");
+static TraceCounter store_written_bytes("object_store", "loose_written_bytes");
+static TraceCounter store_present("object_store", "already_present");
+
+void compress_and_store (const std::string& hash, const std::string& content, std::string dir) {
+    TraceTimerScope scope(store_timer);
+
+    std::string hash_folder = hash.substr(0, 2);
+    std::string object_path = dir + "/.git/objects/" + hash_folder + '/';
+    if (!std::filesystem::exists(object_path)) {
+        std::filesystem::create_directories(object_path);
+    }
+
+    std::string object_file_path = object_path + hash.substr(2);
+    if (!std::filesystem::exists(object_file_path) && !has_packed_object(hash, dir)) {
+        // deflate straight into the file
+        static thread_local Deflater deflater;
+        int fd = open(object_file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        bool stored = fd >= 0 && deflater.compress(content.data(), content.length(), [fd](const char* data, size_t length) {
+            return write_all(fd, data, length);
+        });
+        if (fd >= 0 && close(fd) != 0) {
+            stored = false;
+        }
+        if (!stored) {
+            std::cerr << "Failed to compress data.\n";
+            return;
+        }
+        store_written.add(1);
+        store_written_bytes.add(content.length());
+    }
+    else {
+        store_present.add(1);
+    }
+}
+
+void compress_and_store (const std::string& hash, const std::string& content, FileBatch& batch, const std::string& dir) {
+    TraceTimerScope scope(store_timer);
+
+    std::string object_path = dir + "/.git/objects/" + hash.substr(0, 2);
+    std::string object_file_path = object_path + '/' + hash.substr(2);
+    if (std::filesystem::exists(object_file_path) || has_packed_object(hash, dir)) {
+        store_present.add(1);
+        return;
+    }
+
+    batch.mkdir(object_path);
+    batch.write(object_file_path, compress_string(content));
+    store_written.add(1);
+    store_written_bytes.add(content.length());
+}
+
+static int hex_value (char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return 0;
+}
+
+std::string hash_digest (const std::string& input) {
+    std::string condensed(input.length() / 2, '\0');
+
+    for (size_t i = 0; i + 1 < input.length(); i += 2) {
+        condensed[i / 2] = static_cast<char>((hex_value(input[i]) << 4) | hex_value(input[i + 1]));
+    }
+
+    return condensed;
+}
+
+// convert git hash digest to hash
+std::string digest_to_hash (const std::string& digest) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hash(digest.length() * 2, '0');
+    for (size_t i = 0; i < digest.length(); i++) {
+        unsigned char c = digest[i];
+        hash[i * 2] = digits[c >> 4];
+        hash[i * 2 + 1] = digits[c & 0x0F];
+    }
+
+    return hash;
+}
+
+bool read_object (const std::string& hash, std::string& type, std::string& contents, const std::string& dir) {
+    if (hash.length() != 40) {
+        return false;
+    }
+
+    // read the loose object
+    std::string object_path = dir + "/.git/objects/" + hash.substr(0, 2) + '/' + hash.substr(2);
+    static TraceCounter loose_reads("object_store", "read_loose");
+    static TraceCounter packed_reads("object_store", "read_packed");
+    std::string compressed;
+    if (!read_file(object_path, compressed)) {
+        packed_reads.add(1);
+        return read_packed_object(hash, type, contents, dir);
+    }
+    loose_reads.add(1);
+
+    // the payload is inflated straight into contents, sized from the header
+    uint64_t size = 0;
+    contents.clear();
+    return inflate_loose_object(compressed, type, size, [&contents, &size](const char* data, size_t length) {
+        if (contents.empty()) {
+            contents.reserve(size);
+        }
+        contents.append(data, length);
+        return true;
+    }) && contents.length() == size;
+}
+
+bool inflate_loose_object (const std::string& compressed, std::string& type, uint64_t& size,
+                           const std::function<bool(const char*, size_t)>& sink) {
+    static thread_local Inflater inflater;
+    std::string header;
+    bool header_done = false;
+    bool ok = inflater.decompress(compressed.data(), compressed.length(), [&](const char* data, size_t length) {
+        if (!header_done) {
+            // "<type> <size>\0", which may in theory straddle two pieces of output
+            const char* end = static_cast<const char*>(memchr(data, '\0', length));
+            header.append(data, end ? end - data : length);
+            if (!end) {
+                return header.length() < 64;
+            }
+            size_t space = header.find(' ');
+            if (space == std::string::npos) {
+                return false;
+            }
+            type = header.substr(0, space);
+            size = strtoull(header.c_str() + space + 1, nullptr, 10);
+            header_done = true;
+            length -= end + 1 - data;
+            data = end + 1;
+        }
+        return length == 0 || sink(data, length);
+    });
+    return ok && header_done;
+}
+
+bool stream_object (const std::string& hash, std::string& type, const std::function<bool(const char*, size_t)>& sink,
+                    const std::string& dir) {
+    if (hash.length() != 40) {
+        return false;
+    }
+
+    std::string compressed;
+    if (read_file(dir + "/.git/objects/" + hash.substr(0, 2) + '/' + hash.substr(2), compressed)) {
+        uint64_t size = 0;
+        return inflate_loose_object(compressed, type, size, sink);
+    }
+
+    std::string contents;
+    return read_packed_object(hash, type, contents, dir) && (contents.empty() || sink(contents.data(), contents.length()));
+}
+
+bool has_object (const std::string& hash, const std::string& dir) {
+    if (hash.length() != 40) {
+        return false;
+    }
+
+    std::error_code ec;
+    std::string object_path = dir + "/.git/objects/" + hash.substr(0, 2) + '/' + hash.substr(2);
+    return std::filesystem::exists(object_path, ec) || has_packed_object(hash, dir);
+}
+
+static bool is_hex_hash (const std::string& value) {
+    return value.length() == 40 &&
+           value.find_first_not_of("0123456789abcdef") == std::string::npos;
+}
+
+std::string resolve_revision (const std::string& revision, const std::string& dir) {
+    if (is_hex_hash(revision)) {
+        return revision;
+    }
+
+    // the same lookup order git uses for a short ref name
+    std::vector<std::string> candidates = {
+        revision, "refs/" + revision, "refs/tags/" + revision, "refs/heads/" + revision
+    };
+
+    for (const auto& candidate : candidates) {
+        std::string value = read_ref(candidate, dir);
+
+        // follow symbolic refs such as HEAD
+        for (int depth = 0; value.rfind("ref: ", 0) == 0 && depth < 5; depth++) {
+            value = read_ref(value.substr(5), dir);
+        }
+
+        if (is_hex_hash(value)) {
+            return value;
+        }
+    }
+
+    return {};
+}
+
+bool parse_commit (const std::string& contents, CommitObject& commit) {
+    size_t pos = 0;
+    while (pos < contents.length()) {
+        size_t line_end = contents.find('\n', pos);
+        if (line_end == std::string::npos) {
+            return false;
+        }
+
+        // an empty line separates the headers from the message
+        if (line_end == pos) {
+            commit.message = contents.substr(pos + 1);
+            break;
+        }
+
+        std::string line = contents.substr(pos, line_end - pos);
+        if (line.rfind("tree ", 0) == 0) {
+            commit.tree = line.substr(5);
+        }
+        else if (line.rfind("parent ", 0) == 0) {
+            if (line.length() > 7) {
+                commit.parents.push_back(line.substr(7));
+            }
+        }
+        else if (line.rfind("author ", 0) == 0) {
+            commit.author = line.substr(7);
+        }
+        else if (line.rfind("committer ", 0) == 0) {
+            commit.committer = line.substr(10);
+
+            // the timestamp follows the closing bracket of the email
+            size_t email_end = commit.committer.rfind('>');
+            if (email_end != std::string::npos) {
+                commit.commit_time = std::strtoull(commit.committer.c_str() + email_end + 1, nullptr, 10);
+            }
+        }
+
+        pos = line_end + 1;
+    }
+
+    return commit.tree.length() == 40;
+}
+
+std::vector<std::pair<std::string, std::string>> list_refs (const std::string& dir) {
+    return read_all_refs(dir);
+}
+
+bool parse_tree (const std::string& contents, std::vector<TreeEntry>& entries) {
+    size_t pos = 0;
+    while (pos < contents.length()) {
+        // "<mode> <name>\0<20 byte hash>"
+        size_t space = contents.find(' ', pos);
+        size_t null_pos = contents.find('\0', pos);
+        if (space == std::string::npos || null_pos == std::string::npos || space > null_pos ||
+            null_pos + 21 > contents.length()) {
+            return false;
+        }
+
+        TreeEntry entry;
+        entry.mode = contents.substr(pos, space - pos);
+        entry.name = contents.substr(space + 1, null_pos - space - 1);
+        entry.hash = digest_to_hash(contents.substr(null_pos + 1, 20));
+        entries.push_back(std::move(entry));
+        pos = null_pos + 21;
+    }
+
+    return true;
+}
+
+std::vector<std::string> reference_tips (const std::string& dir) {
+    std::vector<std::string> tips;
+    for (const auto& [name, hash] : list_refs(dir)) {
+        tips.push_back(hash);
+    }
+
+    std::string head = resolve_revision("HEAD", dir);
+    if (!head.empty()) {
+        tips.push_back(head);
+    }
+
+    std::sort(tips.begin(), tips.end());
+    tips.erase(std::unique(tips.begin(), tips.end()), tips.end());
+    return tips;
+}
@@ -0,0 +1,65 @@
+#ifndef OBJECT_STORE_H
+#define OBJECT_STORE_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+class FileBatch;
+
+struct CommitObject {
+    std::string tree;
+    std::vector<std::string> parents;
+    std::string author;     // "Name <email> <timestamp> <timezone>"
+    std::string committer;
+    uint64_t commit_time = 0;
+    std::string message;
+};
+
+struct TreeEntry {
+    std::string mode; // "40000" for trees, "100644", "100755", "120000" or "160000" otherwise
+    std::string name;
+    std::string hash;
+};
+
+std::string compute_sha1 (const std::string& data, bool print_out = false);
+void compress_and_store (const std::string& hash, const std::string& content, std::string dir = ".");
+
+// the same, but the loose object is queued on a FileBatch and only exists after its flush
+void compress_and_store (const std::string& hash, const std::string& content, FileBatch& batch, const std::string& dir = ".");
+std::string hash_digest (const std::string& input);
+std::string digest_to_hash (const std::string& digest);
+
+// read an object by its hex hash, returns false if it cannot be found
+bool read_object (const std::string& hash, std::string& type, std::string& contents, const std::string& dir = ".");
+
+// hand an object's payload to sink without holding it whole: a loose object is inflated a piece
+// at a time, a packed one is read out of its pack. type is set before sink is first called
+bool stream_object (const std::string& hash, std::string& type, const std::function<bool(const char*, size_t)>& sink,
+                    const std::string& dir = ".");
+
+// inflate the bytes of a loose object file, parsing off the "<type> <size>\0" header so that
+// only the payload reaches sink
+bool inflate_loose_object (const std::string& compressed, std::string& type, uint64_t& size,
+                           const std::function<bool(const char*, size_t)>& sink);
+
+// whether an object exists, loose or packed, without reading it
+bool has_object (const std::string& hash, const std::string& dir = ".");
+
+// parse the payload of a commit object (without the "commit <size>\0" header)
+bool parse_commit (const std::string& contents, CommitObject& commit);
+
+// parse the payload of a tree object into its entries
+bool parse_tree (const std::string& contents, std::vector<TreeEntry>& entries);
+
+// resolve HEAD, a ref name or a hex object id to a full object hash, empty if unknown
+std::string resolve_revision (const std::string& revision, const std::string& dir = ".");
+
+// every ref, loose or in packed-refs, with the object it points to, sorted by name
+std::vector<std::pair<std::string, std::string>> list_refs (const std::string& dir = ".");
+
+// the objects named by every ref and HEAD, without duplicates
+std::vector<std::string> reference_tips (const std::string& dir = ".");
+
+#endif // OBJECT_STORE_H
@@ -0,0 +1,404 @@
+#include <iostream>
+#include <filesystem>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pack.h"
+#include "delta.h"
+#include "object_store.h"
+#include "zlib_implement.h"
+
+#define PACK_INDEX_SIGNATURE 0xff744f63
+#define MAX_DELTA_CHAIN 4096
+
+static uint32_t get_be32 (const unsigned char* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+static const unsigned char* map_file (const std::string& path, size_t* size) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return nullptr;
+    }
+
+    *size = st.st_size;
+    return static_cast<const unsigned char*>(mapped);
+}
+
+PackFile::~PackFile () {
+    if (index_data) munmap(const_cast<unsigned char*>(index_data), index_size);
+    if (pack_data) munmap(const_cast<unsigned char*>(pack_data), pack_size);
+}
+
+bool open_pack (const std::string& index_path, PackFile& pack) {
+    pack.pack_path = index_path.substr(0, index_path.length() - 4) + ".pack";
+    pack.index_data = map_file(index_path, &pack.index_size);
+    pack.pack_data = map_file(pack.pack_path, &pack.pack_size);
+    if (!pack.index_data || !pack.pack_data) {
+        return false;
+    }
+
+    // version 2 index: signature, version, 256-entry fanout, then the tables
+    if (pack.index_size < 8 + 256 * 4 + 40 || get_be32(pack.index_data) != PACK_INDEX_SIGNATURE ||
+        get_be32(pack.index_data + 4) != 2) {
+        std::cerr << "Unsupported pack index " << index_path << ".\n";
+        return false;
+    }
+    if (pack.pack_size < 32 || memcmp(pack.pack_data, "PACK", 4) != 0) {
+        std::cerr << "Invalid pack file " << pack.pack_path << ".\n";
+        return false;
+    }
+
+    pack.num_objects = get_be32(pack.index_data + 8 + 255 * 4);
+    if (8 + 256 * 4 + size_t(pack.num_objects) * 28 + 40 > pack.index_size) {
+        std::cerr << "Truncated pack index " << index_path << ".\n";
+        return false;
+    }
+
+    return true;
+}
+
+bool open_pack_data (const std::string& pack_path, PackFile& pack) {
+    pack.pack_path = pack_path;
+    pack.pack_data = map_file(pack_path, &pack.pack_size);
+    if (!pack.pack_data || pack.pack_size < 32 || memcmp(pack.pack_data, "PACK", 4) != 0) {
+        std::cerr << "Invalid pack file " << pack_path << ".\n";
+        return false;
+    }
+
+    pack.num_objects = get_be32(pack.pack_data + 8);
+    return true;
+}
+
+void release_pack_pages (const PackFile& pack, uint64_t begin, uint64_t end) {
+    // the mapping is private and never written, dropped pages are read back from the file
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    begin -= begin % page;
+    end = std::min<uint64_t>(end, pack.pack_size);
+    end -= end % page;
+    if (begin < end) {
+        madvise(const_cast<unsigned char*>(pack.pack_data) + begin, end - begin, MADV_DONTNEED);
+    }
+}
+
+static const unsigned char* fanout_table (const PackFile& pack) {
+    return pack.index_data + 8;
+}
+
+const unsigned char* pack_index_oid (const PackFile& pack, uint32_t position) {
+    return fanout_table(pack) + 256 * 4 + size_t(position) * 20;
+}
+
+uint64_t pack_index_offset (const PackFile& pack, uint32_t position) {
+    const unsigned char* offsets = fanout_table(pack) + 256 * 4 + size_t(pack.num_objects) * 24;
+    uint32_t offset = get_be32(offsets + size_t(position) * 4);
+    if (!(offset & 0x80000000)) {
+        return offset;
+    }
+
+    // offsets beyond 2GB live in the large offset table
+    const unsigned char* large = offsets + size_t(pack.num_objects) * 4 + size_t(offset & 0x7fffffff) * 8;
+    return (uint64_t(get_be32(large)) << 32) | get_be32(large + 4);
+}
+
+bool pack_find (const PackFile& pack, const unsigned char* oid, uint64_t* offset) {
+    const unsigned char* fanout = fanout_table(pack);
+    uint32_t low = oid[0] == 0 ? 0 : get_be32(fanout + (oid[0] - 1) * 4);
+    uint32_t high = get_be32(fanout + oid[0] * 4);
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        int cmp = memcmp(oid, pack_index_oid(pack, mid), 20);
+        if (cmp == 0) {
+            *offset = pack_index_offset(pack, mid);
+            return true;
+        }
+        if (cmp < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    return false;
+}
+
+bool read_pack_entry (const PackFile& pack, uint64_t offset, PackEntry& entry) {
+    const unsigned char* data = pack.pack_data;
+    uint64_t end = pack.pack_size - 20; // the trailing checksum
+    if (offset >= end) {
+        return false;
+    }
+
+    // type in bits 4-6 of the first byte, size as little-endian base-128 starting with 4 bits
+    unsigned char byte = data[offset++];
+    entry.type = (byte >> 4) & 0x7;
+    entry.size = byte & 0x0F;
+    int shift = 4;
+    while (byte & 0x80) {
+        if (offset >= end || shift > 57) return false;
+        byte = data[offset++];
+        entry.size |= uint64_t(byte & 0x7F) << shift;
+        shift += 7;
+    }
+
+    if (entry.type == OBJ_OFS_DELTA) {
+        // negative offset, big-endian base-128 with an implicit +1 per continuation byte
+        if (offset >= end) return false;
+        byte = data[offset++];
+        uint64_t distance = byte & 0x7F;
+        while (byte & 0x80) {
+            if (offset >= end) return false;
+            byte = data[offset++];
+            distance = ((distance + 1) << 7) | (byte & 0x7F);
+        }
+        entry.base_offset = distance;
+    }
+    else if (entry.type == OBJ_REF_DELTA) {
+        if (offset + 20 > end) return false;
+        entry.base_oid.assign(reinterpret_cast<const char*>(data + offset), 20);
+        offset += 20;
+    }
+
+    entry.data_offset = offset;
+    return true;
+}
+
+const std::vector<std::pair<uint64_t, uint32_t>>& pack_reverse_index (const PackFile& pack) {
+    std::call_once(pack.reverse_index_once, [&pack]() {
+        pack.reverse_index.reserve(pack.num_objects);
+        for (uint32_t i = 0; i < pack.num_objects; i++) {
+            pack.reverse_index.emplace_back(pack_index_offset(pack, i), i);
+        }
+        std::sort(pack.reverse_index.begin(), pack.reverse_index.end());
+    });
+
+    return pack.reverse_index;
+}
+
+uint64_t pack_entry_end (const PackFile& pack, uint64_t offset) {
+    const auto& reverse_index = pack_reverse_index(pack);
+    auto next = std::upper_bound(reverse_index.begin(), reverse_index.end(), std::make_pair(offset, UINT32_MAX));
+
+    return next == reverse_index.end() ? pack.pack_size - 20 : next->first;
+}
+
+bool pack_oid_at (const PackFile& pack, uint64_t offset, std::string& oid) {
+    const auto& reverse_index = pack_reverse_index(pack);
+    auto found = std::lower_bound(reverse_index.begin(), reverse_index.end(), std::make_pair(offset, uint32_t(0)));
+    if (found == reverse_index.end() || found->first != offset) {
+        return false;
+    }
+
+    oid.assign(reinterpret_cast<const char*>(pack_index_oid(pack, found->second)), 20);
+    return true;
+}
+
+bool inflate_pack_data (const PackFile& pack, uint64_t offset, uint64_t size, std::string& out) {
+    static thread_local Inflater inflater;
+    const char* data = reinterpret_cast<const char*>(pack.pack_data) + offset;
+    return inflater.decompress(data, pack.pack_size - 20 - offset, out, nullptr, size) && out.length() == size;
+}
+
+bool read_pack_object (const PackFile& pack, uint64_t offset, std::string& type, std::string& contents, const std::string& dir) {
+    // follow the delta chain down to its base, remembering each delta on the way
+    std::vector<uint64_t> chain;
+    PackEntry entry;
+    while (true) {
+        if (!read_pack_entry(pack, offset, entry)) {
+            return false;
+        }
+        if (entry.type != OBJ_OFS_DELTA && entry.type != OBJ_REF_DELTA) {
+            break;
+        }
+        if (chain.size() >= MAX_DELTA_CHAIN) {
+            std::cerr << "Delta chain too long in " << pack.pack_path << ".\n";
+            return false;
+        }
+        chain.push_back(offset);
+
+        if (entry.type == OBJ_OFS_DELTA) {
+            if (entry.base_offset > offset) return false;
+            offset -= entry.base_offset;
+            continue;
+        }
+
+        // reference deltas may point into this pack or at any other object
+        uint64_t base_offset;
+        if (pack_find(pack, reinterpret_cast<const unsigned char*>(entry.base_oid.data()), &base_offset)) {
+            offset = base_offset;
+            continue;
+        }
+        if (!read_object(digest_to_hash(entry.base_oid), type, contents, dir)) {
+            return false;
+        }
+        entry.type = 0;
+        break;
+    }
+
+    if (entry.type != 0) {
+        if (entry.type < OBJ_COMMIT || entry.type > OBJ_TAG ||
+            !inflate_pack_data(pack, entry.data_offset, entry.size, contents)) {
+            return false;
+        }
+        type = object_type_name(entry.type);
+    }
+
+    // apply the deltas from the base upwards
+    std::string delta;
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        if (!read_pack_entry(pack, *it, entry) || !inflate_pack_data(pack, entry.data_offset, entry.size, delta)) {
+            return false;
+        }
+        try {
+            contents = apply_delta(delta, contents);
+        }
+        catch (const std::runtime_error& e) {
+            std::cerr << e.what() << '\n';
+            return false;
+        }
+    }
+
+    return true;
+}
+
+namespace {
+
+// the packs of a repository and the modification time of their directory when it was listed
+struct RepositoryPacks {
+    std::vector<std::shared_ptr<PackFile>> packs;
+    std::filesystem::file_time_type modified;
+};
+
+} // namespace
+
+static std::mutex packs_mutex;
+static std::map<std::string, RepositoryPacks> packs_by_repository;
+
+static std::filesystem::file_time_type pack_dir_modified (const std::string& dir) {
+    std::error_code ec;
+    auto modified = std::filesystem::last_write_time(dir + "/.git/objects/pack", ec);
+    return ec ? std::filesystem::file_time_type::min() : modified;
+}
+
+static RepositoryPacks load_packs (const std::string& dir) {
+    RepositoryPacks loaded;
+    std::vector<std::shared_ptr<PackFile>>& packs = loaded.packs;
+    std::string pack_dir = dir + "/.git/objects/pack";
+    std::error_code ec;
+    // taken before listing, a pack added meanwhile shows up as a later change
+    loaded.modified = pack_dir_modified(dir);
+    if (!std::filesystem::is_directory(pack_dir, ec)) {
+        return loaded;
+    }
+
+    std::vector<std::string> index_paths;
+    for (const auto& entry : std::filesystem::directory_iterator(pack_dir, ec)) {
+        if (entry.path().extension() == ".idx") {
+            index_paths.push_back(entry.path().string());
+        }
+    }
+    std::sort(index_paths.begin(), index_paths.end());
+
+    for (const auto& index_path : index_paths) {
+        auto pack = std::make_shared<PackFile>();
+        if (open_pack(index_path, *pack)) {
+            packs.push_back(pack);
+        }
+    }
+
+    return loaded;
+}
+
+std::vector<std::shared_ptr<PackFile>> repository_packs (const std::string& dir) {
+    std::lock_guard<std::mutex> lock(packs_mutex);
+    auto found = packs_by_repository.find(dir);
+    if (found == packs_by_repository.end()) {
+        found = packs_by_repository.emplace(dir, load_packs(dir)).first;
+    }
+
+    return found->second.packs;
+}
+
+void reload_packs (const std::string& dir) {
+    RepositoryPacks loaded = load_packs(dir);
+    std::lock_guard<std::mutex> lock(packs_mutex);
+    packs_by_repository[dir] = std::move(loaded);
+}
+
+// another process (a repack, a push) may have changed the packs since they were listed; after a
+// miss the directory is checked and listed again if it changed, true if it was
+static bool refresh_packs (const std::string& dir) {
+    {
+        std::lock_guard<std::mutex> lock(packs_mutex);
+        auto found = packs_by_repository.find(dir);
+        if (found != packs_by_repository.end() && found->second.modified == pack_dir_modified(dir)) {
+            return false;
+        }
+    }
+    reload_packs(dir);
+    return true;
+}
+
+static std::shared_ptr<PackFile> find_packed_object (const std::string& hash, uint64_t* offset, const std::string& dir) {
+    std::string oid = hash_digest(hash);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        for (const auto& pack : repository_packs(dir)) {
+            if (pack_find(*pack, reinterpret_cast<const unsigned char*>(oid.data()), offset)) {
+                return pack;
+            }
+        }
+        if (attempt == 0 && !refresh_packs(dir)) {
+            break;
+        }
+    }
+
+    return nullptr;
+}
+
+bool read_packed_object (const std::string& hash, std::string& type, std::string& contents, const std::string& dir) {
+    uint64_t offset;
+    std::shared_ptr<PackFile> pack = find_packed_object(hash, &offset, dir);
+    return pack && read_pack_object(*pack, offset, type, contents, dir);
+}
+
+bool has_packed_object (const std::string& hash, const std::string& dir) {
+    uint64_t offset;
+    return find_packed_object(hash, &offset, dir) != nullptr;
+}
+
+const char* object_type_name (int type) {
+    switch (type) {
+        case OBJ_COMMIT: return "commit";
+        case OBJ_TREE: return "tree";
+        case OBJ_BLOB: return "blob";
+        case OBJ_TAG: return "tag";
+        default: return "";
+    }
+}
+
+int object_type_code (const std::string& type) {
+    if (type == "commit") return OBJ_COMMIT;
+    if (type == "tree") return OBJ_TREE;
+    if (type == "blob") return OBJ_BLOB;
+    if (type == "tag") return OBJ_TAG;
+    return 0;
+}
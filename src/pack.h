@@ -0,0 +1,75 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define OBJ_COMMIT 1
+#define OBJ_TREE 2
+#define OBJ_BLOB 3
+#define OBJ_TAG 4
+#define OBJ_OFS_DELTA 6
+#define OBJ_REF_DELTA 7
+
+// a .pack file and its version 2 .idx, both mapped read-only
+struct PackFile {
+    std::string pack_path;
+    const unsigned char* index_data = nullptr;
+    size_t index_size = 0;
+    const unsigned char* pack_data = nullptr;
+    size_t pack_size = 0;
+    uint32_t num_objects = 0;
+
+    // entry offsets in pack order with their index positions, built on first use
+    mutable std::once_flag reverse_index_once;
+    mutable std::vector<std::pair<uint64_t, uint32_t>> reverse_index;
+
+    PackFile () = default;
+    ~PackFile ();
+    PackFile (const PackFile&) = delete;
+    PackFile& operator= (const PackFile&) = delete;
+};
+
+// the header of one pack entry
+struct PackEntry {
+    int type = 0;
+    uint64_t size = 0;           // inflated size of the entry data (the delta itself for deltas)
+    uint64_t data_offset = 0;    // start of the zlib stream
+    uint64_t base_offset = 0;    // OBJ_OFS_DELTA: distance back to the base entry
+    std::string base_oid;        // OBJ_REF_DELTA base, raw 20 bytes
+};
+
+bool open_pack (const std::string& index_path, PackFile& pack);
+// map a pack that has no index yet, only the entry readers work on it
+bool open_pack_data (const std::string& pack_path, PackFile& pack);
+// let the pages of the mapped pack between two offsets go, keeping the resident part bounded
+void release_pack_pages (const PackFile& pack, uint64_t begin, uint64_t end);
+bool pack_find (const PackFile& pack, const unsigned char* oid, uint64_t* offset);
+const unsigned char* pack_index_oid (const PackFile& pack, uint32_t position);
+uint64_t pack_index_offset (const PackFile& pack, uint32_t position);
+bool read_pack_entry (const PackFile& pack, uint64_t offset, PackEntry& entry);
+// (offset, index position) of every entry sorted by offset: the pack order, built once per pack
+const std::vector<std::pair<uint64_t, uint32_t>>& pack_reverse_index (const PackFile& pack);
+// the offset just past the entry starting at offset, where its raw data ends
+uint64_t pack_entry_end (const PackFile& pack, uint64_t offset);
+// the raw object id of the entry starting at offset
+bool pack_oid_at (const PackFile& pack, uint64_t offset, std::string& oid);
+// inflate exactly one zlib stream of known size out of the mapped pack
+bool inflate_pack_data (const PackFile& pack, uint64_t offset, uint64_t size, std::string& out);
+bool read_pack_object (const PackFile& pack, uint64_t offset, std::string& type, std::string& contents, const std::string& dir = ".");
+
+// packs under .git/objects/pack, mapped once per repository and shared between threads
+std::vector<std::shared_ptr<PackFile>> repository_packs (const std::string& dir = ".");
+void reload_packs (const std::string& dir = ".");
+
+bool read_packed_object (const std::string& hash, std::string& type, std::string& contents, const std::string& dir = ".");
+bool has_packed_object (const std::string& hash, const std::string& dir = ".");
+
+const char* object_type_name (int type);
+int object_type_code (const std::string& type);
+
+#endif // PACK_H
@@ -0,0 +1,580 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
+#include <unistd.h>
+#include <openssl/sha.h>
+#include "pack_bitmap.h"
+#include "pack.h"
+#include "object_store.h"
+#include "trace.h"
+
+#define BITMAP_VERSION 1
+#define BITMAP_OPT_FULL_DAG 1
+#define BITMAP_INTERVAL 100
+
+// the layout of a running length word: the running bit, 32 bits of run length, 31 of literal count
+#define RLW_RUNNING_BITS 32
+#define RLW_LARGEST_RUNNING_COUNT 0xffffffffull
+#define RLW_LARGEST_LITERAL_COUNT 0x7fffffffull
+
+static uint32_t get_be32 (const unsigned char* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+static uint64_t get_be64 (const unsigned char* p) {
+    return (uint64_t(get_be32(p)) << 32) | get_be32(p + 4);
+}
+
+static void put_be16 (std::string& out, uint16_t value) {
+    out += static_cast<char>(value >> 8);
+    out += static_cast<char>(value);
+}
+
+static void put_be32 (std::string& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out += static_cast<char>(value >> shift);
+    }
+}
+
+static void put_be64 (std::string& out, uint64_t value) {
+    put_be32(out, value >> 32);
+    put_be32(out, uint32_t(value));
+}
+
+// "<bit count> <word count> <words> <position of the last running length word>": each running
+// length word says how many all-zero or all-one words follow, then how many literal words
+static void ewah_write (std::string& out, const Bitset& bits, uint32_t num_bits) {
+    std::vector<uint64_t> buffer;
+    size_t last_rlw = 0;
+    size_t i = 0;
+    do {
+        last_rlw = buffer.size();
+        buffer.push_back(0);
+        uint64_t run = 0;
+        bool run_bit = false;
+        if (i < bits.size() && (bits[i] == 0 || bits[i] == ~0ull)) {
+            run_bit = bits[i] != 0;
+            while (i < bits.size() && bits[i] == (run_bit ? ~0ull : 0) && run < RLW_LARGEST_RUNNING_COUNT) {
+                run++;
+                i++;
+            }
+        }
+        uint64_t literals = 0;
+        while (i < bits.size() && bits[i] != 0 && bits[i] != ~0ull && literals < RLW_LARGEST_LITERAL_COUNT) {
+            buffer.push_back(bits[i]);
+            literals++;
+            i++;
+        }
+        buffer[last_rlw] = uint64_t(run_bit) | (run << 1) | (literals << (1 + RLW_RUNNING_BITS));
+    } while (i < bits.size());
+
+    put_be32(out, num_bits);
+    put_be32(out, buffer.size());
+    for (uint64_t word : buffer) {
+        put_be64(out, word);
+    }
+    put_be32(out, last_rlw);
+}
+
+static bool ewah_read (const std::string& data, size_t& position, Bitset& out, uint32_t num_bits) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data()) + position;
+    if (data.length() - position < 8) {
+        return false;
+    }
+    uint64_t words = get_be32(p + 4);
+    if ((data.length() - position - 12) / 8 < words) {
+        return false;
+    }
+    p += 8;
+
+    out.assign((uint64_t(num_bits) + 63) / 64, 0);
+    size_t w = 0;
+    for (uint64_t i = 0; i < words; ) {
+        uint64_t rlw = get_be64(p + i++ * 8);
+        uint64_t run = (rlw >> 1) & RLW_LARGEST_RUNNING_COUNT;
+        uint64_t literals = rlw >> (1 + RLW_RUNNING_BITS);
+        if (rlw & 1) {
+            for (uint64_t k = 0; k < run && w + k < out.size(); k++) {
+                out[w + k] = ~0ull;
+            }
+        }
+        w += run;
+        for (uint64_t k = 0; k < literals && i < words; k++, i++, w++) {
+            if (w < out.size()) {
+                out[w] = get_be64(p + i * 8);
+            }
+        }
+    }
+    if (num_bits % 64 != 0 && !out.empty()) {
+        out.back() &= (1ull << (num_bits % 64)) - 1;
+    }
+
+    position += 12 + words * 8;
+    return true;
+}
+
+static bool test_bit (const Bitset& bits, uint32_t position) {
+    return bits[position / 64] & (1ull << (position % 64));
+}
+
+static void set_bit (Bitset& bits, uint32_t position) {
+    bits[position / 64] |= 1ull << (position % 64);
+}
+
+// the position of an object in pack order
+static bool find_position (const PackFile& pack, const std::string& hash, uint32_t* position) {
+    std::string oid = hash_digest(hash);
+    uint64_t offset;
+    if (!pack_find(pack, reinterpret_cast<const unsigned char*>(oid.data()), &offset)) {
+        return false;
+    }
+    const auto& reverse_index = pack_reverse_index(pack);
+    auto found = std::lower_bound(reverse_index.begin(), reverse_index.end(), std::make_pair(offset, uint32_t(0)));
+    *position = found - reverse_index.begin();
+    return true;
+}
+
+namespace {
+
+// adds what some objects reach to a bitset, ORing the stored bitmap of any commit that has one
+// instead of walking below it. A bit already set stands for everything below it as well.
+class ReachWalk {
+public:
+    ReachWalk (const PackFile& pack, CommitIndex& index, Bitset& bits, std::unordered_map<std::string, std::string>& extra,
+               const std::function<const Bitset*(uint32_t)>& stored)
+        : pack(pack), index(index), bits(bits), extra(extra), stored(stored) {}
+
+    // a commit, tree, blob or tag by its hex id
+    bool add (const std::string& hash);
+    bool add_commit (const std::string& hash);
+
+private:
+    bool add_tree (const std::string& hash);
+    bool seen (const std::string& hash, uint32_t* position, bool* packed);
+    bool mark (const std::string& hash, const char* type);
+
+    const PackFile& pack;
+    CommitIndex& index;
+    Bitset& bits;
+    std::unordered_map<std::string, std::string>& extra;
+    const std::function<const Bitset*(uint32_t)>& stored;
+};
+
+} // namespace
+
+bool ReachWalk::seen (const std::string& hash, uint32_t* position, bool* packed) {
+    *packed = find_position(pack, hash, position);
+    return *packed ? test_bit(bits, *position) : extra.count(hash) > 0;
+}
+
+// false if it was already there
+bool ReachWalk::mark (const std::string& hash, const char* type) {
+    uint32_t position;
+    bool packed;
+    if (seen(hash, &position, &packed)) {
+        return false;
+    }
+    if (packed) {
+        set_bit(bits, position);
+    } else {
+        extra.emplace(hash, type);
+    }
+    return true;
+}
+
+bool ReachWalk::add (const std::string& hash) {
+    std::string current = hash;
+    std::string type, contents;
+    for (int depth = 0; depth < 10; depth++) {
+        if (!read_object(current, type, contents, index.dir)) {
+            std::cerr << "Failed to read object " << current << ".\n";
+            return false;
+        }
+        if (type == "commit") {
+            return add_commit(current);
+        }
+        if (type == "tree") {
+            return add_tree(current);
+        }
+        if (type != "tag") {
+            mark(current, "blob");
+            return true;
+        }
+        if (!mark(current, "tag")) {
+            return true;
+        }
+        if (contents.rfind("object ", 0) != 0) {
+            return false;
+        }
+        current = contents.substr(7, 40);
+    }
+    return false;
+}
+
+bool ReachWalk::add_commit (const std::string& hash) {
+    std::vector<std::string> stack = {hash};
+    std::vector<uint32_t> parents;
+    while (!stack.empty()) {
+        std::string commit = std::move(stack.back());
+        stack.pop_back();
+
+        uint32_t position, id;
+        bool packed;
+        if (seen(commit, &position, &packed)) {
+            continue;
+        }
+        const Bitset* bitmap = packed ? stored(position) : nullptr;
+        if (bitmap) {
+            for (size_t w = 0; w < bits.size() && w < bitmap->size(); w++) {
+                bits[w] |= (*bitmap)[w];
+            }
+            continue;
+        }
+
+        mark(commit, "commit");
+        if (!index.lookup(commit, &id) || !index.parents(id, parents)) {
+            std::cerr << "Failed to read commit " << commit << ".\n";
+            return false;
+        }
+        if (!add_tree(index.tree(id))) {
+            return false;
+        }
+        for (uint32_t parent : parents) {
+            stack.push_back(index.hash(parent));
+        }
+    }
+    return true;
+}
+
+bool ReachWalk::add_tree (const std::string& hash) {
+    std::vector<std::string> stack = {hash};
+    std::string type, contents;
+    std::vector<TreeEntry> entries;
+    while (!stack.empty()) {
+        std::string tree = std::move(stack.back());
+        stack.pop_back();
+        if (!mark(tree, "tree")) {
+            continue;
+        }
+
+        entries.clear();
+        if (!read_object(tree, type, contents, index.dir) || type != "tree" || !parse_tree(contents, entries)) {
+            std::cerr << "Failed to read tree " << tree << ".\n";
+            return false;
+        }
+        for (const TreeEntry& entry : entries) {
+            if (entry.mode == "40000") {
+                stack.push_back(entry.hash);
+            }
+            else if (entry.mode != "160000") {
+                mark(entry.hash, "blob");
+            }
+        }
+    }
+    return true;
+}
+
+bool BitmapIndex::open (const std::string& dir) {
+    for (const auto& candidate : repository_packs(dir)) {
+        std::string path = candidate->pack_path.substr(0, candidate->pack_path.length() - 5) + ".bitmap";
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            continue;
+        }
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+        // header: magic, version, options, entry count, the checksum of the pack it describes
+        const unsigned char* header = reinterpret_cast<const unsigned char*>(data.data());
+        if (data.length() < 32 + 20 || memcmp(header, "BITM", 4) != 0 || ((header[4] << 8) | header[5]) != BITMAP_VERSION ||
+            !(((header[6] << 8) | header[7]) & BITMAP_OPT_FULL_DAG)) {
+            std::cerr << "warning: unsupported bitmap index " << path << ".\n";
+            continue;
+        }
+        if (memcmp(header + 12, candidate->pack_data + candidate->pack_size - 20, 20) != 0) {
+            std::cerr << "warning: " << path << " does not match its pack.\n";
+            continue;
+        }
+
+        uint32_t count = get_be32(header + 8);
+        size_t position = 32;
+        bool valid = true;
+        for (Bitset& type : types) {
+            valid = valid && ewah_read(data, position, type, candidate->num_objects);
+        }
+        entries.clear();
+        Bitset skipped;
+        for (uint32_t i = 0; valid && i < count; i++) {
+            if (data.length() - position < 6) {
+                valid = false;
+                break;
+            }
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data()) + position;
+            Entry entry = {get_be32(p), p[4], position + 6};
+            position += 6;
+            // the bitmap is only decoded when it is needed
+            valid = entry.index_position < candidate->num_objects && entry.xor_offset <= i &&
+                    ewah_read(data, position, skipped, 0);
+            entries.push_back(entry);
+        }
+        if (!valid) {
+            std::cerr << "warning: corrupt bitmap index " << path << ".\n";
+            continue;
+        }
+
+        pack = candidate;
+        const auto& reverse_index = pack_reverse_index(*pack);
+        pack_positions.assign(pack->num_objects, 0);
+        for (uint32_t p = 0; p < reverse_index.size(); p++) {
+            pack_positions[reverse_index[p].second] = p;
+        }
+        by_position.clear();
+        for (size_t i = 0; i < entries.size(); i++) {
+            by_position[pack_positions[entries[i].index_position]] = i;
+        }
+        decoded.clear();
+        return true;
+    }
+
+    return false;
+}
+
+const Bitset* BitmapIndex::commit_bitmap (uint32_t position) {
+    auto found = by_position.find(position);
+    if (found == by_position.end()) {
+        return nullptr;
+    }
+
+    // a bitmap may be stored XORed with an earlier entry's, which is decoded first
+    std::vector<size_t> chain = {found->second};
+    while (!decoded.count(chain.back()) && entries[chain.back()].xor_offset > 0) {
+        chain.push_back(chain.back() - entries[chain.back()].xor_offset);
+    }
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        if (decoded.count(*it)) {
+            continue;
+        }
+        Bitset bits;
+        size_t offset = entries[*it].data;
+        ewah_read(data, offset, bits, pack->num_objects);
+        if (entries[*it].xor_offset > 0) {
+            const Bitset& base = decoded[*it - entries[*it].xor_offset];
+            for (size_t w = 0; w < bits.size(); w++) {
+                bits[w] ^= base[w];
+            }
+        }
+        decoded[*it] = std::move(bits);
+    }
+
+    return &decoded[found->second];
+}
+
+bool BitmapIndex::reachable (CommitIndex& index, const RevListOptions& options, Bitset& result,
+                             std::unordered_map<std::string, std::string>& extra) {
+    TraceRegion region("bitmap", "reachable");
+    std::function<const Bitset*(uint32_t)> stored = [this](uint32_t position) { return commit_bitmap(position); };
+    Bitset excluded((uint64_t(pack->num_objects) + 63) / 64, 0);
+    std::unordered_map<std::string, std::string> excluded_extra;
+    ReachWalk exclude(*pack, index, excluded, excluded_extra, stored);
+    for (const std::string& revision : options.exclude) {
+        std::string hash = resolve_revision(revision, index.dir);
+        if (hash.empty()) {
+            std::cerr << "Unknown revision " << revision << ".\n";
+            return false;
+        }
+        if (!exclude.add(hash)) {
+            return false;
+        }
+    }
+
+    // starting from the excluded set stops the walk where it meets it, then it is taken away
+    result = excluded;
+    extra = excluded_extra;
+    ReachWalk include(*pack, index, result, extra, stored);
+    for (const std::string& revision : options.include) {
+        std::string hash = resolve_revision(revision, index.dir);
+        if (hash.empty()) {
+            std::cerr << "Unknown revision " << revision << ".\n";
+            return false;
+        }
+        if (!include.add(hash)) {
+            return false;
+        }
+    }
+    for (size_t w = 0; w < result.size(); w++) {
+        result[w] &= ~excluded[w];
+    }
+    for (const auto& [hash, type] : excluded_extra) {
+        extra.erase(hash);
+    }
+
+    return true;
+}
+
+uint32_t BitmapIndex::num_objects () const {
+    return pack->num_objects;
+}
+
+std::string BitmapIndex::hash (uint32_t position) const {
+    uint32_t index_position = pack_reverse_index(*pack)[position].second;
+    return digest_to_hash(std::string(reinterpret_cast<const char*>(pack_index_oid(*pack, index_position)), 20));
+}
+
+bool BitmapIndex::is_commit (uint32_t position) const {
+    return test_bit(types[0], position);
+}
+
+// the type of every entry in pack order, deltas taking their base's
+static bool pack_types (const PackFile& pack, std::vector<int8_t>& types) {
+    const auto& reverse_index = pack_reverse_index(pack);
+    types.assign(pack.num_objects, 0);
+    std::vector<uint32_t> chain;
+    PackEntry entry;
+    for (uint32_t position = 0; position < pack.num_objects; position++) {
+        uint32_t current = position;
+        chain.clear();
+        while (types[current] == 0) {
+            chain.push_back(current);
+            uint64_t offset = reverse_index[current].first;
+            if (chain.size() > 10000 || !read_pack_entry(pack, offset, entry)) {
+                return false;
+            }
+            if (entry.type >= OBJ_COMMIT && entry.type <= OBJ_TAG) {
+                types[current] = entry.type;
+                break;
+            }
+            uint64_t base_offset;
+            if (entry.type == OBJ_OFS_DELTA) {
+                base_offset = offset - entry.base_offset;
+            } else if (entry.type != OBJ_REF_DELTA ||
+                       !pack_find(pack, reinterpret_cast<const unsigned char*>(entry.base_oid.data()), &base_offset)) {
+                return false;
+            }
+            current = std::lower_bound(reverse_index.begin(), reverse_index.end(), std::make_pair(base_offset, uint32_t(0))) - reverse_index.begin();
+            if (current >= pack.num_objects) {
+                return false;
+            }
+        }
+        for (uint32_t link : chain) {
+            types[link] = types[current];
+        }
+    }
+    return true;
+}
+
+bool write_bitmap_index (const std::string& pack_name, const std::vector<std::string>& tips, const std::string& dir) {
+    TraceRegion region("bitmap", "write");
+    std::shared_ptr<PackFile> pack;
+    for (const auto& candidate : repository_packs(dir)) {
+        if (std::filesystem::path(candidate->pack_path).stem() == pack_name) {
+            pack = candidate;
+        }
+    }
+    if (!pack) {
+        std::cerr << "No pack " << pack_name << ".\n";
+        return false;
+    }
+    const auto& reverse_index = pack_reverse_index(*pack);
+    size_t words = (uint64_t(pack->num_objects) + 63) / 64;
+
+    std::vector<int8_t> types;
+    if (!pack_types(*pack, types)) {
+        std::cerr << "Cannot read the object types of " << pack->pack_path << ".\n";
+        return false;
+    }
+    Bitset type_bitmaps[4];
+    for (Bitset& bits : type_bitmaps) {
+        bits.assign(words, 0);
+    }
+    for (uint32_t position = 0; position < pack->num_objects; position++) {
+        set_bit(type_bitmaps[types[position] - OBJ_COMMIT], position);
+    }
+
+    // every tip, then one commit in BITMAP_INTERVAL going back through history
+    CommitIndex index(dir);
+    RevListOptions walk;
+    std::unordered_set<uint32_t> selected;
+    for (const std::string& tip : tips) {
+        std::string hash = resolve_revision(tip, dir);
+        uint32_t id;
+        if (!hash.empty() && index.lookup(hash, &id)) {
+            walk.include.push_back(hash);
+            selected.insert(id);
+        }
+    }
+    std::vector<uint32_t> commits;
+    if (!walk.include.empty() && walk_revisions(index, walk, [&](uint32_t id) { commits.push_back(id); return true; }) != EXIT_SUCCESS) {
+        return false;
+    }
+    for (size_t i = 0; i < commits.size(); i += BITMAP_INTERVAL) {
+        selected.insert(commits[i]);
+    }
+
+    // oldest first, so each walk stops at the bitmaps of the selected commits below it
+    std::unordered_map<uint32_t, Bitset> built;
+    std::vector<uint32_t> order;
+    std::function<const Bitset*(uint32_t)> stored = [&built](uint32_t position) {
+        auto found = built.find(position);
+        return found == built.end() ? nullptr : &found->second;
+    };
+    std::unordered_map<std::string, std::string> extra;
+    for (auto it = commits.rbegin(); it != commits.rend(); ++it) {
+        if (!selected.count(*it)) {
+            continue;
+        }
+        std::string hash = index.hash(*it);
+        uint32_t position;
+        if (!find_position(*pack, hash, &position)) {
+            std::cerr << "Commit " << hash << " is not in " << pack->pack_path << ".\n";
+            return false;
+        }
+        Bitset bits(words, 0);
+        ReachWalk reach(*pack, index, bits, extra, stored);
+        if (!reach.add_commit(hash)) {
+            return false;
+        }
+        if (!extra.empty()) {
+            std::cerr << "Commit " << hash << " reaches " << extra.begin()->first << ", which is not in " << pack->pack_path << ".\n";
+            return false;
+        }
+        built[position] = std::move(bits);
+        order.push_back(position);
+    }
+    trace_data("bitmap", "commits", order.size());
+
+    std::string out = "BITM";
+    put_be16(out, BITMAP_VERSION);
+    put_be16(out, BITMAP_OPT_FULL_DAG);
+    put_be32(out, order.size());
+    out.append(reinterpret_cast<const char*>(pack->pack_data) + pack->pack_size - 20, 20);
+    for (const Bitset& bits : type_bitmaps) {
+        ewah_write(out, bits, pack->num_objects);
+    }
+    for (uint32_t position : order) {
+        put_be32(out, reverse_index[position].second);
+        out += '\0'; // not XORed with an earlier bitmap
+        out += '\0'; // flags
+        ewah_write(out, built[position], pack->num_objects);
+    }
+    unsigned char digest[20];
+    SHA1(reinterpret_cast<const unsigned char*>(out.data()), out.length(), digest);
+    out.append(reinterpret_cast<const char*>(digest), 20);
+
+    std::string path = pack->pack_path.substr(0, pack->pack_path.length() - 5) + ".bitmap";
+    std::string temp = path + ".tmp" + std::to_string(getpid());
+    std::ofstream output(temp, std::ios::binary | std::ios::trunc);
+    if (!output.is_open() || !output.write(out.data(), out.length()).good()) {
+        std::cerr << "Failed to write " << temp << ".\n";
+        std::filesystem::remove(temp);
+        return false;
+    }
+    output.close();
+    std::filesystem::rename(temp, path);
+
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef PACK_BITMAP_H
+#define PACK_BITMAP_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "revision.h"
+
+struct PackFile;
+
+// one bit per object of a pack, in pack order
+using Bitset = std::vector<uint64_t>;
+
+// Reachability bitmaps in git's .bitmap format (version 1): for selected commits, the set of
+// objects each one reaches, as EWAH compressed bitsets over the positions of a pack. Finding
+// what some commits reach ORs their bitmaps; only the history above the nearest bitmapped
+// commits is walked, and objects outside the pack are kept on the side.
+class BitmapIndex {
+public:
+    // load the bitmap of a pack in the repository, false if no pack has one
+    bool open (const std::string& dir = ".");
+
+    // everything reachable from options.include and not from options.exclude: pack objects as
+    // bits of result, the rest as hashes with their types in extra
+    bool reachable (CommitIndex& index, const RevListOptions& options, Bitset& result,
+                    std::unordered_map<std::string, std::string>& extra);
+
+    uint32_t num_objects () const;
+    std::string hash (uint32_t position) const;        // hex id of the object at a pack position
+    bool is_commit (uint32_t position) const;
+
+private:
+    struct Entry {
+        uint32_t index_position;
+        uint8_t xor_offset;
+        size_t data;  // offset of the EWAH bitmap in the file
+    };
+
+    const Bitset* commit_bitmap (uint32_t position);
+
+    std::shared_ptr<PackFile> pack;
+    std::string data;
+    std::vector<uint32_t> pack_positions;  // index position -> pack position
+    Bitset types[4];                       // commits, trees, blobs, tags
+    std::vector<Entry> entries;
+    std::unordered_map<uint32_t, size_t> by_position;  // pack position of a commit -> entry
+    std::unordered_map<size_t, Bitset> decoded;
+};
+
+// select commits among those reachable from tips (every tip, then one in BITMAP_INTERVAL
+// walking back) and write pack-<name>.bitmap next to the pack. Everything the tips reach
+// must be in that pack.
+bool write_bitmap_index (const std::string& pack_name, const std::vector<std::string>& tips, const std::string& dir = ".");
+
+#endif // PACK_BITMAP_H
@@ -0,0 +1,98 @@
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+#include "pkt_line.h"
+
+std::string pkt_line (const std::string& payload) {
+    char length[5];
+    snprintf(length, sizeof(length), "%04x", static_cast<unsigned>(payload.length() + 4));
+
+    return length + payload;
+}
+
+static int hex_digit (char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// the length field of a pkt-line header, -1 if it is not hex
+static long parse_length (const char* header) {
+    long length = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hex_digit(header[i]);
+        if (digit < 0) {
+            return -1;
+        }
+        length = (length << 4) | digit;
+    }
+
+    return length;
+}
+
+// hand over one complete line; 0000 is a flush, 0001 and 0002 the protocol v2 delimiters
+bool PktLineDecoder::emit (const char* line, size_t length) {
+    if (!(length < 4 ? handler(nullptr, 0) : handler(line + 4, length - 4))) {
+        failed = true;
+    }
+
+    return !failed;
+}
+
+bool PktLineDecoder::feed (const char* data, size_t length) {
+    // finish the line left over from the previous chunk
+    while (!failed && !partial.empty() && length > 0) {
+        size_t wanted = partial.length() < 4 ? 4 - partial.length() : line_length - partial.length();
+        size_t taken = std::min(wanted, length);
+        partial.append(data, taken);
+        data += taken;
+        length -= taken;
+
+        if (partial.length() == 4) {
+            long header = parse_length(partial.data());
+            if (header < 0) {
+                failed = true;
+                break;
+            }
+            line_length = std::max<long>(header, 4);
+        }
+        if (partial.length() == line_length) {
+            emit(partial.data(), parse_length(partial.data()));
+            partial.clear();
+        }
+    }
+
+    // whole lines straight out of the chunk
+    while (!failed && length >= 4) {
+        long header = parse_length(data);
+        if (header < 0) {
+            failed = true;
+            break;
+        }
+        size_t line = std::max<long>(header, 4);
+        if (line > length) {
+            break;
+        }
+        emit(data, header);
+        data += line;
+        length -= line;
+    }
+
+    if (!failed && length > 0) {
+        partial.assign(data, length);
+        line_length = length >= 4 ? std::max<long>(parse_length(data), 4) : 0;
+    }
+
+    return !failed;
+}
+
+bool parse_pkt_lines (const std::string& buffer, std::vector<std::string>& lines) {
+    PktLineDecoder decoder([&](const char* payload, size_t length) {
+        lines.emplace_back(payload ? std::string(payload, length) : std::string());
+        return true;
+    });
+
+    return decoder.feed(buffer.data(), buffer.length()) && decoder.finished();
+}
@@ -0,0 +1,42 @@
+#ifndef PKT_LINE_H
+#define PKT_LINE_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define PKT_MAX_DATA 65516 // largest payload of one pkt-line
+#define PKT_FLUSH "0000"
+
+// frame a payload as "<4 hex digit length><payload>"
+std::string pkt_line (const std::string& payload);
+
+// split a buffer of pkt-lines, flush packets come back as empty strings
+bool parse_pkt_lines (const std::string& buffer, std::vector<std::string>& lines);
+
+// decodes pkt-lines from a stream arriving in chunks of any size. Whole lines are handed over
+// straight from the chunk, only a line cut by a chunk boundary is copied until it completes.
+class PktLineDecoder {
+public:
+    // a payload, or nullptr for a flush (and the protocol v2 delimiters)
+    using LineHandler = std::function<bool(const char* payload, size_t length)>;
+
+    explicit PktLineDecoder (LineHandler handler) : handler(std::move(handler)) {}
+
+    // false once the stream is malformed or the handler refused a line
+    bool feed (const char* data, size_t length);
+
+    // whether the stream so far ended on a line boundary
+    bool finished () const { return !failed && partial.empty(); }
+
+private:
+    bool emit (const char* line, size_t length);
+
+    LineHandler handler;
+    std::string partial;  // the start of a line cut by the end of the last chunk
+    size_t line_length = 0; // of the partial line, once its header is complete
+    bool failed = false;
+};
+
+#endif // PKT_LINE_H
@@ -0,0 +1,469 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "refs.h"
+#include "object_store.h"
+
+#define ZERO_OID "0000000000000000000000000000000000000000"
+#define PACKED_REFS_HEADER "# pack-refs with: sorted \n"
+
+static bool is_hex_hash (const std::string& value) {
+    return value.length() == 40 && value.find_first_not_of("0123456789abcdef") == std::string::npos;
+}
+
+namespace {
+
+// .git/packed-refs mapped read-only: an optional "# pack-refs with: <traits>" line, then
+// "<id> <name>" records, each possibly followed by a "^<peeled id>" line
+class PackedRefsFile {
+public:
+    explicit PackedRefsFile (const std::string& dir) {
+        int fd = open((dir + "/.git/packed-refs").c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                data = static_cast<const char*>(mapped);
+                size = st.st_size;
+            }
+        }
+        close(fd);
+
+        if (data && size > 0 && data[0] == '#') {
+            body = std::min(line_end(0) + 1, size);
+            std::string traits(data, body - 1);
+            sorted = (traits + ' ').find(" sorted ") != std::string::npos;
+        }
+    }
+
+    ~PackedRefsFile () {
+        if (data) munmap(const_cast<char*>(data), size);
+    }
+
+    PackedRefsFile (const PackedRefsFile&) = delete;
+    PackedRefsFile& operator= (const PackedRefsFile&) = delete;
+
+    // the id of a packed ref, by binary search over the records when the file is sorted
+    std::string find (const std::string& name) const {
+        if (!sorted) {
+            std::string found;
+            for_each([&](const std::string& ref, const std::string& hash) {
+                if (ref == name) found = hash;
+            });
+            return found;
+        }
+
+        size_t lo = body, hi = size;
+        while (lo < hi) {
+            // back up to the start of the record around the middle, a peeled line belongs to the one before it
+            size_t mid = line_start(lo + (hi - lo) / 2, lo);
+            if (data[mid] == '^' && mid > lo) {
+                mid = line_start(mid - 1, lo);
+            }
+
+            size_t end = line_end(mid);
+            if (end - mid < 42 || data[mid + 40] != ' ') {
+                return {}; // corrupt, nothing in it can be trusted
+            }
+            size_t name_length = end - mid - 41;
+            int cmp = memcmp(data + mid + 41, name.data(), std::min(name_length, name.length()));
+            if (cmp == 0 && name_length == name.length()) {
+                return std::string(data + mid, 40);
+            }
+
+            if (cmp < 0 || (cmp == 0 && name_length < name.length())) {
+                lo = end + 1;
+                while (lo < hi && data[lo] == '^') {
+                    lo = line_end(lo) + 1;
+                }
+            }
+            else {
+                hi = mid;
+            }
+        }
+
+        return {};
+    }
+
+    void for_each (const std::function<void(const std::string&, const std::string&)>& visit) const {
+        for (size_t pos = body; pos < size; pos = line_end(pos) + 1) {
+            size_t end = line_end(pos);
+            if (data[pos] == '^' || data[pos] == '#' || end - pos < 42 || data[pos + 40] != ' ') {
+                continue;
+            }
+            visit(std::string(data + pos + 41, end - pos - 41), std::string(data + pos, 40));
+        }
+    }
+
+private:
+    size_t line_end (size_t pos) const {
+        const void* newline = memchr(data + pos, '\n', size - pos);
+        return newline ? static_cast<const char*>(newline) - data : size;
+    }
+
+    size_t line_start (size_t pos, size_t floor) const {
+        while (pos > floor && data[pos - 1] != '\n') {
+            pos--;
+        }
+        return pos;
+    }
+
+    const char* data = nullptr;
+    size_t size = 0;
+    size_t body = 0;     // where the records start
+    bool sorted = false;
+};
+
+} // namespace
+
+static std::string read_loose_ref (const std::string& name, const std::string& dir) {
+    std::ifstream ref_file(dir + "/.git/" + name);
+    std::string line;
+    if (!ref_file.is_open() || !std::getline(ref_file, line)) {
+        return {};
+    }
+    line.erase(line.find_last_not_of(" \r\n") + 1);
+
+    return line;
+}
+
+std::string read_ref (const std::string& name, const std::string& dir) {
+    std::string value = read_loose_ref(name, dir);
+    if (value.empty() && name.rfind("refs/", 0) == 0) {
+        value = PackedRefsFile(dir).find(name);
+    }
+
+    return value;
+}
+
+// every loose ref file under .git/refs holding an id
+static std::map<std::string, std::string> loose_refs (const std::string& dir) {
+    std::map<std::string, std::string> refs;
+    std::string git_dir = dir + "/.git/";
+    std::error_code ec;
+    if (!std::filesystem::is_directory(git_dir + "refs", ec)) {
+        return refs;
+    }
+
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(git_dir + "refs", ec)) {
+        std::string path = entry.path().string();
+        if (!entry.is_regular_file() || (path.length() >= 5 && path.compare(path.length() - 5, 5, ".lock") == 0)) {
+            continue;
+        }
+        std::string name = path.substr(git_dir.length());
+        std::string value = read_loose_ref(name, dir);
+        if (is_hex_hash(value)) {
+            refs[name] = value;
+        }
+    }
+
+    return refs;
+}
+
+std::vector<std::pair<std::string, std::string>> read_all_refs (const std::string& dir) {
+    std::map<std::string, std::string> refs;
+    PackedRefsFile(dir).for_each([&](const std::string& name, const std::string& hash) {
+        refs[name] = hash;
+    });
+    for (auto& [name, hash] : loose_refs(dir)) {
+        refs[name] = hash; // a loose ref is newer than its packed copy
+    }
+
+    return std::vector<std::pair<std::string, std::string>>(refs.begin(), refs.end());
+}
+
+bool check_ref_format (const std::string& name) {
+    if (name == "HEAD") {
+        return true;
+    }
+    if (name.rfind("refs/", 0) != 0 || name.length() == 5 || name.back() == '/' || name.back() == '.' ||
+        name.find("..") != std::string::npos || name.find("//") != std::string::npos ||
+        name.find("/.") != std::string::npos || name.find("@{") != std::string::npos ||
+        (name.length() >= 5 && name.compare(name.length() - 5, 5, ".lock") == 0)) {
+        return false;
+    }
+
+    for (unsigned char c : name) {
+        if (c <= ' ' || c == 0x7f || strchr("~^:?*[\\", c)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// create <path>.lock exclusively, the caller renames it over path or unlinks it
+static int lock_file (const std::string& path) {
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    int fd = open((path + ".lock").c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd < 0) {
+        std::cerr << "Unable to create " << path << ".lock: " << strerror(errno) << ".\n";
+    }
+
+    return fd;
+}
+
+static bool write_all (int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.length()) {
+        ssize_t result = write(fd, data.data() + written, data.length() - written);
+        if (result <= 0) {
+            return false;
+        }
+        written += result;
+    }
+
+    return true;
+}
+
+bool write_symref (const std::string& name, const std::string& target, const std::string& dir) {
+    std::string path = dir + "/.git/" + name;
+    int fd = lock_file(path);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool written = write_all(fd, "ref: " + target + '\n');
+    close(fd);
+    if (!written || rename((path + ".lock").c_str(), path.c_str()) != 0) {
+        std::cerr << "Failed to write " << path << ".\n";
+        unlink((path + ".lock").c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void RefTransaction::update (const std::string& name, const std::string& new_hash, const std::string& old_hash) {
+    updates.push_back({name, new_hash == ZERO_OID ? "" : new_hash, old_hash, false});
+}
+
+void RefTransaction::create (const std::string& name, const std::string& new_hash) {
+    update(name, new_hash, ZERO_OID);
+}
+
+void RefTransaction::remove (const std::string& name, const std::string& old_hash) {
+    updates.push_back({name, "", old_hash, false});
+}
+
+void RefTransaction::verify (const std::string& name, const std::string& old_hash) {
+    updates.push_back({name, "", old_hash, true});
+}
+
+bool RefTransaction::commit () {
+    // an update of HEAD moves the branch it points at
+    for (auto& update : updates) {
+        for (int depth = 0; depth < 5; depth++) {
+            std::string value = read_loose_ref(update.name, dir);
+            if (value.rfind("ref: ", 0) != 0) break;
+            update.name = value.substr(5);
+        }
+        if (!check_ref_format(update.name)) {
+            std::cerr << "Invalid ref name " << update.name << ".\n";
+            return false;
+        }
+    }
+    std::stable_sort(updates.begin(), updates.end(), [](const RefUpdate& a, const RefUpdate& b) { return a.name < b.name; });
+    for (size_t i = 1; i < updates.size(); i++) {
+        if (updates[i].name == updates[i - 1].name) {
+            std::cerr << "Multiple updates for ref " << updates[i].name << " not allowed.\n";
+            return false;
+        }
+    }
+
+    // take every lock before looking at any value. A loose lock gets its new value and is closed
+    // as it is taken, so no descriptors pile up; packed updates only lock packed-refs.
+    std::vector<std::string> locked;
+    auto rollback = [&]() {
+        for (const auto& path : locked) {
+            unlink((path + ".lock").c_str());
+        }
+        return false;
+    };
+    // packed-refs is only rewritten to store refs or to drop deleted ones from it
+    PackedRefsFile packed_refs(dir);
+    bool touch_packed = packed || std::any_of(updates.begin(), updates.end(), [&](const RefUpdate& update) {
+        return !update.verify_only && update.new_hash.empty() && !packed_refs.find(update.name).empty();
+    });
+    if (!packed) {
+        for (const auto& update : updates) {
+            std::string path = dir + "/.git/" + update.name;
+            int fd = lock_file(path);
+            if (fd < 0) {
+                return rollback();
+            }
+            locked.push_back(path);
+            bool written = update.verify_only || update.new_hash.empty() || write_all(fd, update.new_hash + '\n');
+            if (close(fd) != 0 || !written) {
+                std::cerr << "Failed to write " << update.name << ".\n";
+                return rollback();
+            }
+        }
+    }
+    std::string packed_path = dir + "/.git/packed-refs";
+    int packed_fd = touch_packed ? lock_file(packed_path) : -1;
+    if (touch_packed && packed_fd < 0) {
+        return rollback();
+    }
+    if (touch_packed) {
+        locked.push_back(packed_path);
+    }
+
+    // check the old values under the locks
+    bool ok = true;
+    for (const auto& update : updates) {
+        std::string current = read_ref(update.name, dir);
+        if (!update.old_hash.empty() && current != (update.old_hash == ZERO_OID ? "" : update.old_hash)) {
+            std::cerr << "Cannot lock ref " << update.name << ": is at " << (current.empty() ? ZERO_OID : current)
+                      << " but expected " << update.old_hash << ".\n";
+            ok = false;
+        }
+    }
+
+    if (ok && touch_packed) {
+        std::map<std::string, std::string> refs;
+        PackedRefsFile(dir).for_each([&](const std::string& name, const std::string& hash) {
+            refs[name] = hash;
+        });
+        for (const auto& update : updates) {
+            if (update.verify_only) continue;
+            if (update.new_hash.empty()) refs.erase(update.name);
+            else if (packed) refs[update.name] = update.new_hash;
+        }
+
+        std::string contents = PACKED_REFS_HEADER;
+        for (const auto& [name, hash] : refs) {
+            contents += hash + ' ' + name + '\n';
+        }
+        ok = write_all(packed_fd, contents);
+        if (!ok) {
+            std::cerr << "Failed to write " << packed_path << ".\n";
+        }
+    }
+    if (packed_fd >= 0) {
+        close(packed_fd);
+    }
+    if (!ok) {
+        return rollback();
+    }
+
+    // every ref in packed-refs changes with this one rename
+    if (touch_packed && rename((packed_path + ".lock").c_str(), packed_path.c_str()) != 0) {
+        std::cerr << "Failed to write " << packed_path << ".\n";
+        return rollback();
+    }
+    for (const auto& update : updates) {
+        std::string path = dir + "/.git/" + update.name;
+        if (!update.verify_only && !packed && !update.new_hash.empty()) {
+            rename((path + ".lock").c_str(), path.c_str());
+            continue;
+        }
+        if (!update.verify_only) {
+            unlink(path.c_str()); // a stale loose copy would override the packed value
+        }
+        if (!packed) {
+            unlink((path + ".lock").c_str());
+        }
+    }
+
+    return true;
+}
+
+bool pack_refs (const std::string& dir) {
+    std::map<std::string, std::string> refs = loose_refs(dir);
+    if (refs.empty()) {
+        return true;
+    }
+
+    RefTransaction transaction(dir);
+    transaction.set_packed(true);
+    for (const auto& [name, hash] : refs) {
+        transaction.update(name, hash, hash);
+    }
+
+    return transaction.commit();
+}
+
+// a new or old value given on the command line: an id, the zero id or a revision
+static bool parse_value (const std::string& value, std::string& hash, const std::string& dir) {
+    hash = value == ZERO_OID || value.empty() ? value : resolve_revision(value, dir);
+    if (hash.empty() && !value.empty()) {
+        std::cerr << "fatal: " << value << ": not a valid SHA1\n";
+        return false;
+    }
+
+    return true;
+}
+
+int update_ref (const std::vector<std::string>& args, bool packed, const std::string& dir) {
+    RefTransaction transaction(dir);
+    transaction.set_packed(packed);
+    std::string new_hash, old_hash;
+    if (!args.empty() && args[0] == "--stdin") {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            std::vector<std::string> words;
+            size_t pos = 0;
+            while (pos < line.length()) {
+                size_t end = line.find(' ', pos);
+                if (end == std::string::npos) end = line.length();
+                words.push_back(line.substr(pos, end - pos));
+                pos = end + 1;
+            }
+            if (words.empty()) {
+                continue;
+            }
+
+            const std::string& command = words[0];
+            size_t values = words.size() - 2;
+            bool valid = words.size() >= 2 &&
+                         ((command == "update" && values >= 1 && values <= 2) || (command == "create" && values == 1) ||
+                          (command == "delete" && values <= 1) || (command == "verify" && values <= 1));
+            if (!valid) {
+                std::cerr << "fatal: invalid update-ref command: " << line << '\n';
+                return EXIT_FAILURE;
+            }
+            if (!parse_value(words.size() > 2 ? words[2] : "", new_hash, dir) ||
+                !parse_value(words.size() > 3 ? words[3] : "", old_hash, dir)) {
+                return EXIT_FAILURE;
+            }
+
+            if (command == "update") transaction.update(words[1], new_hash, old_hash);
+            else if (command == "create") transaction.create(words[1], new_hash);
+            else if (command == "delete") transaction.remove(words[1], new_hash);
+            else transaction.verify(words[1], new_hash.empty() ? ZERO_OID : new_hash);
+        }
+    }
+    else if (args.size() >= 2 && args.size() <= 3 && args[0] == "-d") {
+        if (!parse_value(args.size() > 2 ? args[2] : "", old_hash, dir)) {
+            return EXIT_FAILURE;
+        }
+        transaction.remove(args[1], old_hash);
+    }
+    else if (args.size() >= 2 && args.size() <= 3) {
+        if (!parse_value(args[1], new_hash, dir) || !parse_value(args.size() > 2 ? args[2] : "", old_hash, dir)) {
+            return EXIT_FAILURE;
+        }
+        transaction.update(args[0], new_hash, old_hash);
+    }
+    else {
+        std::cerr << "Usage: update-ref [--packed] (<ref> <new> [<old>] | -d <ref> [<old>] | --stdin)\n";
+        return EXIT_FAILURE;
+    }
+
+    return transaction.commit() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
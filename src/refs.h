@@ -0,0 +1,62 @@
+#ifndef REFS_H
+#define REFS_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// The ref store: loose files under .git/refs override the entries of .git/packed-refs, a
+// sorted "<id> <name>" file that is mapped and binary searched rather than read whole.
+
+// the value of one ref, not following symbolic refs: a hex id, "ref: <target>", or empty
+std::string read_ref (const std::string& name, const std::string& dir = ".");
+
+// every ref under refs/ with its id, loose and packed merged, sorted by name
+std::vector<std::pair<std::string, std::string>> read_all_refs (const std::string& dir = ".");
+
+// whether a name is safe to store: HEAD or refs/..., no "..", no special characters
+bool check_ref_format (const std::string& name);
+
+// point a symbolic ref such as HEAD at another ref, written through a lock file
+bool write_symref (const std::string& name, const std::string& target, const std::string& dir = ".");
+
+// A set of ref changes applied all or nothing. Every ref is locked and its old value checked
+// before anything is written; loose refs are renamed into place one by one, packed ones go
+// into a new packed-refs in a single rename.
+class RefTransaction {
+public:
+    explicit RefTransaction (const std::string& dir = ".") : dir(dir) {}
+
+    // old_hash empty skips the check, the zero id requires the ref not to exist yet
+    void update (const std::string& name, const std::string& new_hash, const std::string& old_hash = "");
+    void create (const std::string& name, const std::string& new_hash);
+    void remove (const std::string& name, const std::string& old_hash = "");
+    void verify (const std::string& name, const std::string& old_hash);
+
+    // store the updated refs in packed-refs instead of one loose file each
+    void set_packed (bool packed) { this->packed = packed; }
+
+    // false, with the reason on stderr, if nothing was changed
+    bool commit ();
+
+private:
+    struct RefUpdate {
+        std::string name;
+        std::string new_hash; // empty to delete
+        std::string old_hash;
+        bool verify_only;
+    };
+
+    std::string dir;
+    std::vector<RefUpdate> updates;
+    bool packed = false;
+};
+
+// move every loose ref into packed-refs
+bool pack_refs (const std::string& dir = ".");
+
+// update-ref <ref> <new> [<old>], update-ref -d <ref> [<old>], or update-ref --stdin with
+// "update", "create", "delete" and "verify" lines committed as one transaction
+int update_ref (const std::vector<std::string>& args, bool packed = false, const std::string& dir = ".");
+
+#endif // REFS_H
@@ -0,0 +1,162 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include "remote_refs.h"
+#include "object_store.h"
+
+void RefTable::add (const char* name, size_t name_length, const unsigned char* oid) {
+    Entry entry;
+    entry.name_offset = names.length();
+    entry.name_length = name_length;
+    memcpy(entry.oid, oid, 20);
+    names.append(name, name_length);
+    entries.push_back(entry);
+}
+
+void RefTable::sort () {
+    auto less = [this](const Entry& a, const Entry& b) {
+        int cmp = memcmp(names.data() + a.name_offset, names.data() + b.name_offset, std::min(a.name_length, b.name_length));
+        return cmp != 0 ? cmp < 0 : a.name_length < b.name_length;
+    };
+    // servers send their refs sorted already, which makes this a single pass
+    if (!std::is_sorted(entries.begin(), entries.end(), less)) {
+        std::stable_sort(entries.begin(), entries.end(), less);
+    }
+}
+
+std::string RefTable::name (size_t i) const {
+    return names.substr(entries[i].name_offset, entries[i].name_length);
+}
+
+std::string RefTable::hash (size_t i) const {
+    return digest_to_hash(std::string(reinterpret_cast<const char*>(entries[i].oid), 20));
+}
+
+size_t RefTable::lower_bound (const std::string& name) const {
+    auto found = std::lower_bound(entries.begin(), entries.end(), name, [this](const Entry& entry, const std::string& key) {
+        int cmp = memcmp(names.data() + entry.name_offset, key.data(), std::min<size_t>(entry.name_length, key.length()));
+        return cmp != 0 ? cmp < 0 : entry.name_length < key.length();
+    });
+
+    return found - entries.begin();
+}
+
+std::string RefTable::find (const std::string& name) const {
+    size_t i = lower_bound(name);
+    if (i == entries.size() || entries[i].name_length != name.length() ||
+        memcmp(names.data() + entries[i].name_offset, name.data(), name.length()) != 0) {
+        return {};
+    }
+
+    return hash(i);
+}
+
+std::string RefTable::symref_target (const std::string& name) const {
+    for (const auto& [symref, target] : symrefs) {
+        if (symref == name) {
+            return target;
+        }
+    }
+
+    return {};
+}
+
+bool RefTable::has_capability (const std::string& capability) const {
+    return std::find(capabilities.begin(), capabilities.end(), capability) != capabilities.end();
+}
+
+bool RefTable::default_branch (std::string& branch, std::string& id) const {
+    std::string target = symref_target("HEAD");
+    if (target.rfind("refs/heads/", 0) == 0 && !(id = find(target)).empty()) {
+        branch = target.substr(11);
+        return true;
+    }
+
+    // an older server: guess the branch from the id HEAD has, master first
+    std::string head = find("HEAD");
+    std::string master = find("refs/heads/master");
+    if (!master.empty() && (head.empty() || head == master)) {
+        branch = "master";
+        id = master;
+        return true;
+    }
+    for (size_t i = lower_bound("refs/heads/"); i < entries.size(); i++) {
+        std::string ref = name(i);
+        if (ref.rfind("refs/heads/", 0) != 0) {
+            break;
+        }
+        if (head.empty() || hash(i) == head) {
+            branch = ref.substr(11);
+            id = hash(i);
+            return true;
+        }
+    }
+
+    branch.clear();
+    id = head; // detached
+    return !head.empty();
+}
+
+RefAdvertisementParser::RefAdvertisementParser (RefTable& table)
+    : table(table), decoder([this](const char* line, size_t length) { return line ? parse_line(line, length) : true; }) {}
+
+// "<id> <name>", the first ref followed by "\0<capabilities>"
+bool RefAdvertisementParser::parse_line (const char* line, size_t length) {
+    if (length > 0 && line[length - 1] == '\n') {
+        length--;
+    }
+    if (length >= 10 && memcmp(line, "# service=", 10) == 0) {
+        return true;
+    }
+    if (length >= 4 && memcmp(line, "ERR ", 4) == 0) {
+        std::cerr << "Remote error: " << std::string(line + 4, length - 4) << '\n';
+        return false;
+    }
+    if (length < 42 || line[40] != ' ') {
+        std::cerr << "Invalid ref advertisement line.\n";
+        return false;
+    }
+
+    const char* name = line + 41;
+    const char* name_end = static_cast<const char*>(memchr(name, '\0', line + length - name));
+    if (name_end && !seen_ref) {
+        // space separated, symref=HEAD:refs/heads/main names where a symbolic ref points
+        std::string capabilities(name_end + 1, line + length);
+        size_t pos = 0;
+        while (pos < capabilities.length()) {
+            size_t end = capabilities.find(' ', pos);
+            if (end == std::string::npos) end = capabilities.length();
+            std::string capability = capabilities.substr(pos, end - pos);
+            size_t colon = capability.find(':');
+            if (capability.rfind("symref=", 0) == 0 && colon != std::string::npos) {
+                table.symrefs.emplace_back(capability.substr(7, colon - 7), capability.substr(colon + 1));
+            }
+            else if (!capability.empty()) {
+                table.capabilities.push_back(capability);
+            }
+            pos = end + 1;
+        }
+    }
+    seen_ref = true;
+
+    std::string id(line, 40);
+    if (id.find_first_not_of("0123456789abcdef") != std::string::npos) {
+        std::cerr << "Invalid object id in ref advertisement.\n";
+        return false;
+    }
+    size_t name_length = (name_end ? name_end : line + length) - name;
+    if (std::string(name, name_length) != "capabilities^{}") { // the placeholder of an empty repository
+        std::string oid = hash_digest(id);
+        table.add(name, name_length, reinterpret_cast<const unsigned char*>(oid.data()));
+    }
+
+    return true;
+}
+
+bool RefAdvertisementParser::finish () {
+    table.sort();
+
+    return decoder.finished();
+}
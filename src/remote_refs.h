@@ -0,0 +1,67 @@
+#ifndef REMOTE_REFS_H
+#define REMOTE_REFS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "pkt_line.h"
+
+// the refs a server advertised. Names share one buffer and the entries are sorted by name,
+// so a table of 100k refs is two allocations and every lookup a binary search.
+class RefTable {
+public:
+    // add refs in any order, then sort once before looking anything up
+    void add (const char* name, size_t name_length, const unsigned char* oid);
+    void sort ();
+
+    size_t size () const { return entries.size(); }
+    std::string name (size_t i) const;
+    std::string hash (size_t i) const; // hex
+
+    // the hex id of a ref, empty if it was not advertised
+    std::string find (const std::string& name) const;
+
+    // the ref a symref such as HEAD points at, empty if the server did not say
+    std::string symref_target (const std::string& name) const;
+    bool has_capability (const std::string& capability) const;
+
+    // the branch a clone checks out and its commit: where HEAD points, else HEAD itself
+    // (detached, branch empty), else master, else the first branch
+    bool default_branch (std::string& branch, std::string& id) const;
+
+    std::vector<std::string> capabilities;
+    std::vector<std::pair<std::string, std::string>> symrefs; // "HEAD", "refs/heads/main"
+
+private:
+    struct Entry {
+        uint32_t name_offset;
+        uint32_t name_length;
+        unsigned char oid[20];
+    };
+
+    size_t lower_bound (const std::string& name) const;
+
+    std::string names;
+    std::vector<Entry> entries;
+};
+
+// fills a RefTable from a smart HTTP advertisement as it arrives, "# service=" header included
+class RefAdvertisementParser {
+public:
+    explicit RefAdvertisementParser (RefTable& table);
+
+    bool feed (const char* data, size_t length) { return decoder.feed(data, length); }
+
+    // sort the table, false if the advertisement was malformed or cut short
+    bool finish ();
+
+private:
+    bool parse_line (const char* line, size_t length);
+
+    RefTable& table;
+    PktLineDecoder decoder;
+    bool seen_ref = false;
+};
+
+#endif // REMOTE_REFS_H
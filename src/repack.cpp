@@ -0,0 +1,496 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <zlib.h>
+#include <unistd.h>
+#include <openssl/sha.h>
+#include <openssl/evp.h>
+#include "repack.h"
+#include "pack.h"
+#include "delta.h"
+#include "revision.h"
+#include "pack_bitmap.h"
+#include "commit_graph.h"
+#include "object_store.h"
+#include "refs.h"
+#include "zlib_implement.h"
+
+#define MIN_DELTA_SIZE 50 // smaller objects are never worth a delta
+
+static void put_be32 (std::string& out, uint32_t value) {
+    out.push_back(char(value >> 24));
+    out.push_back(char(value >> 16));
+    out.push_back(char(value >> 8));
+    out.push_back(char(value));
+}
+
+// git's pack_name_hash: the last characters of a path weigh the most, grouping files by suffix
+static uint32_t name_hash (const std::string& name) {
+    uint32_t hash = 0;
+    for (unsigned char c : name) {
+        if (isspace(c)) continue;
+        hash = (hash >> 2) + (uint32_t(c) << 24);
+    }
+
+    return hash;
+}
+
+static unsigned thread_count (unsigned requested) {
+    if (requested > 0) return requested;
+    unsigned cores = std::thread::hardware_concurrency();
+    return cores > 0 ? cores : 1;
+}
+
+void compute_deltas (std::vector<PackInput>& objects, std::vector<std::string>& contents,
+                     const std::vector<std::string>& names, const RepackOptions& options) {
+    // order candidates by type, name hash and decreasing size so similar objects sit together
+    std::vector<uint32_t> hashes(objects.size());
+    std::vector<uint32_t> order(objects.size());
+    for (size_t i = 0; i < objects.size(); i++) {
+        hashes[i] = name_hash(names[i]);
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        if (objects[a].type != objects[b].type) return objects[a].type < objects[b].type;
+        if (hashes[a] != hashes[b]) return hashes[a] < hashes[b];
+        if (contents[a].length() != contents[b].length()) return contents[a].length() > contents[b].length();
+        return a < b;
+    });
+
+    // every thread slides its own window over a contiguous slice of the order
+    unsigned threads = std::min<size_t>(thread_count(options.threads), std::max<size_t>(objects.size() / 64, 1));
+    std::vector<int> depth(objects.size(), 0);
+    auto search = [&](size_t begin, size_t end) {
+        std::deque<uint32_t> window;
+        for (size_t n = begin; n < end; n++) {
+            uint32_t target = order[n];
+            const std::string& target_contents = contents[target];
+            std::string best_delta;
+            int best_base = -1;
+
+            if (target_contents.length() >= MIN_DELTA_SIZE) {
+                for (auto it = window.rbegin(); it != window.rend(); ++it) {
+                    uint32_t base = *it;
+                    const std::string& base_contents = contents[base];
+                    if (objects[base].type != objects[target].type || depth[base] >= options.depth ||
+                        base_contents.length() / 32 > target_contents.length()) {
+                        continue;
+                    }
+
+                    // a delta has to beat half the object, and any delta found so far
+                    size_t max_size = best_base >= 0 ? best_delta.length() - 1 : target_contents.length() / 2;
+                    if (max_size <= 20) continue;
+                    std::string delta = create_delta(base_contents, target_contents, max_size);
+                    if (!delta.empty()) {
+                        best_delta = std::move(delta);
+                        best_base = base;
+                    }
+                }
+            }
+
+            PackInput& object = objects[target];
+            if (best_base >= 0) {
+                object.base = best_base;
+                object.size = best_delta.length();
+                object.data = compress_string(best_delta);
+                depth[target] = depth[best_base] + 1;
+            } else {
+                object.size = target_contents.length();
+                object.data = compress_string(target_contents);
+            }
+
+            // contents leaving the window are no longer needed
+            window.push_back(target);
+            if (window.size() > size_t(options.window)) {
+                std::string().swap(contents[window.front()]);
+                window.pop_front();
+            }
+        }
+        for (uint32_t index : window) {
+            std::string().swap(contents[index]);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    size_t slice = (objects.size() + threads - 1) / threads;
+    for (unsigned t = 0; t < threads; t++) {
+        size_t begin = t * slice;
+        size_t end = std::min(objects.size(), begin + slice);
+        if (begin >= end) break;
+        workers.emplace_back(search, begin, end);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// entry header: type and size, then the base reference of a delta
+static std::string entry_header (int type, uint64_t size) {
+    std::string header;
+    unsigned char byte = (type << 4) | (size & 0x0F);
+    size >>= 4;
+    while (size) {
+        header.push_back(char(byte | 0x80));
+        byte = size & 0x7F;
+        size >>= 7;
+    }
+    header.push_back(char(byte));
+
+    return header;
+}
+
+static std::string ofs_delta_distance (uint64_t distance) {
+    unsigned char buffer[16];
+    int pos = sizeof(buffer) - 1;
+    buffer[pos] = distance & 0x7F;
+    while (distance >>= 7) {
+        buffer[--pos] = 0x80 | (--distance & 0x7F);
+    }
+
+    return std::string(reinterpret_cast<char*>(buffer + pos), sizeof(buffer) - pos);
+}
+
+PackWriter::PackWriter (const std::function<bool(const char*, size_t)>& sink)
+    : sink(sink), context(EVP_MD_CTX_new(), EVP_MD_CTX_free) {
+    EVP_DigestInit_ex(context.get(), EVP_sha1(), nullptr);
+}
+
+bool PackWriter::emit (const char* data, size_t length) {
+    EVP_DigestUpdate(context.get(), data, length);
+    position += length;
+    return sink(data, length);
+}
+
+bool PackWriter::begin (uint32_t num_objects) {
+    std::string header = "PACK";
+    put_be32(header, 2);
+    put_be32(header, num_objects);
+    return emit(header.data(), header.length());
+}
+
+bool PackWriter::add_entry (const std::string& header, const char* data, size_t length, uint64_t* offset, uint32_t* crc) {
+    if (offset) *offset = position;
+    if (crc) {
+        *crc = crc32(0, reinterpret_cast<const Bytef*>(header.data()), header.length());
+        *crc = crc32(*crc, reinterpret_cast<const Bytef*>(data), length);
+    }
+    return emit(header.data(), header.length()) && emit(data, length);
+}
+
+bool PackWriter::add_object (int type, uint64_t size, const char* data, size_t length, uint64_t* offset, uint32_t* crc) {
+    return add_entry(entry_header(type, size), data, length, offset, crc);
+}
+
+bool PackWriter::add_ofs_delta (uint64_t base_offset, uint64_t size, const char* data, size_t length, uint64_t* offset, uint32_t* crc) {
+    return add_entry(entry_header(OBJ_OFS_DELTA, size) + ofs_delta_distance(position - base_offset), data, length, offset, crc);
+}
+
+bool PackWriter::add_ref_delta (const std::string& base_oid, uint64_t size, const char* data, size_t length, uint64_t* offset, uint32_t* crc) {
+    return add_entry(entry_header(OBJ_REF_DELTA, size) + base_oid, data, length, offset, crc);
+}
+
+bool PackWriter::finish (std::string* checksum) {
+    unsigned char digest[20];
+    EVP_DigestFinal_ex(context.get(), digest, nullptr);
+    if (!sink(reinterpret_cast<const char*>(digest), 20)) return false;
+
+    if (checksum) checksum->assign(reinterpret_cast<const char*>(digest), 20);
+    return true;
+}
+
+bool write_pack (const std::vector<PackInput>& objects, const std::function<bool(const char*, size_t)>& sink,
+                 bool ofs_delta, std::vector<uint64_t>* offsets, std::vector<uint32_t>* crcs, std::string* checksum) {
+    PackWriter writer(sink);
+    if (!writer.begin(objects.size())) return false;
+
+    std::vector<uint64_t> entry_offsets(objects.size(), UINT64_MAX);
+    std::vector<uint32_t> entry_crcs(objects.size(), 0);
+    std::vector<size_t> pending;
+    for (size_t first = 0; first < objects.size(); first++) {
+        // write the chain of bases below this object first
+        for (size_t current = first; current != SIZE_MAX && entry_offsets[current] == UINT64_MAX;) {
+            pending.push_back(current);
+            current = objects[current].base >= 0 ? size_t(objects[current].base) : SIZE_MAX;
+        }
+
+        while (!pending.empty()) {
+            size_t index = pending.back();
+            pending.pop_back();
+            const PackInput& object = objects[index];
+            const char* data = object.data.data();
+            size_t length = object.data.length();
+
+            bool written;
+            if (object.base < 0) {
+                written = writer.add_object(object.type, object.size, data, length, &entry_offsets[index], &entry_crcs[index]);
+            } else if (ofs_delta) {
+                written = writer.add_ofs_delta(entry_offsets[object.base], object.size, data, length, &entry_offsets[index], &entry_crcs[index]);
+            } else {
+                written = writer.add_ref_delta(hash_digest(objects[object.base].hash), object.size, data, length, &entry_offsets[index], &entry_crcs[index]);
+            }
+            if (!written) return false;
+        }
+    }
+
+    if (!writer.finish(checksum)) return false;
+
+    if (offsets) *offsets = std::move(entry_offsets);
+    if (crcs) *crcs = std::move(entry_crcs);
+    return true;
+}
+
+bool write_pack_index (const std::string& path, const std::vector<PackInput>& objects,
+                       const std::vector<uint64_t>& offsets, const std::vector<uint32_t>& crcs, const std::string& checksum) {
+    std::vector<std::pair<std::string, size_t>> sorted;
+    sorted.reserve(objects.size());
+    for (size_t i = 0; i < objects.size(); i++) {
+        sorted.emplace_back(hash_digest(objects[i].hash), i);
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    std::string index = "\377tOc";
+    put_be32(index, 2);
+
+    size_t count = 0;
+    for (int byte = 0; byte < 256; byte++) {
+        while (count < sorted.size() && static_cast<unsigned char>(sorted[count].first[0]) == byte) {
+            count++;
+        }
+        put_be32(index, count);
+    }
+    for (const auto& entry : sorted) {
+        index += entry.first;
+    }
+    for (const auto& entry : sorted) {
+        put_be32(index, crcs[entry.second]);
+    }
+
+    // offsets that do not fit in 31 bits go to the large offset table
+    std::string large_offsets;
+    for (const auto& entry : sorted) {
+        uint64_t offset = offsets[entry.second];
+        if (offset < 0x80000000) {
+            put_be32(index, offset);
+        } else {
+            put_be32(index, 0x80000000 | uint32_t(large_offsets.length() / 8));
+            put_be32(large_offsets, offset >> 32);
+            put_be32(large_offsets, uint32_t(offset));
+        }
+    }
+    index += large_offsets;
+    index += checksum;
+
+    unsigned char digest[20];
+    SHA1(reinterpret_cast<const unsigned char*>(index.data()), index.length(), digest);
+    index.append(reinterpret_cast<const char*>(digest), 20);
+
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    return output.is_open() && output.write(index.data(), index.length()).good();
+}
+
+std::string write_pack_files (const std::vector<PackInput>& objects, const std::string& dir) {
+    std::string pack_dir = dir + "/.git/objects/pack/";
+    std::filesystem::create_directories(pack_dir);
+    std::string temp_pack = pack_dir + "tmp_pack_" + std::to_string(getpid());
+    std::string temp_index = pack_dir + "tmp_idx_" + std::to_string(getpid());
+
+    std::ofstream output(temp_pack, std::ios::binary | std::ios::trunc);
+    if (!output.is_open()) {
+        std::cerr << "Failed to create " << temp_pack << ".\n";
+        return {};
+    }
+
+    std::vector<uint64_t> offsets;
+    std::vector<uint32_t> crcs;
+    std::string checksum;
+    bool written = write_pack(objects, [&](const char* data, size_t length) {
+        return output.write(data, length).good();
+    }, true, &offsets, &crcs, &checksum);
+    output.close();
+
+    if (!written || !write_pack_index(temp_index, objects, offsets, crcs, checksum)) {
+        std::cerr << "Failed to write pack.\n";
+        std::filesystem::remove(temp_pack);
+        std::filesystem::remove(temp_index);
+        return {};
+    }
+
+    // the index is renamed last, a pack only becomes visible once it has one
+    std::string name = "pack-" + digest_to_hash(checksum);
+    std::filesystem::rename(temp_pack, pack_dir + name + ".pack");
+    std::filesystem::rename(temp_index, pack_dir + name + ".idx");
+
+    return name;
+}
+
+// remove the packs the new one makes redundant, and loose objects that are now packed. After a
+// walk from every ref that is every other pack; a walk from some revisions only covers part of
+// the history, so then only packs whose every object went into the new one can go.
+static void prune_redundant (const std::string& dir, const std::string& keep_pack, bool all_refs) {
+    std::string objects_dir = dir + "/.git/objects/";
+    std::unordered_set<std::string> covered;
+    if (!all_refs) {
+        auto packs = repository_packs(dir);
+        auto kept = std::find_if(packs.begin(), packs.end(), [&](const std::shared_ptr<PackFile>& pack) {
+            return std::filesystem::path(pack->pack_path).stem() == keep_pack;
+        });
+        if (kept == packs.end()) {
+            return;
+        }
+        for (const auto& pack : packs) {
+            uint64_t offset;
+            uint32_t i = 0;
+            while (i < pack->num_objects && pack_find(**kept, pack_index_oid(*pack, i), &offset)) {
+                i++;
+            }
+            if (pack != *kept && i == pack->num_objects) {
+                covered.insert(std::filesystem::path(pack->pack_path).stem().string());
+            }
+        }
+    }
+
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(objects_dir + "pack", ec)) {
+        std::string stem = entry.path().stem().string();
+        std::string extension = entry.path().extension().string();
+        if (stem != keep_pack && (all_refs || covered.count(stem)) &&
+            (extension == ".pack" || extension == ".idx" || extension == ".bitmap")) {
+            std::filesystem::remove(entry.path(), ec);
+        }
+    }
+    reload_packs(dir);
+
+    for (const auto& folder : std::filesystem::directory_iterator(objects_dir, ec)) {
+        std::string prefix = folder.path().filename().string();
+        if (prefix.length() != 2 || !folder.is_directory()) {
+            continue;
+        }
+        for (const auto& file : std::filesystem::directory_iterator(folder.path(), ec)) {
+            if (has_packed_object(prefix + file.path().filename().string(), dir)) {
+                std::filesystem::remove(file.path(), ec);
+            }
+        }
+        std::filesystem::remove(folder.path(), ec); // only succeeds once empty
+    }
+}
+
+// write one pack of everything reachable from revisions (every ref when empty); pack_name stays
+// empty when there is nothing to pack
+static int write_repack (const RepackOptions& options, const std::vector<std::string>& revisions, const std::string& dir,
+                         std::string& pack_name) {
+    RevListOptions walk;
+    walk.include = revisions;
+    if (walk.include.empty()) {
+        walk.include = reference_tips(dir);
+    }
+    if (walk.include.empty()) {
+        std::cerr << "Nothing to pack.\n";
+        return EXIT_SUCCESS;
+    }
+
+    // collect every reachable object with the path it was found under
+    std::vector<PackInput> objects;
+    std::vector<std::string> names;
+    CommitIndex index(dir);
+    int status = list_objects(index, walk, [&](const std::string& hash, const std::string& type, const std::string& name) {
+        PackInput object;
+        object.hash = hash;
+        object.type = object_type_code(type);
+        objects.push_back(std::move(object));
+        names.push_back(name);
+    });
+    if (status != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    // inflate the objects in parallel
+    std::vector<std::string> contents(objects.size());
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < thread_count(options.threads); t++) {
+        readers.emplace_back([&]() {
+            std::string type;
+            for (size_t i = next++; i < objects.size() && !failed; i = next++) {
+                if (!read_object(objects[i].hash, type, contents[i], dir)) {
+                    std::cerr << "Failed to read object " << objects[i].hash << ".\n";
+                    failed = true;
+                }
+            }
+        });
+    }
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    if (failed) {
+        return EXIT_FAILURE;
+    }
+
+    compute_deltas(objects, contents, names, options);
+
+    pack_name = write_pack_files(objects, dir);
+    if (pack_name.empty()) {
+        return EXIT_FAILURE;
+    }
+    reload_packs(dir);
+    if (options.write_bitmap && !write_bitmap_index(pack_name, walk.include, dir)) {
+        return EXIT_FAILURE;
+    }
+
+    size_t deltas = std::count_if(objects.begin(), objects.end(), [](const PackInput& object) { return object.base >= 0; });
+    std::cerr << "Total " << objects.size() << " (delta " << deltas << "), " << pack_name << '\n';
+
+    return EXIT_SUCCESS;
+}
+
+int repack (const RepackOptions& options, const std::vector<std::string>& revisions, const std::string& dir) {
+    std::string pack_name;
+    if (write_repack(options, revisions, dir, pack_name) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    if (options.delete_redundant && !pack_name.empty()) {
+        prune_redundant(dir, pack_name, revisions.empty());
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int gc (const std::string& dir) {
+    std::string pack_name;
+    if (write_repack(RepackOptions(), {}, dir, pack_name) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    // the graph goes first so a failure leaves every old pack in place; it only takes commits
+    std::vector<std::string> tips;
+    for (const auto& tip : reference_tips(dir)) {
+        std::string commit = peel_to_commit(tip, dir);
+        if (!commit.empty()) {
+            tips.push_back(commit);
+        }
+    }
+    if (!tips.empty() && write_commit_graph(tips, dir) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    if (!pack_name.empty()) {
+        prune_redundant(dir, pack_name, true);
+    }
+
+    if (!pack_refs(dir)) {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
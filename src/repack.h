@@ -0,0 +1,67 @@
+#ifndef REPACK_H
+#define REPACK_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
+
+struct RepackOptions {
+    int window = 10;          // delta candidates tried per object
+    int depth = 50;           // longest delta chain
+    unsigned threads = 0;     // 0 uses one thread per core
+    bool delete_redundant = false; // remove old packs and loose objects covered by the new pack
+    bool write_bitmap = false;     // write a reachability bitmap index for the new pack
+};
+
+// an object ready to go into a pack
+struct PackInput {
+    std::string hash;   // hex
+    int type = 0;       // OBJ_COMMIT .. OBJ_TAG
+    int base = -1;      // index of the delta base in the same list, -1 for a whole object
+    uint64_t size = 0;  // inflated size of data: the object itself, or the delta
+    std::string data;   // deflated object or delta
+};
+
+// pick delta bases over a sliding window and deflate every object, contents[i] belongs to objects[i]
+void compute_deltas (std::vector<PackInput>& objects, std::vector<std::string>& contents,
+                     const std::vector<std::string>& names, const RepackOptions& options);
+
+// streams pack entries to a sink, hashing as it goes; entry data arrives already deflated
+class PackWriter {
+public:
+    explicit PackWriter (const std::function<bool(const char*, size_t)>& sink);
+
+    bool begin (uint32_t num_objects);
+    bool add_object (int type, uint64_t size, const char* data, size_t length, uint64_t* offset = nullptr, uint32_t* crc = nullptr);
+    bool add_ofs_delta (uint64_t base_offset, uint64_t size, const char* data, size_t length, uint64_t* offset = nullptr, uint32_t* crc = nullptr);
+    bool add_ref_delta (const std::string& base_oid, uint64_t size, const char* data, size_t length, uint64_t* offset = nullptr, uint32_t* crc = nullptr);
+    bool finish (std::string* checksum = nullptr); // appends the trailing SHA-1
+
+    uint64_t position = 0; // bytes written so far
+
+private:
+    bool emit (const char* data, size_t length);
+    bool add_entry (const std::string& header, const char* data, size_t length, uint64_t* offset, uint32_t* crc);
+
+    std::function<bool(const char*, size_t)> sink;
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> context;
+};
+
+// stream a version 2 pack, writing each delta base before the objects depending on it
+bool write_pack (const std::vector<PackInput>& objects, const std::function<bool(const char*, size_t)>& sink,
+                 bool ofs_delta, std::vector<uint64_t>* offsets, std::vector<uint32_t>* crcs, std::string* checksum);
+
+// write a version 2 .idx for a pack written by write_pack
+bool write_pack_index (const std::string& path, const std::vector<PackInput>& objects,
+                       const std::vector<uint64_t>& offsets, const std::vector<uint32_t>& crcs, const std::string& checksum);
+
+// write .pack and .idx under .git/objects/pack, returns the pack name or an empty string
+std::string write_pack_files (const std::vector<PackInput>& objects, const std::string& dir = ".");
+
+int repack (const RepackOptions& options, const std::vector<std::string>& revisions, const std::string& dir = ".");
+int gc (const std::string& dir = ".");
+
+#endif // REPACK_H
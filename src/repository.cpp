@@ -0,0 +1,132 @@
+#include <filesystem>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <ctime>
+#include <algorithm>
+#include "repository.h"
+#include "commands.h"
+#include "object_store.h"
+#include "pack.h"
+
+std::unique_ptr<Repository> Repository::open (const std::string& dir) {
+    if (!std::filesystem::is_directory(dir + "/.git")) {
+        return nullptr;
+    }
+
+    repository_packs(dir); // map the packs now rather than on the first lookup
+    return std::unique_ptr<Repository>(new Repository(dir));
+}
+
+std::unique_ptr<Repository> Repository::init (const std::string& dir) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec || !git_init(dir, false)) {
+        return nullptr;
+    }
+
+    return open(dir);
+}
+
+std::unique_ptr<Repository> Repository::clone (const std::string& url, const std::string& dir) {
+    try {
+        if (::clone(url, dir, false) != EXIT_SUCCESS) {
+            return nullptr;
+        }
+    }
+    catch (const std::exception& e) {
+        return nullptr;
+    }
+
+    return open(dir);
+}
+
+bool Repository::read_object (const std::string& hash, std::string& type, std::string& contents) const {
+    return ::read_object(hash, type, contents, dir);
+}
+
+bool Repository::has_object (const std::string& hash) const {
+    return ::has_object(hash, dir);
+}
+
+std::string Repository::write_object (const std::string& type, const std::string& contents) {
+    std::string object = type + ' ' + std::to_string(contents.length()) + '\0' + contents;
+    std::string hash = compute_sha1(object);
+    compress_and_store(hash, object, dir);
+
+    return hash;
+}
+
+std::string Repository::resolve (const std::string& revision) const {
+    return resolve_revision(revision, dir);
+}
+
+bool Repository::read_tree (const std::string& hash, std::vector<TreeEntry>& entries) const {
+    std::string type, contents;
+    return ::read_object(hash, type, contents, dir) && type == "tree" && parse_tree(contents, entries);
+}
+
+bool Repository::walk_tree (const std::string& hash, bool recursive,
+                            const std::function<bool(const std::string&, const TreeEntry&)>& visit) const {
+    std::function<bool(const std::string&, const std::string&)> walk = [&](const std::string& tree, const std::string& base) {
+        std::vector<TreeEntry> entries;
+        if (!read_tree(tree, entries)) {
+            return false;
+        }
+        for (const auto& entry : entries) {
+            std::string path = base + entry.name;
+            if (!visit(path, entry)) {
+                return false;
+            }
+            if (recursive && entry.mode == "40000" && !walk(entry.hash, path + '/')) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    return walk(hash, "");
+}
+
+std::string Repository::write_tree (std::vector<TreeEntry> entries) {
+    // git's tree order: a subtree sorts as if its name ended in '/'
+    auto sort_key = [](const TreeEntry& entry) { return entry.mode == "40000" ? entry.name + '/' : entry.name; };
+    std::sort(entries.begin(), entries.end(), [&](const TreeEntry& a, const TreeEntry& b) { return sort_key(a) < sort_key(b); });
+
+    std::string contents;
+    for (const auto& entry : entries) {
+        contents += entry.mode + ' ' + entry.name + '\0' + hash_digest(entry.hash);
+    }
+
+    return write_object("tree", contents);
+}
+
+std::string Repository::write_worktree () {
+    return ::write_tree(dir, dir);
+}
+
+bool Repository::read_commit (const std::string& hash, CommitObject& commit) const {
+    std::string type, contents;
+    return ::read_object(hash, type, contents, dir) && type == "commit" && parse_commit(contents, commit);
+}
+
+std::string Repository::create_commit (const std::string& tree, const std::vector<std::string>& parents,
+                                       const std::string& message, const std::string& author, const std::string& committer) {
+    std::string timestamp = std::to_string(std::time(nullptr)) + " +0000";
+    std::string contents = "tree " + tree + '\n';
+    for (const auto& parent : parents) {
+        contents += "parent " + parent + '\n';
+    }
+    contents += "author " + author + ' ' + timestamp + '\n';
+    contents += "committer " + (committer.empty() ? author : committer) + ' ' + timestamp + '\n';
+    contents += '\n' + message;
+    if (message.empty() || message.back() != '\n') {
+        contents += '\n';
+    }
+
+    return write_object("commit", contents);
+}
+
+void Repository::refresh () {
+    reload_packs(dir);
+}
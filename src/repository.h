@@ -0,0 +1,55 @@
+#ifndef REPOSITORY_H
+#define REPOSITORY_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "object_store.h"
+
+// An open repository for programs linking libgit-cpp instead of running the CLI. The packs
+// of a repository stay mapped in a process-wide registry, so handles are cheap to keep around
+// and every lookup after the first reuses them. Methods do not print; failures return
+// false or an empty string.
+class Repository {
+public:
+    // nullptr unless dir holds a .git directory
+    static std::unique_ptr<Repository> open (const std::string& dir);
+    static std::unique_ptr<Repository> init (const std::string& dir);
+    // clone over smart HTTP, or by linking objects from a local path or file:// URL
+    static std::unique_ptr<Repository> clone (const std::string& url, const std::string& dir);
+
+    const std::string& path () const { return dir; }
+
+    // objects, addressed by hex hash
+    bool read_object (const std::string& hash, std::string& type, std::string& contents) const;
+    bool has_object (const std::string& hash) const;
+    std::string write_object (const std::string& type, const std::string& contents);
+    std::string resolve (const std::string& revision) const;
+
+    // trees
+    bool read_tree (const std::string& hash, std::vector<TreeEntry>& entries) const;
+    // visit every entry with its path in tree order, descending into subtrees when recursive;
+    // returning false from visit stops the walk
+    bool walk_tree (const std::string& hash, bool recursive,
+                    const std::function<bool(const std::string& path, const TreeEntry& entry)>& visit) const;
+    // store a tree from entries in any order
+    std::string write_tree (std::vector<TreeEntry> entries);
+    // store the files of the worktree and return the tree of its root
+    std::string write_worktree ();
+
+    // commits; identities are "Name <email>", the committer defaults to the author
+    bool read_commit (const std::string& hash, CommitObject& commit) const;
+    std::string create_commit (const std::string& tree, const std::vector<std::string>& parents,
+                               const std::string& message, const std::string& author, const std::string& committer = "");
+
+    // pick up packs written by other processes since the repository was opened
+    void refresh ();
+
+private:
+    explicit Repository (const std::string& dir) : dir(dir) {}
+
+    std::string dir;
+};
+
+#endif // REPOSITORY_H
@@ -0,0 +1,756 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <unordered_set>
+#include "revision.h"
+#include "object_store.h"
+#include "pack_bitmap.h"
+
+#define FLAG_SEEN 0x01
+#define FLAG_IN_QUEUE 0x02
+#define FLAG_UNINTERESTING 0x04
+#define FLAG_PARENT1 0x08
+#define FLAG_PARENT2 0x10
+#define FLAG_STALE 0x20
+#define FLAG_RESULT 0x40
+
+static std::string raw_to_hex (const unsigned char* raw) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(40, '0');
+    for (int i = 0; i < 20; i++) {
+        hex[i * 2] = digits[raw[i] >> 4];
+        hex[i * 2 + 1] = digits[raw[i] & 0x0F];
+    }
+
+    return hex;
+}
+
+static bool hex_to_raw (const std::string& hex, unsigned char* raw) {
+    if (hex.length() != 40) {
+        return false;
+    }
+
+    for (int i = 0; i < 20; i++) {
+        int value = 0;
+        for (int j = 0; j < 2; j++) {
+            char c = hex[i * 2 + j];
+            int nibble = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+            if (nibble < 0) {
+                return false;
+            }
+            value = (value << 4) | nibble;
+        }
+        raw[i] = static_cast<unsigned char>(value);
+    }
+
+    return true;
+}
+
+CommitIndex::CommitIndex (const std::string& dir) : dir(dir) {
+    load_commit_graph(graph, dir);
+}
+
+CommitIndex::~CommitIndex () {
+    close_commit_graph(graph);
+}
+
+bool CommitIndex::lookup (const std::string& hash, uint32_t* id) {
+    unsigned char raw[20];
+    if (!hex_to_raw(hash, raw)) {
+        return false;
+    }
+
+    if (commit_graph_find(graph, raw, id)) {
+        return true;
+    }
+
+    std::string key(reinterpret_cast<const char*>(raw), 20);
+    auto found = extra_lookup.find(key);
+    if (found != extra_lookup.end()) {
+        *id = found->second;
+        return true;
+    }
+
+    // not covered by the commit-graph: parse the commit object itself
+    std::string type, contents;
+    CommitObject commit;
+    if (!read_object(hash, type, contents, dir) || type != "commit" || !parse_commit(contents, commit)) {
+        return false;
+    }
+
+    *id = graph.num_commits + extra_oids.size();
+    extra_lookup[key] = *id;
+    extra_oids.push_back(key);
+    extra_trees.push_back(commit.tree);
+    extra_parents.push_back(commit.parents);
+    extra_times.push_back(commit.commit_time);
+
+    return true;
+}
+
+std::string CommitIndex::hash (uint32_t id) const {
+    if (id < graph.num_commits) {
+        return raw_to_hex(commit_graph_oid(graph, id));
+    }
+
+    return raw_to_hex(reinterpret_cast<const unsigned char*>(extra_oids[id - graph.num_commits].data()));
+}
+
+std::string CommitIndex::tree (uint32_t id) const {
+    if (id < graph.num_commits) {
+        return raw_to_hex(commit_graph_tree(graph, id));
+    }
+
+    return extra_trees[id - graph.num_commits];
+}
+
+bool CommitIndex::parents (uint32_t id, std::vector<uint32_t>& out) {
+    if (id < graph.num_commits) {
+        commit_graph_parents(graph, id, out);
+        return true;
+    }
+
+    out.clear();
+    // copy the list, looking up a parent may grow extra_parents
+    std::vector<std::string> parent_hashes = extra_parents[id - graph.num_commits];
+    for (const auto& parent : parent_hashes) {
+        uint32_t parent_id;
+        if (!lookup(parent, &parent_id)) {
+            std::cerr << "Failed to read commit " << parent << ".\n";
+            return false;
+        }
+        out.push_back(parent_id);
+    }
+
+    return true;
+}
+
+uint64_t CommitIndex::commit_time (uint32_t id) const {
+    if (id < graph.num_commits) {
+        return commit_graph_time(graph, id);
+    }
+
+    return extra_times[id - graph.num_commits];
+}
+
+uint32_t CommitIndex::generation (uint32_t id) const {
+    if (id < graph.num_commits) {
+        return commit_graph_generation(graph, id);
+    }
+
+    return GENERATION_NUMBER_INFINITY;
+}
+
+namespace {
+
+struct QueueEntry {
+    uint32_t id;
+    uint32_t generation;
+    uint64_t time;
+    uint64_t order; // insertion counter, keeps equal entries first-in first-out
+};
+
+// newest commit first
+struct ByDate {
+    bool operator() (const QueueEntry& a, const QueueEntry& b) const {
+        if (a.time != b.time) return a.time < b.time;
+        return a.order > b.order;
+    }
+};
+
+// highest generation first, so a commit is only popped after all its descendants
+struct ByGeneration {
+    bool operator() (const QueueEntry& a, const QueueEntry& b) const {
+        if (a.generation != b.generation) return a.generation < b.generation;
+        if (a.time != b.time) return a.time < b.time;
+        return a.order > b.order;
+    }
+};
+
+} // namespace
+
+static void grow_flags (std::vector<uint8_t>& flags, const CommitIndex& index) {
+    if (flags.size() < index.size()) {
+        flags.resize(index.size() + index.size() / 2, 0);
+    }
+}
+
+// peel annotated tags, reporting each tag object on the way
+static bool peel_object (const std::string& hash, std::string& peeled, std::string& type, const std::string& dir,
+                         const std::function<void(const std::string&, const std::string&, const std::string&)>* show) {
+    std::string contents;
+    peeled = hash;
+    for (int depth = 0; depth < 10; depth++) {
+        if (!read_object(peeled, type, contents, dir)) {
+            std::cerr << "Failed to read object " << peeled << ".\n";
+            return false;
+        }
+        if (type != "tag") {
+            return true;
+        }
+        if (show) {
+            (*show)(peeled, type, "");
+        }
+        if (contents.rfind("object ", 0) != 0) {
+            return false;
+        }
+        peeled = contents.substr(7, 40);
+    }
+
+    return false;
+}
+
+std::string peel_to_commit (const std::string& hash, const std::string& dir) {
+    std::string peeled, type;
+    if (!peel_object(hash, peeled, type, dir, nullptr) || type != "commit") {
+        return {};
+    }
+    return peeled;
+}
+
+static bool resolve_commits (CommitIndex& index, const std::vector<std::string>& revisions, std::vector<uint32_t>& ids) {
+    for (const auto& revision : revisions) {
+        std::string hash = resolve_revision(revision, index.dir);
+        uint32_t id;
+        if (!hash.empty()) {
+            hash = peel_to_commit(hash, index.dir);
+        }
+        if (hash.empty() || !index.lookup(hash, &id)) {
+            std::cerr << "Unknown revision " << revision << ".\n";
+            return false;
+        }
+        ids.push_back(id);
+    }
+
+    return true;
+}
+
+int walk_revisions (CommitIndex& index, const RevListOptions& options, const std::function<bool(uint32_t)>& visit) {
+    std::vector<uint32_t> include, exclude;
+    if (!resolve_commits(index, options.include, include) || !resolve_commits(index, options.exclude, exclude)) {
+        return EXIT_FAILURE;
+    }
+
+    std::vector<uint8_t> flags(index.size(), 0);
+    std::vector<uint32_t> parents;
+    uint64_t order = 0;
+    int64_t shown = 0;
+
+    // without exclusions commits can be emitted as soon as they are popped
+    if (exclude.empty()) {
+        std::priority_queue<QueueEntry, std::vector<QueueEntry>, ByDate> queue;
+        auto push = [&](uint32_t id) {
+            grow_flags(flags, index);
+            if (flags[id] & FLAG_SEEN) return;
+            flags[id] |= FLAG_SEEN;
+            queue.push({id, 0, index.commit_time(id), order++});
+        };
+
+        for (uint32_t id : include) push(id);
+        while (!queue.empty() && (options.max_count < 0 || shown < options.max_count)) {
+            uint32_t id = queue.top().id;
+            queue.pop();
+            shown++;
+            if (!visit(id)) break;
+
+            if (!index.parents(id, parents)) return EXIT_FAILURE;
+            for (uint32_t parent : parents) push(parent);
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    // with exclusions, paint uninteresting history first in generation order
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, ByGeneration> queue;
+    size_t interesting_queued = 0;
+    auto push = [&](uint32_t id) {
+        grow_flags(flags, index);
+        if (flags[id] & FLAG_IN_QUEUE) return;
+        flags[id] |= FLAG_SEEN | FLAG_IN_QUEUE;
+        if (!(flags[id] & FLAG_UNINTERESTING)) interesting_queued++;
+        queue.push({id, index.generation(id), index.commit_time(id), order++});
+    };
+
+    for (uint32_t id : exclude) {
+        grow_flags(flags, index);
+        flags[id] |= FLAG_UNINTERESTING;
+        push(id);
+    }
+    for (uint32_t id : include) push(id);
+
+    std::vector<uint32_t> selected;
+    while (!queue.empty() && interesting_queued > 0) {
+        uint32_t id = queue.top().id;
+        queue.pop();
+        flags[id] &= ~FLAG_IN_QUEUE;
+
+        bool uninteresting = flags[id] & FLAG_UNINTERESTING;
+        if (!uninteresting) {
+            interesting_queued--;
+            selected.push_back(id);
+        }
+
+        if (!index.parents(id, parents)) return EXIT_FAILURE;
+        for (uint32_t parent : parents) {
+            grow_flags(flags, index);
+            if (uninteresting && !(flags[parent] & FLAG_UNINTERESTING)) {
+                if (flags[parent] & FLAG_IN_QUEUE) interesting_queued--;
+                flags[parent] |= FLAG_UNINTERESTING;
+                push(parent);
+            }
+            else if (!(flags[parent] & FLAG_SEEN)) {
+                push(parent);
+            }
+        }
+    }
+
+    // commits reached before their exclusion was known (clock skew outside the graph) are dropped here
+    std::vector<uint32_t> result;
+    for (uint32_t id : selected) {
+        if (!(flags[id] & FLAG_UNINTERESTING)) result.push_back(id);
+    }
+    std::stable_sort(result.begin(), result.end(), [&](uint32_t a, uint32_t b) {
+        return index.commit_time(a) > index.commit_time(b);
+    });
+
+    for (uint32_t id : result) {
+        if (options.max_count >= 0 && shown >= options.max_count) break;
+        shown++;
+        if (!visit(id)) break;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// walk a tree depth first, skipping (and not reporting) anything already seen
+static bool walk_tree (const std::string& tree_hash, const std::string& path, std::unordered_set<std::string>& seen,
+                       const std::string& dir,
+                       const std::function<void(const std::string&, const std::string&, const std::string&)>* show) {
+    std::vector<std::pair<std::string, std::string>> stack = {{tree_hash, path}};
+    while (!stack.empty()) {
+        auto [hash, name] = stack.back();
+        stack.pop_back();
+        if (!seen.insert(hash).second) {
+            continue;
+        }
+        if (show) {
+            (*show)(hash, "tree", name);
+        }
+
+        std::string type, contents;
+        std::vector<TreeEntry> entries;
+        if (!read_object(hash, type, contents, dir) || type != "tree" || !parse_tree(contents, entries)) {
+            std::cerr << "Failed to read tree " << hash << ".\n";
+            return false;
+        }
+
+        std::string prefix = name.empty() ? "" : name + '/';
+        for (auto entry = entries.rbegin(); entry != entries.rend(); ++entry) {
+            if (entry->mode == "40000") {
+                stack.emplace_back(entry->hash, prefix + entry->name);
+            }
+            else if (entry->mode != "160000" && seen.insert(entry->hash).second && show) {
+                (*show)(entry->hash, "blob", prefix + entry->name);
+            }
+        }
+    }
+
+    return true;
+}
+
+int list_objects (CommitIndex& index, const RevListOptions& options,
+                  const std::function<void(const std::string& hash, const std::string& type, const std::string& name)>& show) {
+    std::unordered_set<std::string> seen;
+    RevListOptions commit_options = options;
+    commit_options.include.clear();
+    commit_options.exclude.clear();
+    std::vector<std::pair<std::string, std::string>> roots; // trees and blobs named directly
+
+    for (const auto& revision : options.include) {
+        std::string hash = resolve_revision(revision, index.dir);
+        std::string peeled, type;
+        if (hash.empty()) {
+            std::cerr << "Unknown revision " << revision << ".\n";
+            return EXIT_FAILURE;
+        }
+        if (!peel_object(hash, peeled, type, index.dir, &show)) {
+            return EXIT_FAILURE;
+        }
+        if (type == "commit") {
+            commit_options.include.push_back(peeled);
+        } else {
+            roots.emplace_back(peeled, type);
+        }
+    }
+
+    // everything reachable from excluded trees is known to the other side
+    for (const auto& revision : options.exclude) {
+        std::string hash = resolve_revision(revision, index.dir);
+        std::string peeled, type;
+        if (hash.empty() || !peel_object(hash, peeled, type, index.dir, nullptr)) {
+            continue; // an unknown exclusion cannot hide anything
+        }
+        if (type == "commit") {
+            commit_options.exclude.push_back(peeled);
+        } else if (type == "tree" && !walk_tree(peeled, "", seen, index.dir, nullptr)) {
+            return EXIT_FAILURE;
+        } else {
+            seen.insert(peeled);
+        }
+    }
+
+    std::vector<uint32_t> commits;
+    if (!commit_options.include.empty() &&
+        walk_revisions(index, commit_options, [&](uint32_t id) { commits.push_back(id); return true; }) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    // mark the trees of boundary commits, the parents left out of the walk
+    if (!commit_options.exclude.empty()) {
+        std::unordered_set<uint32_t> selected(commits.begin(), commits.end());
+        std::vector<uint32_t> parents;
+        std::unordered_set<uint32_t> boundary;
+        for (uint32_t id : commits) {
+            if (!index.parents(id, parents)) return EXIT_FAILURE;
+            for (uint32_t parent : parents) {
+                if (!selected.count(parent) && boundary.insert(parent).second &&
+                    !walk_tree(index.tree(parent), "", seen, index.dir, nullptr)) {
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+    }
+
+    for (uint32_t id : commits) {
+        show(index.hash(id), "commit", "");
+    }
+    for (uint32_t id : commits) {
+        if (!walk_tree(index.tree(id), "", seen, index.dir, &show)) return EXIT_FAILURE;
+    }
+    for (const auto& [hash, type] : roots) {
+        if (type == "tree") {
+            if (!walk_tree(hash, "", seen, index.dir, &show)) return EXIT_FAILURE;
+        } else if (seen.insert(hash).second) {
+            show(hash, type, "");
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// rev-list answered from a reachability bitmap: the pack objects come out in pack order
+static int rev_list_bitmap (CommitIndex& index, BitmapIndex& bitmap, const RevListOptions& options, const RevListOutput& output) {
+    Bitset reachable;
+    std::unordered_map<std::string, std::string> extra;
+    if (!bitmap.reachable(index, options, reachable, extra)) {
+        return EXIT_FAILURE;
+    }
+
+    uint64_t count = 0;
+    std::string listing;
+    for (uint32_t position = 0; position < bitmap.num_objects(); position++) {
+        if (!(reachable[position / 64] & (1ull << (position % 64))) || (!output.objects && !bitmap.is_commit(position))) {
+            continue;
+        }
+        count++;
+        if (!output.count_only) {
+            listing += bitmap.hash(position);
+            listing += '\n';
+            if (listing.length() > 65536) {
+                std::cout << listing;
+                listing.clear();
+            }
+        }
+    }
+    for (const auto& [hash, type] : extra) {
+        if (output.objects || type == "commit") {
+            count++;
+            if (!output.count_only) {
+                listing += hash + '\n';
+            }
+        }
+    }
+
+    std::cout << listing;
+    if (output.count_only) {
+        std::cout << count << '\n';
+    }
+    return EXIT_SUCCESS;
+}
+
+int rev_list (const RevListOptions& options, const RevListOutput& output, const std::string& dir) {
+    CommitIndex index(dir);
+    uint64_t count = 0;
+    std::string listing;
+
+    // list_objects passes over exclusions it cannot resolve, as upload-pack needs for unknown
+    // haves; here that would quietly count everything
+    for (const std::string& revision : options.exclude) {
+        if (resolve_revision(revision, dir).empty()) {
+            std::cerr << "Unknown revision " << revision << ".\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    // the order of a walk is lost in a bitmap, and so is --max-count
+    BitmapIndex bitmap;
+    if ((output.count_only || (output.objects && output.use_bitmap)) && options.max_count < 0 && bitmap.open(dir)) {
+        return rev_list_bitmap(index, bitmap, options, output);
+    }
+
+    auto emit = [&](const std::string& hash, const std::string* name) {
+        count++;
+        if (!output.count_only) {
+            listing += hash;
+            if (name) {
+                listing += ' ';
+                listing += *name;
+            }
+            listing += '\n';
+            if (listing.length() > 65536) {
+                std::cout << listing;
+                listing.clear();
+            }
+        }
+    };
+
+    int status;
+    if (output.objects) {
+        status = list_objects(index, options, [&](const std::string& hash, const std::string& type, const std::string& name) {
+            emit(hash, type == "commit" ? nullptr : &name);
+        });
+    } else {
+        status = walk_revisions(index, options, [&](uint32_t id) {
+            emit(index.hash(id), nullptr);
+            return true;
+        });
+    }
+
+    std::cout << listing;
+    if (status == EXIT_SUCCESS && output.count_only) {
+        std::cout << count << '\n';
+    }
+
+    return status;
+}
+
+// "Name <email> 1700000000 -0800" -> "Name <email>" and "Tue Nov 14 14:13:20 2023 -0800"
+static void format_identity (const std::string& identity, std::string& person, std::string& date) {
+    size_t email_end = identity.rfind('>');
+    if (email_end == std::string::npos) {
+        person = identity;
+        date.clear();
+        return;
+    }
+    person = identity.substr(0, email_end + 1);
+
+    char timezone[8] = "+0000";
+    long long timestamp = 0;
+    sscanf(identity.c_str() + email_end + 1, "%lld %7s", &timestamp, timezone);
+
+    // shift into the author's timezone before breaking the time down
+    int offset = atoi(timezone + 1);
+    int offset_seconds = ((offset / 100) * 60 + offset % 100) * 60;
+    time_t local_time = static_cast<time_t>(timestamp + (timezone[0] == '-' ? -offset_seconds : offset_seconds));
+    struct tm parts;
+    gmtime_r(&local_time, &parts);
+
+    static const char* days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static const char* months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%s %s %d %02d:%02d:%02d %d %s",
+             days[parts.tm_wday], months[parts.tm_mon], parts.tm_mday,
+             parts.tm_hour, parts.tm_min, parts.tm_sec, parts.tm_year + 1900, timezone);
+    date = buffer;
+}
+
+int log_commits (const RevListOptions& options, const std::string& dir) {
+    CommitIndex index(dir);
+    bool first = true;
+
+    return walk_revisions(index, options, [&](uint32_t id) {
+        std::string hash = index.hash(id);
+        std::string type, contents;
+        CommitObject commit;
+        if (!read_object(hash, type, contents, dir) || !parse_commit(contents, commit)) {
+            std::cerr << "Failed to read commit " << hash << ".\n";
+            return false;
+        }
+
+        std::string person, date;
+        format_identity(commit.author, person, date);
+
+        std::string output = first ? "" : "\n";
+        first = false;
+        output += "commit " + hash + '\n';
+        if (commit.parents.size() > 1) {
+            output += "Merge:";
+            for (const auto& parent : commit.parents) {
+                output += ' ' + parent.substr(0, 7);
+            }
+            output += '\n';
+        }
+        output += "Author: " + person + '\n';
+        output += "Date:   " + date + "\n\n";
+
+        // indent the message body, dropping its trailing newline
+        std::string message = commit.message;
+        while (!message.empty() && message.back() == '\n') {
+            message.pop_back();
+        }
+        size_t pos = 0;
+        while (pos <= message.length()) {
+            size_t line_end = message.find('\n', pos);
+            if (line_end == std::string::npos) line_end = message.length();
+            std::string line = message.substr(pos, line_end - pos);
+            output += line.empty() ? "\n" : "    " + line + '\n';
+            pos = line_end + 1;
+        }
+
+        std::cout << output;
+        return true;
+    });
+}
+
+bool is_ancestor (CommitIndex& index, uint32_t ancestor, uint32_t descendant) {
+    if (ancestor == descendant) {
+        return true;
+    }
+
+    // nothing with a lower generation than the ancestor can reach it
+    uint32_t min_generation = index.generation(ancestor);
+    std::vector<uint8_t> flags(index.size(), 0);
+    std::vector<uint32_t> stack = {descendant};
+    std::vector<uint32_t> parents;
+    flags[descendant] = FLAG_SEEN;
+
+    while (!stack.empty()) {
+        uint32_t id = stack.back();
+        stack.pop_back();
+        if (!index.parents(id, parents)) {
+            return false;
+        }
+
+        for (uint32_t parent : parents) {
+            if (parent == ancestor) {
+                return true;
+            }
+            grow_flags(flags, index);
+            if ((flags[parent] & FLAG_SEEN) || index.generation(parent) < min_generation) {
+                continue;
+            }
+            flags[parent] |= FLAG_SEEN;
+            stack.push_back(parent);
+        }
+    }
+
+    return false;
+}
+
+std::vector<uint32_t> merge_bases (CommitIndex& index, const std::vector<uint32_t>& commits) {
+    std::vector<uint32_t> result;
+    if (commits.empty()) {
+        return result;
+    }
+    for (size_t i = 1; i < commits.size(); i++) {
+        if (commits[i] == commits[0]) {
+            return {commits[0]};
+        }
+    }
+
+    // paint down from both sides until only stale commits remain queued
+    std::vector<uint8_t> flags(index.size(), 0);
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, ByGeneration> queue;
+    std::vector<uint32_t> parents;
+    uint64_t order = 0;
+    size_t nonstale_queued = 0;
+    auto push = [&](uint32_t id) {
+        if (flags[id] & FLAG_IN_QUEUE) return;
+        flags[id] |= FLAG_IN_QUEUE;
+        if (!(flags[id] & FLAG_STALE)) nonstale_queued++;
+        queue.push({id, index.generation(id), index.commit_time(id), order++});
+    };
+
+    flags[commits[0]] |= FLAG_PARENT1;
+    push(commits[0]);
+    for (size_t i = 1; i < commits.size(); i++) {
+        flags[commits[i]] |= FLAG_PARENT2;
+        push(commits[i]);
+    }
+
+    std::vector<uint32_t> candidates;
+    while (!queue.empty() && nonstale_queued > 0) {
+        uint32_t id = queue.top().id;
+        queue.pop();
+        flags[id] &= ~FLAG_IN_QUEUE;
+
+        uint8_t paint = flags[id] & (FLAG_PARENT1 | FLAG_PARENT2 | FLAG_STALE);
+        if (!(paint & FLAG_STALE)) nonstale_queued--;
+        if (paint == (FLAG_PARENT1 | FLAG_PARENT2)) {
+            if (!(flags[id] & FLAG_RESULT)) {
+                flags[id] |= FLAG_RESULT;
+                candidates.push_back(id);
+            }
+            paint |= FLAG_STALE;
+        }
+
+        if (!index.parents(id, parents)) {
+            return {};
+        }
+        for (uint32_t parent : parents) {
+            grow_flags(flags, index);
+            if ((flags[parent] & paint) == paint) continue;
+
+            bool was_stale = flags[parent] & FLAG_STALE;
+            flags[parent] |= paint;
+            if ((flags[parent] & FLAG_IN_QUEUE) && !was_stale && (paint & FLAG_STALE)) {
+                nonstale_queued--;
+            }
+            push(parent);
+        }
+    }
+
+    for (uint32_t id : candidates) {
+        if (!(flags[id] & FLAG_STALE)) result.push_back(id);
+    }
+
+    // drop candidates that are ancestors of other candidates
+    std::vector<uint32_t> independent;
+    for (size_t i = 0; i < result.size(); i++) {
+        bool redundant = false;
+        for (size_t j = 0; j < result.size() && !redundant; j++) {
+            redundant = i != j && is_ancestor(index, result[i], result[j]);
+        }
+        if (!redundant) independent.push_back(result[i]);
+    }
+
+    return independent;
+}
+
+int merge_base (const std::vector<std::string>& revisions, bool all, bool is_ancestor_check, const std::string& dir) {
+    CommitIndex index(dir);
+    std::vector<uint32_t> commits;
+    if (!resolve_commits(index, revisions, commits)) {
+        return EXIT_FAILURE;
+    }
+
+    if (is_ancestor_check) {
+        return is_ancestor(index, commits[0], commits[1]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    std::vector<uint32_t> bases = merge_bases(index, commits);
+    if (bases.empty()) {
+        return EXIT_FAILURE;
+    }
+
+    for (uint32_t id : bases) {
+        std::cout << index.hash(id) << '\n';
+        if (!all) break;
+    }
+
+    return EXIT_SUCCESS;
+}
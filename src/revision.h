@@ -0,0 +1,70 @@
+#ifndef REVISION_H
+#define REVISION_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "commit_graph.h"
+
+// commits addressed by a dense id: commit-graph positions first, then
+// commits missing from the graph, parsed from their objects on demand
+struct CommitIndex {
+    std::string dir;
+    CommitGraph graph;
+    std::vector<std::string> extra_oids; // raw 20-byte ids
+    std::vector<std::string> extra_trees;
+    std::vector<std::vector<std::string>> extra_parents;
+    std::vector<uint64_t> extra_times;
+    std::unordered_map<std::string, uint32_t> extra_lookup;
+
+    explicit CommitIndex (const std::string& dir = ".");
+    ~CommitIndex ();
+    CommitIndex (const CommitIndex&) = delete;
+    CommitIndex& operator= (const CommitIndex&) = delete;
+
+    uint32_t size () const { return graph.num_commits + extra_oids.size(); }
+    bool lookup (const std::string& hash, uint32_t* id);
+    std::string hash (uint32_t id) const;
+    std::string tree (uint32_t id) const;
+    bool parents (uint32_t id, std::vector<uint32_t>& out);
+    uint64_t commit_time (uint32_t id) const;
+    uint32_t generation (uint32_t id) const;
+};
+
+struct RevListOptions {
+    std::vector<std::string> include;
+    std::vector<std::string> exclude;
+    int64_t max_count = -1;
+};
+
+// the commit a hash names, following annotated tags; empty when it ends at something else
+std::string peel_to_commit (const std::string& hash, const std::string& dir = ".");
+
+// walk history newest first, calling visit for every selected commit until it returns false
+int walk_revisions (CommitIndex& index, const RevListOptions& options, const std::function<bool(uint32_t)>& visit);
+
+// enumerate the commits, tags, trees and blobs reachable from options.include but not from
+// options.exclude; trees and blobs are named by their path for delta heuristics
+int list_objects (CommitIndex& index, const RevListOptions& options,
+                  const std::function<void(const std::string& hash, const std::string& type, const std::string& name)>& show);
+
+// what rev-list prints: the commits, or with objects everything they reach; a count instead
+// of the list. Counting uses a reachability bitmap when the repository has one, listing
+// objects only when use_bitmap asks for it (they come out in pack order, without names).
+struct RevListOutput {
+    bool count_only = false;
+    bool objects = false;
+    bool use_bitmap = false;
+};
+
+int rev_list (const RevListOptions& options, const RevListOutput& output, const std::string& dir = ".");
+int log_commits (const RevListOptions& options, const std::string& dir = ".");
+
+// best common ancestors of two or more commits
+std::vector<uint32_t> merge_bases (CommitIndex& index, const std::vector<uint32_t>& commits);
+bool is_ancestor (CommitIndex& index, uint32_t ancestor, uint32_t descendant);
+int merge_base (const std::vector<std::string>& revisions, bool all, bool is_ancestor_check, const std::string& dir = ".");
+
+#endif // REVISION_H
@@ -0,0 +1,137 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "sparse_checkout.h"
+
+#define SPARSE_CHECKOUT_FILE "/.git/info/sparse-checkout"
+
+static std::string strip_slashes (const std::string& path) {
+    size_t start = path.find_first_not_of('/');
+    size_t end = path.find_last_not_of('/');
+    return start == std::string::npos ? "" : path.substr(start, end - start + 1);
+}
+
+static bool ends_with (const std::string& s, const std::string& suffix) {
+    return s.length() >= suffix.length() && s.compare(s.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+
+// whether a directory above path is in the set
+static bool has_ancestor (const std::set<std::string>& paths, const std::string& path) {
+    for (size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+        if (paths.count(path.substr(0, slash))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool read_sparse_checkout (SparseCone& cone, const std::string& dir) {
+    std::ifstream file(dir + SPARSE_CHECKOUT_FILE);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    // "/*" and "!/*/" keep the root files only, then "/a/" with "!/a/*/" for each parent
+    // and "/a/b/" for each selected directory
+    std::set<std::string> included;
+    cone = SparseCone();
+    std::string line;
+    while (std::getline(file, line)) {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (line.empty() || line[0] == '#' || line == "/*" || line == "!/*/") {
+            continue;
+        }
+
+        bool negative = line[0] == '!';
+        std::string pattern = negative ? line.substr(1) : line;
+        if (pattern.length() < 3 || pattern.front() != '/' || pattern.back() != '/' ||
+            (negative && !ends_with(pattern, "/*/"))) {
+            std::cerr << "warning: " << line << " is not a cone pattern, checking out everything.\n";
+            return false;
+        }
+        if (negative) {
+            cone.parents.insert(strip_slashes(pattern.substr(0, pattern.length() - 2)));
+        }
+        else {
+            included.insert(strip_slashes(pattern));
+        }
+    }
+
+    for (const auto& path : included) {
+        if (!cone.parents.count(path)) {
+            cone.recursive.insert(path);
+        }
+    }
+
+    return true;
+}
+
+bool write_sparse_checkout (const SparseCone& cone, const std::string& dir) {
+    std::set<std::string> paths(cone.parents);
+    paths.insert(cone.recursive.begin(), cone.recursive.end());
+
+    std::string patterns = "/*\n!/*/\n";
+    for (const auto& path : paths) {
+        patterns += '/' + path + "/\n";
+        if (!cone.recursive.count(path)) {
+            patterns += "!/" + path + "/*/\n";
+        }
+    }
+
+    std::filesystem::create_directories(dir + "/.git/info");
+    std::ofstream file(dir + SPARSE_CHECKOUT_FILE, std::ios::trunc);
+    if (!file.is_open() || !(file << patterns).good()) {
+        std::cerr << "Failed to write " << dir << SPARSE_CHECKOUT_FILE << ".\n";
+        return false;
+    }
+
+    // git only honors the patterns with sparseCheckout set
+    std::string config_path = dir + "/.git/config";
+    std::ifstream config_in(config_path);
+    std::stringstream config;
+    config << config_in.rdbuf();
+    if (config.str().find("sparseCheckout") == std::string::npos) {
+        std::ofstream config_out(config_path, std::ios::app);
+        config_out << "[core]\n\tsparseCheckout = true\n\tsparseCheckoutCone = true\n";
+    }
+
+    return true;
+}
+
+SparseCone sparse_cone (const std::vector<std::string>& directories) {
+    std::set<std::string> selected;
+    for (const auto& directory : directories) {
+        std::string path = strip_slashes(directory);
+        if (!path.empty()) {
+            selected.insert(path);
+        }
+    }
+
+    SparseCone cone;
+    for (const auto& path : selected) {
+        if (has_ancestor(selected, path)) {
+            continue; // inside another selected directory, adds nothing
+        }
+        cone.recursive.insert(path);
+        for (size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+            cone.parents.insert(path.substr(0, slash));
+        }
+    }
+
+    return cone;
+}
+
+SparseMatch sparse_match (const SparseCone& cone, const std::string& path) {
+    if (path.empty()) {
+        return SparseMatch::Parent;
+    }
+    if (cone.recursive.count(path) || has_ancestor(cone.recursive, path)) {
+        return SparseMatch::Recursive;
+    }
+
+    return cone.parents.count(path) ? SparseMatch::Parent : SparseMatch::Excluded;
+}
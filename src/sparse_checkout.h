@@ -0,0 +1,33 @@
+#ifndef SPARSE_CHECKOUT_H
+#define SPARSE_CHECKOUT_H
+
+#include <set>
+#include <string>
+#include <vector>
+
+// the directories of a cone mode .git/info/sparse-checkout. The files directly in the root
+// and in every parent of a selected directory are checked out, selected directories in full.
+struct SparseCone {
+    std::set<std::string> recursive; // "a/b", with everything below it
+    std::set<std::string> parents;   // "a", only its files
+};
+
+enum class SparseMatch {
+    Excluded,  // neither the directory nor anything below it is checked out
+    Parent,    // its files are, its subdirectories are matched on their own
+    Recursive  // the directory and everything below it
+};
+
+// read .git/info/sparse-checkout, false if there is none and the checkout is full
+bool read_sparse_checkout (SparseCone& cone, const std::string& dir = ".");
+
+// write the patterns of the cone and enable cone mode sparse checkout in .git/config
+bool write_sparse_checkout (const SparseCone& cone, const std::string& dir = ".");
+
+// the cone selecting the given directories, "a/b" or "/a/b/"
+SparseCone sparse_cone (const std::vector<std::string>& directories);
+
+// how a directory of the tree ("" for the root) is checked out
+SparseMatch sparse_match (const SparseCone& cone, const std::string& path);
+
+#endif // SPARSE_CHECKOUT_H
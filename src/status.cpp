@@ -0,0 +1,312 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "status.h"
+#include "index.h"
+#include "object_store.h"
+#include "diff_tree.h"
+#include "sparse_checkout.h"
+
+namespace {
+
+struct WorktreeEntry {
+    std::string name;
+    bool is_dir;
+    struct stat st;
+};
+
+// a file present in both HEAD and the worktree whose contents are unknown until hashed
+struct HashJob {
+    std::string path;
+    uint32_t mode;
+    std::string tree_hash;
+    uint32_t tree_mode;
+};
+
+class StatusWalk {
+public:
+    StatusWalk (const std::string& dir, const Index& index, bool has_index, const SparseCone* cone)
+        : dir(dir), index(index), has_index(has_index), cone(cone) {
+        for (const auto& node : index.cache_tree) {
+            if (node.entry_count >= 0) cache_tree[node.path] = node.hash;
+        }
+    }
+
+    // list a directory once, returning whether every file below it matches the index
+    bool scan (const std::string& path);
+    bool walk (const std::string& path, const std::string& tree_hash);
+
+    std::vector<StatusChange> changes;
+    std::vector<HashJob> jobs;
+
+private:
+    const std::string& dir;
+    const Index& index;
+    bool has_index;
+    const SparseCone* cone; // outside of it, missing directories are expected
+    std::unordered_map<std::string, std::string> cache_tree;
+    std::unordered_map<std::string, std::vector<WorktreeEntry>> listings;
+    std::unordered_set<std::string> clean_dirs;
+
+    size_t index_entries_below (const std::string& path) const;
+};
+
+} // namespace
+
+static std::string join_path (const std::string& base, const std::string& name) {
+    return base.empty() ? name : base + '/' + name;
+}
+
+// git's tree order: a directory sorts as if its name ended in '/'
+static bool tree_order_less (const std::string& a, bool a_dir, const std::string& b, bool b_dir) {
+    size_t length = std::min(a.length(), b.length());
+    int cmp = memcmp(a.data(), b.data(), length);
+    if (cmp != 0) {
+        return cmp < 0;
+    }
+
+    unsigned char c1 = length < a.length() ? a[length] : (a_dir ? '/' : '\0');
+    unsigned char c2 = length < b.length() ? b[length] : (b_dir ? '/' : '\0');
+    return c1 < c2;
+}
+
+size_t StatusWalk::index_entries_below (const std::string& path) const {
+    auto by_path = [](const IndexEntry& entry, const std::string& key) { return entry.path < key; };
+    if (path.empty()) {
+        return index.entries.size();
+    }
+    // everything in "<path>/" sorts between "<path>/" and "<path>0"
+    auto first = std::lower_bound(index.entries.begin(), index.entries.end(), path + '/', by_path);
+    auto last = std::lower_bound(first, index.entries.end(), path + '0', by_path);
+    return last - first;
+}
+
+bool StatusWalk::scan (const std::string& path) {
+    std::vector<WorktreeEntry>& listing = listings[path];
+    std::string full_path = path.empty() ? dir : dir + '/' + path;
+    DIR* handle = opendir(full_path.c_str());
+    if (handle) {
+        while (struct dirent* item = readdir(handle)) {
+            std::string name = item->d_name;
+            if (name == "." || name == ".." || name == ".git") {
+                continue;
+            }
+            WorktreeEntry entry;
+            entry.name = name;
+            if (lstat((full_path + '/' + name).c_str(), &entry.st) != 0 ||
+                !(S_ISDIR(entry.st.st_mode) || S_ISREG(entry.st.st_mode) || S_ISLNK(entry.st.st_mode))) {
+                continue;
+            }
+            entry.is_dir = S_ISDIR(entry.st.st_mode);
+            listing.push_back(std::move(entry));
+        }
+        closedir(handle);
+    }
+    std::sort(listing.begin(), listing.end(), [](const WorktreeEntry& a, const WorktreeEntry& b) {
+        return tree_order_less(a.name, a.is_dir, b.name, b.is_dir);
+    });
+
+    bool clean = has_index;
+    size_t files = 0;
+    for (const auto& entry : listing) {
+        std::string entry_path = join_path(path, entry.name);
+        if (entry.is_dir) {
+            clean = scan(entry_path) && clean;
+            files += index_entries_below(entry_path);
+            continue;
+        }
+        const IndexEntry* cached = has_index ? index_find(index, entry_path) : nullptr;
+        clean = clean && cached && index_entry_clean(index, *cached, entry.st);
+        files++;
+    }
+
+    // a clean directory holds exactly the files the index records below it
+    if (clean && files == index_entries_below(path)) {
+        clean_dirs.insert(path);
+        return true;
+    }
+
+    return false;
+}
+
+bool StatusWalk::walk (const std::string& path, const std::string& tree_hash) {
+    if (!tree_hash.empty() && clean_dirs.count(path)) {
+        auto cached = cache_tree.find(path);
+        if (cached != cache_tree.end() && cached->second == tree_hash) {
+            return true; // unchanged since the index was written, the tree is never read
+        }
+    }
+
+    std::vector<TreeEntry> tree_entries;
+    if (!tree_hash.empty()) {
+        std::string type, contents;
+        if (!read_object(tree_hash, type, contents, dir) || type != "tree" || !parse_tree(contents, tree_entries)) {
+            std::cerr << "Invalid tree object " << tree_hash << ".\n";
+            return false;
+        }
+    }
+
+    static const std::vector<WorktreeEntry> no_entries;
+    auto listing_it = listings.find(path);
+    const std::vector<WorktreeEntry>& listing = listing_it != listings.end() ? listing_it->second : no_entries;
+
+    size_t i = 0, j = 0;
+    while (i < tree_entries.size() || j < listing.size()) {
+        const TreeEntry* tree_entry = i < tree_entries.size() ? &tree_entries[i] : nullptr;
+        const WorktreeEntry* work_entry = j < listing.size() ? &listing[j] : nullptr;
+        bool tree_is_dir = tree_entry && tree_entry->mode == "40000";
+        if (tree_entry && work_entry) {
+            if (tree_order_less(tree_entry->name, tree_is_dir, work_entry->name, work_entry->is_dir)) work_entry = nullptr;
+            else if (tree_order_less(work_entry->name, work_entry->is_dir, tree_entry->name, tree_is_dir)) tree_entry = nullptr;
+        }
+        if (tree_entry) i++;
+        if (work_entry) j++;
+
+        std::string entry_path = join_path(path, tree_entry ? tree_entry->name : work_entry->name);
+        if (tree_is_dir || (work_entry && work_entry->is_dir)) {
+            if (tree_entry && tree_entry->mode == "160000") {
+                continue; // a submodule checkout is not compared
+            }
+            if (!work_entry && cone && sparse_match(*cone, entry_path) == SparseMatch::Excluded) {
+                continue; // left out by the sparse checkout, the tree is never read
+            }
+            // a directory on either side, the other side may be missing
+            if (!walk(entry_path, tree_entry ? tree_entry->hash : "")) {
+                return false;
+            }
+            continue;
+        }
+        if (!work_entry) {
+            const IndexEntry* cached = has_index ? index_find(index, entry_path) : nullptr;
+            if (!cached || !(cached->extended_flags & INDEX_SKIP_WORKTREE)) {
+                changes.push_back({'D', entry_path});
+            }
+            continue;
+        }
+        if (!tree_entry) {
+            changes.push_back({'A', entry_path});
+            continue;
+        }
+
+        uint32_t tree_mode = std::stoul(tree_entry->mode, nullptr, 8);
+        uint32_t mode = worktree_mode(work_entry->st);
+        const IndexEntry* cached = has_index ? index_find(index, entry_path) : nullptr;
+        if (cached && index_entry_clean(index, *cached, work_entry->st)) {
+            if (cached->hash != tree_entry->hash || mode != tree_mode) {
+                changes.push_back({'M', entry_path});
+            }
+            continue;
+        }
+        jobs.push_back({entry_path, mode, tree_entry->hash, tree_mode});
+    }
+
+    return true;
+}
+
+static bool hash_worktree_file (const std::string& path, uint32_t mode, std::string& hash) {
+    std::string contents;
+    if (mode == 0120000) {
+        char target[4096];
+        ssize_t length = readlink(path.c_str(), target, sizeof(target));
+        if (length < 0) return false;
+        contents.assign(target, length);
+    }
+    else {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file) return false;
+        char buffer[65536];
+        size_t read;
+        while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            contents.append(buffer, read);
+        }
+        fclose(file);
+    }
+
+    hash = compute_sha1("blob " + std::to_string(contents.length()) + '\0' + contents);
+    return true;
+}
+
+bool worktree_status (std::vector<StatusChange>& changes, unsigned threads, const std::string& dir) {
+    std::string head_tree;
+    if (!resolve_revision("HEAD", dir).empty()) {
+        head_tree = resolve_tree("HEAD", dir);
+        if (head_tree.empty()) {
+            std::cerr << "Invalid HEAD commit.\n";
+            return false;
+        }
+    }
+
+    Index index;
+    bool has_index = read_index(index, dir);
+    SparseCone cone;
+    bool sparse = read_sparse_checkout(cone, dir);
+    StatusWalk status_walk(dir, index, has_index, sparse ? &cone : nullptr);
+    status_walk.scan("");
+    if (!status_walk.walk("", head_tree)) {
+        return false;
+    }
+
+    // hash the files the index could not vouch for
+    std::vector<HashJob>& jobs = status_walk.jobs;
+    std::vector<char> modified(jobs.size(), 0);
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min<size_t>(threads, std::max<size_t>(jobs.size() / 16, 1));
+    std::vector<std::thread> hashers;
+    for (unsigned t = 0; t < threads; t++) {
+        hashers.emplace_back([&]() {
+            std::string hash;
+            for (size_t i = next++; i < jobs.size() && !failed; i = next++) {
+                if (!hash_worktree_file(dir + '/' + jobs[i].path, jobs[i].mode, hash)) {
+                    std::cerr << "Failed to read " << jobs[i].path << ".\n";
+                    failed = true;
+                }
+                modified[i] = hash != jobs[i].tree_hash || jobs[i].mode != jobs[i].tree_mode;
+            }
+        });
+    }
+    for (auto& hasher : hashers) {
+        hasher.join();
+    }
+    if (failed) {
+        return false;
+    }
+
+    changes = std::move(status_walk.changes);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (modified[i]) {
+            changes.push_back({'M', jobs[i].path});
+        }
+    }
+    std::sort(changes.begin(), changes.end(), [](const StatusChange& a, const StatusChange& b) { return a.path < b.path; });
+
+    return true;
+}
+
+int status (unsigned threads, const std::string& dir) {
+    std::vector<StatusChange> changes;
+    if (!worktree_status(changes, threads, dir)) {
+        return EXIT_FAILURE;
+    }
+
+    std::string output;
+    for (const auto& change : changes) {
+        output += change.status;
+        output += '\t' + change.path + '\n';
+    }
+    std::cout << output;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,20 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <string>
+#include <vector>
+
+struct StatusChange {
+    char status; // 'A', 'M' or 'D'
+    std::string path;
+};
+
+// compare the worktree with the tree of HEAD without writing anything, in path order.
+// Files whose stat data matches .git/index take their hash from it, directories whose
+// files are all unchanged and whose cached tree is HEAD's subtree are skipped whole,
+// the remaining files are hashed on a pool of threads.
+bool worktree_status (std::vector<StatusChange>& changes, unsigned threads = 0, const std::string& dir = ".");
+
+int status (unsigned threads = 0, const std::string& dir = ".");
+
+#endif // STATUS_H
@@ -0,0 +1,196 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unistd.h>
+#include <sys/time.h>
+#include "trace.h"
+
+namespace {
+
+struct TraceState {
+    FILE* output = nullptr;
+    std::string sid;
+    std::chrono::steady_clock::time_point start;
+    std::mutex lock;
+    std::vector<TraceTimer*> timers;
+    std::vector<TraceCounter*> counters;
+    std::atomic<int> next_thread{1};
+};
+
+} // namespace
+
+static TraceState& trace_state () {
+    static TraceState* state = new TraceState(); // never destroyed, atexit still writes through it
+    return *state;
+}
+
+static thread_local int trace_nesting = 0;
+static thread_local int trace_thread_id = -1;
+
+static std::string thread_name () {
+    if (trace_thread_id < 0) {
+        trace_thread_id = trace_state().next_thread++;
+    }
+
+    return trace_thread_id == 1 ? "main" : "th" + std::to_string(trace_thread_id);
+}
+
+static std::string json_escape (const std::string& text) {
+    std::string escaped;
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c < 0x20) {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+            escaped += buffer;
+        } else {
+            escaped += c;
+        }
+    }
+
+    return escaped;
+}
+
+static double seconds_since (std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// {"event":"<name>","sid":...,"thread":...,"time":...<fields>}
+static void emit (const char* event, const std::string& fields) {
+    TraceState& state = trace_state();
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    struct tm utc;
+    gmtime_r(&now.tv_sec, &utc);
+    char time[40];
+    size_t length = strftime(time, sizeof(time), "%Y-%m-%dT%H:%M:%S", &utc);
+    snprintf(time + length, sizeof(time) - length, ".%06ldZ", long(now.tv_usec));
+
+    std::string line = std::string("{\"event\":\"") + event + "\",\"sid\":\"" + state.sid + "\",\"thread\":\"" +
+                       thread_name() + "\",\"time\":\"" + time + "\"" + fields + "}\n";
+    std::lock_guard<std::mutex> guard(state.lock);
+    fwrite(line.data(), 1, line.length(), state.output);
+    fflush(state.output);
+}
+
+static void trace_exit () {
+    TraceState& state = trace_state();
+    std::vector<TraceTimer*> timers;
+    std::vector<TraceCounter*> counters;
+    {
+        std::lock_guard<std::mutex> guard(state.lock);
+        timers = state.timers;
+        counters = state.counters;
+    }
+
+    char buffer[256];
+    for (const TraceTimer* timer : timers) {
+        if (timer->intervals == 0) continue;
+        snprintf(buffer, sizeof(buffer), ",\"category\":\"%s\",\"name\":\"%s\",\"intervals\":%llu,\"t_total\":%.6f,\"t_min\":%.6f,\"t_max\":%.6f",
+                 timer->category, timer->name, (unsigned long long) timer->intervals.load(),
+                 timer->total_ns / 1e9, timer->min_ns / 1e9, timer->max_ns / 1e9);
+        emit("timer", buffer);
+    }
+    for (const TraceCounter* counter : counters) {
+        if (counter->value == 0) continue;
+        snprintf(buffer, sizeof(buffer), ",\"category\":\"%s\",\"name\":\"%s\",\"count\":%lld",
+                 counter->category, counter->name, (long long) counter->value.load());
+        emit("counter", buffer);
+    }
+
+    snprintf(buffer, sizeof(buffer), ",\"t_abs\":%.6f", seconds_since(state.start));
+    emit("exit", buffer);
+}
+
+static bool trace_init () {
+    const char* target = getenv("GIT_TRACE2_EVENT");
+    if (!target || !*target || !strcmp(target, "0") || !strcasecmp(target, "false")) {
+        return false;
+    }
+
+    TraceState& state = trace_state();
+    if (!strcmp(target, "1") || !strcmp(target, "2") || !strcasecmp(target, "true")) {
+        state.output = stderr;
+    } else if (target[0] == '/') {
+        state.output = fopen(target, "a");
+    }
+    if (!state.output) {
+        return false;
+    }
+
+    state.start = std::chrono::steady_clock::now();
+    char sid[64];
+    snprintf(sid, sizeof(sid), "%llx-%d", (unsigned long long) time(nullptr), int(getpid()));
+    state.sid = sid;
+    atexit(trace_exit);
+
+    return true;
+}
+
+bool trace_enabled_flag = trace_init();
+
+void trace_start (int argc, char* argv[]) {
+    if (!trace_enabled()) return;
+
+    emit("version", ",\"evt\":\"3\",\"exe\":\"git-cpp\"");
+    std::string fields = ",\"t_abs\":" + std::to_string(seconds_since(trace_state().start)) + ",\"argv\":[";
+    for (int i = 0; i < argc; i++) {
+        fields += std::string(i ? "," : "") + '"' + json_escape(argv[i]) + '"';
+    }
+    emit("start", fields + "]");
+}
+
+void trace_data (const char* category, const char* key, int64_t value) {
+    if (!trace_enabled()) return;
+
+    emit("data", std::string(",\"category\":\"") + category + "\",\"key\":\"" + key + "\",\"value\":\"" +
+                 std::to_string(value) + "\",\"nesting\":" + std::to_string(trace_nesting));
+}
+
+TraceRegion::TraceRegion (const char* category, const char* label)
+    : category(category), label(label), active(trace_enabled()) {
+    if (!active) return;
+
+    trace_nesting++;
+    emit("region_enter", std::string(",\"category\":\"") + category + "\",\"label\":\"" + label +
+                         "\",\"nesting\":" + std::to_string(trace_nesting));
+    start = std::chrono::steady_clock::now();
+}
+
+void TraceRegion::leave () {
+    if (!active) return;
+    active = false;
+
+    char elapsed[32];
+    snprintf(elapsed, sizeof(elapsed), "%.6f", seconds_since(start));
+    emit("region_leave", std::string(",\"category\":\"") + category + "\",\"label\":\"" + label +
+                         "\",\"t_rel\":" + elapsed + ",\"nesting\":" + std::to_string(trace_nesting));
+    trace_nesting--;
+}
+
+TraceTimer::TraceTimer (const char* category, const char* name) : category(category), name(name) {
+    TraceState& state = trace_state();
+    std::lock_guard<std::mutex> guard(state.lock);
+    state.timers.push_back(this);
+}
+
+void TraceTimerScope::stop () {
+    uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    timer->intervals.fetch_add(1, std::memory_order_relaxed);
+    timer->total_ns.fetch_add(elapsed, std::memory_order_relaxed);
+    uint64_t current = timer->min_ns.load(std::memory_order_relaxed);
+    while (elapsed < current && !timer->min_ns.compare_exchange_weak(current, elapsed)) {}
+    current = timer->max_ns.load(std::memory_order_relaxed);
+    while (elapsed > current && !timer->max_ns.compare_exchange_weak(current, elapsed)) {}
+}
+
+TraceCounter::TraceCounter (const char* category, const char* name) : category(category), name(name) {
+    TraceState& state = trace_state();
+    std::lock_guard<std::mutex> guard(state.lock);
+    state.counters.push_back(this);
+}
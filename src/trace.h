@@ -0,0 +1,79 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// trace2-style JSON events, one object per line, written when GIT_TRACE2_EVENT is set to
+// 1 or 2 (stderr) or to an absolute path (appended to). Disabled, every hook is one branch.
+extern bool trace_enabled_flag;
+
+inline bool trace_enabled () { return trace_enabled_flag; }
+
+// emit the start event with the command line
+void trace_start (int argc, char* argv[]);
+
+// a "data" event attached to the innermost open region of this thread
+void trace_data (const char* category, const char* key, int64_t value);
+
+// region_enter on construction, region_leave with the elapsed time on leave() or destruction
+class TraceRegion {
+public:
+    TraceRegion (const char* category, const char* label);
+    ~TraceRegion () { leave(); }
+    void leave ();
+    TraceRegion (const TraceRegion&) = delete;
+    TraceRegion& operator= (const TraceRegion&) = delete;
+
+private:
+    const char* category;
+    const char* label;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+};
+
+// time accumulated over many short calls from any thread, reported once at exit;
+// declare as a function-local static next to the code it measures, or at file scope when
+// several functions add to the same one
+struct TraceTimer {
+    const char* category;
+    const char* name;
+    std::atomic<uint64_t> intervals{0};
+    std::atomic<uint64_t> total_ns{0};
+    std::atomic<uint64_t> min_ns{UINT64_MAX};
+    std::atomic<uint64_t> max_ns{0};
+
+    TraceTimer (const char* category, const char* name);
+};
+
+class TraceTimerScope {
+public:
+    explicit TraceTimerScope (TraceTimer& timer)
+        : timer(trace_enabled() ? &timer : nullptr) {
+        if (this->timer) start = std::chrono::steady_clock::now();
+    }
+    ~TraceTimerScope () {
+        if (timer) stop();
+    }
+
+private:
+    void stop ();
+
+    TraceTimer* timer;
+    std::chrono::steady_clock::time_point start;
+};
+
+// a total reported once at exit: objects, bytes, cache hits and misses
+struct TraceCounter {
+    const char* category;
+    const char* name;
+    std::atomic<int64_t> value{0};
+
+    TraceCounter (const char* category, const char* name);
+    void add (int64_t amount) {
+        if (trace_enabled()) value.fetch_add(amount, std::memory_order_relaxed);
+    }
+};
+
+#endif // TRACE_H
@@ -0,0 +1,378 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <algorithm>
+#include "upload_pack.h"
+#include "http_server.h"
+#include "pkt_line.h"
+#include "pack.h"
+#include "repack.h"
+#include "revision.h"
+#include "object_store.h"
+#include "zlib_implement.h"
+
+#define UPLOAD_PACK_CAPABILITIES "multi_ack_detailed side-band-64k ofs-delta no-progress"
+#define UPLOAD_PACK_AGENT "agent=git-cpp/1.0"
+#define NULL_OID "0000000000000000000000000000000000000000"
+
+static std::string head_symref (const std::string& dir) {
+    std::ifstream head_file(dir + "/.git/HEAD");
+    std::string line;
+    if (!std::getline(head_file, line) || line.rfind("ref: ", 0) != 0) {
+        return {};
+    }
+
+    return line.substr(5);
+}
+
+std::string advertise_refs (const std::string& dir) {
+    std::vector<std::pair<std::string, std::string>> lines; // object, name
+    std::string head = resolve_revision("HEAD", dir);
+    if (!head.empty()) {
+        lines.emplace_back(head, "HEAD");
+    }
+
+    for (const auto& [name, hash] : list_refs(dir)) {
+        lines.emplace_back(hash, name);
+
+        // annotated tags are followed by the object they point at
+        std::string type, contents;
+        if (name.rfind("refs/tags/", 0) == 0 && read_object(hash, type, contents, dir) &&
+            type == "tag" && contents.rfind("object ", 0) == 0) {
+            lines.emplace_back(contents.substr(7, 40), name + "^{}");
+        }
+    }
+
+    std::string capabilities = UPLOAD_PACK_CAPABILITIES;
+    std::string symref = head_symref(dir);
+    if (!symref.empty()) {
+        capabilities += " symref=HEAD:" + symref;
+    }
+    capabilities += " " UPLOAD_PACK_AGENT; // last, as git does, so the line never ends in a ref name
+
+    std::string advertisement = pkt_line("# service=git-upload-pack\n") + PKT_FLUSH;
+    if (lines.empty()) {
+        advertisement += pkt_line(std::string(NULL_OID) + " capabilities^{}" + '\0' + capabilities + '\n');
+    }
+    for (size_t i = 0; i < lines.size(); i++) {
+        std::string line = lines[i].first + ' ' + lines[i].second;
+        if (i == 0) {
+            line += '\0' + capabilities;
+        }
+        advertisement += pkt_line(line + '\n');
+    }
+    advertisement += PKT_FLUSH;
+
+    return advertisement;
+}
+
+namespace {
+
+// one object of the outgoing pack and where its data can be copied from
+struct UploadObject {
+    std::string hash;
+    int type = 0;
+    std::shared_ptr<PackFile> pack; // the pack holding it, if any
+    uint64_t offset = 0;
+    PackEntry entry;
+    int base = -1;                  // delta base within the outgoing pack
+    bool reuse = false;             // copy the stored entry instead of deflating again
+};
+
+} // namespace
+
+static void plan_reuse (std::vector<UploadObject>& objects, const std::vector<std::shared_ptr<PackFile>>& packs) {
+    std::unordered_map<std::string, int> positions;
+    for (size_t i = 0; i < objects.size(); i++) {
+        positions[objects[i].hash] = i;
+    }
+
+    for (auto& object : objects) {
+        std::string oid = hash_digest(object.hash);
+        for (const auto& pack : packs) {
+            if (pack_find(*pack, reinterpret_cast<const unsigned char*>(oid.data()), &object.offset)) {
+                object.pack = pack;
+                break;
+            }
+        }
+        if (!object.pack || !read_pack_entry(*object.pack, object.offset, object.entry)) {
+            object.pack.reset();
+            continue;
+        }
+
+        if (object.entry.type >= OBJ_COMMIT && object.entry.type <= OBJ_TAG) {
+            object.reuse = true;
+            continue;
+        }
+
+        // a stored delta can be sent as is when its base goes out in the same pack
+        std::string base_oid = object.entry.base_oid;
+        if (object.entry.type == OBJ_OFS_DELTA &&
+            !pack_oid_at(*object.pack, object.offset - object.entry.base_offset, base_oid)) {
+            continue;
+        }
+        auto base = positions.find(digest_to_hash(base_oid));
+        if (base != positions.end()) {
+            object.base = base->second;
+            object.reuse = true;
+        }
+    }
+}
+
+static bool write_upload_pack (std::vector<UploadObject>& objects, bool ofs_delta,
+                               const std::function<bool(const char*, size_t)>& sink, const std::string& dir) {
+    PackWriter writer(sink);
+    if (!writer.begin(objects.size())) {
+        return false;
+    }
+
+    std::vector<uint64_t> offsets(objects.size(), UINT64_MAX);
+    std::vector<bool> pending_flag(objects.size(), false);
+    std::vector<size_t> pending;
+    for (size_t first = 0; first < objects.size(); first++) {
+        // queue the chain of reused delta bases below this object
+        for (size_t current = first; current != SIZE_MAX && offsets[current] == UINT64_MAX;) {
+            if (pending_flag[current]) {
+                // deltas from different packs formed a cycle, send this one whole
+                objects[current].reuse = false;
+                objects[current].base = -1;
+                break;
+            }
+            pending_flag[current] = true;
+            pending.push_back(current);
+            current = objects[current].reuse && objects[current].base >= 0 ? size_t(objects[current].base) : SIZE_MAX;
+        }
+
+        while (!pending.empty()) {
+            size_t index = pending.back();
+            pending.pop_back();
+            pending_flag[index] = false;
+            UploadObject& object = objects[index];
+
+            bool written;
+            if (object.reuse) {
+                const char* data = reinterpret_cast<const char*>(object.pack->pack_data + object.entry.data_offset);
+                size_t length = pack_entry_end(*object.pack, object.offset) - object.entry.data_offset;
+                if (object.base < 0) {
+                    written = writer.add_object(object.entry.type, object.entry.size, data, length, &offsets[index]);
+                } else if (ofs_delta) {
+                    written = writer.add_ofs_delta(offsets[object.base], object.entry.size, data, length, &offsets[index]);
+                } else {
+                    written = writer.add_ref_delta(hash_digest(objects[object.base].hash), object.entry.size, data, length, &offsets[index]);
+                }
+            }
+            else {
+                std::string type, contents;
+                if (!read_object(object.hash, type, contents, dir)) {
+                    std::cerr << "Failed to read object " << object.hash << ".\n";
+                    return false;
+                }
+                std::string compressed = compress_string(contents);
+                written = writer.add_object(object_type_code(type), contents.length(), compressed.data(), compressed.length(), &offsets[index]);
+            }
+            if (!written) {
+                return false;
+            }
+        }
+    }
+
+    return writer.finish();
+}
+
+bool upload_pack (const std::string& request, const std::function<bool(const char*, size_t)>& sink, const std::string& dir) {
+    std::vector<std::string> lines;
+    if (!parse_pkt_lines(request, lines)) {
+        std::cerr << "Malformed upload-pack request.\n";
+        return false;
+    }
+
+    std::vector<std::string> wants, haves;
+    std::set<std::string> capabilities;
+    bool done = false;
+    for (auto line : lines) {
+        if (!line.empty() && line.back() == '\n') {
+            line.pop_back();
+        }
+
+        if (line.rfind("want ", 0) == 0 && line.length() >= 45) {
+            wants.push_back(line.substr(5, 40));
+            // the first want carries the client capabilities
+            std::string rest = line.length() > 46 ? line.substr(46) : "";
+            size_t pos = 0;
+            while (pos < rest.length()) {
+                size_t space = rest.find(' ', pos);
+                if (space == std::string::npos) space = rest.length();
+                capabilities.insert(rest.substr(pos, space - pos));
+                pos = space + 1;
+            }
+        }
+        else if (line.rfind("have ", 0) == 0 && line.length() >= 45) {
+            haves.push_back(line.substr(5, 40));
+        }
+        else if (line == "done") {
+            done = true;
+        }
+    }
+
+    if (wants.empty()) {
+        return sink("", 0);
+    }
+    for (const auto& want : wants) {
+        if (!has_object(want, dir)) {
+            std::cerr << "Not our object " << want << ".\n";
+            return false;
+        }
+    }
+
+    bool multi_ack_detailed = capabilities.count("multi_ack_detailed");
+    bool multi_ack = multi_ack_detailed || capabilities.count("multi_ack");
+    size_t band_size = capabilities.count("side-band-64k") ? 65520 : capabilities.count("side-band") ? 1000 : 0;
+    bool ofs_delta = capabilities.count("ofs-delta");
+
+    // acknowledge the haves we share with the client
+    std::string negotiation;
+    std::vector<std::string> common;
+    for (const auto& have : haves) {
+        if (std::find(common.begin(), common.end(), have) != common.end() || !has_object(have, dir)) {
+            continue;
+        }
+        common.push_back(have);
+        if (multi_ack_detailed) {
+            negotiation += pkt_line("ACK " + have + " common\n");
+        } else if (multi_ack) {
+            negotiation += pkt_line("ACK " + have + " continue\n");
+        } else if (common.size() == 1) {
+            negotiation += pkt_line("ACK " + have + "\n");
+        }
+    }
+
+    // without "done" this was one stateless negotiation round
+    if (!done) {
+        if (common.empty() || multi_ack) {
+            negotiation += pkt_line("NAK\n");
+        }
+        return sink(negotiation.data(), negotiation.length());
+    }
+    if (common.empty()) {
+        negotiation += pkt_line("NAK\n");
+    } else if (multi_ack) {
+        negotiation += pkt_line("ACK " + common.back() + "\n");
+    }
+
+    // everything the wants reach that the common commits do not
+    std::vector<UploadObject> objects;
+    CommitIndex index(dir);
+    RevListOptions options;
+    options.include = wants;
+    for (const auto& have : common) {
+        std::string type, contents;
+        if (read_object(have, type, contents, dir) && type == "commit") {
+            options.exclude.push_back(have);
+        }
+    }
+    int status = list_objects(index, options, [&](const std::string& hash, const std::string& type, const std::string&) {
+        UploadObject object;
+        object.hash = hash;
+        object.type = object_type_code(type);
+        objects.push_back(std::move(object));
+    });
+    if (status != EXIT_SUCCESS) {
+        return false;
+    }
+    plan_reuse(objects, repository_packs(dir));
+
+    if (!sink(negotiation.data(), negotiation.length())) {
+        return false;
+    }
+
+    // with side-band the pack travels in band 1 pkt-lines
+    std::function<bool(const char*, size_t)> pack_sink = sink;
+    if (band_size > 0) {
+        pack_sink = [&](const char* data, size_t length) {
+            while (length > 0) {
+                size_t chunk = std::min(length, band_size - 5);
+                std::string packet = pkt_line('\1' + std::string(data, chunk));
+                if (!sink(packet.data(), packet.length())) {
+                    return false;
+                }
+                data += chunk;
+                length -= chunk;
+            }
+            return true;
+        };
+    }
+
+    if (!write_upload_pack(objects, ofs_delta, pack_sink, dir)) {
+        return false;
+    }
+
+    return band_size == 0 || sink(PKT_FLUSH, 4);
+}
+
+// map "/<repository>/info/refs" or "/<repository>/git-upload-pack" to a repository directory
+static bool repository_for_path (const std::string& path, const std::string& suffix, const std::string& base_dir, std::string& dir) {
+    if (path.length() < suffix.length() || path.compare(path.length() - suffix.length(), suffix.length(), suffix) != 0) {
+        return false;
+    }
+
+    std::string prefix = path.substr(0, path.length() - suffix.length());
+    if (prefix.find("..") != std::string::npos) {
+        return false;
+    }
+
+    dir = base_dir + prefix;
+    while (dir.length() > 1 && dir.back() == '/') {
+        dir.pop_back();
+    }
+    std::error_code ec;
+    return std::filesystem::is_directory(dir + "/.git", ec);
+}
+
+int serve (uint16_t port, unsigned workers, const std::string& base_dir,
+           const std::atomic<bool>* stop, const std::function<void(uint16_t)>& on_listen) {
+    HttpHandler handler = [&base_dir](const HttpRequest& request, HttpResponse& response) {
+        std::string dir;
+        if (request.method == "GET" && repository_for_path(request.path, "/info/refs", base_dir, dir)) {
+            if (request.query.find("service=git-upload-pack") == std::string::npos) {
+                response.start(403, "text/plain"); // only the smart protocol is served
+                return;
+            }
+            response.start(200, "application/x-git-upload-pack-advertisement", {"Cache-Control: no-cache"});
+            response.write(advertise_refs(dir));
+            return;
+        }
+
+        if (request.method == "POST" && repository_for_path(request.path, "/git-upload-pack", base_dir, dir)) {
+            std::string body = request.body;
+            auto encoding = request.headers.find("content-encoding");
+            if (encoding != request.headers.end() && encoding->second == "gzip") {
+                body = gunzip_string(body);
+            }
+
+            // the status line goes out with the first bytes, so early failures can still report 400
+            bool ok = upload_pack(body, [&](const char* data, size_t length) {
+                if (!response.started) {
+                    response.start(200, "application/x-git-upload-pack-result", {"Cache-Control: no-cache"});
+                }
+                return response.write(data, length);
+            }, dir);
+            if (!ok && !response.started) {
+                response.start(400, "text/plain");
+            }
+            return;
+        }
+
+        response.start(404, "text/plain");
+    };
+
+    return serve_http(port, workers, handler, stop, [&](uint16_t bound_port) {
+        std::cerr << "Serving " << base_dir << " on port " << bound_port << '\n';
+        if (on_listen) {
+            on_listen(bound_port);
+        }
+    });
+}
@@ -0,0 +1,19 @@
+#ifndef UPLOAD_PACK_H
+#define UPLOAD_PACK_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// the smart HTTP ref advertisement served for GET /info/refs?service=git-upload-pack
+std::string advertise_refs (const std::string& dir = ".");
+
+// answer one stateless upload-pack request: negotiation, then a pack built on the fly
+bool upload_pack (const std::string& request, const std::function<bool(const char*, size_t)>& sink, const std::string& dir = ".");
+
+// serve every repository below base_dir over smart HTTP until stop becomes true
+int serve (uint16_t port, unsigned workers, const std::string& base_dir,
+           const std::atomic<bool>* stop = nullptr, const std::function<void(uint16_t)>& on_listen = nullptr);
+
+#endif // UPLOAD_PACK_H
@@ -1,4 +1,6 @@
 #include <iostream>
+#include <algorithm>
+#include <climits>
 #include <cstdlib>
 #include <cstring>
 #include <zlib.h>
@@ -6,125 +8,35 @@
 #include <stdexcept>
 #include "zlib_implement.h"
 
-#define CHUNK 16384 //16KB
-
-int decompress(FILE* input, FILE* output) {
-    // initialize decompression stream
-    //std::cout << "Initializing decompression stream.\n";
-    z_stream stream = {0};
-    if (inflateInit(&stream) != Z_OK) {
-        std::cerr << "Failed to initialize decompression stream.\n";
-        return EXIT_FAILURE;
+std::string decompress_string (const std::string& compressed_str) {
+    static thread_local Inflater inflater;
+    std::string decompressed_str;
+    if (!inflater.decompress(compressed_str.data(), compressed_str.size(), decompressed_str)) {
+        throw(std::runtime_error("Exception during zlib decompression: " + inflater.error()));
     }
 
-    // initialize decompression variables
-    char in[CHUNK];
-    char out[CHUNK];
-    bool haveHeader = false;
-    char header[64];
-    int ret;
-
-    do {
-        stream.avail_in = fread(in, 1, CHUNK, input); // read from input file
-        stream.next_in = reinterpret_cast<unsigned char*>(in); // set input stream
-        if (ferror(input)) {
-            std::cerr << "Failed to read from input file.\n";
-            return EXIT_FAILURE;
-        }
-        if (stream.avail_in == 0) {
-            break;
-        }
-
-        do {
-            stream.avail_out = CHUNK; // set output buffer size
-            stream.next_out = reinterpret_cast<unsigned char*>(out); // set output stream
-            ret = inflate(&stream, Z_NO_FLUSH); // decompress
-            if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
-                std::cerr << "Failed to decompress file.\n";
-                return EXIT_FAILURE;
-            }
-
-            // write header to output file
-            unsigned headerLen = 0, dataLen = 0;
-            if (!haveHeader) {
-                sscanf(out, "%s %u", header, &dataLen);
-                haveHeader = true;
-                headerLen = strlen(out) + 1;
-            }
-            // write decompressed data to output file
-            if (dataLen > 0) {
-                if(fwrite(out + headerLen, 1, dataLen, output) != dataLen) {
-                    std::cerr << "Failed to write to output file.\n";
-                    return EXIT_FAILURE;
-                }
-            }
-        } while (stream.avail_out == 0);
-        
-    } while (ret != Z_STREAM_END);
-
-    return inflateEnd(&stream) == Z_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+    return decompressed_str;
 }
 
-int compress(FILE* input, FILE* output) {
-    // Initialize compression stream.
-    //std::cout << "Initializing compression stream.\n";
-    z_stream stream = {0};
-    if (deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK) {
-        std::cerr << "Failed to initialize compression stream.\n";
-        return EXIT_FAILURE;
-    }
-
-    char in[CHUNK];
-    char out[CHUNK];
-    int ret;
-    int flush;
-
-    do {
-        stream.avail_in = fread(in, 1, CHUNK, input);
-        stream.next_in = reinterpret_cast<unsigned char*>(in);
-        if (ferror(input)) {
-            (void)deflateEnd(&stream);  // Free memory
-            std::cerr << "Failed to read from input file.\n";
-            return EXIT_FAILURE;
-        }
-        flush = feof(input) ? Z_FINISH : Z_NO_FLUSH;
-
-        do {
-            stream.avail_out = CHUNK;
-            stream.next_out = reinterpret_cast<unsigned char*>(out);
-            ret = deflate(&stream, flush);
-            if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
-                (void)deflateEnd(&stream);  // Free memory
-                std::cerr << "Failed to compress file.\n";
-                return EXIT_FAILURE;
-            }
-            size_t have = CHUNK - stream.avail_out;
-            if (fwrite(out, 1, have, output) != have || ferror(output)) {
-                (void)deflateEnd(&stream);  // Free memory
-                std::cerr << "Failed to write to output file.\n";
-                return EXIT_FAILURE;
-            }
-        } while (stream.avail_out == 0);
-    } while (flush != Z_FINISH);
-
-    // Clean up and check for errors
-    if (deflateEnd(&stream) != Z_OK) {
-        return EXIT_FAILURE;
-    }
+std::string compress_string (const std::string& input_str) {
+    static thread_local Deflater deflater;
+    std::string compressed_str;
+    deflater.compress(input_str.data(), input_str.size(), compressed_str);
 
-    return EXIT_SUCCESS;
+    return compressed_str;
 }
 
-std::string decompress_string (const std::string& compressed_str) {
+std::string gunzip_string (const std::string& gzipped_str) {
     z_stream d_stream;
     memset(&d_stream, 0, sizeof(d_stream));
 
-    if (inflateInit(&d_stream) != Z_OK) {
-        throw(std::runtime_error("inflateInit failed while decompressing."));
+    // 16 + MAX_WBITS selects the gzip wrapper instead of zlib
+    if (inflateInit2(&d_stream, 16 + MAX_WBITS) != Z_OK) {
+        throw(std::runtime_error("inflateInit2 failed while decompressing."));
     }
 
-    d_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed_str.data()));
-    d_stream.avail_in = compressed_str.size();
+    d_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(gzipped_str.data()));
+    d_stream.avail_in = gzipped_str.size();
 
     int status;
     const size_t buffer_size = 32768; // 32KB
@@ -142,55 +54,336 @@ std::string decompress_string (const std::string& compressed_str) {
         }
     } while (status == Z_OK);
 
-    if (inflateEnd(&d_stream) != Z_OK) {
-        throw(std::runtime_error("inflateEnd failed while decompressing."));
-    }
+    inflateEnd(&d_stream);
 
     if (status != Z_STREAM_END) {
         std::ostringstream oss;
-        oss << "Exception during zlib decompression: (" << status << ") " << d_stream.msg;
+        oss << "Exception during gzip decompression: (" << status << ") " << (d_stream.msg ? d_stream.msg : "");
         throw(std::runtime_error(oss.str()));
     }
 
     return decompressed_str;
 }
 
-std::string compress_string (const std::string& input_str) {
-    z_stream c_stream;
-    memset(&c_stream, 0, sizeof(c_stream));
-
-    if (deflateInit(&c_stream, Z_DEFAULT_COMPRESSION) != Z_OK) {
+Deflater::Deflater (int level) {
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit(&stream, level) != Z_OK) {
         throw(std::runtime_error("deflateInit failed while compressing."));
     }
+}
 
-    c_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input_str.data()));
-    c_stream.avail_in = input_str.size();
+Deflater::~Deflater () {
+    deflateEnd(&stream);
+}
 
+void Deflater::compress (const char* data, size_t length, std::string& out) {
+    deflateReset(&stream);
+    out.resize(deflateBound(&stream, length));
+    const char* end = data + length;
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = 0;
+    stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    stream.avail_out = 0;
+
+    // the bound leaves room for all of it; avail_in and avail_out are 32 bits, so spans past
+    // 4 GiB go in pieces and only the last one finishes the stream
     int status;
-    const size_t buffer_size = 32768; // 32KB
-    char buffer[buffer_size];
-    std::string compressed_str;
-
     do {
-        c_stream.next_out = reinterpret_cast<Bytef*>(buffer);
-        c_stream.avail_out = sizeof(buffer);
-
-        status = deflate(&c_stream, Z_FINISH);
-
-        if (compressed_str.size() < c_stream.total_out) {
-            compressed_str.append(buffer, c_stream.total_out - compressed_str.size());
+        if (stream.avail_in == 0) {
+            stream.avail_in = std::min<size_t>(end - reinterpret_cast<const char*>(stream.next_in), UINT_MAX);
         }
+        if (stream.avail_out == 0) {
+            stream.avail_out = std::min<size_t>(out.size() - (reinterpret_cast<char*>(stream.next_out) - &out[0]), UINT_MAX);
+        }
+        bool last = reinterpret_cast<const char*>(stream.next_in) + stream.avail_in == end;
+        status = deflate(&stream, last ? Z_FINISH : Z_NO_FLUSH);
     } while (status == Z_OK);
 
-    if (deflateEnd(&c_stream) != Z_OK) {
-        throw(std::runtime_error("deflateEnd failed while compressing."));
+    if (status != Z_STREAM_END) {
+        std::ostringstream oss;
+        oss << "Exception during zlib compression: (" << status << ") " << (stream.msg ? stream.msg : "output buffer full");
+        throw(std::runtime_error(oss.str()));
     }
+    out.resize(stream.total_out);
+}
+
+bool Deflater::compress (const char* data, size_t length, const std::function<bool(const char*, size_t)>& sink) {
+    deflateReset(&stream);
+    const char* end = data + length;
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = 0;
+
+    char buffer[32768];
+    int status;
+    do {
+        // avail_in is 32 bits, longer inputs go in pieces
+        if (stream.avail_in == 0) {
+            stream.avail_in = std::min<size_t>(end - reinterpret_cast<const char*>(stream.next_in), UINT_MAX);
+        }
+        bool last = reinterpret_cast<const char*>(stream.next_in) + stream.avail_in == end;
+        stream.next_out = reinterpret_cast<Bytef*>(buffer);
+        stream.avail_out = sizeof(buffer);
+        status = deflate(&stream, last ? Z_FINISH : Z_NO_FLUSH);
+        size_t have = sizeof(buffer) - stream.avail_out;
+        if (have > 0 && !sink(buffer, have)) {
+            return false;
+        }
+    } while (status == Z_OK || status == Z_BUF_ERROR);
 
     if (status != Z_STREAM_END) {
         std::ostringstream oss;
-        oss << "Exception during zlib compression: (" << status << ") " << c_stream.msg;
+        oss << "Exception during zlib compression: (" << status << ") " << (stream.msg ? stream.msg : "");
         throw(std::runtime_error(oss.str()));
     }
+    return true;
+}
 
-    return compressed_str;
-}
\ No newline at end of file
+Inflater::Inflater () {
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK) {
+        throw(std::runtime_error("inflateInit failed while decompressing."));
+    }
+}
+
+Inflater::~Inflater () {
+    inflateEnd(&stream);
+}
+
+void Inflater::start (const char* data, size_t length) {
+    inflateReset(&stream);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = 0;
+    input_end = data + length;
+}
+
+// avail_in is 32 bits, a longer span is handed to zlib in pieces
+void Inflater::refill () {
+    if (stream.avail_in == 0) {
+        stream.avail_in = std::min<size_t>(input_end - reinterpret_cast<const char*>(stream.next_in), UINT_MAX);
+    }
+}
+
+bool Inflater::decompress (const char* data, size_t length, const std::function<bool(const char*, size_t)>& sink, size_t* consumed) {
+    start(data, length);
+    char buffer[32768];
+    do {
+        refill();
+        stream.next_out = reinterpret_cast<Bytef*>(buffer);
+        stream.avail_out = sizeof(buffer);
+        status = inflate(&stream, Z_NO_FLUSH);
+        size_t have = sizeof(buffer) - stream.avail_out;
+        if (have > 0 && (status == Z_OK || status == Z_STREAM_END) && !sink(buffer, have)) {
+            status = Z_ERRNO;
+            break;
+        }
+    } while (status == Z_OK);
+
+    if (consumed) {
+        *consumed = reinterpret_cast<const char*>(stream.next_in) - data;
+    }
+    return status == Z_STREAM_END;
+}
+
+bool Inflater::decompress (const char* data, size_t length, std::string& out, size_t* consumed, size_t size) {
+    if (size == 0) {
+        out.clear();
+        return decompress(data, length, [&out](const char* chunk, size_t chunk_length) {
+            out.append(chunk, chunk_length);
+            return true;
+        }, consumed);
+    }
+
+    start(data, length);
+    out.resize(size);
+    stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    stream.avail_out = 0;
+    size_t out_left = size;
+    unsigned char overflow;
+    do {
+        refill();
+        if (stream.avail_out == 0) {
+            if (out_left == 0) {
+                // out is full, a well formed stream only has its end left to consume
+                stream.next_out = &overflow;
+                stream.avail_out = 1;
+            }
+            else {
+                stream.avail_out = std::min<size_t>(out_left, UINT_MAX);
+                out_left -= stream.avail_out;
+            }
+        }
+        status = inflate(&stream, Z_NO_FLUSH);
+    } while (status == Z_OK && stream.total_out <= size);
+
+    if (consumed) {
+        *consumed = reinterpret_cast<const char*>(stream.next_in) - data;
+    }
+    return status == Z_STREAM_END && stream.total_out == size;
+}
+
+std::string Inflater::error () const {
+    if (stream.msg) {
+        return stream.msg;
+    }
+    switch (status) {
+        case Z_ERRNO: return "output refused";
+        case Z_STREAM_END: return "unexpected inflated size";
+        case Z_NEED_DICT: return "preset dictionary required";
+        case Z_MEM_ERROR: return "out of memory";
+        case Z_OK:
+        case Z_BUF_ERROR: return "truncated stream";
+    }
+    return "error " + std::to_string(status);
+}
+
+ParallelGzip::ParallelGzip (const std::function<bool(const char*, size_t)>& sink, unsigned threads, int level, size_t block_size)
+    : sink(sink), level(level), block_size(block_size), crc(crc32(0, Z_NULL, 0)) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned i = 0; threads > 1 && i < threads; i++) {
+        workers.emplace_back(&ParallelGzip::work, this);
+    }
+    current.reserve(block_size);
+}
+
+ParallelGzip::~ParallelGzip () {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ParallelGzip::work () {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        work_ready.wait(lock, [this]() { return stopping || !pending.empty(); });
+        if (stopping) {
+            return;
+        }
+        std::shared_ptr<Block> block = pending.front();
+        pending.pop_front();
+
+        lock.unlock();
+        compress_block(*block);
+        lock.lock();
+        block->done = true;
+        block_done.notify_all();
+    }
+}
+
+// a raw deflate stream ending on a sync flush, or on the final block for the last one
+void ParallelGzip::compress_block (Block& block) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw(std::runtime_error("deflateInit failed while compressing."));
+    }
+    if (!block.dictionary.empty()) {
+        deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(block.dictionary.data()), block.dictionary.length());
+    }
+
+    stream.next_in = reinterpret_cast<Bytef*>(&block.input[0]);
+    stream.avail_in = block.input.length();
+    block.output.resize(deflateBound(&stream, block.input.length()) + 16);
+    int flush = block.last ? Z_FINISH : Z_SYNC_FLUSH;
+    int status;
+    do {
+        if (stream.total_out == block.output.length()) {
+            block.output.resize(block.output.length() * 2);
+        }
+        stream.next_out = reinterpret_cast<Bytef*>(&block.output[stream.total_out]);
+        stream.avail_out = block.output.length() - stream.total_out;
+        status = deflate(&stream, flush);
+    } while (block.last ? status == Z_OK || status == Z_BUF_ERROR : stream.avail_out == 0);
+    block.output.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    block.crc = crc32(0, reinterpret_cast<const Bytef*>(block.input.data()), block.input.length());
+    block.length = block.input.length();
+    block.input = std::string();
+    block.dictionary = std::string();
+}
+
+bool ParallelGzip::emit (Block& block) {
+    if (!header_written) {
+        static const char header[10] = { '\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, 3 }; // deflate, no mtime, Unix
+        header_written = true;
+        failed = failed || !sink(header, sizeof(header));
+    }
+    crc = crc32_combine(crc, block.crc, block.length);
+    total += block.length;
+    failed = failed || !sink(block.output.data(), block.output.length());
+    block.output = std::string();
+
+    return !failed;
+}
+
+bool ParallelGzip::submit (bool last) {
+    auto block = std::make_shared<Block>();
+    block->input = std::move(current);
+    block->dictionary = window;
+    block->last = last;
+    window += block->input;
+    if (window.length() > 32768) {
+        window.erase(0, window.length() - 32768);
+    }
+    current = std::string();
+    current.reserve(block_size);
+
+    if (workers.empty()) {
+        compress_block(*block);
+        return emit(*block);
+    }
+
+    // at most two blocks per thread are held in memory; the oldest is written first
+    std::unique_lock<std::mutex> lock(mutex);
+    pending.push_back(block);
+    in_flight.push_back(block);
+    work_ready.notify_one();
+    while (!in_flight.empty() && (last || in_flight.size() > 2 * workers.size())) {
+        std::shared_ptr<Block> oldest = in_flight.front();
+        block_done.wait(lock, [&oldest]() { return oldest->done; });
+        in_flight.pop_front();
+        lock.unlock();
+        bool written = emit(*oldest);
+        lock.lock();
+        if (!written) {
+            return false;
+        }
+    }
+
+    return !failed;
+}
+
+bool ParallelGzip::write (const char* data, size_t length) {
+    while (length > 0) {
+        size_t take = std::min(length, block_size - current.length());
+        current.append(data, take);
+        data += take;
+        length -= take;
+        if (current.length() == block_size && !submit(false)) {
+            return false;
+        }
+    }
+
+    return !failed;
+}
+
+bool ParallelGzip::finish () {
+    if (!submit(true)) {
+        return false;
+    }
+
+    char trailer[8];
+    for (int i = 0; i < 4; i++) {
+        trailer[i] = char(crc >> (8 * i));
+        trailer[4 + i] = char(total >> (8 * i));
+    }
+
+    return sink(trailer, sizeof(trailer));
+}
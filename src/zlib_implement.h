@@ -1,12 +1,117 @@
 #ifndef ZLIB_IMPLEMENT_H
 #define ZLIB_IMPLEMENT_H
 
-#include <cstdio>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+#include <zlib.h>
 
-int decompress (FILE* input, FILE* output);
-int compress (FILE* input, FILE* output);
 std::string decompress_string (const std::string& compressed_str);
 std::string compress_string (const std::string& input_str);
+std::string gunzip_string (const std::string& gzipped_str);
+
+// one deflate stream reset between inputs: for many small objects, setting up the stream
+// state again on every call costs more than compressing them
+class Deflater {
+public:
+    explicit Deflater (int level = Z_DEFAULT_COMPRESSION);
+    ~Deflater ();
+    Deflater (const Deflater&) = delete;
+    Deflater& operator= (const Deflater&) = delete;
+
+    // replace out with the zlib stream of data
+    void compress (const char* data, size_t length, std::string& out);
+    // hand the zlib stream of data to sink a piece at a time; false if sink refused one
+    bool compress (const char* data, size_t length, const std::function<bool(const char*, size_t)>& sink);
+
+private:
+    z_stream stream;
+};
+
+// the inflating side of Deflater. Input is a span of memory that may go on past the zlib
+// stream; consumed is set to the length of the stream itself, which is how a reader of
+// back to back streams in a pack finds where the next entry starts.
+class Inflater {
+public:
+    Inflater ();
+    ~Inflater ();
+    Inflater (const Inflater&) = delete;
+    Inflater& operator= (const Inflater&) = delete;
+
+    // hand the inflated bytes to sink as they come out; false on a bad or truncated stream, or
+    // when sink returns false to stop early
+    bool decompress (const char* data, size_t length, const std::function<bool(const char*, size_t)>& sink,
+                     size_t* consumed = nullptr);
+    // replace out with the inflated bytes. A known size inflates straight into out and fails
+    // unless the stream holds exactly that many bytes.
+    bool decompress (const char* data, size_t length, std::string& out, size_t* consumed = nullptr, size_t size = 0);
+
+    // why the last call failed
+    std::string error () const;
+
+private:
+    void start (const char* data, size_t length);
+    void refill ();
+
+    z_stream stream;
+    const char* input_end = nullptr;
+    int status = Z_OK;
+};
+
+// gzip compressed in blocks on a pool of threads, the way pigz does it: every block is primed
+// with the last 32 KiB of input before it and ends byte aligned on a sync flush, so the blocks
+// concatenate into one deflate stream that any gunzip reads. Output keeps the input order.
+class ParallelGzip {
+public:
+    // threads 0 uses one per core, 1 compresses on the calling thread
+    ParallelGzip (const std::function<bool(const char*, size_t)>& sink, unsigned threads = 0,
+                  int level = Z_DEFAULT_COMPRESSION, size_t block_size = 128 << 10);
+    ~ParallelGzip ();
+    ParallelGzip (const ParallelGzip&) = delete;
+    ParallelGzip& operator= (const ParallelGzip&) = delete;
+
+    bool write (const char* data, size_t length);
+    // compress what is left and write the gzip trailer
+    bool finish ();
+
+private:
+    struct Block {
+        std::string input;
+        std::string dictionary;
+        bool last = false;
+        std::string output;
+        uLong crc = 0;
+        size_t length = 0;
+        bool done = false;
+    };
+
+    void compress_block (Block& block);
+    bool submit (bool last);
+    bool emit (Block& block);
+    void work ();
+
+    std::function<bool(const char*, size_t)> sink;
+    int level;
+    size_t block_size;
+    std::string current;
+    std::string window; // the last 32 KiB submitted, the dictionary of the next block
+    bool header_written = false;
+    bool failed = false;
+    uLong crc;
+    uint64_t total = 0;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable block_done;
+    std::deque<std::shared_ptr<Block>> pending;   // waiting for a worker
+    std::deque<std::shared_ptr<Block>> in_flight; // submitted and not written yet, in order
+    bool stopping = false;
+};
 
 #endif // ZLIB_IMPLEMENT_H
\ No newline at end of file